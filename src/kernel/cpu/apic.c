@@ -0,0 +1,121 @@
+#include <apic.h>
+#include <bootloader.h>
+#include <system.h>
+#include <timer.h>
+
+// Local APIC: every cpu's own timer & inter-processor interrupts. Device IRQs
+// still come through the (remapped) PIC, onto the BSP.
+// Copyright (C) 2024 Panagiotis
+
+#define APIC_DEBUG 0
+
+uint32_t apicTimerPerMs = 0;
+bool     apicTscDeadline = false;
+
+// Every cpu sees its own APIC on the very same physical page
+size_t apicBase = 0;
+
+static uint32_t apicRead(uint32_t reg) {
+  return *(volatile uint32_t *)(apicBase + reg);
+}
+
+static void apicWrite(uint32_t reg, uint32_t value) {
+  *(volatile uint32_t *)(apicBase + reg) = value;
+}
+
+// Called on every cpu, before anything else APIC related
+void initiateApic() {
+  uint64_t msr = rdmsr(MSRID_APIC_BASE);
+  wrmsr(MSRID_APIC_BASE, msr | APIC_BASE_ENABLE);
+  if (!apicBase)
+    apicBase = bootloader.hhdmOffset + (msr & APIC_BASE_MASK);
+
+  apicWrite(APIC_REG_TPR, 0);
+  apicWrite(APIC_REG_SPURIOUS, APIC_SOFTWARE_ENABLE | APIC_VECTOR_SPURIOUS);
+}
+
+static bool apicCheckTscDeadline() {
+  uint32_t eax = 0x1, ebx = 0, ecx = 0, edx = 0;
+  cpuid(&eax, &ebx, &ecx, &edx);
+  return (ecx >> 24) & 1;
+}
+
+// Measures the APIC timer against the PIT's ticks, so it needs the PIT running
+// & interrupts enabled. Done once (on the BSP), every cpu runs off the same bus
+// clock. Returns the TSC cycles per millisecond, measured along the way.
+uint64_t apicCalibrate() {
+  apicWrite(APIC_REG_TIMER_DIVIDE, APIC_TIMER_DIVIDE_16);
+  apicWrite(APIC_REG_LVT_TIMER, APIC_LVT_MASKED);
+
+  // start right on a tick's edge
+  uint64_t start = timerTicks;
+  while (timerTicks == start)
+    asm volatile("pause");
+
+  apicWrite(APIC_REG_TIMER_INITIAL, 0xFFFFFFFF);
+  uint64_t tsc = rdtsc();
+  start = timerTicks;
+  while (timerTicks - start < APIC_CALIBRATE_MS)
+    asm volatile("pause");
+  uint32_t elapsed = 0xFFFFFFFF - apicRead(APIC_REG_TIMER_CURRENT);
+  tsc = rdtsc() - tsc;
+  apicWrite(APIC_REG_TIMER_INITIAL, 0);
+
+  apicTimerPerMs = elapsed / APIC_CALIBRATE_MS;
+  apicTscDeadline = apicCheckTscDeadline();
+#if APIC_DEBUG
+  debugf("[apic] Calibrated: perMs{%d} tscPerMs{%ld} tscDeadline{%d}\n",
+         apicTimerPerMs, tsc / APIC_CALIBRATE_MS, apicTscDeadline);
+#endif
+  return tsc / APIC_CALIBRATE_MS;
+}
+
+uint32_t apicId() { return apicRead(APIC_REG_ID) >> 24; }
+
+void apicEoi() { apicWrite(APIC_REG_EOI, 0); }
+
+// One-shot, left stopped until apicTimerArm()
+void apicTimerStart() {
+  if (apicTscDeadline) {
+    apicWrite(APIC_REG_LVT_TIMER, APIC_TIMER_TSC_DEADLINE | APIC_VECTOR_TIMER);
+    // orders the LVT write before any of the MSR's
+    asm volatile("mfence" ::: "memory");
+    return;
+  }
+
+  apicWrite(APIC_REG_TIMER_DIVIDE, APIC_TIMER_DIVIDE_16);
+  apicWrite(APIC_REG_LVT_TIMER, APIC_VECTOR_TIMER);
+}
+
+// Fires once, at deadline (in timerTicks) or right away if that's past.
+// Replaces whatever was armed before.
+void apicTimerArm(uint64_t deadline) {
+  if (apicTscDeadline) {
+    wrmsr(MSRID_TSC_DEADLINE, timerTsc(deadline));
+    return;
+  }
+
+  uint64_t now = timerTicks;
+  uint64_t count = deadline > now ? (deadline - now) * apicTimerPerMs : 1;
+  apicWrite(APIC_REG_TIMER_INITIAL, MIN(count, 0xFFFFFFFF));
+}
+
+void apicTimerStop() {
+  if (apicTscDeadline)
+    wrmsr(MSRID_TSC_DEADLINE, 0);
+  else
+    apicWrite(APIC_REG_TIMER_INITIAL, 0);
+}
+
+// Fixed delivery, to a single cpu. The ICR is a pair of registers, so nothing
+// may come in between writing them.
+void apicIpi(uint32_t lapicId, uint8_t vector) {
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  while (apicRead(APIC_REG_ICR_LOW) & APIC_ICR_PENDING)
+    asm volatile("pause");
+  apicWrite(APIC_REG_ICR_HIGH, lapicId << 24);
+  apicWrite(APIC_REG_ICR_LOW, vector);
+  if (ints)
+    asm volatile("sti");
+}
@@ -6,16 +6,16 @@ bits    64
 global asm_finalize_sched
 asm_finalize_sched:
   ; rdi = switch stack pointer
-  ; rsi = next pagedir
+  ; rsi = next cr3 (pagedir | PCID, see PageDirectoryCr3())
   ; rdx = old task pointer (for cleanup)
 
   mov rsp, rdi
   mov cr3, rsi
 
-  ; cleanup (WILL check task state, dw)
+  ; old is off its stack now, so it can be queued back up or cleaned up
   mov rdi, rdx
-  extern taskKillCleanup
-  call taskKillCleanup
+  extern scheduleFinish
+  call scheduleFinish
 
   pop rbp
   ; mov ds, ebp
@@ -38,11 +38,24 @@ asm_finalize_sched:
   pop rax
 
   add rsp, 16      ; pop error code and interrupt number
+
+  ; userland's gs base goes back in on the way there (see gdtLoad())
+  test qword [rsp + 8], 3
+  jz .kernel_exit
+  swapgs
+.kernel_exit:
   iretq            ; pops (CS, EIP, EFLAGS) and also (SS, ESP) if privilege change occurs
 
 global syscall_entry
 syscall_entry:
-  push rsp
+  swapgs ; always from userland
+
+  ; straight onto the task's syscall stack (see Cpu), before anything touches
+  ; userland's: it might be swapped out or copy-on-write, & faults can't be
+  ; handled in here (interrupts are off)
+  mov [gs:32], rsp
+  mov rsp, [gs:24]
+  push qword [gs:32]
 
   ; mimic: interrupt stuff
   push qword 0
@@ -73,14 +86,12 @@ syscall_entry:
   mov rbp, ds
   push rbp
 
-  mov rdi, rsp
-  extern handle_syscall_tssrsp
-  call handle_syscall_tssrsp
-  mov rsp, rax
-
   mov rdi, rsp
   extern syscallHandler
   call syscallHandler
+
+  ; nothing may come in past the swapgs below
+  cli
   
   pop rbp
   mov ds, ebp
@@ -107,9 +118,15 @@ syscall_entry:
 
   pop rsp ; reset rsp
 
+  swapgs
   o64 sysret
 
 isr_common:
+    ; the kernel's gs base (the cpu's own) is only there if we came from it
+    test qword [rsp + 24], 3
+    jz .kernel_entry
+    swapgs
+.kernel_entry:
     push rax
     push rbx
     push rcx
@@ -168,6 +185,11 @@ asm_isr_exit:
     pop rax
 
     add rsp, 16      ; pop error code and interrupt number
+
+    test qword [rsp + 8], 3
+    jz .kernel_exit
+    swapgs
+.kernel_exit:
     iretq            ; pops (CS, EIP, EFLAGS) and also (SS, ESP) if privilege change occurs
 
 ; generate isr stubs that jump to isr_common, in order to get a consistent stack frame
@@ -240,15 +262,24 @@ ISR_NO_ERROR_CODE 45
 ISR_NO_ERROR_CODE 46
 ISR_NO_ERROR_CODE 47
 
+; local APIC vectors (see apic.h)
+ISR_NO_ERROR_CODE 48 ; timer
+ISR_NO_ERROR_CODE 49 ; reschedule IPI
+ISR_NO_ERROR_CODE 50 ; TLB shootdown IPI
+
 ; syscall 0x80
 ISR_NO_ERROR_CODE 128
 global isr128
 
+; local APIC spurious interrupts
+ISR_NO_ERROR_CODE 255
+global isr255
+
 section .data
 global asm_isr_redirect_table
 asm_isr_redirect_table:
 %assign i 0
-%rep 48
+%rep 51
   dq isr%+i
 %assign i i+1
 %endrep
\ No newline at end of file
@@ -1,3 +1,5 @@
+#include <apic.h>
+#include <gdt.h>
 #include <idt.h>
 #include <isr.h>
 #include <kb.h>
@@ -6,10 +8,12 @@
 #include <paging.h>
 #include <rtl8139.h>
 #include <schedule.h>
+#include <swap.h>
 #include <syscalls.h>
 #include <system.h>
 #include <task.h>
 #include <timer.h>
+#include <vma.h>
 
 // ISR Entry configurator
 // Copyright (C) 2024 Panagiotis
@@ -71,10 +75,11 @@ void initiateISR() {
   // IRQs 0 - 15 -> 32 - 48
   remap_pic();
 
-  // ISR exceptions 0 - 31
-  for (int i = 0; i < 48; i++) {
+  // ISR exceptions 0 - 31, IRQs & local APIC vectors
+  for (int i = 0; i <= APIC_VECTOR_SHOOTDOWN; i++) {
     set_idt_gate(i, (uint64_t)asm_isr_redirect_table[i], 0x8E);
   }
+  set_idt_gate(APIC_VECTOR_SPURIOUS, (uint64_t)isr255, 0x8E);
 
   // Syscalls having DPL 3
   set_idt_gate(0x80, (uint64_t)isr128, 0xEE);
@@ -112,17 +117,65 @@ void handleTaskFault(AsmPassedInterrupt *regs) {
   schedule((uint64_t)regs);
 }
 
-uint64_t handle_syscall_tssrsp(uint64_t rsp) {
-  if (!tasksInitiated)
-    return rsp;
+extern void asm_finalize_sched(uint64_t rsp, uint64_t cr3, Task *old);
 
-  void *cpu = (void *)rsp;
+// Runs (in ring 0, interrupts enabled) in place of the faulting instruction,
+// for page faults that need to go through the page cache & thus the disk (or
+// just wait on the page tables' lock)
+static void isrDeferredFault(AsmPassedInterrupt *frame, uint64_t addr) {
+  PAGING_FAULT fault = PagingHandleFaultWait(addr, frame->error);
+  if (fault == PAGING_FAULT_DEFER)
+    fault = SwapHandleFault(currentTask, addr, frame->error) ||
+                    VmaHandleFault(currentTask, addr, frame->error)
+                ? PAGING_FAULT_HANDLED
+                : PAGING_FAULT_FATAL;
 
-  void *iretqRsp =
-      (void *)(currentTask->whileSyscallRsp - sizeof(AsmPassedInterrupt) - 8);
-  memcpy(iretqRsp, cpu, sizeof(AsmPassedInterrupt) + 8);
+  asm volatile("cli");
+  if (fault != PAGING_FAULT_HANDLED) {
+    debugf("[isr] Deferred page fault failed at cr2{%lx} rip{%lx}\n", addr,
+           frame->rip);
+    if (!(frame->cs & 3))
+      panic();
+    taskKill(currentTask->id, 139);
+  }
 
-  return (size_t)iretqRsp;
+  // back to the original instruction, which can now go through
+  asm_finalize_sched((size_t)frame, PageDirectoryCr3(GetPageDirectory()),
+                     currentTask);
+}
+
+// Deferring reruns the fault with interrupts enabled, which is only fine for
+// userland & syscalls that had them enabled anyway. Kernel code faulting with
+// them off (holding an irq spinlock, for one) must not be resumed like that.
+static bool isrDeferrable(AsmPassedInterrupt *cpu) {
+  if (cpu->cs & 3)
+    return true;
+  return currentTask->systemCallInProgress && cpu->rflags & RFLAGS_IF;
+}
+
+// Disk i/o can't happen inside of the isr, so the fault's frame is stashed
+// away & the cpu returns to isrDeferredFault() instead. Userland faults get
+// the (unused at the time) syscall stack, kernel ones (syscalls touching a
+// mapping) just continue below where they were interrupted.
+static void isrDeferFault(AsmPassedInterrupt *cpu, uint64_t addr) {
+  size_t stack =
+      (cpu->cs & 3) ? currentTask->whileSyscallRsp : cpu->usermode_rsp;
+  AsmPassedInterrupt *frame =
+      (AsmPassedInterrupt *)((stack - sizeof(AsmPassedInterrupt)) & ~0xF);
+  memcpy(frame, cpu, sizeof(AsmPassedInterrupt));
+
+  // as if isrDeferredFault(frame, addr) was just called (it never returns)
+  uint64_t *rsp = (uint64_t *)((size_t)frame - sizeof(uint64_t));
+  *rsp = 0;
+
+  cpu->rip = (uint64_t)isrDeferredFault;
+  cpu->cs = GDT_KERNEL_CODE;
+  cpu->ds = GDT_KERNEL_DATA;
+  cpu->usermode_ss = GDT_KERNEL_DATA;
+  cpu->usermode_rsp = (size_t)rsp;
+  cpu->rflags = RFLAGS_IF;
+  cpu->rdi = (size_t)frame;
+  cpu->rsi = addr;
 }
 
 uint64_t handle_tssrsp(uint64_t rsp) {
@@ -148,8 +201,8 @@ void handle_interrupt(uint64_t rsp) {
     }
     outportb(0x20, 0x20);
     switch (cpu->interrupt) {
-    case 32 + 0: // irq0
-      timerTick((uint64_t)cpu);
+    case 32 + 0: // irq0 (only keeps time until the APIC timer takes over)
+      timerPitTick();
       break;
 
     case 32 + 1: // irq1
@@ -168,6 +221,10 @@ void handle_interrupt(uint64_t rsp) {
       break;
     }
     }
+
+    // an idle cpu has no tick coming up to notice what the handler woke
+    if (scheduleWanted())
+      schedule((uint64_t)cpu);
   } else if (cpu->interrupt >= 0 && cpu->interrupt <= 31) { // ISR
     // To drop the current execution and give control to the scheduler, set this
     // variable and generate a page fault onto the magic address
@@ -182,6 +239,20 @@ void handle_interrupt(uint64_t rsp) {
       }
     }
 
+    // Demand paging, copy-on-write & friends
+    if (cpu->interrupt == 14) {
+      uint64_t errorLocation = 0;
+      asm volatile("movq %%cr2, %0" : "=r"(errorLocation));
+      PAGING_FAULT fault = PagingHandleFault(errorLocation, cpu->error,
+                                             cpu->rflags & RFLAGS_IF);
+      if (fault == PAGING_FAULT_HANDLED)
+        return;
+      if (fault == PAGING_FAULT_DEFER && isrDeferrable(cpu)) {
+        isrDeferFault(cpu, errorLocation);
+        return;
+      }
+    }
+
     if (currentTask->systemCallInProgress)
       debugf("[isr] Happened from system call!\n");
 
@@ -201,6 +272,23 @@ void handle_interrupt(uint64_t rsp) {
     // if (framebuffer == KERNEL_GFX)
     //   printf(format, exceptions[cpu->interrupt]);
     panic();
+  } else if (cpu->interrupt >= APIC_VECTOR_TIMER &&
+             cpu->interrupt <= APIC_VECTOR_SHOOTDOWN) { // local APIC
+    apicEoi();
+    switch (cpu->interrupt) {
+    case APIC_VECTOR_TIMER: // every cpu's own one-shot (see timerProgram())
+      timerTick((uint64_t)cpu);
+      break;
+
+    case APIC_VECTOR_RESCHEDULE: // somebody queued up work for us
+      if (scheduleWanted())
+        schedule((uint64_t)cpu);
+      break;
+
+    case APIC_VECTOR_SHOOTDOWN:
+      PagingShootdownHandle();
+      break;
+    }
   } else if (cpu->interrupt == 0x80) {
     syscallHandler(cpu);
   }
@@ -0,0 +1,130 @@
+#include <apic.h>
+#include <bootloader.h>
+#include <fastSyscall.h>
+#include <gdt.h>
+#include <idt.h>
+#include <isr.h>
+#include <malloc.h>
+#include <paging.h>
+#include <smp.h>
+#include <system.h>
+#include <task.h>
+#include <timer.h>
+#include <util.h>
+#include <vmm.h>
+
+// Application processor bring-up & per-cpu state
+// Copyright (C) 2024 Panagiotis
+
+#define SMP_DEBUG 0
+
+Cpu      cpuBsp = {.self = &cpuBsp, .online = true};
+Cpu     *cpus[SMP_MAX_CPUS] = {&cpuBsp};
+uint32_t smpCpus = 1;
+uint64_t smpOnline = 1;
+
+extern void asm_finalize_sched(uint64_t rsp, uint64_t cr3, Task *old);
+
+// Straight off gs, so a task can't be migrated halfway through. Anything past
+// these might only be touched with interrupts off.
+Cpu *cpuSelf() {
+  Cpu *cpu = 0;
+  asm volatile("movq %%gs:0, %0" : "=r"(cpu));
+  return cpu;
+}
+
+Task *cpuCurrentTask() {
+  Task *task = 0;
+  asm volatile("movq %%gs:%c1, %0"
+               : "=r"(task)
+               : "i"(__builtin_offsetof(Cpu, current)));
+  return task;
+}
+
+uint64_t *cpuPagedir() {
+  uint64_t *pagedir = 0;
+  asm volatile("movq %%gs:%c1, %0"
+               : "=r"(pagedir)
+               : "i"(__builtin_offsetof(Cpu, pagedir)));
+  return pagedir;
+}
+
+// Where the bootloader sends APs off to (on a stack of its own, with
+// interrupts off). They end up on their idle task, for the scheduler to take
+// over from there.
+static void smpApEntry(struct limine_smp_info *info) {
+  Cpu *cpu = (Cpu *)info->extra_argument;
+
+  uint64_t cr3 = (uint64_t)pagingBootPagedir - bootloader.hhdmOffset;
+  asm volatile("movq %0, %%cr3" ::"r"(cr3) : "memory");
+
+  gdtLoad(cpu);
+  cpu->current = cpu->idle;
+  cpu->pagedir = pagingBootPagedir;
+
+  set_idt();
+  PagingInitiateCpu();
+  initiateSSE();
+  initiateSyscallInst();
+  initiateApic();
+  apicTimerStart();
+  cpu->idleSince = rdtsc();
+
+  Task *idle = cpu->idle;
+  idle->onCpu = true;
+  idle->cpu = cpu->id;
+  cpu->tss.rsp0 = idle->whileTssRsp;
+
+  __atomic_or_fetch(&smpOnline, 1ULL << cpu->id, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&cpu->online, true, __ATOMIC_RELEASE);
+#if SMP_DEBUG
+  debugf("[smp] Cpu online: id{%d} lapic{%d}\n", cpu->id, cpu->lapicId);
+#endif
+
+  AsmPassedInterrupt *frame =
+      (AsmPassedInterrupt *)(idle->whileTssRsp - sizeof(AsmPassedInterrupt));
+  memcpy(frame, &idle->registers, sizeof(AsmPassedInterrupt));
+  ChangePageDirectoryFake(idle->pagedir);
+  asm_finalize_sched((size_t)frame, PageDirectoryCr3(idle->pagedir), idle);
+}
+
+// Needs the scheduler & the timer up (with interrupts on), APs start picking
+// up tasks right away
+void initiateSmp() {
+  cpuBsp.lapicId = apicId();
+
+  struct limine_smp_response *smp = bootloader.smp;
+  if (!smp) {
+    debugf("[smp] No SMP info from the bootloader, staying on the BSP\n");
+    return;
+  }
+
+  uint32_t online = 1;
+  for (uint64_t i = 0; i < smp->cpu_count && smpCpus < SMP_MAX_CPUS; i++) {
+    struct limine_smp_info *info = smp->cpus[i];
+    if (info->lapic_id == smp->bsp_lapic_id)
+      continue;
+
+    Cpu *cpu = (Cpu *)VirtualAllocate(SMP_CPU_PAGES);
+    memset(cpu, 0, sizeof(Cpu));
+    cpu->self = cpu;
+    cpu->id = smpCpus;
+    cpu->lapicId = info->lapic_id;
+    cpu->idle = taskCreateIdle(cpu);
+    cpus[smpCpus++] = cpu;
+
+    info->extra_argument = (uint64_t)cpu;
+    __atomic_store_n(&info->goto_address, smpApEntry, __ATOMIC_SEQ_CST);
+
+    uint64_t start = timerTicks;
+    while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE) &&
+           timerTicks - start < SMP_BOOT_TIMEOUT)
+      asm volatile("pause");
+    if (cpu->online)
+      online++;
+    else
+      debugf("[smp] Cpu didn't come up: lapic{%d}\n", cpu->lapicId);
+  }
+
+  debugf("[smp] Online: cpus{%d}\n", online);
+}
@@ -55,6 +55,13 @@ uint64_t wrmsr(uint32_t msrid, uint64_t value) {
   return value;
 }
 
+uint64_t rdtsc() {
+  uint32_t low;
+  uint32_t high;
+  __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+  return (uint64_t)low << 0 | (uint64_t)high << 32;
+}
+
 bool checkSSE() {
   uint32_t eax = 0x1, ebx = 0, ecx = 0, edx = 0;
   cpuid(&eax, &ebx, &ecx, &edx);
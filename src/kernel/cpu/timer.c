@@ -1,8 +1,46 @@
+#include <apic.h>
 #include <isr.h>
 #include <rtc.h>
 #include <schedule.h>
+#include <smp.h>
 #include <system.h>
+#include <task.h>
 #include <timer.h>
+#include <util.h>
+#include <wait.h>
+
+// The PIT only keeps time until the TSC (& the APIC timer) are calibrated off
+// it. Past that, the clock is read straight off the TSC & every cpu runs on a
+// one-shot timer of its own, armed only for whatever's coming up next (see
+// timerProgram()). Idle cpus don't get any ticks at all.
+uint64_t timerTscPerMs = 0;
+uint64_t timerPitTicks = 0;
+uint64_t timerTscBase = 0; // the TSC & ticks the switch happened at
+uint64_t timerPitBase = 0;
+
+// Pending events, sorted by deadline
+Spinlock    LOCK_TIMER = ATOMIC_FLAG_INIT;
+TimerEvent *timerEvents = 0;
+
+static void timerSwitch() {
+  initiateApic();
+  uint64_t tscPerMs = apicCalibrate();
+
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  timerPitBase = timerPitTicks;
+  timerTscBase = rdtsc();
+  __atomic_store_n(&timerTscPerMs, tscPerMs, __ATOMIC_RELEASE);
+
+  outportb(0x21, inportb(0x21) | 1); // irq0
+  apicTimerStart();
+  timerProgram(scheduleDeadline());
+  if (ints)
+    asm volatile("sti");
+
+  debugf("[timer] Switched to the local APIC: tscPerMs{%ld} tscDeadline{%d}\n",
+         tscPerMs, apicTscDeadline);
+}
 
 void initiateTimer(uint32_t reload_value) {
   timerFrequency = TIMER_ACCURANCY / reload_value;
@@ -17,19 +55,151 @@ void initiateTimer(uint32_t reload_value) {
 
   RTC rtc = {0};
   readFromCMOS(&rtc);
-  timerTicks = 0;
+  timerPitTicks = 0;
 
   timerBootUnix = rtcToUnix(&rtc);
   debugf("[timer] Ready to fire: frequency{%dMHz}\n", timerFrequency);
+
+  timerSwitch();
+}
+
+// Every cpu's TSC is expected to run in sync (invariant TSCs, reset together)
+uint64_t timerNow() {
+  uint64_t tscPerMs = __atomic_load_n(&timerTscPerMs, __ATOMIC_ACQUIRE);
+  if (!tscPerMs)
+    return __atomic_load_n(&timerPitTicks, __ATOMIC_RELAXED);
+
+  uint64_t tsc = rdtsc();
+  if (tsc < timerTscBase)
+    tsc = timerTscBase;
+  return timerPitBase + (tsc - timerTscBase) / tscPerMs;
+}
+
+// The TSC value a point in time (in timerTicks) corresponds to
+uint64_t timerTsc(uint64_t ticks) {
+  if (ticks < timerPitBase)
+    ticks = timerPitBase;
+  return timerTscBase + (ticks - timerPitBase) * timerTscPerMs;
+}
+
+void timerPitTick() { __atomic_add_fetch(&timerPitTicks, 1, __ATOMIC_RELAXED); }
+
+static void timerEventUnlink(TimerEvent *event) {
+  if (!event->armed)
+    return;
+
+  TimerEvent **link = &timerEvents;
+  while (*link != event)
+    link = &(*link)->next;
+  *link = event->next;
+  event->armed = false;
+}
+
+static uint64_t timerEventNearest() {
+  bool     ints = spinlockIrqAcquire(&LOCK_TIMER);
+  uint64_t nearest = timerEvents ? timerEvents->deadline : 0;
+  spinlockIrqRelease(&LOCK_TIMER, ints);
+  return nearest;
 }
 
+static void timerEventsRun() {
+  uint64_t now = timerTicks;
+  bool     ints = spinlockIrqAcquire(&LOCK_TIMER);
+  while (timerEvents && timerEvents->deadline <= now) {
+    TimerEvent *event = timerEvents;
+    timerEvents = event->next;
+    event->armed = false;
+    event->callback(event->arg);
+  }
+  spinlockIrqRelease(&LOCK_TIMER, ints);
+}
+
+// (Re)arms an event, which has to stay around until it fires or is cancelled
+void timerEventArm(TimerEvent *event, uint64_t deadline) {
+  bool ints = spinlockIrqAcquire(&LOCK_TIMER);
+  timerEventUnlink(event);
+  event->deadline = deadline;
+  TimerEvent **link = &timerEvents;
+  while (*link && (*link)->deadline <= deadline)
+    link = &(*link)->next;
+  event->next = *link;
+  *link = event;
+  event->armed = true;
+  spinlockIrqRelease(&LOCK_TIMER, ints);
+
+  // might come before what this cpu is armed for, the rest take it into
+  // account whenever they (re)program theirs
+  asm volatile("cli");
+  Cpu *self = cpuSelf();
+  if (timerTscPerMs && (!self->timerDeadline || deadline < self->timerDeadline))
+    timerProgram(deadline);
+  if (ints)
+    asm volatile("sti");
+}
+
+// Once this returns, the callback won't run (or be running) anymore
+void timerEventCancel(TimerEvent *event) {
+  bool ints = spinlockIrqAcquire(&LOCK_TIMER);
+  timerEventUnlink(event);
+  spinlockIrqRelease(&LOCK_TIMER, ints);
+}
+
+// Arms this cpu's timer for whichever comes first: deadline (0 being none) or
+// the nearest event. With neither, it's left stopped. Called with interrupts
+// off.
+void timerProgram(uint64_t deadline) {
+  uint64_t nearest = timerEventNearest();
+  if (nearest && (!deadline || nearest < deadline))
+    deadline = nearest;
+
+  cpuSelf()->timerDeadline = deadline;
+  if (deadline)
+    apicTimerArm(deadline);
+  else
+    apicTimerStop();
+}
+
+// Every cpu's own timer interrupt
 void timerTick(uint64_t rsp) {
-  timerTicks++;
-  schedule(rsp);
+  Cpu *self = cpuSelf();
+  self->ticks++;
+  self->timerDeadline = 0;
+
+  timerEventsRun();
+  if (scheduleTick())
+    schedule(rsp); // programs the timer for the next task
+  else
+    timerProgram(scheduleDeadline());
 }
 
+// Text summary (for /sys/kernel/timerinfo), returns the amount of characters
+// written
+size_t timerInfo(char *out, size_t limit) {
+  size_t len = snprintf(out, limit, "clock %s\ntscperms %ld\nticks %ld\n",
+                        apicTscDeadline ? "tsc-deadline" : "apic-oneshot",
+                        timerTscPerMs, timerTicks);
+  for (uint32_t i = 0; i < smpCpus && len < limit; i++) {
+    Cpu     *cpu = cpus[i];
+    uint64_t idle = cpu->idleTsc;
+    uint64_t since = cpu->idleSince;
+    uint64_t now = rdtsc();
+    if (cpu->current == cpu->idle && now > since)
+      idle += now - since;
+
+    len += snprintf(out + len, limit - len, "cpu%d ticks %ld idlems %ld\n", i,
+                    cpu->ticks, timerTscPerMs ? idle / timerTscPerMs : 0);
+  }
+  return len < limit ? len : limit - 1;
+}
+
+// Milliseconds, spins only until there's a scheduler (& a timer) to block on
 void sleep(uint32_t time) {
   uint64_t target = timerTicks + (time);
+  if (tasksInitiated && timerTscPerMs && currentTask != cpuSelf()->idle) {
+    waitUntil(target);
+    return;
+  }
+
   while (target > timerTicks) {
   }
-}
\ No newline at end of file
+}
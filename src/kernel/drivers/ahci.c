@@ -1,5 +1,6 @@
 #include <ahci.h>
 #include <bootloader.h>
+#include <disk.h>
 #include <isr.h>
 #include <linked_list.h>
 #include <malloc.h>
@@ -103,50 +104,74 @@ force_inline bool ahciCmdIssue(ahci *ahciPtr, HBA_PORT *port, int slot) {
 /* Set up AHCI parts for reading/writing: */
 
 force_inline HBA_CMD_HEADER *ahciSetUpCmdHeader(ahci *ahciPtr, uint32_t portId,
-                                                uint32_t cmdslot, uint32_t prdt,
-                                                bool write) {
+                                                uint32_t cmdslot, bool write) {
   HBA_CMD_HEADER *cmdheader = (HBA_CMD_HEADER *)ahciPtr->clbVirt[portId];
   cmdheader =
       (HBA_CMD_HEADER *)((size_t)cmdheader + cmdslot * sizeof(HBA_CMD_HEADER));
   cmdheader->cfl = sizeof(FIS_REG_H2D) / sizeof(uint32_t); // Command FIS size
   cmdheader->w = (uint8_t)write; // 0 = read, 1 = write
-  cmdheader->prdtl = prdt;       // PRDT entries count
+  cmdheader->prdtl = 0;          // filled in by ahciSetUpPRDT()
 
   return cmdheader;
 }
 
-force_inline HBA_CMD_TBL *ahciSetUpCmdTable(ahci           *ahciPtr,
-                                            HBA_CMD_HEADER *cmdheader,
-                                            uint32_t        portId,
-                                            uint32_t        cmdTableId) {
+force_inline HBA_CMD_TBL *ahciSetUpCmdTable(ahci *ahciPtr, uint32_t portId,
+                                            uint32_t cmdTableId) {
   HBA_CMD_TBL *cmdtbl =
-      (HBA_CMD_TBL *)((size_t)ahciPtr->ctbaVirt[portId] + cmdTableId * 256);
-  memset(cmdtbl, 0,
-         sizeof(HBA_CMD_TBL) + (cmdheader->prdtl - 1) * sizeof(HBA_PRDT_ENTRY));
+      (HBA_CMD_TBL *)((size_t)ahciPtr->ctbaVirt[portId] +
+                      cmdTableId * AHCI_CMD_TABLE_SIZE);
+  // PRDT entries are written as a whole, only the FIS part needs clearing
+  memset(cmdtbl, 0, sizeof(HBA_CMD_TBL) - sizeof(HBA_PRDT_ENTRY));
   return cmdtbl;
 }
 
-force_inline void ahciSetUpPRDT(HBA_CMD_HEADER *cmdheader, HBA_CMD_TBL *cmdtbl,
-                                uint16_t *buff, uint32_t *count) {
-  // 4 MiB (16 sectors) per PRDT
-  int i = 0;
-  for (i = 0; i < cmdheader->prdtl - 1; i++) {
-    size_t targPhys = VirtualToPhysical((size_t)buff);
-    cmdtbl->prdt_entry[i].dba = SPLIT_64_LOWER(targPhys);
-    cmdtbl->prdt_entry[i].dbau = SPLIT_64_HIGHER(targPhys);
-    cmdtbl->prdt_entry[i].dbc =
-        4194304 - 1; // 4 MiB (this value should always be set to 1 less
-                     // than the actual value)
-    cmdtbl->prdt_entry[i].i = 1;
-    buff += 4194304 / 2;     // appropriate words
-    *count -= 4194304 / 512; // appropriate sectors
+// The buffer is only virtually contiguous (kernel heap, vmalloc), so it's
+// walked page by page & every physically contiguous run gets its own entry.
+// Returns the amount of sectors covered, which is less than requested when the
+// buffer is too scattered to fit on a single command table.
+force_inline uint32_t ahciSetUpPRDT(HBA_CMD_HEADER *cmdheader,
+                                    HBA_CMD_TBL *cmdtbl, uint8_t *buff,
+                                    uint32_t count) {
+  size_t bytes = (size_t)count * SECTOR_SIZE;
+  size_t done = 0;
+  size_t runEnd = 0; // physical address right past the last entry
+  int    entries = 0;
+  while (done < bytes) {
+    size_t virt = (size_t)buff + done;
+    size_t phys = VirtualToPhysical(virt);
+    size_t chunk = MIN(PAGE_SIZE - (virt % PAGE_SIZE), bytes - done);
+
+    if (entries && phys == runEnd &&
+        cmdtbl->prdt_entry[entries - 1].dbc + 1 + chunk <= AHCI_PRDT_MAX_BYTES)
+      cmdtbl->prdt_entry[entries - 1].dbc += chunk;
+    else if (entries < AHCI_PRDT_ENTRIES)
+      cmdtbl->prdt_entry[entries++] =
+          (HBA_PRDT_ENTRY){.dba = SPLIT_64_LOWER(phys),
+                           .dbau = SPLIT_64_HIGHER(phys),
+                           .dbc = chunk - 1, // always 1 less than the actual
+                           .i = 1};
+    else
+      break;
+
+    runEnd = phys + chunk;
+    done += chunk;
+  }
+
+  // commands can only move whole sectors, so trim whatever hangs off the end
+  size_t extra = done % SECTOR_SIZE;
+  done -= extra;
+  while (extra) {
+    HBA_PRDT_ENTRY *last = &cmdtbl->prdt_entry[entries - 1];
+    if (last->dbc + 1 > extra) {
+      last->dbc -= extra;
+      break;
+    }
+    extra -= last->dbc + 1;
+    entries--;
   }
-  size_t targPhys = VirtualToPhysical((size_t)buff);
-  // Last entry
-  cmdtbl->prdt_entry[i].dba = SPLIT_64_LOWER(targPhys);
-  cmdtbl->prdt_entry[i].dbau = SPLIT_64_HIGHER(targPhys);
-  cmdtbl->prdt_entry[i].dbc = (*count << 9) - 1; // 512 bytes per sector
-  cmdtbl->prdt_entry[i].i = 1;
+
+  cmdheader->prdtl = entries;
+  return done / SECTOR_SIZE;
 }
 
 /* Port initialization (used only on startup): */
@@ -185,7 +210,7 @@ void ahciPortRebase(ahci *ahciPtr, HBA_PORT *port, int portno) {
   // Command list entry maxim count = 32
   // Command list maxim size = 32*32 = 1K per port
   uint32_t clbPages = DivRoundUp(sizeof(HBA_CMD_HEADER) * 32, BLOCK_SIZE);
-  void    *clbVirt = VirtualAllocate(clbPages); //!
+  void    *clbVirt = VirtualAllocatePhysicallyContiguous(clbPages);
   ahciPtr->clbVirt[portno] = clbVirt;
   size_t clbPhys = VirtualToPhysical((size_t)clbVirt);
   port->clb = SPLIT_64_LOWER(clbPhys);
@@ -200,21 +225,18 @@ void ahciPortRebase(ahci *ahciPtr, HBA_PORT *port, int portno) {
   port->fbu = SPLIT_64_HIGHER(fbPhys);
   // memset((void *)(port->fb), 0, 256); already 0'd
 
-  // Command table offset: 40K + 8K*portno
-  // Command table size = 256*32 = 8K per port
+  // Command tables: AHCI_CMD_TABLE_SIZE for each of the 32 slots
   HBA_CMD_HEADER *cmdheader = (HBA_CMD_HEADER *)clbVirt;
-  void           *ctbaVirt = VirtualAllocate(2); // 2 pages = 8192 bytes //!
+  uint32_t        ctbaPages = DivRoundUp(AHCI_CMD_TABLE_SIZE * 32, BLOCK_SIZE);
+  void           *ctbaVirt = VirtualAllocatePhysicallyContiguous(ctbaPages);
   ahciPtr->ctbaVirt[portno] = ctbaVirt;
   size_t ctbaPhys = (size_t)VirtualToPhysical((size_t)ctbaVirt);
-  memset(ctbaVirt, 0, 8192);
+  memset(ctbaVirt, 0, ctbaPages * BLOCK_SIZE);
   for (int i = 0; i < 32; i++) {
-    cmdheader[i].prdtl = 8; // 8 prdt entries per command table
-                            // 256 bytes per command table, 64+16+48+16*8
-    // Command table offset: 40K + 8K*portno + cmdheader_index*256
-    size_t ctbaPhysCurr = ctbaPhys + i * 256;
+    cmdheader[i].prdtl = 0; // set per command, see ahciSetUpPRDT()
+    size_t ctbaPhysCurr = ctbaPhys + i * AHCI_CMD_TABLE_SIZE;
     cmdheader[i].ctba = SPLIT_64_LOWER(ctbaPhysCurr);
     cmdheader[i].ctbau = SPLIT_64_HIGHER(ctbaPhysCurr);
-    // memset((void *)cmdheader[i].ctba, 0, 256); already 0'd
   }
 
   if (port->serr & (1 << 10))
@@ -269,81 +291,64 @@ force_inline bool ahciPortReady(HBA_PORT *port) {
   return true;
 }
 
-bool ahciRead(ahci *ahciPtr, uint32_t portId, HBA_PORT *port, uint32_t startl,
-              uint32_t starth, uint32_t count, uint8_t *buff) {
-  port->is = (uint32_t)-1; // Clear pending interrupt bits
-  int slot = ahciCmdFind(ahciPtr, port);
-  // debugf("%d ", slot);
-  if (slot == -1)
-    return false;
+// Split into as many commands as the buffer's layout & the 16 bit sector count
+// require, each one waited on before the next is issued
+bool ahciTransfer(ahci *ahciPtr, uint32_t portId, HBA_PORT *port, uint64_t lba,
+                  uint32_t count, uint8_t *buff, bool write) {
+  while (count) {
+    port->is = (uint32_t)-1; // Clear pending interrupt bits
+    int slot = ahciCmdFind(ahciPtr, port);
+    if (slot == -1)
+      return false;
+
+    HBA_CMD_HEADER *cmdheader =
+        ahciSetUpCmdHeader(ahciPtr, portId, slot, write);
+    HBA_CMD_TBL *cmdtbl = ahciSetUpCmdTable(ahciPtr, portId, slot);
+    uint32_t     sectors = ahciSetUpPRDT(cmdheader, cmdtbl, buff,
+                                         MIN(count, AHCI_MAX_SECTORS));
 
-  HBA_CMD_HEADER *cmdheader =
-      ahciSetUpCmdHeader(ahciPtr, portId, slot, AHCI_CALC_PRDT(count), false);
-  HBA_CMD_TBL *cmdtbl = ahciSetUpCmdTable(ahciPtr, cmdheader, portId, slot);
+    FIS_REG_H2D *cmdfis = (FIS_REG_H2D *)(&cmdtbl->cfis);
 
-  // todo: look this up
-  uint32_t countSec = count;
-  ahciSetUpPRDT(cmdheader, cmdtbl, (uint16_t *)buff, &countSec);
+    cmdfis->fis_type = FIS_TYPE_REG_H2D;
+    cmdfis->c = 1; // Command
+    cmdfis->command = write ? ATA_CMD_WRITE_DMA_EX : ATA_CMD_READ_DMA_EX;
 
-  FIS_REG_H2D *cmdfis = (FIS_REG_H2D *)(&cmdtbl->cfis);
+    cmdfis->lba0 = (uint8_t)lba;
+    cmdfis->lba1 = (uint8_t)(lba >> 8);
+    cmdfis->lba2 = (uint8_t)(lba >> 16);
+    cmdfis->device = 1 << 6; // LBA mode
 
-  cmdfis->fis_type = FIS_TYPE_REG_H2D;
-  cmdfis->c = 1; // Command
-  cmdfis->command = ATA_CMD_READ_DMA_EX;
+    cmdfis->lba3 = (uint8_t)(lba >> 24);
+    cmdfis->lba4 = (uint8_t)(lba >> 32);
+    cmdfis->lba5 = (uint8_t)(lba >> 40);
 
-  cmdfis->lba0 = (uint8_t)startl;
-  cmdfis->lba1 = (uint8_t)(startl >> 8);
-  cmdfis->lba2 = (uint8_t)(startl >> 16);
-  cmdfis->device = 1 << 6; // LBA mode
+    cmdfis->countl = sectors & 0xFF;
+    cmdfis->counth = (sectors >> 8) & 0xFF;
 
-  cmdfis->lba3 = (uint8_t)(startl >> 24);
-  cmdfis->lba4 = (uint8_t)starth;
-  cmdfis->lba5 = (uint8_t)(starth >> 8);
+    if (!ahciPortReady(port))
+      return false;
 
-  cmdfis->countl = count & 0xFF;
-  cmdfis->counth = (count >> 8) & 0xFF;
+    if (!ahciCmdIssue(ahciPtr, port, slot))
+      return false;
 
-  if (!ahciPortReady(port))
-    return false;
+    lba += sectors;
+    buff += sectors * SECTOR_SIZE;
+    count -= sectors;
+  }
 
-  return ahciCmdIssue(ahciPtr, port, slot);
+  return true;
+}
+
+bool ahciRead(ahci *ahciPtr, uint32_t portId, HBA_PORT *port, uint32_t startl,
+              uint32_t starth, uint32_t count, uint8_t *buff) {
+  return ahciTransfer(ahciPtr, portId, port, COMBINE_64(starth, startl), count,
+                      buff, false);
 }
 
 bool ahciWrite(ahci *ahciPtr, uint32_t portId, HBA_PORT *port, uint32_t startl,
                uint32_t starth, uint32_t count, uint8_t *buff) {
-  port->is = (uint32_t)-1; // Clear pending interrupt bits
-  int slot = ahciCmdFind(ahciPtr, port);
-  if (slot == -1)
-    return false;
-
-  HBA_CMD_HEADER *cmdheader =
-      ahciSetUpCmdHeader(ahciPtr, portId, slot, AHCI_CALC_PRDT(count), true);
-  HBA_CMD_TBL *cmdtbl = ahciSetUpCmdTable(ahciPtr, cmdheader, portId, slot);
-
-  ahciSetUpPRDT(cmdheader, cmdtbl, (uint16_t *)buff, &count);
-
-  FIS_REG_H2D *cmdfis = (FIS_REG_H2D *)(&cmdtbl->cfis);
-
-  cmdfis->fis_type = FIS_TYPE_REG_H2D;
-  cmdfis->c = 1; // Command
-  cmdfis->command = ATA_CMD_WRITE_DMA_EX;
-
-  cmdfis->lba0 = (uint8_t)startl;
-  cmdfis->lba1 = (uint8_t)(startl >> 8);
-  cmdfis->lba2 = (uint8_t)(startl >> 16);
-  cmdfis->device = 1 << 6; // LBA mode
-
-  cmdfis->lba3 = (uint8_t)(startl >> 24);
-  cmdfis->lba4 = (uint8_t)starth;
-  cmdfis->lba5 = (uint8_t)(starth >> 8);
-
-  cmdfis->countl = count & 0xFF;
-  cmdfis->counth = (count >> 8) & 0xFF;
-
-  if (!ahciPortReady(port))
-    return false;
-
-  return ahciCmdIssue(ahciPtr, port, slot);
+  return ahciTransfer(ahciPtr, portId, port, COMBINE_64(starth, startl), count,
+                      buff, true);
 }
 
 void ahciInterruptHandler(AsmPassedInterrupt *regs) {
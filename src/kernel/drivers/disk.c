@@ -3,6 +3,7 @@
 #include <malloc.h>
 #include <system.h>
 #include <util.h>
+#include <zram.h>
 
 // Multiple disk handler
 // Copyright (C) 2022 Panagiotis
@@ -29,6 +30,12 @@ bool validateMbr(uint8_t *mbrSector) {
 
 void diskBytes(uint8_t *target_address, uint32_t LBA, uint32_t sector_count,
                bool write) {
+  // the compressed ram disk has a sector window of its own (see zram.h)
+  if (LBA >= ZRAM_LBA_START) {
+    zramBytes(target_address, LBA - ZRAM_LBA_START, sector_count, write);
+    return;
+  }
+
   // todo: yeah, this STILL is NOT ideal
 
   PCI *browse = firstPCI;
@@ -60,9 +67,9 @@ void diskBytes(uint8_t *target_address, uint32_t LBA, uint32_t sector_count,
 // todo: allow concurrent stuff
 force_inline void diskBytesMax(uint8_t *target_address, uint32_t LBA,
                                size_t sector_count, bool write) {
-  // calculated by: (bytesPerPRDT * PRDTamnt) / SECTOR_SIZE
-  //                (    4MiB     *     8   ) /     512
-  int max = 65536;
+  // the most a single command can move (ahciTransfer() splits further if the
+  // buffer is too scattered)
+  int max = AHCI_MAX_SECTORS;
 
   size_t chunks = sector_count / max;
   size_t remainder = sector_count % max;
@@ -91,3 +98,10 @@ void setDiskBytes(const uint8_t *target_address, uint32_t LBA,
   uint8_t *rw_target_address = (uint8_t *)((size_t)target_address);
   return diskBytesMax(rw_target_address, LBA, sector_count, true);
 }
+
+// The range's contents won't be needed anymore, only the compressed ram disk
+// does anything with that for now
+void discardDiskBytes(uint32_t LBA, size_t sector_count) {
+  if (LBA >= ZRAM_LBA_START)
+    zramDiscard(LBA - ZRAM_LBA_START, sector_count);
+}
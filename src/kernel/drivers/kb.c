@@ -1,7 +1,9 @@
 #include <console.h>
 #include <kb.h>
 #include <paging.h>
+#include <schedule.h>
 #include <task.h>
+#include <wait.h>
 
 #include <linux.h>
 #include <system.h>
@@ -47,6 +49,8 @@ uint32_t kbCurr = 0;
 uint32_t kbMax = 0;
 uint32_t kbTaskId = 0;
 
+WaitQueue kbWaiters = WAIT_QUEUE_INIT;
+
 uint8_t kbRead() {
   while (!(inportb(0x64) & 1))
     ;
@@ -104,9 +108,7 @@ char handleKbEvent() {
 
 // used by the kernel atm
 uint32_t readStr(char *buffstr) {
-  while (kbIsOccupied())
-    ;
-  bool res = kbTaskRead(KERNEL_TASK_ID, buffstr, 1024, false);
+  bool res = kbTaskRead(KERNEL_TASK_ID, buffstr, 1024);
   if (!res)
     return 0;
 
@@ -114,17 +116,16 @@ uint32_t readStr(char *buffstr) {
   if (!task)
     return 0;
 
-  while (kbBuff) {
-  }
+  waitEvent(&kbWaiters, !kbIsReading(KERNEL_TASK_ID));
   uint32_t ret = task->tmpRecV;
   buffstr[ret] = '\0';
   return ret;
 }
 
-bool kbTaskRead(uint32_t taskId, char *buff, uint32_t limit,
-                bool changeTaskState) {
-  while (kbIsOccupied())
-    ;
+// Claims the keyboard for a task, whose read is done once kbIsReading() stops
+// holding (kbWaiters get woken up then)
+bool kbTaskRead(uint32_t taskId, char *buff, uint32_t limit) {
+  waitEvent(&kbWaiters, !kbIsOccupied());
   Task *task = taskGet(taskId);
   if (!task)
     return false;
@@ -133,9 +134,6 @@ bool kbTaskRead(uint32_t taskId, char *buff, uint32_t limit,
   kbCurr = 0;
   kbMax = limit;
   kbTaskId = taskId;
-
-  if (changeTaskState)
-    task->state = TASK_STATE_WAITING_INPUT;
   return true;
 }
 
@@ -154,11 +152,10 @@ void initiateKb() {
 
 void kbFinaliseStream() {
   Task *task = taskGet(kbTaskId);
-  if (task) {
+  if (task)
     task->tmpRecV = kbCurr;
-    task->state = TASK_STATE_READY;
-  }
   kbReset();
+  waitWakeAll(&kbWaiters);
 }
 
 void kbChar(Task *task, char out) {
@@ -200,3 +197,5 @@ void kbIrq() {
 }
 
 bool kbIsOccupied() { return !!kbBuff; }
+
+bool kbIsReading(uint32_t taskId) { return kbBuff && kbTaskId == taskId; }
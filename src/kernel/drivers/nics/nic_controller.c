@@ -8,6 +8,9 @@
 #include <nic_controller.h>
 #include <rtl8139.h>
 #include <rtl8169.h>
+#include <schedule.h>
+#include <shrinker.h>
+#include <slab.h>
 #include <system.h>
 #include <util.h>
 
@@ -35,12 +38,31 @@ NIC *createNewNIC(PCI *pci) {
 
   nic->dhcpTransactionID = rand();
   nic->mtu = 1500;
+  ShrinkerRegister("arp_table", SHRINKER_PRIORITY_NET, netArpTableCount,
+                   netArpTableShrink, nic);
 
   pci->extra = nic;
   selectedNIC = nic;
   return nic;
 }
 
+// Frames on their way out are short-lived & (almost always) no larger than
+// PACKET_MAX, so they come off a cache of their own
+SlabCache slabPacket = SLAB_CACHE_INIT("net_packet", uint8_t[PACKET_MAX], 0);
+
+void *netPacketAllocate(uint32_t size) {
+  if (size > PACKET_MAX)
+    return malloc(size);
+  return SlabAllocate(&slabPacket);
+}
+
+void netPacketFree(void *packet, uint32_t size) {
+  if (size > PACKET_MAX)
+    free(packet);
+  else
+    SlabFree(&slabPacket, packet);
+}
+
 void sendPacket(NIC *nic, uint8_t *destination_mac, void *data, uint32_t size,
                 uint16_t protocol) {
   if ((size + sizeof(netPacketHeader)) > nic->mtu) {
@@ -48,7 +70,7 @@ void sendPacket(NIC *nic, uint8_t *destination_mac, void *data, uint32_t size,
            sizeof(netPacketHeader) + size, nic->mtu);
     return;
   }
-  netPacketHeader *packet = malloc(sizeof(netPacketHeader) + size);
+  netPacketHeader *packet = netPacketAllocate(sizeof(netPacketHeader) + size);
   void            *packetData = (void *)packet + sizeof(netPacketHeader);
 
   memcpy(packet->source_mac, nic->MAC, 6);
@@ -69,7 +91,7 @@ void sendPacket(NIC *nic, uint8_t *destination_mac, void *data, uint32_t size,
     break;
   }
 
-  free(packet);
+  netPacketFree(packet, sizeof(netPacketHeader) + size);
 }
 
 void handlePacket(NIC *nic, void *packet, uint32_t size) {
@@ -127,5 +149,5 @@ void netQueueAdd(NIC *nic, uint8_t *packet, uint16_t packetLength) {
     netQueueCurr = 0;
 
   // direct the task
-  netHelperTask->state = TASK_STATE_READY;
+  scheduleWake(netHelperTask);
 }
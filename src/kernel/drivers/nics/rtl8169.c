@@ -111,14 +111,19 @@ void sendRTL8169(NIC *nic, void *packet, uint32_t packetSize) {
 }
 
 void setupDescriptorsRTL8169(rtl8169_interface *infoLocation) {
+  // buffers get DMA'd into, so they can't straddle a page boundary (the kernel
+  // heap isn't physically contiguous). Two of them fit in every page.
+  uint32_t ringPages = DivRoundUp(RTL8169_DESCRIPTORS, 2);
+  uint8_t *ringRX = (uint8_t *)VirtualAllocatePhysicallyContiguous(ringPages);
+  memset(ringRX, 0, ringPages * BLOCK_SIZE);
+  uint8_t *ringTX = (uint8_t *)VirtualAllocatePhysicallyContiguous(ringPages);
+  memset(ringTX, 0, ringPages * BLOCK_SIZE);
+
   for (uint32_t i = 0; i < RTL8169_DESCRIPTORS; i++) {
     uint32_t buffer_len = 1536;
 
-    // will be consecutive
-    void *addrRX = (void *)malloc(buffer_len);
-    memset(addrRX, 0, buffer_len);
-    void *addrTX = (void *)malloc(buffer_len);
-    memset(addrTX, 0, buffer_len);
+    void *addrRX = &ringRX[i * (BLOCK_SIZE / 2)];
+    void *addrTX = &ringTX[i * (BLOCK_SIZE / 2)];
 
     // setup RX
     if (i == (RTL8169_DESCRIPTORS - 1)) {
@@ -0,0 +1,298 @@
+#include <bootloader.h>
+#include <linux.h>
+#include <lz4.h>
+#include <malloc.h>
+#include <paging.h>
+#include <system.h>
+#include <util.h>
+#include <vmm.h>
+#include <zram.h>
+
+// Compressed ram disk (like Linux's zram): every page of the device gets LZ4'd
+// on its own & lives on the heap, all-zero ones aren't stored at all. It sits
+// on a sector window of its own (see diskBytes()), so it can be swapped on or
+// hold a scratch filesystem.
+// Copyright (C) 2024 Panagiotis
+
+#define ZRAM_DEBUG 0
+
+// Per-call scratch: a whole page, the compressor's output & its hash table
+#define ZRAM_SCRATCH_SIZE (PAGE_SIZE * 2 + LZ4_HASH_SIZE * sizeof(uint16_t))
+
+// Writers racing on a page retry (see zramStore()), everyone else goes by this
+#define ZRAM_ANY_GENERATION (-1)
+
+Zram zram = {0};
+
+void initiateZram() {
+  size_t pages = bootloader.mmTotal / PAGE_SIZE / ZRAM_SIZE_DIVISOR;
+  pages = MIN(pages, ZRAM_MAX_SECTORS / ZRAM_PAGE_SECTORS);
+
+  zram.pages = pages;
+  zram.table = (ZramPage *)VmallocAllocate(
+      DivRoundUp(pages * sizeof(ZramPage), PAGE_SIZE));
+
+  debugf("[zram] Device ready: size{%ldMiB} sectors{%lx..%lx}\n",
+         pages * PAGE_SIZE / 1024 / 1024, ZRAM_LBA_START,
+         ZRAM_LBA_START + pages * ZRAM_PAGE_SECTORS);
+}
+
+static bool zramZeroed(const uint8_t *in) {
+  const uint64_t *words = (const uint64_t *)in;
+  for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+    if (words[i])
+      return false;
+  }
+  return true;
+}
+
+// Adds (sign = 1) or removes (sign = -1) a page from the counters, called with
+// the lock held
+static void zramAccount(ZramPage *page, int64_t sign) {
+  if (page->flags & ZRAM_PAGE_ZERO)
+    zram.zeroPages += sign;
+  if (!page->data)
+    return;
+
+  zram.storedPages += sign;
+  zram.origBytes += sign * PAGE_SIZE;
+  zram.comprBytes += sign * page->size;
+  zram.memUsed += sign * malloc_usable_size(page->data);
+  if (page->flags & ZRAM_PAGE_RAW)
+    zram.rawPages += sign;
+  zram.memUsedMax = MAX(zram.memUsedMax, zram.memUsed);
+}
+
+// Decompresses a page onto out, returns its generation
+static uint32_t zramLoad(size_t index, uint8_t *out) {
+  spinlockAcquire(&zram.LOCK);
+  ZramPage *page = &zram.table[index];
+  uint32_t  generation = page->generation;
+  if (!page->data)
+    memset(out, 0, PAGE_SIZE);
+  else if (page->flags & ZRAM_PAGE_RAW)
+    memcpy(out, page->data, PAGE_SIZE);
+  else if (!LZ4Decompress(page->data, page->size, out, PAGE_SIZE)) {
+    debugf("[zram] Corrupted page{%lx}!\n", index);
+    panic();
+  }
+  spinlockRelease(&zram.LOCK);
+
+  return generation;
+}
+
+// Installs a whole page, unless somebody else stored to it since expected was
+// read. Everything that might allocate happens outside of the lock, since the
+// swapper could need it to make room for said allocations.
+static bool zramStore(size_t index, const uint8_t *in, uint8_t *scratch,
+                      int64_t expected) {
+  uint8_t *data = 0;
+  size_t   size = 0;
+  uint16_t flags = 0;
+  if (zramZeroed(in))
+    flags = ZRAM_PAGE_ZERO;
+  else {
+    uint16_t *table = (uint16_t *)(scratch + PAGE_SIZE);
+    size = LZ4Compress(in, PAGE_SIZE, scratch, ZRAM_COMPRESS_LIMIT, table);
+
+    // not worth the trouble of decompressing it later
+    const uint8_t *source = scratch;
+    if (!size) {
+      size = PAGE_SIZE;
+      source = in;
+      flags = ZRAM_PAGE_RAW;
+    }
+
+    data = (uint8_t *)malloc(size);
+    memcpy(data, source, size);
+  }
+
+  spinlockAcquire(&zram.LOCK);
+  ZramPage *page = &zram.table[index];
+  if (expected != ZRAM_ANY_GENERATION && page->generation != expected) {
+    spinlockRelease(&zram.LOCK);
+    free(data);
+    return false;
+  }
+
+  ZramPage old = *page;
+  zramAccount(page, -1);
+  page->data = data;
+  page->size = size;
+  page->flags = flags;
+  page->generation++;
+  zramAccount(page, 1);
+  spinlockRelease(&zram.LOCK);
+
+  free(old.data);
+  return true;
+}
+
+// Writes len bytes at offset inside of a page, partial ones being read back
+// first
+static void zramWrite(size_t index, const uint8_t *in, size_t offset,
+                      size_t len, uint8_t *scratch) {
+  if (!offset && len == PAGE_SIZE) {
+    zramStore(index, in, scratch + PAGE_SIZE, ZRAM_ANY_GENERATION);
+    return;
+  }
+
+  while (true) {
+    uint32_t generation = zramLoad(index, scratch);
+    memcpy(scratch + offset, in, len);
+    if (zramStore(index, scratch, scratch + PAGE_SIZE, generation))
+      return;
+  }
+}
+
+// Byte-level access for both the sector window & /dev/zram0, which might be
+// handed userland buffers (so they're only ever touched outside of the lock)
+static size_t zramAccess(uint8_t *buff, size_t offset, size_t len,
+                         bool write) {
+  size_t capacity = zram.pages * PAGE_SIZE;
+  if (offset >= capacity)
+    return 0;
+  len = MIN(len, capacity - offset);
+
+  uint8_t *scratch = (uint8_t *)malloc(ZRAM_SCRATCH_SIZE);
+  size_t   done = 0;
+  while (done < len) {
+    size_t index = (offset + done) / PAGE_SIZE;
+    size_t inner = (offset + done) % PAGE_SIZE;
+    size_t chunk = MIN(PAGE_SIZE - inner, len - done);
+    if (write)
+      zramWrite(index, &buff[done], inner, chunk, scratch);
+    else {
+      zramLoad(index, scratch);
+      memcpy(&buff[done], scratch + inner, chunk);
+    }
+    done += chunk;
+  }
+  free(scratch);
+
+  return done;
+}
+
+// Sectors are relative to ZRAM_LBA_START. Whatever is past the end reads as
+// zeroes & writes to it are dropped, like with no disk at all.
+void zramBytes(uint8_t *buff, size_t sector, size_t count, bool write) {
+  size_t done =
+      zramAccess(buff, sector * SECTOR_SIZE, count * SECTOR_SIZE, write);
+  if (!write && done < count * SECTOR_SIZE)
+    memset(&buff[done], 0, count * SECTOR_SIZE - done);
+}
+
+// The range's contents are of no use anymore (freed swap slots), only whole
+// pages can actually be dropped
+void zramDiscard(size_t sector, size_t count) {
+  size_t start = DivRoundUp(sector, ZRAM_PAGE_SECTORS);
+  size_t end = MIN((sector + count) / ZRAM_PAGE_SECTORS, zram.pages);
+  for (size_t index = start; index < end; index++) {
+    spinlockAcquire(&zram.LOCK);
+    ZramPage *page = &zram.table[index];
+    ZramPage  old = *page;
+    zramAccount(page, -1);
+    page->data = 0;
+    page->size = 0;
+    page->flags = 0;
+    page->generation++;
+    spinlockRelease(&zram.LOCK);
+
+    free(old.data);
+  }
+}
+
+// The whole device as a single partition, for fsMount(). Fails if there's no
+// filesystem we could mount on it.
+bool zramPartition(mbr_partition *out) {
+  memset(out, 0, sizeof(mbr_partition));
+  out->lba_first_sector = ZRAM_LBA_START;
+  out->sector_count = zram.pages * ZRAM_PAGE_SECTORS;
+
+  uint8_t *sector = (uint8_t *)malloc(SECTOR_SIZE * 3);
+  zramBytes(sector, 0, 3, false);
+  if (sector[66] == 0x28 || sector[66] == 0x29)
+    out->type = 0x0c; // FAT32 (LBA)
+  else if (*(uint16_t *)(&sector[1024 + 56]) == 0xef53)
+    out->type = 0x83; // ext2 (superblock magic)
+  free(sector);
+
+  return out->type;
+}
+
+// Either a filesystem or swap can live on it, not both
+bool zramClaim() {
+  return !__atomic_exchange_n(&zram.claimed, true, __ATOMIC_SEQ_CST);
+}
+
+void zramUnclaim() { __atomic_store_n(&zram.claimed, false, __ATOMIC_SEQ_CST); }
+
+// Same layout as Linux's /sys/block/zram0/mm_stat
+size_t zramMmStat(char *out, size_t limit) {
+  size_t tableBytes =
+      DivRoundUp(zram.pages * sizeof(ZramPage), PAGE_SIZE) * PAGE_SIZE;
+  size_t len = snprintf(out, limit, "%8ld %8ld %8ld %8d %8ld %8ld %8d %8ld\n",
+                        zram.origBytes, zram.comprBytes,
+                        zram.memUsed + tableBytes, 0,
+                        zram.memUsedMax + tableBytes, zram.zeroPages, 0,
+                        zram.rawPages);
+  return len < limit ? len : limit - 1;
+}
+
+/* /dev/zram0 */
+
+static int zramUserRead(OpenFile *fd, uint8_t *out, size_t limit) {
+  size_t done = zramAccess(out, fd->pointer, limit, false);
+  fd->pointer += done;
+  return done;
+}
+
+static int zramUserWrite(OpenFile *fd, uint8_t *in, size_t limit) {
+  size_t done = zramAccess(in, fd->pointer, limit, true);
+  if (!done && limit)
+    return -ENOSPC;
+  fd->pointer += done;
+  return done;
+}
+
+static size_t zramUserSeek(OpenFile *fd, size_t target, long int offset,
+                           int whence) {
+  fd->pointer = target;
+  return fd->pointer;
+}
+
+static size_t zramUserGetFilesize(OpenFile *fd) {
+  return zram.pages * PAGE_SIZE;
+}
+
+// Goes straight to the sector window, so swapon() can use it like a file
+static size_t zramUserBmap(OpenFile *fd, size_t offset) {
+  if (offset >= zram.pages * PAGE_SIZE)
+    return 0;
+  return ZRAM_LBA_START + offset / SECTOR_SIZE;
+}
+
+static int zramUserStat(OpenFile *fd, stat *target) {
+  memset(target, 0, sizeof(stat));
+  target->st_dev = 70;
+  target->st_ino = (size_t)&zram;
+  target->st_mode = S_IFBLK | S_IRUSR | S_IWUSR;
+  target->st_nlink = 1;
+  target->st_rdev = 0xfb00; // zram's major (251)
+  target->st_blksize = PAGE_SIZE;
+  target->st_size = zram.pages * PAGE_SIZE;
+  target->st_blocks = zram.comprBytes / 512;
+
+  return 0;
+}
+
+VfsHandlers zramHandlers = {.read = zramUserRead,
+                            .write = zramUserWrite,
+                            .seek = zramUserSeek,
+                            .stat = zramUserStat,
+                            .getFilesize = zramUserGetFilesize,
+                            .bmap = zramUserBmap,
+                            .duplicate = 0,
+                            .ioctl = 0,
+                            .mmap = 0,
+                            .getdents64 = 0};
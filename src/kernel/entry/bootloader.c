@@ -19,8 +19,9 @@ static volatile struct limine_hhdm_request limineHHDMreq = {
 static volatile struct limine_memmap_request limineMMreq = {
     .id = LIMINE_MEMMAP_REQUEST, .revision = 0};
 
-// static volatile struct limine_smp_request limineSmpReq = {
-//     .id = LIMINE_SMP_REQUEST, .revision = 0};
+// xAPIC mode (no flags), see apic.c
+static volatile struct limine_smp_request limineSmpReq = {
+    .id = LIMINE_SMP_REQUEST, .revision = 0, .flags = 0};
 
 void initialiseBootloaderParser() {
   // Paging mode
@@ -54,10 +55,6 @@ void initialiseBootloaderParser() {
       bootloader.mmTotal += entry->length;
   }
 
-  // SMP
-  // struct limine_smp_response *smp_response = limineSmpReq.response;
-
-  // for (int i = 0; i < smp_response->cpu_count; i++) {
-  //   struct limine_smp_info *entry = smp_response->cpus[i];
-  // }
+  // SMP (APs are parked until initiateSmp() sends them off)
+  bootloader.smp = limineSmpReq.response;
 }
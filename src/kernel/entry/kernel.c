@@ -12,9 +12,11 @@
 #include <kernel_helper.h>
 #include <limine.h>
 #include <malloc.h>
+#include <malloc_glue.h>
 #include <md5.h>
 #include <mouse.h>
 #include <nic_controller.h>
+#include <page_cache.h>
 #include <paging.h>
 #include <pci.h>
 #include <pmm.h>
@@ -22,7 +24,9 @@
 #include <rtc.h>
 #include <serial.h>
 #include <shell.h>
+#include <smp.h>
 #include <string.h>
+#include <swap.h>
 #include <sys.h>
 #include <syscalls.h>
 #include <system.h>
@@ -32,6 +36,7 @@
 #include <util.h>
 #include <vga.h>
 #include <vmm.h>
+#include <zram.h>
 
 // Kernel entry file
 // Copyright (C) 2024 Panagiotis
@@ -51,13 +56,14 @@ void _start(void) {
   initiateConsole();
   clearScreen();
 
-  // None of the two depend on paging
+  // Doesn't depend on paging
   initiatePMM();
-  initiateVMM();
 
   initiateGDT();
   initiateISR();
   initiatePaging();
+  initiateKernelHeap();
+  initiateVMM();
 
   initiateKb();
   initiateMouse();
@@ -69,11 +75,14 @@ void _start(void) {
   initiateKernelThreads();
   initiateNetworking();
   initiatePCI();
+  initiateZram();
+  initiatePageCache();
   firstMountPoint = 0;
   fsMount("/", CONNECTOR_AHCI, 0, 1);
   fsMount("/boot/", CONNECTOR_AHCI, 0, 0);
   fsMount("/dev/", CONNECTOR_DEV, 0, 0);
   fsMount("/sys/", CONNECTOR_SYS, 0, 0);
+  initiateSwap();
 
   // just in case there's another font preference
   psfLoadFromFile(DEFAULT_FONT_PATH);
@@ -82,6 +91,7 @@ void _start(void) {
   initiateSyscalls();
 
   initiateSSE();
+  initiateSmp();
   // initiateTasks();
 
   testingInit();
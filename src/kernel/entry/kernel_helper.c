@@ -1,5 +1,7 @@
 #include <kernel_helper.h>
 #include <nic_controller.h>
+#include <pmm.h>
+#include <shrinker.h>
 #include <system.h>
 #include <task.h>
 #include <types.h>
@@ -29,7 +31,58 @@ void netHelperEntry() {
   }
 }
 
+// Keeps the pmm's pool of zeroed frames topped up. The scheduler only wakes it
+// up when there's nothing else to run (see schedule()), so it never gets in
+// anybody's way.
+Task *zeroHelperTask = 0;
+
+void zeroHelperEntry() {
+  while (true) {
+    PhysicalZeroPoolFill(ZERO_HELPER_BATCH);
+
+    zeroHelperTask->state = TASK_STATE_IDLE;
+    while (zeroHelperTask->state == TASK_STATE_IDLE)
+      handControl();
+  }
+}
+
+// Frees dead tasks (stacks, structs, etc) once they're off the CPU, woken up by
+// taskKillCleanup() right after the switch away from them
+Task *reaperHelperTask = 0;
+
+void reaperHelperEntry() {
+  while (true) {
+    taskReap();
+
+    reaperHelperTask->state = TASK_STATE_IDLE;
+    // anything queued before we went idle wouldn't have woken us up
+    if (__atomic_load_n(&firstDeadTask, __ATOMIC_ACQUIRE)) {
+      reaperHelperTask->state = TASK_STATE_READY;
+      continue;
+    }
+    while (reaperHelperTask->state == TASK_STATE_IDLE)
+      handControl();
+  }
+}
+
+// Shrinks caches & evicts pages to swap whenever free memory runs low, woken up
+// by the pmm (see ReclaimWake()) & by allocations waiting on it
+Task *reclaimHelperTask = 0;
+
+void reclaimHelperEntry() {
+  while (true) {
+    ReclaimRound();
+
+    reclaimHelperTask->state = TASK_STATE_IDLE;
+    while (reclaimHelperTask->state == TASK_STATE_IDLE)
+      handControl();
+  }
+}
+
 void initiateKernelThreads() {
   // a
   netHelperTask = taskCreateKernel((size_t)netHelperEntry, 0);
+  zeroHelperTask = taskCreateKernel((size_t)zeroHelperEntry, 0);
+  reaperHelperTask = taskCreateKernel((size_t)reaperHelperEntry, 0);
+  reclaimHelperTask = taskCreateKernel((size_t)reclaimHelperEntry, 0);
 }
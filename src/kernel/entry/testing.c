@@ -5,8 +5,12 @@
 #include <malloc.h>
 #include <md5.h>
 #include <ne2k.h>
+#include <paging.h>
 #include <pci.h>
+#include <pmm.h>
+#include <smp.h>
 #include <socket.h>
+#include <stack.h>
 #include <string.h>
 #include <system.h>
 #include <task.h>
@@ -24,6 +28,109 @@
 
 extern void weirdTests();
 
+#define TESTING_PMM_BENCHMARK 0
+#define TESTING_PMM_ITERATIONS 256
+
+// Cycles per PhysicalAllocate()/PhysicalFree() for a given order. Never holds
+// more than a quarter of what's free, so it can't push the pmm into reclaim.
+void testingPmmBenchmarkOrder(int order) {
+  size_t pages = 1 << order;
+  size_t iterations = physical.freeBlocks / 4 / pages;
+  if (iterations > TESTING_PMM_ITERATIONS)
+    iterations = TESTING_PMM_ITERATIONS;
+  if (!iterations)
+    return;
+  size_t *phys = (size_t *)malloc(iterations * sizeof(size_t));
+
+  uint64_t start = rdtsc();
+  for (size_t i = 0; i < iterations; i++)
+    phys[i] = PhysicalAllocate(pages);
+  uint64_t allocCycles = rdtsc() - start;
+
+  start = rdtsc();
+  for (size_t i = 0; i < iterations; i++)
+    PhysicalFree(phys[i], pages);
+  uint64_t freeCycles = rdtsc() - start;
+
+  debugf("[testing::pmm] order{%d} alloc{%ld cycles} free{%ld cycles}\n", order,
+         allocCycles / iterations, freeCycles / iterations);
+  free(phys);
+}
+
+void testingPmmBenchmark() {
+  testingPmmBenchmarkOrder(0);
+  testingPmmBenchmarkOrder(4);
+  testingPmmBenchmarkOrder(9);
+}
+
+// Flips PCIDs & global pages for everyone while it runs, so it's only meant
+// for boots where nothing else is going on
+#define TESTING_SWITCH_BENCHMARK 0
+#define TESTING_SWITCH_ITERATIONS 1024
+#define TESTING_SWITCH_PAGES 32
+#define TESTING_SWITCH_BUFFER 0x200000000000 // private (non-global) pages
+
+volatile uint64_t testingSwitchTurn = 0;
+volatile uint64_t testingSwitchDone = 0;
+
+// One side of the ping-pong, running in its own address space: waits for its
+// turn, touches its working set & hands the turn over to the other side
+void testingSwitchEntry(uint64_t side) {
+  size_t phys = PhysicalAllocate(TESTING_SWITCH_PAGES);
+  for (int i = 0; i < TESTING_SWITCH_PAGES; i++)
+    VirtualMap(TESTING_SWITCH_BUFFER + i * PAGE_SIZE, phys + i * PAGE_SIZE,
+               PF_RW | PF_USER);
+
+  for (int i = 0; i < TESTING_SWITCH_ITERATIONS; i++) {
+    while (testingSwitchTurn != side)
+      handControl();
+    for (int j = 0; j < TESTING_SWITCH_PAGES; j++)
+      ((volatile uint8_t *)TESTING_SWITCH_BUFFER)[j * PAGE_SIZE]++;
+    testingSwitchTurn = !side;
+  }
+
+  VirtualUnmapL(GetPageDirectory(), TESTING_SWITCH_BUFFER, TESTING_SWITCH_PAGES,
+                false);
+  PhysicalFree(phys, TESTING_SWITCH_PAGES);
+
+  __atomic_add_fetch(&testingSwitchDone, 1, __ATOMIC_SEQ_CST);
+  taskKill(currentTask->id, 0);
+}
+
+// Both sides go on the same cpu, so it's the switch that's being measured and
+// not two cpus polling each other
+static void testingSwitchSpawn(uint64_t side, uint64_t affinity) {
+  Task *task = taskCreate(taskGenerateId(), (size_t)testingSwitchEntry, true,
+                          PageDirectoryAllocate(), 0, 0);
+  stackGenerateKernel(task, side);
+  task->affinity = affinity;
+  taskCreateFinish(task);
+}
+
+// Cycles per round trip between two address spaces, with & without PCIDs and
+// global kernel pages
+void testingSwitchBenchmarkRun(bool tagging) {
+  PagingTlbTagging(tagging);
+  testingSwitchTurn = 0;
+  testingSwitchDone = 0;
+
+  uint64_t affinity = 1ULL << cpuSelf()->id;
+  uint64_t start = rdtsc();
+  testingSwitchSpawn(0, affinity);
+  testingSwitchSpawn(1, affinity);
+  while (testingSwitchDone < 2)
+    handControl();
+  uint64_t cycles = rdtsc() - start;
+
+  debugf("[testing::switch] pcid{%d} tagging{%d} round trip{%ld cycles}\n",
+         pagingPcid, tagging, cycles / TESTING_SWITCH_ITERATIONS);
+}
+
+void testingSwitchBenchmark() {
+  testingSwitchBenchmarkRun(false);
+  testingSwitchBenchmarkRun(true);
+}
+
 // char *argv[] = {"/doom", "-iwad", "/DOOM.WAD"};
 // char *argv[] = {"/usr/bin/busybox", "sh"};
 // char *argv[] = {"/usr/bin/bash"};
@@ -31,6 +138,12 @@ extern void weirdTests();
 // char *argv[] = {"/a.out"};
 // char *argv[] = {"/usr/bin/doom", "-iwad", "/usr/bin/doom.wad"};
 void testingInit() {
+#if TESTING_PMM_BENCHMARK
+  testingPmmBenchmark();
+#endif
+#if TESTING_SWITCH_BENCHMARK
+  testingSwitchBenchmark();
+#endif
   // netSocketConnect(selectedNIC, SOCKET_PROT_UDP, (uint8_t[]){10, 0, 2, 15},
   //                   5643, 69);
   // weirdTests();
@@ -1,6 +1,7 @@
 #include <dev.h>
 #include <malloc.h>
 #include <util.h>
+#include <zram.h>
 
 #include <fb.h>
 #include <syscalls.h>
@@ -20,6 +21,15 @@ void devSetup() {
                 S_IFCHR | S_IRUSR | S_IWUSR, &fb0);
   fakefsAddFile(&rootDev, rootDev.rootFile, "null", 0,
                 S_IFCHR | S_IRUSR | S_IWUSR, &handleNull);
+  fakefsAddFile(&rootDev, rootDev.rootFile, "zram0", 0,
+                S_IFBLK | S_IRUSR | S_IWUSR, &zramHandlers);
+
+  // shm_open() objects, any name goes (see shmem.c)
+  FakefsFile *shm =
+      fakefsAddFile(&rootDev, rootDev.rootFile, "shm", 0,
+                    S_IFDIR | S_IRUSR | S_IWUSR | S_IXUSR, &fakefsRootHandlers);
+  fakefsAddFile(&rootDev, shm, "*", 0, S_IFREG | S_IRUSR | S_IWUSR,
+                &shmemHandlers);
 }
 
 bool devMount(MountPoint *mount) {
@@ -1,12 +1,33 @@
 #include <bootloader.h>
 #include <ext2.h>
 #include <malloc.h>
+#include <page_cache.h>
 #include <paging.h>
+#include <slab.h>
 #include <string.h>
 #include <system.h>
 #include <task.h>
 #include <timer.h>
 #include <util.h>
+#include <vmm.h>
+
+SlabCache slabExt2OpenFd = SLAB_CACHE_INIT("ext2_open_fd", Ext2OpenFd, 0);
+
+// Small ones stay on the heap: vmalloc populates fresh frames every time & its
+// frees shoot every cpu's TLB down. Big ones don't make the heap find (& keep
+// around) that much in a row.
+static void *ext2TmpAllocate(size_t size) {
+  if (size > EXT2_TMP_VMALLOC)
+    return VmallocAllocate(DivRoundUp(size, PAGE_SIZE));
+  return malloc(size);
+}
+
+static void ext2TmpFree(void *ptr, size_t size) {
+  if (size > EXT2_TMP_VMALLOC)
+    VmallocFree(ptr, DivRoundUp(size, PAGE_SIZE));
+  else
+    free(ptr);
+}
 
 bool ext2Mount(MountPoint *mount) {
   // assign handlers
@@ -162,10 +183,14 @@ int ext2Open(char *filename, int flags, int mode, OpenFile *fd,
     inodeFetched->num_sectors = 0;
 
     ext2InodeModifyM(ext2, inode, inodeFetched);
+
+    // nothing that was cached is part of the file anymore
+    PageCache *cache = PageCacheFind(fd->mountPoint, inode);
+    if (cache)
+      PageCacheTruncate(cache, 0);
   }
 
-  Ext2OpenFd *dir = (Ext2OpenFd *)malloc(sizeof(Ext2OpenFd));
-  memset(dir, 0, sizeof(Ext2OpenFd));
+  Ext2OpenFd *dir = (Ext2OpenFd *)SlabAllocateZero(&slabExt2OpenFd);
   fd->dir = dir;
 
   dir->inodeNum = inode;
@@ -202,7 +227,8 @@ int ext2Read(OpenFile *fd, uint8_t *buff, size_t naiveLimit) {
   uint32_t *blocks =
       ext2BlockChain(ext2, dir, dir->ptr / ext2->blockSize, blocksRequired);
 
-  uint8_t *tmp = (uint8_t *)calloc((blocksRequired + 1) * ext2->blockSize, 1);
+  size_t   tmpSize = (blocksRequired + 1) * ext2->blockSize;
+  uint8_t *tmp = (uint8_t *)ext2TmpAllocate(tmpSize);
   int      currBlock = 0;
 
   // optimization: we can use consecutive sectors to make our life easier
@@ -260,7 +286,7 @@ int ext2Read(OpenFile *fd, uint8_t *buff, size_t naiveLimit) {
 
   // cleanup
   free(blocks);
-  free(tmp);
+  ext2TmpFree(tmp, tmpSize);
 
   // debugf("[fd:%d id:%d] read %d bytes\n", fd->id, currentTask->id, curr);
   // debugf("%d / %d\n", dir->ptr, dir->inode.size);
@@ -278,6 +304,7 @@ int ext2Write(OpenFile *fd, uint8_t *buff, size_t limit) {
     appendCursor = dir->ptr;
     dir->ptr = COMBINE_64(dir->inode.size_high, dir->inode.size);
   }
+  size_t writeOffset = dir->ptr;
 
   int ptrIgnoredBlocks = dir->ptr / ext2->blockSize;
   int ptrIgnoredBytes = dir->ptr % ext2->blockSize;
@@ -332,7 +359,8 @@ int ext2Write(OpenFile *fd, uint8_t *buff, size_t limit) {
       }
     }
 
-    uint8_t *tmp = (uint8_t *)calloc((blocksRequired + 1) * ext2->blockSize, 1);
+    size_t   tmpSize = (blocksRequired + 1) * ext2->blockSize;
+    uint8_t *tmp = (uint8_t *)ext2TmpAllocate(tmpSize);
 
     // our first block will have junk data in the start!
     getDiskBytes(tmp, BLOCK_TO_LBA(ext2, 0, blocks[0]),
@@ -398,7 +426,7 @@ int ext2Write(OpenFile *fd, uint8_t *buff, size_t limit) {
 
     // cleanup
     free(blocks);
-    free(tmp);
+    ext2TmpFree(tmp, tmpSize);
   }
 
   if (dir->ptr > dir->inode.size) {
@@ -413,6 +441,11 @@ int ext2Write(OpenFile *fd, uint8_t *buff, size_t limit) {
 
   spinlockRelease(&ext2->LOCK_WRITE);
 
+  // anyone who has the file mmap()'d has to see this as well
+  PageCache *cache = PageCacheFind(fd->mountPoint, dir->inodeNum);
+  if (cache)
+    PageCacheUpdate(cache, writeOffset, buff, limit);
+
   // debugf("[fd:%d id:%d] read %d bytes\n", fd->id, currentTask->id, curr);
   // debugf("%d / %d\n", dir->ptr, dir->inode.size);
   return limit;
@@ -461,6 +494,25 @@ size_t ext2GetFilesize(OpenFile *fd) {
   return COMBINE_64(dir->inode.size_high, dir->inode.size);
 }
 
+size_t ext2Bmap(OpenFile *fd, size_t offset) {
+  Ext2       *ext2 = EXT2_PTR(fd->mountPoint->fsInfo);
+  Ext2OpenFd *dir = EXT2_DIR_PTR(fd->dir);
+  if (offset >= ext2GetFilesize(fd))
+    return 0;
+
+  uint32_t block = ext2BlockFetch(ext2, &dir->inode, &dir->lookup,
+                                  offset / ext2->blockSize);
+  if (!block)
+    return 0;
+  return BLOCK_TO_LBA(ext2, 0, block) +
+         (offset % ext2->blockSize) / SECTOR_SIZE;
+}
+
+struct PageCache *ext2PageCache(OpenFile *fd) {
+  Ext2OpenFd *dir = EXT2_DIR_PTR(fd->dir);
+  return PageCacheGet(fd->mountPoint, dir->inodeNum);
+}
+
 void ext2StatInternal(Ext2 *ext2, Ext2Inode *inode, uint32_t inodeNum,
                       struct stat *target) {
   target->st_dev = 69; // todo
@@ -572,12 +624,12 @@ bool ext2Close(OpenFile *fd) {
 
   ext2BlockFetchCleanup(&dir->lookup);
 
-  free(fd->dir);
+  SlabFree(&slabExt2OpenFd, fd->dir);
   return true;
 }
 
 bool ext2DuplicateNodeUnsafe(OpenFile *original, OpenFile *orphan) {
-  orphan->dir = malloc(sizeof(Ext2OpenFd));
+  orphan->dir = SlabAllocate(&slabExt2OpenFd);
   memcpy(orphan->dir, original->dir, sizeof(Ext2OpenFd));
 
   Ext2       *ext2 = EXT2_PTR(orphan->mountPoint->fsInfo);
@@ -606,53 +658,19 @@ bool ext2DuplicateNodeUnsafe(OpenFile *original, OpenFile *orphan) {
 // task is taken into account
 size_t ext2Mmap(size_t addr, size_t length, int prot, int flags, OpenFile *fd,
                 size_t pgoffset) {
-  if (!(flags & MAP_PRIVATE)) {
-    debugf("[ext2::mmap] Unsupported flags! flags{%x}\n", flags);
-    return -ENOSYS;
-  }
-
-  // if (prot & PROT_WRITE && !(fd->flags & O_WRONLY || fd->flags & O_RDWR))
-  //   return -EACCES;
-
-  uint64_t mappingFlags = PF_USER;
-  if (prot & PROT_WRITE)
-    mappingFlags |= PF_RW;
-  // read & execute don't have to be specified..
-
-  int pages = DivRoundUp(length, PAGE_SIZE);
-
-  size_t virt = 0;
-  if (!(flags & MAP_FIXED)) {
-    virt = currentTask->mmap_end;
-    currentTask->mmap_end += pages * PAGE_SIZE;
-  } else {
-    virt = addr;
-    if (virt > bootloader.hhdmOffset &&
-        virt < (bootloader.hhdmOffset + bootloader.mmTotal))
+  if (flags & MAP_FIXED) {
+    if (addr > bootloader.hhdmOffset &&
+        addr < (bootloader.hhdmOffset + bootloader.mmTotal))
       return -EACCES;
-    else if (virt > bootloader.kernelVirtBase &&
-             virt < bootloader.kernelVirtBase + 268435456) {
+    else if (addr > bootloader.kernelVirtBase &&
+             addr < bootloader.kernelVirtBase + 268435456) {
       return -EACCES;
     }
   }
 
-  // allocate physical space required
-  size_t phys = PhysicalAllocate(pages);
-  size_t hhdmAddition = bootloader.hhdmOffset + phys;
-
-  // now access it properly (via the HHDM, obviously)
-  for (int i = 0; i < pages; i++)
-    VirtualMap(virt + i * PAGE_SIZE, phys + i * PAGE_SIZE, mappingFlags);
-  memset((void *)(hhdmAddition), 0, pages * PAGE_SIZE);
-
-  // do the read
-  Ext2OpenFd *dir = EXT2_DIR_PTR(fd->dir);
-  size_t      oldPtr = dir->ptr;
-  dir->ptr = pgoffset;
-  ext2Read(fd, (void *)hhdmAddition, length);
-  dir->ptr = oldPtr;
-
-  return virt;
+  // pages get read in (& shared) through the page cache, once touched
+  return PageCacheMmap(addr, length, prot, flags, fd, pgoffset,
+                       ext2PageCache(fd));
 }
 
 VfsHandlers ext2Handlers = {.open = ext2Open,
@@ -664,4 +682,6 @@ VfsHandlers ext2Handlers = {.open = ext2Open,
                             .getdents64 = ext2Getdents64,
                             .seek = ext2Seek,
                             .getFilesize = ext2GetFilesize,
+                            .bmap = ext2Bmap,
+                            .pageCache = ext2PageCache,
                             .mmap = ext2Mmap};
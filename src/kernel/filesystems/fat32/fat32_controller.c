@@ -1,6 +1,7 @@
 #include <disk.h>
 #include <fat32.h>
 #include <malloc.h>
+#include <shrinker.h>
 #include <string.h>
 #include <system.h>
 #include <timer.h>
@@ -34,7 +35,9 @@ bool fat32Mount(MountPoint *mount) {
   if (fat->bootsec.bytes_per_sector != SECTOR_SIZE) {
     debugf("[fat32] What kind of devil-made FAT partition doesn't have 512 "
            "bytes / sector?\n");
-    panic();
+    free(mount->fsInfo);
+    mount->fsInfo = 0;
+    return false;
   }
 
   // setup some other offsets so it's easier later
@@ -43,11 +46,10 @@ bool fat32Mount(MountPoint *mount) {
       fat->offsetFats +
       fat->bootsec.table_count * fat->bootsec.extended_section.table_size_32;
 
-  for (int i = 0; i < FAT32_CACHE_MAX; i++) {
+  for (int i = 0; i < FAT32_CACHE_MAX; i++)
     fat->cacheBase[i] = FAT32_CACHE_BAD;
-    fat->cache[i] = malloc(LBA_TO_OFFSET(fat->bootsec.sectors_per_cluster));
-    memset(fat->cache[i], 0, LBA_TO_OFFSET(fat->bootsec.sectors_per_cluster));
-  }
+  ShrinkerRegister("fat32_fat_cache", SHRINKER_PRIORITY_FS, fat32FATcacheCount,
+                   fat32FATcacheShrink, fat);
 
   // done :")
   return true;
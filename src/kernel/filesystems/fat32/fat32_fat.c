@@ -3,7 +3,8 @@
 #include <system.h>
 #include <util.h>
 
-uint32_t fat32FATcacheLookup(FAT32 *fat, uint32_t offset) {
+// Called with the cache lock held
+static uint32_t fat32FATcacheLookup(FAT32 *fat, uint32_t offset) {
   for (int i = 0; i < FAT32_CACHE_MAX; i++) {
     if (fat->cacheBase[i] == offset)
       return i;
@@ -12,24 +13,81 @@ uint32_t fat32FATcacheLookup(FAT32 *fat, uint32_t offset) {
   return FAT32_CACHE_BAD;
 }
 
-void fat32FATcacheAdd(FAT32 *fat, uint32_t offset, uint8_t *bytes) {
+// The slot's sector is taken out while being filled in, so nothing gets
+// allocated with the lock held (the shrinker needs it)
+static void fat32FATcacheAdd(FAT32 *fat, uint32_t offset, uint8_t *bytes) {
+  spinlockAcquire(&fat->LOCK_CACHE);
   if (fat->cacheCurr >= FAT32_CACHE_MAX)
     fat->cacheCurr = 0;
-  fat->cacheBase[fat->cacheCurr] = offset;
-  memcpy(fat->cache[fat->cacheCurr], bytes, SECTOR_SIZE);
-  fat->cacheCurr++;
+  int      curr = fat->cacheCurr++;
+  uint8_t *sector = fat->cache[curr];
+  fat->cache[curr] = 0;
+  fat->cacheBase[curr] = FAT32_CACHE_BAD;
+  spinlockRelease(&fat->LOCK_CACHE);
+
+  if (!sector)
+    sector = (uint8_t *)malloc(SECTOR_SIZE);
+  memcpy(sector, bytes, SECTOR_SIZE);
+
+  spinlockAcquire(&fat->LOCK_CACHE);
+  if (!fat->cache[curr]) {
+    fat->cache[curr] = sector;
+    fat->cacheBase[curr] = offset;
+    sector = 0;
+  }
+  spinlockRelease(&fat->LOCK_CACHE);
+
+  free(sector);
 }
 
 void fat32FATfetch(FAT32 *fat, uint32_t offsetSector, uint8_t *bytes) {
+  spinlockAcquire(&fat->LOCK_CACHE);
   uint32_t cacheRes = fat32FATcacheLookup(fat, offsetSector);
   if (cacheRes != FAT32_CACHE_BAD) {
     memcpy(bytes, fat->cache[cacheRes], SECTOR_SIZE);
+    spinlockRelease(&fat->LOCK_CACHE);
     return;
   }
+  spinlockRelease(&fat->LOCK_CACHE);
+
   getDiskBytes(bytes, offsetSector, 1);
   fat32FATcacheAdd(fat, offsetSector, bytes);
 }
 
+/* Shrinker (see shrinker.c) */
+
+size_t fat32FATcacheCount(void *ctx) {
+  FAT32 *fat = FAT_PTR(ctx);
+  size_t cnt = 0;
+  for (int i = 0; i < FAT32_CACHE_MAX; i++) {
+    if (fat->cache[i])
+      cnt++;
+  }
+
+  return cnt;
+}
+
+// Oldest sectors go first, those are the next ones to be overwritten anyway
+size_t fat32FATcacheShrink(void *ctx, size_t target) {
+  FAT32 *fat = FAT_PTR(ctx);
+  size_t freed = 0;
+
+  spinlockAcquire(&fat->LOCK_CACHE);
+  for (int i = 0; i < FAT32_CACHE_MAX && freed < target; i++) {
+    int curr = (fat->cacheCurr + i) % FAT32_CACHE_MAX;
+    if (!fat->cache[curr])
+      continue;
+
+    free(fat->cache[curr]);
+    fat->cache[curr] = 0;
+    fat->cacheBase[curr] = FAT32_CACHE_BAD;
+    freed++;
+  }
+  spinlockRelease(&fat->LOCK_CACHE);
+
+  return freed;
+}
+
 uint32_t fat32FATtraverse(FAT32 *fat, uint32_t offset) {
   int bytesPerCluster = SECTOR_SIZE;
 
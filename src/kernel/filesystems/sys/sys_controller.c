@@ -1,7 +1,12 @@
 #include <malloc.h>
 #include <pci.h>
+#include <shrinker.h>
+#include <slab.h>
+#include <swap.h>
 #include <sys.h>
+#include <timer.h>
 #include <util.h>
+#include <zram.h>
 
 #include <fb.h>
 #include <syscalls.h>
@@ -115,6 +120,42 @@ void sysSetupPci(FakefsFile *devices) {
   free(out);
 }
 
+// Text files generated on every read (so the counters are always fresh) by
+// the function attached to them
+typedef size_t (*SysGenerator)(char *out, size_t limit);
+
+int sysGeneratedRead(OpenFile *fd, uint8_t *out, size_t limit) {
+  FakefsFile  *file = (FakefsFile *)fd->fakefs;
+  SysGenerator generator = (SysGenerator)file->extra;
+
+  char  *buff = (char *)malloc(4096);
+  size_t len = generator(buff, 4096);
+
+  int toCopy = 0;
+  if (fd->pointer < len)
+    toCopy = MIN(limit, len - fd->pointer);
+  memcpy(out, &buff[fd->pointer], toCopy);
+  fd->pointer += toCopy;
+
+  free(buff);
+  return toCopy;
+}
+
+size_t sysGeneratedSeek(OpenFile *fd, size_t target, long int offset,
+                        int whence) {
+  fd->pointer = target;
+  return 0;
+}
+
+VfsHandlers handleGenerated = {.read = sysGeneratedRead,
+                               .write = 0,
+                               .stat = fakefsFstat,
+                               .seek = sysGeneratedSeek,
+                               .duplicate = 0,
+                               .ioctl = 0,
+                               .mmap = 0,
+                               .getdents64 = 0};
+
 void sysSetup() {
   FakefsFile *bus =
       fakefsAddFile(&rootSys, rootSys.rootFile, "bus", 0,
@@ -127,6 +168,32 @@ void sysSetup() {
                     &fakefsRootHandlers);
 
   sysSetupPci(devices);
+
+  FakefsFile *kernel =
+      fakefsAddFile(&rootSys, rootSys.rootFile, "kernel", 0,
+                    S_IFDIR | S_IRUSR | S_IWUSR, &fakefsRootHandlers);
+  FakefsFile *slabinfo = fakefsAddFile(&rootSys, kernel, "slabinfo", 0,
+                                       S_IFREG | S_IRUSR, &handleGenerated);
+  fakefsAttachFile(slabinfo, (void *)SlabInfo, 4096);
+  FakefsFile *swapinfo = fakefsAddFile(&rootSys, kernel, "swapinfo", 0,
+                                       S_IFREG | S_IRUSR, &handleGenerated);
+  fakefsAttachFile(swapinfo, (void *)SwapInfo, 4096);
+  FakefsFile *shrinkers = fakefsAddFile(&rootSys, kernel, "shrinkers", 0,
+                                        S_IFREG | S_IRUSR, &handleGenerated);
+  fakefsAttachFile(shrinkers, (void *)ShrinkerInfo, 4096);
+  FakefsFile *timerinfo = fakefsAddFile(&rootSys, kernel, "timerinfo", 0,
+                                        S_IFREG | S_IRUSR, &handleGenerated);
+  fakefsAttachFile(timerinfo, (void *)timerInfo, 4096);
+
+  FakefsFile *block =
+      fakefsAddFile(&rootSys, rootSys.rootFile, "block", 0,
+                    S_IFDIR | S_IRUSR | S_IWUSR, &fakefsRootHandlers);
+  FakefsFile *zram0 =
+      fakefsAddFile(&rootSys, block, "zram0", 0, S_IFDIR | S_IRUSR | S_IWUSR,
+                    &fakefsRootHandlers);
+  FakefsFile *mmStat = fakefsAddFile(&rootSys, zram0, "mm_stat", 0,
+                                     S_IFREG | S_IRUSR, &handleGenerated);
+  fakefsAttachFile(mmStat, (void *)zramMmStat, 4096);
 }
 
 bool sysMount(MountPoint *mount) {
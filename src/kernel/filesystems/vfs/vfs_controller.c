@@ -3,6 +3,7 @@
 #include <fat32.h>
 #include <linked_list.h>
 #include <malloc.h>
+#include <slab.h>
 #include <string.h>
 #include <system.h>
 #include <task.h>
@@ -12,10 +13,12 @@
 // Simple VFS abstraction to manage filesystems
 // Copyright (C) 2024 Panagiotis
 
+SlabCache slabOpenFile = SLAB_CACHE_INIT("open_file", OpenFile, 0);
+
 OpenFile *fsRegisterNode(Task *task) {
+  OpenFile *ret = SlabAllocateZero(&slabOpenFile);
   spinlockCntWriteAcquire(&task->WLOCK_FILES);
-  OpenFile *ret =
-      LinkedListAllocate((void **)&task->firstFile, sizeof(OpenFile));
+  LinkedListAppend((void **)&task->firstFile, ret);
   spinlockCntWriteRelease(&task->WLOCK_FILES);
   return ret;
 }
@@ -47,7 +50,7 @@ OpenFile *fsOpenGeneric(char *filename, Task *task, int flags, int mode) {
   if (!mnt) {
     // no mountpoint for this
     fsUnregisterNode(task, target);
-    free(target);
+    SlabFree(&slabOpenFile, target);
     free(safeFilename);
     return 0;
   }
@@ -66,7 +69,7 @@ OpenFile *fsOpenGeneric(char *filename, Task *task, int flags, int mode) {
     if (ret < 0) {
       // failed to open
       fsUnregisterNode(task, target);
-      free(target);
+      SlabFree(&slabOpenFile, target);
       free(safeFilename);
 
       if (symlink && ret != -ELOOP) {
@@ -84,9 +87,24 @@ OpenFile *fsOpenGeneric(char *filename, Task *task, int flags, int mode) {
   return target;
 }
 
+// Handles that don't live on any mountpoint (shared memory objects & the like)
+// with the handlers & private data given. Without a task it's an orphan.
+OpenFile *fsUserOpenSpecial(void *task, VfsHandlers *handlers, void *dir,
+                            int flags) {
+  OpenFile *target = task ? fsRegisterNode((Task *)task)
+                          : (OpenFile *)SlabAllocateZero(&slabOpenFile);
+  if (task)
+    target->id = openId++;
+  target->flags = flags;
+  target->closeOnExec = !!(flags & O_CLOEXEC);
+  target->handlers = handlers;
+  target->dir = dir;
+  return target;
+}
+
 // returns an ORPHAN!
 OpenFile *fsUserDuplicateNodeUnsafe(OpenFile *original) {
-  OpenFile *orphan = (OpenFile *)malloc(sizeof(OpenFile));
+  OpenFile *orphan = (OpenFile *)SlabAllocate(&slabOpenFile);
   orphan->next = 0; // duh
 
   memcpy((void *)((size_t)orphan + sizeof(orphan->next)),
@@ -95,7 +113,7 @@ OpenFile *fsUserDuplicateNodeUnsafe(OpenFile *original) {
 
   if (original->handlers->duplicate &&
       !original->handlers->duplicate(original, orphan)) {
-    free(orphan);
+    SlabFree(&slabOpenFile, orphan);
     return 0;
   }
 
@@ -150,14 +168,19 @@ int fsUserOpen(void *task, char *filename, int flags, int mode) {
   return file->id;
 }
 
-bool fsCloseGeneric(OpenFile *file, Task *task) {
-  fsUnregisterNode(task, file);
-
+// For handles that were never part of a task's list (see
+// fsUserDuplicateNodeUnsafe())
+bool fsCloseOrphan(OpenFile *file) {
   bool res = file->handlers->close ? file->handlers->close(file) : true;
-  free(file);
+  SlabFree(&slabOpenFile, file);
   return res;
 }
 
+bool fsCloseGeneric(OpenFile *file, Task *task) {
+  fsUnregisterNode(task, file);
+  return fsCloseOrphan(file);
+}
+
 bool fsKernelClose(OpenFile *file) {
   Task *target = taskGet(KERNEL_TASK_ID);
   return fsCloseGeneric(file, target);
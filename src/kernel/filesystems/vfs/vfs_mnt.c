@@ -10,6 +10,7 @@
 #include <task.h>
 #include <util.h>
 #include <vfs.h>
+#include <zram.h>
 
 // Different mount point separation
 // Copyright (C) 2024 Panagiotis
@@ -45,11 +46,31 @@ bool isFat(mbr_partition *mbr) {
 
 bool isExt2(mbr_partition *mbr) { return mbr->type == 0x83; }
 
-// prefix MUST end with '/': /mnt/handle/
+// Whatever filesystem lives on the (already filled in) partition
+static bool fsMountPartition(MountPoint *mount) {
+  if (isFat(&mount->mbr)) {
+    mount->filesystem = FS_FATFS;
+    return fat32Mount(mount);
+  } else if (isExt2(&mount->mbr)) {
+    mount->filesystem = FS_EXT2;
+    return ext2Mount(mount);
+  }
+
+  return false;
+}
+
+// A mount that didn't go through, which was never listed to begin with
+static void fsMountAbort(MountPoint *mount) {
+  free(mount->prefix);
+  free(mount);
+}
+
+// prefix MUST end with '/': /mnt/handle/. Only listed once it's actually
+// mounted, failures just return 0.
 MountPoint *fsMount(char *prefix, CONNECTOR connector, uint32_t disk,
                     uint8_t partition) {
-  MountPoint *mount = (MountPoint *)LinkedListAllocate(
-      (void **)&firstMountPoint, sizeof(MountPoint));
+  MountPoint *mount = (MountPoint *)malloc(sizeof(MountPoint));
+  memset(mount, 0, sizeof(MountPoint));
 
   uint32_t strlen = strlength(prefix);
   mount->prefix = (char *)(malloc(strlen + 1));
@@ -64,17 +85,19 @@ MountPoint *fsMount(char *prefix, CONNECTOR connector, uint32_t disk,
   switch (connector) {
   case CONNECTOR_AHCI:
     if (!openDisk(disk, partition, &mount->mbr)) {
-      fsUnmount(mount);
+      fsMountAbort(mount);
       return 0;
     }
 
-    if (isFat(&mount->mbr)) {
-      mount->filesystem = FS_FATFS;
-      ret = fat32Mount(mount);
-    } else if (isExt2(&mount->mbr)) {
-      mount->filesystem = FS_EXT2;
-      ret = ext2Mount(mount);
+    ret = fsMountPartition(mount);
+    break;
+  case CONNECTOR_ZRAM:
+    if (!zramPartition(&mount->mbr)) {
+      fsMountAbort(mount);
+      return 0;
     }
+
+    ret = fsMountPartition(mount);
     break;
   case CONNECTOR_DEV:
     mount->filesystem = FS_DEV;
@@ -91,9 +114,10 @@ MountPoint *fsMount(char *prefix, CONNECTOR connector, uint32_t disk,
   }
 
   if (!ret) {
-    fsUnmount(mount);
+    fsMountAbort(mount);
     return 0;
   }
+  LinkedListAppend((void **)&firstMountPoint, mount);
 
   if (!systemDiskInit && strlength(prefix) == 1 && prefix[0] == '/')
     systemDiskInit = true;
@@ -0,0 +1,287 @@
+#include <bootloader.h>
+#include <linked_list.h>
+#include <linux.h>
+#include <malloc.h>
+#include <page_cache.h>
+#include <paging.h>
+#include <pmm.h>
+#include <shrinker.h>
+#include <system.h>
+#include <task.h>
+#include <util.h>
+#include <vma.h>
+
+// Per-inode page cache, backing file mmap()s so that every mapping of the same
+// file ends up on the very same frames
+// Copyright (C) 2024 Panagiotis
+
+#define PAGE_CACHE_DEBUG 0
+
+#define HHDMoffset (bootloader.hhdmOffset)
+
+static PageCache *PageCacheFindUnsafe(MountPoint *mnt, size_t inode) {
+  PageCache *browse = firstPageCache;
+  while (browse) {
+    if (browse->mnt == mnt && browse->inode == inode)
+      break;
+    browse = browse->next;
+  }
+  return browse;
+}
+
+PageCache *PageCacheFind(MountPoint *mnt, size_t inode) {
+  spinlockAcquire(&LOCK_PAGE_CACHES);
+  PageCache *cache = PageCacheFindUnsafe(mnt, inode);
+  spinlockRelease(&LOCK_PAGE_CACHES);
+
+  return cache;
+}
+
+// Looked up & created in one go, so concurrent mappings of the same inode can't
+// end up on caches of their own
+PageCache *PageCacheGet(MountPoint *mnt, size_t inode) {
+  spinlockAcquire(&LOCK_PAGE_CACHES);
+  PageCache *cache = PageCacheFindUnsafe(mnt, inode);
+  if (!cache) {
+    cache = LinkedListAllocate((void **)&firstPageCache, sizeof(PageCache));
+    cache->mnt = mnt;
+    cache->inode = inode;
+  }
+  spinlockRelease(&LOCK_PAGE_CACHES);
+
+  return cache;
+}
+
+// Unbacked (& unlisted) caches, owned by whoever allocates them
+PageCache *PageCacheAllocate() {
+  PageCache *cache = (PageCache *)malloc(sizeof(PageCache));
+  memset(cache, 0, sizeof(PageCache));
+  return cache;
+}
+
+// Programs keep running off the frames they were loaded from, so instead of
+// patching those in place the cache moves onto a copy of its own. Called with
+// the cache's lock held.
+static void PageCacheUnshareText(PageCachePage *page) {
+  if (!page->text || !PhysicalShared(page->phys))
+    return;
+
+  size_t phys = PhysicalAllocate(1);
+  memcpy((void *)(phys + HHDMoffset), (void *)(page->phys + HHDMoffset),
+         PAGE_SIZE);
+  PhysicalRelease(page->phys);
+  page->phys = phys;
+  page->text = false;
+}
+
+// Drops every page at or past size (in bytes), zeroing the tail of the last
+// one that's left. Mappings keep whatever frames they still reference.
+void PageCacheTruncate(PageCache *cache, size_t size) {
+  spinlockAcquire(&cache->LOCK);
+  PageCachePage *page =
+      (PageCachePage *)AvlCeiling(&cache->pages, DivRoundUp(size, PAGE_SIZE));
+  while (page) {
+    PageCachePage *next = (PageCachePage *)AvlNext(&cache->pages, &page->node);
+    AvlRemove(&cache->pages, &page->node);
+    PhysicalRelease(page->phys);
+    free(page);
+    page = next;
+  }
+
+  page = (PageCachePage *)AvlFind(&cache->pages, size / PAGE_SIZE);
+  if (page && size % PAGE_SIZE) {
+    PageCacheUnshareText(page);
+    memset((void *)(page->phys + HHDMoffset + size % PAGE_SIZE), 0,
+           PAGE_SIZE - size % PAGE_SIZE);
+  }
+  spinlockRelease(&cache->LOCK);
+}
+
+void PageCacheFree(PageCache *cache) {
+  PageCacheTruncate(cache, 0);
+  free(cache);
+}
+
+// Returns the frame holding the page, reading it off the file first if it's
+// not already here. Anything past the end of the file (or anything at all for
+// unbacked caches) is zeroes.
+size_t PageCacheFetch(PageCache *cache, OpenFile *file, size_t index) {
+  spinlockAcquire(&cache->LOCK);
+  PageCachePage *page = (PageCachePage *)AvlFind(&cache->pages, index);
+  if (page) {
+    spinlockRelease(&cache->LOCK);
+    return page->phys;
+  }
+
+  size_t phys = PhysicalAllocate(1);
+  memset((void *)(phys + HHDMoffset), 0, PAGE_SIZE);
+
+  size_t offset = index * PAGE_SIZE;
+  size_t filesize = cache->mnt ? fsGetFilesize(file) : 0;
+  if (offset < filesize) {
+    file->handlers->seek(file, offset, offset, SEEK_SET);
+    fsRead(file, (uint8_t *)(phys + HHDMoffset),
+           MIN(PAGE_SIZE, filesize - offset));
+  }
+
+  page = (PageCachePage *)malloc(sizeof(PageCachePage));
+  memset(page, 0, sizeof(PageCachePage));
+  page->phys = phys;
+  page->node.key = index;
+  AvlInsert(&cache->pages, &page->node);
+  spinlockRelease(&cache->LOCK);
+
+#if PAGE_CACHE_DEBUG
+  debugf("[page_cache] Read: inode{%ld} index{%ld} phys{%lx}\n", cache->inode,
+         index, phys);
+#endif
+  return phys;
+}
+
+// Same as PageCacheFetch(), but for mapping the page: the returned frame comes
+// with a reference of its own, taken before the page could be truncated (or
+// shrunk) away. Text is for pages mapped straight into programs (see elf.c).
+size_t PageCacheFetchShare(PageCache *cache, OpenFile *file, size_t index,
+                           bool text) {
+  while (true) {
+    PageCacheFetch(cache, file, index);
+
+    spinlockAcquire(&cache->LOCK);
+    PageCachePage *page = (PageCachePage *)AvlFind(&cache->pages, index);
+    if (page) {
+      page->text |= text;
+      PhysicalShare(page->phys);
+      size_t phys = page->phys;
+      spinlockRelease(&cache->LOCK);
+      return phys;
+    }
+    spinlockRelease(&cache->LOCK);
+  }
+}
+
+// Pushes a (MAP_SHARED) page back to the file, never growing it. The frame is
+// held onto through the write, as the page might get truncated away meanwhile.
+void PageCacheWriteback(PageCache *cache, OpenFile *file, size_t index) {
+  spinlockAcquire(&cache->LOCK);
+  PageCachePage *page = (PageCachePage *)AvlFind(&cache->pages, index);
+  size_t         phys = page ? page->phys : 0;
+  if (phys)
+    PhysicalShare(phys);
+  spinlockRelease(&cache->LOCK);
+  if (!phys)
+    return;
+
+  size_t offset = index * PAGE_SIZE;
+  size_t filesize = fsGetFilesize(file);
+  if (offset < filesize) {
+    file->handlers->seek(file, offset, offset, SEEK_SET);
+    fsWrite(file, (uint8_t *)(phys + HHDMoffset),
+            MIN(PAGE_SIZE, filesize - offset));
+  }
+  PhysicalRelease(phys);
+
+#if PAGE_CACHE_DEBUG
+  debugf("[page_cache] Wrote back: inode{%ld} index{%ld}\n", cache->inode,
+         index);
+#endif
+}
+
+// Pages nobody has mapped can simply be read back in later (shared mappings
+// are written back once they go away, see VmaSyncUnsafe()). Unbacked caches
+// aren't listed, being the only copy of their contents. Locks are only ever
+// tried, as allocations happen with either of them held.
+static size_t PageCacheShrinkWalk(size_t target, bool drop) {
+  size_t cnt = 0;
+  if (!spinlockTryAcquire(&LOCK_PAGE_CACHES))
+    return 0;
+
+  for (PageCache *cache = firstPageCache; cache && cnt < target;
+       cache = cache->next) {
+    if (!cache->mnt || !spinlockTryAcquire(&cache->LOCK))
+      continue;
+
+    PageCachePage *page = (PageCachePage *)AvlFirst(&cache->pages);
+    while (page && cnt < target) {
+      PageCachePage *next =
+          (PageCachePage *)AvlNext(&cache->pages, &page->node);
+      if (!PhysicalShared(page->phys)) {
+        if (drop) {
+          AvlRemove(&cache->pages, &page->node);
+          PhysicalRelease(page->phys);
+          free(page);
+        }
+        cnt++;
+      }
+      page = next;
+    }
+    spinlockRelease(&cache->LOCK);
+  }
+  spinlockRelease(&LOCK_PAGE_CACHES);
+
+  return cnt;
+}
+
+static size_t PageCacheShrinkCount(void *ctx) {
+  return PageCacheShrinkWalk((size_t)-1, false);
+}
+
+static size_t PageCacheShrink(void *ctx, size_t target) {
+  return PageCacheShrinkWalk(target, true);
+}
+
+void initiatePageCache() {
+  ShrinkerRegister("page_cache", SHRINKER_PRIORITY_PAGE_CACHE,
+                   PageCacheShrinkCount, PageCacheShrink, 0);
+}
+
+// Regular write()s have to be reflected onto any cached pages
+void PageCacheUpdate(PageCache *cache, size_t offset, uint8_t *buff,
+                     size_t length) {
+  spinlockAcquire(&cache->LOCK);
+  size_t done = 0;
+  while (done < length) {
+    size_t index = (offset + done) / PAGE_SIZE;
+    size_t inner = (offset + done) % PAGE_SIZE;
+    size_t chunk = MIN(PAGE_SIZE - inner, length - done);
+
+    PageCachePage *page = (PageCachePage *)AvlFind(&cache->pages, index);
+    if (page) {
+      uint8_t *target = (uint8_t *)(page->phys + HHDMoffset + inner);
+      if (target != &buff[done]) { // writeback of the page itself
+        PageCacheUnshareText(page);
+        target = (uint8_t *)(page->phys + HHDMoffset + inner);
+        memcpy(target, &buff[done], chunk);
+      }
+    }
+
+    done += chunk;
+  }
+  spinlockRelease(&cache->LOCK);
+}
+
+// Generic mmap() handler for anything with a page cache: only the range is
+// reserved, pages get faulted in through the cache (see VmaHandleFault())
+size_t PageCacheMmap(size_t addr, size_t length, int prot, int flags,
+                     OpenFile *fd, size_t pgoffset, PageCache *cache) {
+  if (!(flags & MAP_PRIVATE) && !(flags & MAP_SHARED))
+    return -EINVAL;
+  if (pgoffset % PAGE_SIZE)
+    return -EINVAL;
+  if (flags & MAP_SHARED && prot & PROT_WRITE && !(fd->flags & O_RDWR))
+    return -EACCES;
+
+  // the mapping outlives the file descriptor, so it keeps its own
+  OpenFile *orphan = fsUserDuplicateNodeUnsafe(fd);
+  if (!orphan)
+    return -ENOMEM;
+
+  size_t virt = VmaReserveFile(currentTask, addr, length, prot, flags, orphan,
+                               pgoffset, cache);
+  if (!virt) {
+    fsCloseOrphan(orphan);
+    return -ENOMEM;
+  }
+
+  VirtualMapDemand(virt, DivRoundUp(length, PAGE_SIZE), PF_USER | PF_FILE);
+  return virt;
+}
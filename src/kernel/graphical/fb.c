@@ -3,7 +3,9 @@
 #include <paging.h>
 #include <stdarg.h>
 #include <system.h>
+#include <task.h>
 #include <util.h>
+#include <vma.h>
 
 // System framebuffer manager
 // Copyright (C) 2024 Panagiotis
@@ -96,11 +98,31 @@ size_t fbUserMmap(size_t addr, size_t length, int prot, int flags, OpenFile *fd,
     length = framebufferWidth * framebufferHeight * 4;
   size_t targPages = DivRoundUp(length, PAGE_SIZE);
   size_t physStart = VirtualToPhysical((size_t)framebuffer);
-  for (int i = 0; i < targPages; i++) {
-    VirtualMap(0x150000000000 + i * PAGE_SIZE, physStart + i * PAGE_SIZE,
-               PF_RW | PF_USER | PF_CACHE_WC);
-  } // todo: get rid of hardcoded location!
-  return 0x150000000000;
+
+  size_t virt = VmaReserve(currentTask, addr, length, prot, flags, VMA_DEVICE);
+  if (!virt)
+    return -ENOMEM;
+
+  // whole 2MiB pages wherever both sides line up, saves a ton of TLB entries
+  size_t i = 0;
+  while (i < targPages) {
+    size_t xvirt = virt + i * PAGE_SIZE;
+    size_t xphys = physStart + i * PAGE_SIZE;
+    if (!(xvirt % PAGE_SIZE_LARGE) && !(xphys % PAGE_SIZE_LARGE) &&
+        (targPages - i) >= (PAGE_SIZE_LARGE / PAGE_SIZE) &&
+        VirtualMapLarge(xvirt, xphys, PF_RW | PF_USER | PF_CACHE_WC)) {
+      i += PAGE_SIZE_LARGE / PAGE_SIZE;
+      continue;
+    }
+
+    // the rest (up to the next 2MiB boundary) in one go
+    size_t run = (PAGE_SIZE_LARGE - xvirt % PAGE_SIZE_LARGE) / PAGE_SIZE;
+    run = MIN(run, targPages - i);
+    VirtualMapRangeL(currentTask->pagedir, xvirt, xphys, run,
+                     PF_RW | PF_USER | PF_CACHE_WC);
+    i += run;
+  }
+  return virt;
 }
 
 int fbUserStat(OpenFile *fd, stat *target) {
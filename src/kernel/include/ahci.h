@@ -543,7 +543,13 @@ typedef struct tagHBA_CMD_TBL {
   prdt_entry[1]; // Physical region descriptor table entries, 0 ~ 65535
 } HBA_CMD_TBL;
 
-#define AHCI_CALC_PRDT(sectors) (DivRoundUp((sectors) * 512, 4194304))
+// Every command slot gets a page-sized table, which leaves room for enough PRDT
+// entries to describe a buffer that's scattered all over physical memory
+#define AHCI_CMD_TABLE_SIZE 4096
+#define AHCI_PRDT_ENTRIES                                                      \
+  ((AHCI_CMD_TABLE_SIZE - 0x80) / sizeof(HBA_PRDT_ENTRY))
+#define AHCI_PRDT_MAX_BYTES 4194304 // 4 MiB (22 bit byte count)
+#define AHCI_MAX_SECTORS 65536      // 16 bit sector count (0 -> 65536)
 
 typedef enum {
   FIS_TYPE_REG_H2D = 0x27,   // Register FIS - host to device
@@ -0,0 +1,55 @@
+#include "types.h"
+
+#ifndef APIC_H
+#define APIC_H
+
+// Local APIC (xAPIC mode, reached through its MMIO page on the HHDM)
+#define MSRID_APIC_BASE 0x1B
+#define APIC_BASE_ENABLE (1 << 11)
+#define APIC_BASE_MASK 0xFFFFF000
+
+#define MSRID_TSC_DEADLINE 0x6E0
+
+// Registers (offsets in the MMIO page)
+#define APIC_REG_ID 0x20
+#define APIC_REG_TPR 0x80
+#define APIC_REG_EOI 0xB0
+#define APIC_REG_SPURIOUS 0xF0
+#define APIC_REG_ICR_LOW 0x300
+#define APIC_REG_ICR_HIGH 0x310
+#define APIC_REG_LVT_TIMER 0x320
+#define APIC_REG_TIMER_INITIAL 0x380
+#define APIC_REG_TIMER_CURRENT 0x390
+#define APIC_REG_TIMER_DIVIDE 0x3E0
+
+#define APIC_SOFTWARE_ENABLE (1 << 8)
+#define APIC_LVT_MASKED (1 << 16)
+#define APIC_TIMER_TSC_DEADLINE (2 << 17) // one-shot otherwise
+#define APIC_TIMER_DIVIDE_16 0x3
+#define APIC_ICR_PENDING (1 << 12)
+
+// Vectors, right past the (remapped) PIC's
+#define APIC_VECTOR_TIMER 48
+#define APIC_VECTOR_RESCHEDULE 49 // see scheduleWake()
+#define APIC_VECTOR_SHOOTDOWN 50  // see PagingShootdown()
+#define APIC_VECTOR_SPURIOUS 255
+
+// Timer ticks (PIT ones) the APIC timer is measured against
+#define APIC_CALIBRATE_MS 10
+
+// APIC timer counts (at APIC_TIMER_DIVIDE_16) per millisecond
+uint32_t apicTimerPerMs;
+
+// The timer is armed straight off the TSC (no counting down)
+bool apicTscDeadline;
+
+void     initiateApic();
+uint64_t apicCalibrate();
+uint32_t apicId();
+void     apicEoi();
+void     apicTimerStart();
+void     apicTimerArm(uint64_t deadline);
+void     apicTimerStop();
+void     apicIpi(uint32_t lapicId, uint8_t vector);
+
+#endif
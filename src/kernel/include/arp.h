@@ -39,4 +39,7 @@ void netArpHandle(NIC *nic, arpPacket *packet);
 
 void debugArpTable(NIC *nic);
 
+size_t netArpTableCount(void *ctx);
+size_t netArpTableShrink(void *ctx, size_t target);
+
 #endif
\ No newline at end of file
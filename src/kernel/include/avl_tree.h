@@ -0,0 +1,30 @@
+#include "types.h"
+
+#ifndef AVL_TREE_H
+#define AVL_TREE_H
+
+// Intrusive node, has to be embedded (preferably first) in the actual struct.
+// Keys are expected to be unique.
+typedef struct AvlNode AvlNode;
+struct AvlNode {
+  AvlNode *left;
+  AvlNode *right;
+  int      height;
+
+  size_t key;
+};
+
+typedef struct DS_AvlTree {
+  AvlNode *root;
+  size_t   count;
+} DS_AvlTree;
+
+void     AvlInsert(DS_AvlTree *tree, AvlNode *node);
+bool     AvlRemove(DS_AvlTree *tree, AvlNode *node);
+AvlNode *AvlFind(DS_AvlTree *tree, size_t key);
+AvlNode *AvlFloor(DS_AvlTree *tree, size_t key);
+AvlNode *AvlCeiling(DS_AvlTree *tree, size_t key);
+AvlNode *AvlFirst(DS_AvlTree *tree);
+AvlNode *AvlNext(DS_AvlTree *tree, AvlNode *node);
+
+#endif
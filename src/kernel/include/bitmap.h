@@ -37,6 +37,7 @@ void MarkBlocks(DS_Bitmap *bitmap, size_t start, size_t size, bool val);
 void MarkRegion(DS_Bitmap *bitmap, void *basePtr, size_t sizeBytes, int isUsed);
 size_t FindFreeRegion(DS_Bitmap *bitmap, size_t blocks);
 void  *BitmapAllocate(DS_Bitmap *bitmap, size_t blocks);
+void   BitmapFree(DS_Bitmap *bitmap, void *base, size_t blocks);
 
 size_t BitmapAllocatePageframe(DS_Bitmap *bitmap);
 void   BitmapFreePageframe(DS_Bitmap *bitmap, void *addr);
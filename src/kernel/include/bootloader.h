@@ -18,6 +18,9 @@ typedef struct Bootloader {
   size_t   mmTotal;
   uint64_t mmEntryCnt;
   LIMINE_PTR(struct limine_memmap_entry **) mmEntries;
+
+  // SMP info, null if the bootloader had none to give
+  LIMINE_PTR(struct limine_smp_response *) smp;
 } Bootloader;
 
 Bootloader bootloader;
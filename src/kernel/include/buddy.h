@@ -0,0 +1,43 @@
+#include "types.h"
+
+#ifndef BUDDY_H
+#define BUDDY_H
+
+// Orders 0 -> (BUDDY_MAX_ORDER - 1), meaning 4KiB -> 512MiB blocks
+#define BUDDY_MAX_ORDER 18
+#define BUDDY_ORDER_NONE 0xff
+
+typedef struct BuddyFreeBlock BuddyFreeBlock;
+struct BuddyFreeBlock {
+  BuddyFreeBlock *next;
+  BuddyFreeBlock *prev;
+};
+
+typedef struct DS_Buddy {
+  // Order of the free block that starts on every block, or BUDDY_ORDER_NONE if
+  // it's either allocated or part of a bigger free block. Lets us find out if
+  // our buddy is free in O(1) when coalescing.
+  uint8_t *orders;
+  size_t   blocks;
+
+  // The free list nodes are stored inside the free blocks themselves, which
+  // we reach through this offset (HHDM)
+  size_t mem_start;
+  size_t virt_offset;
+
+  BuddyFreeBlock *freeLists[BUDDY_MAX_ORDER];
+  size_t          freeCount[BUDDY_MAX_ORDER];
+  size_t          freeBlocks;
+
+  bool ready; // has been initiated
+} DS_Buddy;
+
+void   BuddyInit(DS_Buddy *buddy, uint8_t *orders, size_t blocks,
+                 size_t virtOffset);
+size_t BuddyAllocate(DS_Buddy *buddy, size_t blocks);
+void   BuddyFree(DS_Buddy *buddy, size_t block, size_t blocks);
+int    BuddyOrderFor(size_t blocks);
+
+void BuddyDump(DS_Buddy *buddy);
+
+#endif
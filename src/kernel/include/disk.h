@@ -29,5 +29,6 @@ bool validateMbr(uint8_t *mbrSector);
 void getDiskBytes(uint8_t *target_address, uint32_t LBA, size_t sector_count);
 void setDiskBytes(const uint8_t *target_address, uint32_t LBA,
                   size_t sector_count);
+void discardDiskBytes(uint32_t LBA, size_t sector_count);
 
 #endif
\ No newline at end of file
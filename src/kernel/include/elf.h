@@ -62,6 +62,11 @@ typedef struct {
 #define PT_LOPROC 0x70000000
 #define PT_HIPROC 0x7fffffff
 
+// p_flags (PF_* is taken by paging)
+#define ELF_PF_X 0x1
+#define ELF_PF_W 0x2
+#define ELF_PF_R 0x4
+
 enum Elf_Ident {
   EI_MAG0 = 0,       // 0x7F
   EI_MAG1 = 1,       // 'E'
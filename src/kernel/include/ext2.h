@@ -133,6 +133,10 @@ typedef struct Ext2Directory {
 } Ext2Directory;
 
 #define EXT2_MAX_CONSEC_DIRALLOC 32
+
+// Read/write temporaries past this go on vmalloc instead of the heap (see
+// ext2TmpAllocate())
+#define EXT2_TMP_VMALLOC (64 * 1024)
 #define EXT2_MAX_CONSEC_BLOCK 32
 #define EXT2_MAX_CONSEC_INODE 32
 #define EXT2_MAX_CONSEC_WRITE 32
@@ -237,6 +241,8 @@ bool   ext2Lstat(MountPoint *mnt, char *filename, struct stat *target,
 int    ext2StatFd(OpenFile *fd, struct stat *target);
 size_t ext2Seek(OpenFile *fd, size_t target, long int offset, int whence);
 size_t ext2GetFilesize(OpenFile *fd);
+size_t ext2Bmap(OpenFile *fd, size_t offset);
+struct PageCache *ext2PageCache(OpenFile *fd);
 int    ext2Readlink(Ext2 *ext2, char *path, char *buf, int size,
                     char **symlinkResolve);
 
@@ -1,3 +1,4 @@
+#include "spinlock.h"
 #include "types.h"
 #include "vfs.h"
 
@@ -107,10 +108,12 @@ typedef struct FAT32 {
   // better "waste" some memory to be safe
   FAT32BootSector bootsec;
 
-  // store old FATs for easier lookup
+  // store old FATs for easier lookup (sectors are allocated as they come in &
+  // might be handed back under memory pressure)
   uint8_t *cache[FAT32_CACHE_MAX];
   uint32_t cacheBase[FAT32_CACHE_MAX];
   int      cacheCurr;
+  Spinlock LOCK_CACHE;
 } FAT32;
 
 typedef struct FAT32OpenFd {
@@ -141,6 +144,8 @@ unsigned long fat32UnixTime(unsigned short fat_date, unsigned short fat_time);
 // fat32_fat.c
 uint32_t  fat32FATtraverse(FAT32 *fat, uint32_t offset);
 uint32_t *fat32FATchain(FAT32 *fat, uint32_t offsetStart, uint32_t amount);
+size_t    fat32FATcacheCount(void *ctx);
+size_t    fat32FATcacheShrink(void *ctx, size_t target);
 
 // fat32_traverse.c
 typedef struct FAT32TraverseResult {
@@ -62,6 +62,9 @@ typedef struct GDTPtr {
 #define GDT_USER_DATA 72
 #define GDT_TSS 80
 
+typedef struct Cpu Cpu;
+
 void initiateGDT();
+void gdtLoad(Cpu *cpu);
 
 #endif
\ No newline at end of file
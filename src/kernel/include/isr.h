@@ -5,6 +5,7 @@
 
 #define MSRID_FSBASE 0xC0000100
 #define MSRID_GSBASE 0xC0000101
+#define MSRID_KERNEL_GSBASE 0xC0000102 // the other one, swapgs
 
 #define MSRID_EFER 0xC0000080
 #define MSRID_STAR 0xC0000081
@@ -59,5 +60,6 @@ irqHandler *registerIRQhandler(uint8_t id, void *handler);
 extern void  asm_isr_exit();
 extern void *asm_isr_redirect_table[];
 extern void  isr128();
+extern void  isr255();
 
 #endif
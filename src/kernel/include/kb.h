@@ -1,4 +1,5 @@
 #include "util.h"
+#include "wait.h"
 
 #ifndef KB_H
 #define KB_H
@@ -15,8 +16,10 @@
 uint32_t readStr(char *buffstr);
 void     initiateKb();
 void     kbIrq();
-bool     kbTaskRead(uint32_t taskId, char *buff, uint32_t limit,
-                    bool changeTaskState);
+bool     kbTaskRead(uint32_t taskId, char *buff, uint32_t limit);
 bool     kbIsOccupied();
+bool     kbIsReading(uint32_t taskId);
+
+WaitQueue kbWaiters; // for the keyboard to free up, or a read to finish
 
 #endif
@@ -7,6 +7,18 @@
 Task *netHelperTask;
 void  netHelperEntry();
 
+// Frames zeroed per wakeup, before checking back with the scheduler
+#define ZERO_HELPER_BATCH 32
+
+Task *zeroHelperTask;
+void  zeroHelperEntry();
+
+Task *reaperHelperTask;
+void  reaperHelperEntry();
+
+Task *reclaimHelperTask;
+void  reclaimHelperEntry();
+
 void initiateKernelThreads();
 
 #endif
\ No newline at end of file
@@ -11,6 +11,7 @@ struct LLheader {
 };
 
 void *LinkedListAllocate(void **LLfirstPtr, uint32_t structSize);
+void  LinkedListAppend(void **LLfirstPtr, void *LLtarget);
 bool  LinkedListUnregister(void **LLfirstPtr, const void *LLtarget);
 bool  LinkedListRemove(void **LLfirstPtr, void *LLtarget);
 bool  LinkedListDuplicate(void **LLfirstPtrSource, void **LLfirstPtrTarget,
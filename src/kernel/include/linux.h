@@ -263,6 +263,9 @@ typedef struct rusage {
   long    ru_nivcsw;   /* involuntary context switches */
 } rusage;
 
+#define RUSAGE_SELF 0
+#define RUSAGE_CHILDREN (-1)
+
 // /usr/include/bits/sigaction.h
 struct sigaction {
   union {
@@ -497,6 +500,21 @@ struct sigaction {
 #define MS_SYNC 4       /* Synchronous memory sync.  */
 #define MS_INVALIDATE 2 /* Invalidate the caches.  */
 
+/* Flags for `mremap'.  */
+#define MREMAP_MAYMOVE 1
+#define MREMAP_FIXED 2
+
+/* Advice to `madvise'.  */
+#define MADV_NORMAL 0     /* No further special treatment.  */
+#define MADV_RANDOM 1     /* Expect random page references.  */
+#define MADV_SEQUENTIAL 2 /* Expect sequential page references.  */
+#define MADV_WILLNEED 3   /* Will need these pages.  */
+#define MADV_DONTNEED 4   /* Don't need these pages.  */
+
+/* Flags for `memfd_create'.  */
+#define MFD_CLOEXEC 1U
+#define MFD_ALLOW_SEALING 2U
+
 // /usr/include/linux/time.h
 // Standard POSIX clocks
 #define CLOCK_REALTIME                                                         \
@@ -0,0 +1,20 @@
+#include "types.h"
+
+#ifndef LZ4_H
+#define LZ4_H
+
+// Hash table entries LZ4Compress() wants (as scratch) from the caller
+#define LZ4_HASH_BITS 12
+#define LZ4_HASH_SIZE (1 << LZ4_HASH_BITS)
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 // the last bytes are always literals
+#define LZ4_MF_LIMIT 12     // no match can start this close to the end
+
+// Inputs have to be shorter than 64KiB, since positions are kept as offsets
+size_t LZ4Compress(const uint8_t *in, size_t len, uint8_t *out, size_t limit,
+                   uint16_t *table);
+bool   LZ4Decompress(const uint8_t *in, size_t len, uint8_t *out,
+                     size_t outLen);
+
+#endif
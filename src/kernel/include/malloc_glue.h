@@ -7,6 +7,16 @@
 
 // malloc.c provides it's own headers for a lot of stuff apparently!
 
+// Kernel heap region (a whole PML4 entry, right past the HHDM's)
+#define KERNEL_HEAP_START 0xffffc00000000000
+#define KERNEL_HEAP_SIZE 0x8000000000
+
+size_t kernelHeapBreak;
+size_t kernelHeapMapped;
+
+void  initiateKernelHeap();
+void *sbrk(long increment);
+
 // spinlocks
 typedef Spinlock MLOCK_T;
 
@@ -15,4 +25,6 @@ int     ACQUIRE_LOCK(Spinlock *lock);
 int     RELEASE_LOCK(Spinlock *lock);
 int     INITIAL_LOCK(Spinlock *lock);
 
+int malloc_trim_try(size_t pad);
+
 #endif
\ No newline at end of file
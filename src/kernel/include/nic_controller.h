@@ -1,4 +1,5 @@
 #include "pci.h"
+#include "spinlock.h"
 #include "types.h"
 
 #ifndef NIC_CONTROLLER_H
@@ -83,9 +84,10 @@ struct NIC {
   // IPv4
   IPv4fragmentedPacket *firstFragmentedPacket;
 
-  // ARP
-  arpTableEntry arpTable[ARP_TABLE_LEN];
-  uint32_t      arpTableCurr;
+  // ARP (allocated on the first entry, dropped under memory pressure)
+  arpTableEntry *arpTable;
+  uint32_t       arpTableCurr;
+  Spinlock       LOCK_ARP;
 
   // DHCP
   Socket  *dhcpUdpRegistered;
@@ -125,6 +127,9 @@ enum NET_ETHERTYPES {
   NET_ETHERTYPE_IPV6 = 0x86DD
 };
 
+void *netPacketAllocate(uint32_t size);
+void  netPacketFree(void *packet, uint32_t size);
+
 void sendPacket(NIC *nic, uint8_t *destination_mac, void *data, uint32_t size,
                 uint16_t protocol);
 void handlePacket(NIC *nic, void *packet, uint32_t size);
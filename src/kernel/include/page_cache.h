@@ -0,0 +1,48 @@
+#include "avl_tree.h"
+#include "spinlock.h"
+#include "types.h"
+#include "vfs.h"
+
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+typedef struct PageCachePage {
+  AvlNode node; // keyed by page index (file offset / PAGE_SIZE)
+  size_t  phys; // the cache itself owns one reference
+  bool    text; // mapped straight into running programs (see elf.c)
+} PageCachePage;
+
+// Every (mmap()'d) inode gets its own, shared by all of its mappings. Ones
+// without a mountpoint aren't backed by anything (shared memory objects).
+typedef struct PageCache PageCache;
+struct PageCache {
+  PageCache *next;
+
+  MountPoint *mnt;
+  size_t      inode;
+
+  Spinlock   LOCK;
+  DS_AvlTree pages;
+};
+
+Spinlock   LOCK_PAGE_CACHES;
+PageCache *firstPageCache;
+
+PageCache *PageCacheGet(MountPoint *mnt, size_t inode);
+PageCache *PageCacheFind(MountPoint *mnt, size_t inode);
+PageCache *PageCacheAllocate();
+void       PageCacheTruncate(PageCache *cache, size_t size);
+void       PageCacheFree(PageCache *cache);
+size_t     PageCacheFetch(PageCache *cache, OpenFile *file, size_t index);
+size_t     PageCacheFetchShare(PageCache *cache, OpenFile *file, size_t index,
+                               bool text);
+void       PageCacheWriteback(PageCache *cache, OpenFile *file, size_t index);
+void       PageCacheUpdate(PageCache *cache, size_t offset, uint8_t *buff,
+                           size_t length);
+
+void initiatePageCache();
+
+size_t PageCacheMmap(size_t addr, size_t length, int prot, int flags,
+                     OpenFile *fd, size_t pgoffset, PageCache *cache);
+
+#endif
@@ -13,8 +13,13 @@
 #define PF_DIRTY (1 << 6)   // Indicates whether 4K page was written
 #define PF_PS (1 << 7)      // Page size (valid for PD and PDPT only)
 #define PF_PAT (1 << 7)     // Page Attribute Table (valid for PT only)
+#define PF_PAT_LARGE (1 << 12) // Page Attribute Table (PF_PS entries only)
 #define PF_GLOBAL (1 << 8)  // Indicates the page is globally cached
 #define PF_SHARED (1 << 9)  // Userland page is shared
+#define PF_COW (1 << 10)    // Userland page is copy-on-write (read-only for now)
+#define PF_DEMAND (1 << 11) // Non-present entry, zero-filled on first touch
+#define PF_FILE (1ULL << 52) // PF_DEMAND entry backed by the page cache instead
+#define PF_SWAP (1ULL << 53) // Non-present entry, the page itself is on swap
 // #define PF_SYSTEM (1 << 9)  // Page used by the kernel
 
 // Region caching (following the Limine protocol)
@@ -49,8 +54,16 @@
 #define PTE_GET_ADDR(VALUE) ((VALUE) & PTE_ADDR_MASK)
 #define PTE_GET_FLAGS(VALUE) ((VALUE) & ~PTE_ADDR_MASK)
 
+#define PTE_LARGE_ADDR_MASK 0x000fffffffe00000
+#define PTE_GET_ADDR_LARGE(VALUE) ((VALUE) & PTE_LARGE_ADDR_MASK)
+#define PTE_GET_FLAGS_LARGE(VALUE) ((VALUE) & ~PTE_LARGE_ADDR_MASK)
+
 #define PAGE_MASK(x) ((1 << (x)) - 1)
 
+// Swap entries (PF_SWAP) keep the original flags, with the slot in place of
+// the frame
+#define PTE_SWAP_SLOT(VALUE) (PTE_GET_ADDR(VALUE) >> PGSHIFT_PTE)
+
 // Sizes & lengths
 #define USER_STACK_PAGES (0x30)
 #define PAGE_SIZE 0x1000
@@ -64,27 +77,104 @@
 #define USER_MMAP_START 0x700000000000
 #define USER_HEAP_START 0x600000000000
 #define USER_STACK_BOTTOM 0x800000000000
+#define USER_END USER_STACK_BOTTOM // first address past userland
 
 #define P_PHYS_ADDR(x) ((x) & ~0xFFF)
 
+// Live (present) 2MiB userland mappings
+size_t pagingLargeMappings;
+
+// Paging structure pages (pml4s & the tables below them) allocated past boot
+size_t pagingTables;
+
+// TLB tagging (PCIDs) & global kernel mappings
+#define PAGING_PCID_COUNT 4096
+#define CR3_NOFLUSH (1ULL << 63) // keep the PCID's entries around on cr3 loads
+#define CR4_PGE (1 << 7)         // global pages
+#define CR4_PCIDE (1 << 17)      // process-context identifiers
+
+// Ranges longer than this (in pages) get flushed with a cr3 reload
+#define PAGING_FLUSH_THRESHOLD 32
+
+bool pagingPcid; // cr3 loads carry a PCID (see PageDirectoryCr3())
+
+uint64_t *pagingBootPagedir; // limine's, also the kernel task's
+
 void initiatePaging();
 
 void VirtualMapL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
                  uint64_t flags);
 void VirtualMap(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
+void VirtualMapRangeL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
+                      size_t pages, uint64_t flags);
+void VirtualPopulateRangeL(uint64_t *pagedir, uint64_t virt_addr, size_t pages,
+                           uint64_t flags);
+bool VirtualMapLargeL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
+                      uint64_t flags);
+bool VirtualMapLarge(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
+void VirtualMapDemandL(uint64_t *pagedir, uint64_t virt_addr, size_t pages,
+                       uint64_t flags);
+void VirtualMapDemand(uint64_t virt_addr, size_t pages, uint64_t flags);
 // uint32_t VirtualUnmap(uint32_t virt_addr);
+void   VirtualUnmapL(uint64_t *pagedir, uint64_t virt_addr, size_t pages,
+                     bool release);
+bool   VirtualUnmapTryL(uint64_t *pagedir, uint64_t virt_addr, size_t pages,
+                        bool release);
+void   VirtualMoveL(uint64_t *pagedir, uint64_t from, uint64_t to,
+                    size_t pages);
+void   VirtualDiscardL(uint64_t *pagedir, uint64_t virt_addr, size_t pages);
+size_t VirtualCleanL(uint64_t *pagedir, uint64_t virt_addr);
+bool   VirtualFillL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
+                    uint64_t flags);
 size_t VirtualToPhysical(size_t virt_addr);
+size_t VirtualToPhysicalL(uint64_t *pagedir, size_t virt_addr);
+
+// Entries looked at per VirtualSwapOutL() call, so the lock isn't held forever
+#define PAGING_SWAP_SCAN 512
+
+typedef enum PAGING_SWAP {
+  PAGING_SWAP_NONE = 0,    // went through a batch without finding a victim
+  PAGING_SWAP_EVICTED = 1, // a page now points to the slot, its frame is gone
+  PAGING_SWAP_BUSY = 2,    // the tables were locked, nothing was looked at
+} PAGING_SWAP;
+
+PAGING_SWAP VirtualSwapOutL(uint64_t *pagedir, uint64_t *cursor, size_t slot,
+                            void *buff);
+uint64_t    VirtualSwappedL(uint64_t *pagedir, uint64_t virt_addr);
+bool        VirtualSwapInL(uint64_t *pagedir, uint64_t virt_addr,
+                           uint64_t entry, uint64_t phys_addr);
 
 uint64_t *GetPageDirectory();
+uint64_t  PageDirectoryCr3(uint64_t *pagedir);
+void      PagingTlbTagging(bool enabled);
+void      PagingInitiateCpu();
+void      PagingShootdownHandle();
 void      ChangePageDirectory(uint64_t *pd);
 void      ChangePageDirectoryUnsafe(uint64_t *pd);
 void      ChangePageDirectoryFake(uint64_t *pd);
 
 uint64_t *PageDirectoryAllocate();
 void      PageDirectoryFree(uint64_t *page_dir);
+void      PageDirectoryDestroy(uint64_t *page_dir);
 
 void PageDirectoryUserDuplicate(uint64_t *source, uint64_t *target);
 
+// Page fault error code bits
+#define PF_ERR_PRESENT (1 << 0) // Protection violation (page was present)
+#define PF_ERR_WRITE (1 << 1)   // Caused by a write
+#define PF_ERR_USER (1 << 2)    // Caused while in CPL==3
+#define PF_ERR_RSVD (1 << 3)    // Reserved bit set somewhere in the walk
+#define PF_ERR_FETCH (1 << 4)   // Caused by an instruction fetch
+
+typedef enum PAGING_FAULT {
+  PAGING_FAULT_FATAL = 0,   // nothing we could do, task has to go
+  PAGING_FAULT_HANDLED = 1, // (or retry) just return to the instruction
+  PAGING_FAULT_DEFER = 2,   // needs i/o, so has to happen outside the isr
+} PAGING_FAULT;
+
+PAGING_FAULT PagingHandleFault(uint64_t virt_addr, uint64_t error, bool ints);
+PAGING_FAULT PagingHandleFaultWait(uint64_t virt_addr, uint64_t error);
+
 void invalidate(uint64_t vaddr);
 
 #endif
\ No newline at end of file
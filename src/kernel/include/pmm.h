@@ -1,14 +1,45 @@
 #ifndef PMM_H
 #define PMM_H
 
-#include "bitmap.h"
+#include "buddy.h"
 #include "types.h"
 
-DS_Bitmap physical;
+DS_Buddy physical;
+
+// PhysicalAllocateFlags() flags
+#define PHYSICAL_ZERO (1 << 0) // hand out zeroed frames
+#define PHYSICAL_TRY (1 << 1)  // return 0 instead of waiting on locks
+
+// Pre-zeroed frames (refilled whenever the cpu is idle)
+#define PHYSICAL_ZERO_POOL 512
+
+// Free frame watermarks: under the low one the swapper gets woken up, which
+// keeps evicting pages until it's past the high one
+#define PHYSICAL_FREE_LOW 512
+#define PHYSICAL_FREE_HIGH 2048
+
+size_t physicalZeroPoolCnt;
+size_t physicalZeroHits;
+size_t physicalZeroMisses;
 
 void initiatePMM();
 
 size_t PhysicalAllocate(int pages);
+size_t PhysicalAllocateTry(int pages);
+size_t PhysicalAllocateLargeTry();
+size_t PhysicalAllocateFlags(int pages, uint32_t flags);
 void   PhysicalFree(size_t ptr, int pages);
 
+size_t PhysicalZeroPoolDrain();
+bool   PhysicalZeroPoolWanted();
+bool   PhysicalZeroPoolFill(size_t batch);
+
+void PhysicalShare(size_t ptr);
+bool PhysicalShared(size_t ptr);
+bool PhysicalPrivate(size_t ptr);
+bool PhysicalRelease(size_t ptr);
+void PhysicalShareLarge(size_t ptr);
+bool PhysicalReleaseLarge(size_t ptr);
+void PhysicalPin(size_t ptr);
+
 #endif
@@ -1,9 +1,19 @@
+#include "task.h"
 #include "types.h"
 
 #ifndef SCHEDULE_H
 #define SCHEDULE_H
 
+// Milliseconds a task gets to run for before it's preempted
+#define SCHEDULE_SLICE 4
+
 uint64_t rsp_fix(uint64_t rsp);
 void     schedule(uint64_t rsp);
+bool     scheduleTick();
+uint64_t scheduleDeadline();
+bool     scheduleWanted();
+void     scheduleWake(Task *task);
+void     scheduleStop(Task *task);
+void     scheduleFinish(Task *old);
 
 #endif
\ No newline at end of file
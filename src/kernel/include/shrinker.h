@@ -0,0 +1,53 @@
+#include "spinlock.h"
+#include "types.h"
+
+#ifndef SHRINKER_H
+#define SHRINKER_H
+
+// Lower ones get shrunk first: whatever's cheapest to build back up
+#define SHRINKER_PRIORITY_NET 10
+#define SHRINKER_PRIORITY_FS 20
+#define SHRINKER_PRIORITY_PAGE_CACHE 30
+
+// Objects asked of a shrinker at a time, before checking back on the pmm
+#define SHRINKER_BATCH 32
+
+// Reclaim rounds PhysicalAllocate() sits through before giving up, & how long
+// (in ms) it waits on any single one of them
+#define RECLAIM_WAIT_ROUNDS 8
+#define RECLAIM_WAIT_MS 1000
+
+// How many objects could be freed right now
+typedef size_t (*ShrinkerCount)(void *ctx);
+// Frees (at most) target objects, returns how many it actually did
+typedef size_t (*ShrinkerScan)(void *ctx, size_t target);
+
+// Anything holding onto memory it could let go of (caches, mostly). Callbacks
+// run on the reclaim thread & can't allocate memory or take locks that are
+// held around allocations.
+typedef struct Shrinker Shrinker;
+struct Shrinker {
+  Shrinker *next;
+
+  char         *name;
+  int           priority;
+  ShrinkerCount count;
+  ShrinkerScan  scan;
+  void         *ctx;
+
+  size_t reclaimed; // objects, over its lifetime
+};
+
+Shrinker *ShrinkerRegister(char *name, int priority, ShrinkerCount count,
+                           ShrinkerScan scan, void *ctx);
+
+void   ReclaimBlock();
+void   ReclaimUnblock();
+void   ReclaimWake();
+bool   ReclaimWait();
+size_t ReclaimRound();
+
+size_t ShrinkerInfo(char *out, size_t limit);
+void   ShrinkerDump();
+
+#endif
@@ -0,0 +1,65 @@
+#include "spinlock.h"
+#include "types.h"
+
+#ifndef SLAB_H
+#define SLAB_H
+
+// Slabs are naturally aligned runs of (a power of two) pages, big enough for
+// at least SLAB_MIN_OBJECTS objects, with their header at the very start
+#define SLAB_MIN_OBJECTS 8
+#define SLAB_MAX_PAGES 16
+#define SLAB_ALIGN 16
+
+typedef void (*SlabConstructor)(void *obj);
+
+typedef struct SlabCache SlabCache;
+
+typedef struct Slab Slab;
+struct Slab {
+  Slab *next;
+  Slab *prev;
+
+  SlabCache *cache;
+  void      *freeList;
+  uint32_t   inUse;
+};
+
+// One per object type. The constructor (if any) only runs when a slab gets
+// carved up, so objects have to be handed back in their constructed state.
+struct SlabCache {
+  SlabCache *next; // set up on the first allocation
+
+  char           *name;
+  size_t          objSize;
+  SlabConstructor ctor;
+
+  // geometry, also worked out on the first allocation
+  size_t   slotSize;
+  size_t   linkOffset; // where the free list link lives inside a slot
+  uint32_t perSlab;
+  uint32_t slabPages;
+
+  Slab *partial;
+  Slab *full;
+  Slab *empty; // at most one is kept around, the rest go back to the pmm
+
+  size_t slabs;
+  size_t active;
+  size_t allocations;
+
+  Spinlock LOCK;
+};
+
+#define SLAB_CACHE_INIT(cacheName, type, constructor)                          \
+  {.name = cacheName, .objSize = sizeof(type), .ctor = constructor}
+
+Spinlock   LOCK_SLAB_CACHES;
+SlabCache *firstSlabCache;
+
+void  *SlabAllocate(SlabCache *cache);
+void  *SlabAllocateZero(SlabCache *cache);
+void   SlabFree(SlabCache *cache, void *obj);
+size_t SlabInfo(char *out, size_t limit);
+void   SlabDump();
+
+#endif
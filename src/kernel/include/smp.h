@@ -0,0 +1,66 @@
+#include "gdt.h"
+#include "paging.h"
+#include "types.h"
+
+#ifndef SMP_H
+#define SMP_H
+
+#define SMP_MAX_CPUS 64 // one bit each on affinity masks
+#define SMP_AFFINITY_ALL (~0ULL)
+
+// Milliseconds an AP gets to come up, before we move on without it
+#define SMP_BOOT_TIMEOUT 1000
+
+typedef struct Task Task;
+
+// Everything kept per cpu, reached through gs (the kernel's gs base always
+// points to the cpu's own) so it works out no matter where a task migrates
+typedef struct Cpu Cpu;
+struct Cpu {
+  // read straight off gs (see cpuSelf() & friends), have to stay on top
+  Cpu      *self;
+  Task     *current;
+  uint64_t *pagedir; // loaded on cr3
+
+  // syscall_entry's, at fixed offsets (24 & 32) for it
+  uint64_t syscallStack;   // the running task's whileSyscallRsp
+  uint64_t syscallUserRsp; // userland's, until it's on the syscall stack
+
+  uint32_t id; // index on cpus[] & bit on affinity masks
+  uint32_t lapicId;
+  bool     online;
+
+  Task *idle; // runs whenever there's nothing else to
+
+  // run queue (see schedule.c)
+  Task    *runHead;
+  Task    *runTail;
+  uint32_t runCnt;
+
+  // timer (see timer.c)
+  uint64_t timerDeadline; // what it's armed for (in timerTicks), 0 if stopped
+  uint64_t ticks;         // times it actually fired
+  uint64_t idleSince;     // TSC the idle task last got on at
+  uint64_t idleTsc;       // TSC cycles spent on the idle task before that
+
+  // whose entries every PCID holds on this cpu's TLB (see PageDirectoryCr3())
+  uint64_t *pcidOwners[PAGING_PCID_COUNT];
+
+  __attribute__((aligned(16))) GDTEntries gdt;
+  GDTPtr                                  gdtr;
+  TSSPtr                                  tss;
+};
+
+#define SMP_CPU_PAGES DivRoundUp(sizeof(Cpu), PAGE_SIZE)
+
+Cpu      cpuBsp;
+Cpu     *cpus[SMP_MAX_CPUS];
+uint32_t smpCpus;   // entries on cpus[]
+uint64_t smpOnline; // bit per cpu that's up & scheduling
+
+void      initiateSmp();
+Cpu      *cpuSelf();
+Task     *cpuCurrentTask();
+uint64_t *cpuPagedir();
+
+#endif
@@ -12,17 +12,28 @@
 
 typedef atomic_flag Spinlock;
 
+// Attempts on a taken lock before handing control over, when whoever holds it
+// might be running on another cpu
+#define SPINLOCK_SPINS 128
+
 void spinlockAcquire(Spinlock *lock);
+bool spinlockTryAcquire(Spinlock *lock);
 void spinlockRelease(Spinlock *lock);
 
+bool spinlockIrqAcquire(Spinlock *lock);
+bool spinlockIrqTryAcquire(Spinlock *lock, bool *ints);
+void spinlockIrqRelease(Spinlock *lock, bool ints);
+
 typedef struct SpinlockCnt {
   int64_t cnt;
 } SpinlockCnt;
 
 void spinlockCntReadAcquire(SpinlockCnt *lock);
+bool spinlockCntReadTryAcquire(SpinlockCnt *lock);
 void spinlockCntReadRelease(SpinlockCnt *lock);
 
 void spinlockCntWriteAcquire(SpinlockCnt *lock);
+bool spinlockCntWriteTryAcquire(SpinlockCnt *lock);
 void spinlockCntWriteRelease(SpinlockCnt *lock);
 
 #endif
@@ -5,8 +5,7 @@
 #define STACK_H
 
 void stackGenerateUser(Task *target, uint32_t argc, char **argv, uint32_t envc,
-                       char **envv, uint8_t *out, size_t filesize,
-                       void *elf_ehdr_ptr);
+                       char **envv, uint8_t *phdrs, void *elf_ehdr_ptr);
 void stackGenerateKernel(Task *target, uint64_t parameter);
 
 #endif
\ No newline at end of file
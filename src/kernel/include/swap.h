@@ -0,0 +1,39 @@
+#include "disk.h"
+#include "paging.h"
+#include "task.h"
+#include "types.h"
+#include "vfs.h"
+
+#ifndef SWAP_H
+#define SWAP_H
+
+// Partition type of dedicated (Linux) swap partitions
+#define MBR_TYPE_SWAP 0x82
+
+// Every slot holds a single page. The very first one is never handed out, so
+// mkswap's header survives & 0 can mean "no slot".
+#define SWAP_SLOT_SECTORS (PAGE_SIZE / SECTOR_SIZE)
+#define SWAP_PINNED 0xffff
+
+// Times the swapper retries locked page tables before calling it a round
+#define SWAP_BUSY_RETRIES 16
+
+bool   swapActive;
+size_t swapSlots; // usable ones
+size_t swapUsed;
+size_t swapIns;
+size_t swapOuts;
+
+void initiateSwap();
+bool SwapActivatePartition(mbr_partition *mbr);
+int  SwapActivateFile(OpenFile *file);
+
+void SwapSlotShare(size_t slot);
+void SwapSlotRelease(size_t slot);
+
+size_t SwapReclaim();
+bool   SwapHandleFault(Task *task, size_t addr, uint64_t error);
+
+size_t SwapInfo(char *out, size_t limit);
+
+#endif
@@ -56,4 +56,10 @@ VfsHandlers pipeWriteEnd;
 bool pipeCloseEnd(OpenFile *readFd);
 int  pipeOpen(int *fds);
 
+/* Shared memory objects (defined in shmem.c) */
+VfsHandlers shmemHandlers;
+
+int    shmemMemfdCreate(char *name, unsigned int flags);
+size_t shmemMmapAnonymous(size_t addr, size_t length, int prot, int flags);
+
 #endif
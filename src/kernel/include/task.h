@@ -1,7 +1,12 @@
+#include "avl_tree.h"
 #include "isr.h"
+#include "slab.h"
+#include "smp.h"
 #include "system.h"
+#include "timer.h"
 #include "types.h"
 #include "vfs.h"
+#include "wait.h"
 
 #ifndef TASK_H
 #define TASK_H
@@ -11,6 +16,9 @@
 
 #define KERNEL_TASK_ID 0
 
+// Kernel stacks (USER_STACK_PAGES each) of reaped tasks kept for new ones
+#define TASK_STACK_POOL 16
+
 typedef struct {
   uint64_t edi;
   uint64_t esi;
@@ -28,6 +36,7 @@ typedef enum TASK_STATE {
   TASK_STATE_WAITING_CHILD = 5,
   TASK_STATE_WAITING_CHILD_SPECIFIC = 6, // task->waitingForPid
   TASK_STATE_WAITING_VFORK = 7,
+  TASK_STATE_BLOCKED = 8, // on a wait queue or in waitUntil() (see wait.c)
   TASK_STATE_DUMMY = 69,
 } TASK_STATE;
 
@@ -76,8 +85,11 @@ struct Task {
   uint64_t heap_start;
   uint64_t heap_end;
 
-  uint64_t mmap_start;
-  uint64_t mmap_end;
+  SpinlockCnt WLOCK_VMAS;
+  DS_AvlTree  vmas; // mmap()'d regions (see vma.c)
+
+  uint64_t minorFaults; // demand-zero & copy-on-write faults served
+  uint64_t majorFaults; // ones that had to go through the page cache
 
   termios  term;
   uint32_t tmpRecV;
@@ -92,6 +104,7 @@ struct Task {
   uint32_t                             mxcsr;
 
   bool noInformParent;
+  bool reapPagedir; // pml4 is ours (not a vfork() parent's) to free
 
   Spinlock    LOCK_CHILD_TERM;
   KilledInfo *firstChildTerminated;
@@ -99,14 +112,41 @@ struct Task {
 
   Task *parent;
   Task *next;
+  Task *nextDead; // waiting for the reaper, see taskKillCleanup()
+
+  // run queue (see schedule.c)
+  Task    *runNext;
+  Task    *runPrev;
+  bool     runQueued;
+  uint64_t sliceEnd; // timerTicks the timer preempts it at
+
+  uint32_t cpu;        // the one it's queued up on (or running on)
+  bool     onCpu;      // running, or still on its stack
+  bool     runStopped; // going away, may never run again (see scheduleStop())
+  uint64_t affinity;   // bit per cpu it may run on, sched_setaffinity()
+
+  uint64_t switchesVoluntary;   // blocked or handed control over
+  uint64_t switchesInvoluntary; // preempted by the timer (or an interrupt)
+
+  uint32_t reclaimBlocked; // locks held that reclaim needs (see ReclaimBlock())
+
+  // wait queue it's blocked on (see wait.c)
+  WaitQueue *waitQueue;
+  Task      *waitNext;
+  Task      *waitPrev;
+  TimerEvent waitTimer; // wakes it up from waitUntil()
 };
 
 SpinlockCnt TASK_LL_MODIFY;
 
+SlabCache slabKilledInfo;
+
 Task *firstTask;
-Task *currentTask;
 
-Task *dummyTask;
+// The one running on this cpu
+#define currentTask (cpuCurrentTask())
+
+Task *firstDeadTask;
 
 bool tasksInitiated;
 
@@ -114,11 +154,13 @@ void  initiateTasks();
 Task *taskCreate(uint32_t id, uint64_t rip, bool kernel_task, uint64_t *pagedir,
                  uint32_t argc, char **argv);
 Task *taskCreateKernel(uint64_t rip, uint64_t rdi);
+Task *taskCreateIdle(Cpu *cpu);
 void  taskCreateFinish(Task *task);
 void  taskAdjustHeap(Task *task, size_t new_heap_end, size_t *start,
                      size_t *end);
 void  taskKill(uint32_t id, uint16_t ret);
 void  taskKillCleanup(Task *task);
+void  taskReap();
 void  taskKillChildren(Task *task);
 void  taskFreeChildren(Task *task);
 Task *taskGet(uint32_t id);
@@ -1,5 +1,6 @@
 #include "nic_controller.h"
 #include "types.h"
+#include "wait.h"
 
 #ifndef TCP_H
 #define TCP_H
@@ -29,8 +30,9 @@ typedef struct tcpHeader {
 } __attribute__((packed)) tcpHeader;
 
 typedef struct tcpConnection {
-  bool open;
-  bool closing;
+  bool      open;
+  bool      closing;
+  WaitQueue opened; // netTcpAwaitOpen() callers
 
   uint32_t client_seq_number;
   uint32_t client_ack_number;
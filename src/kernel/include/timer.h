@@ -5,12 +5,35 @@
 #ifndef TIMER_H
 #define TIMER_H
 
+// Milliseconds since boot: counted by the PIT's interrupts early on, read off
+// the TSC once it's calibrated (see timerNow())
+#define timerTicks (timerNow())
+
+// Ran from the timer interrupt (with interrupts off & the events' lock held)
+// once the deadline passes, so it has to be short & may not touch any events
+typedef void (*TimerCallback)(void *arg);
+
+typedef struct TimerEvent {
+  struct TimerEvent *next;
+  uint64_t           deadline; // in timerTicks
+  TimerCallback      callback;
+  void              *arg;
+  bool               armed;
+} TimerEvent;
+
 uint32_t timerFrequency;
-uint64_t timerTicks;
 uint64_t timerBootUnix;
+uint64_t timerTscPerMs; // 0 while the PIT still keeps time
 
-void initiateTimer(uint32_t reload_value);
-void timerTick(uint64_t rsp);
-void sleep(uint32_t time);
+void     initiateTimer(uint32_t reload_value);
+uint64_t timerNow();
+uint64_t timerTsc(uint64_t ticks);
+void     timerPitTick();
+void     timerTick(uint64_t rsp);
+void     timerProgram(uint64_t deadline);
+void     timerEventArm(TimerEvent *event, uint64_t deadline);
+void     timerEventCancel(TimerEvent *event);
+size_t   timerInfo(char *out, size_t limit);
+void     sleep(uint32_t time);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,5 +1,6 @@
 #include "disk.h"
 #include "linux.h"
+#include "slab.h"
 #include "types.h"
 
 #ifndef FS_CONTROLLER_H
@@ -9,7 +10,8 @@ typedef enum FS { FS_FATFS, FS_EXT2, FS_DEV, FS_SYS } FS;
 typedef enum CONNECTOR {
   CONNECTOR_AHCI,
   CONNECTOR_DEV,
-  CONNECTOR_SYS
+  CONNECTOR_SYS,
+  CONNECTOR_ZRAM
 } CONNECTOR;
 
 // Accordingly to fatfs
@@ -64,6 +66,11 @@ typedef int (*SpecialOpen)(char *filename, int flags, int mode, OpenFile *fd,
                            char **symlinkResolve);
 typedef bool (*SpecialClose)(OpenFile *fd);
 typedef size_t (*SpecialGetFilesize)(OpenFile *fd);
+typedef int (*SpecialTruncate)(OpenFile *fd, size_t length);
+// disk sector behind a byte of the file, 0 for holes (swap files)
+typedef size_t (*SpecialBmap)(OpenFile *fd, size_t offset);
+// cache every mapping of the file shares frames through (exec's text too)
+typedef struct PageCache *(*SpecialPageCache)(OpenFile *fd);
 
 typedef struct VfsHandlers {
   SpecialReadHandler  read;
@@ -74,6 +81,9 @@ typedef struct VfsHandlers {
   SpecialMmapHandler  mmap;
   SpecialGetdents64   getdents64;
   SpecialGetFilesize  getFilesize;
+  SpecialTruncate     truncate;
+  SpecialBmap         bmap;
+  SpecialPageCache    pageCache;
 
   SpecialDuplicate duplicate;
   SpecialOpen      open;
@@ -133,18 +143,23 @@ struct OpenFile {
 
 MountPoint *firstMountPoint;
 
+SlabCache slabOpenFile;
+
 #define SEEK_SET 0  // start + offset
 #define SEEK_CURR 1 // current + offset
 #define SEEK_END 2  // end + offset
 
 OpenFile *fsKernelOpen(char *filename, int flags, uint32_t mode);
 bool      fsKernelClose(OpenFile *file);
+bool      fsCloseOrphan(OpenFile *file);
 
 int fsUserOpen(void *task, char *filename, int flags, int mode);
 int fsUserClose(void *task, int fd);
 int fsUserSeek(void *task, uint32_t fd, int offset, int whence);
 
 OpenFile *fsUserGetNode(void *task, int fd);
+OpenFile *fsUserOpenSpecial(void *task, VfsHandlers *handlers, void *dir,
+                            int flags);
 
 OpenFile *fsUserDuplicateNode(void *taskPtr, OpenFile *original);
 OpenFile *fsUserDuplicateNodeUnsafe(OpenFile *original);
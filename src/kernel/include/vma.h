@@ -0,0 +1,53 @@
+#include "avl_tree.h"
+#include "page_cache.h"
+#include "task.h"
+#include "types.h"
+
+#ifndef VMA_H
+#define VMA_H
+
+typedef enum VMA_TYPE {
+  VMA_ANONYMOUS = 0, // demand-zero memory
+  VMA_FILE = 1,      // file contents & shared memory, through the page cache
+  VMA_DEVICE = 2,    // frames that aren't ours (framebuffer & such)
+} VMA_TYPE;
+
+// A contiguous range of a task's address space handed out by mmap()
+typedef struct Vma {
+  AvlNode node; // keyed by start
+
+  size_t start;
+  size_t end; // exclusive
+
+  int      prot;  // PROT_*
+  int      flags; // MAP_*
+  VMA_TYPE type;
+
+  // VMA_FILE only: a private handle (outlives the fd) & where we start in it
+  OpenFile  *file;
+  size_t     offset;
+  PageCache *cache;
+} Vma;
+
+// Where mmap() looks for free space when it isn't told exactly where to go
+#define VMA_SEARCH_START USER_MMAP_START
+#define VMA_SEARCH_END (USER_STACK_BOTTOM - USER_STACK_PAGES * PAGE_SIZE)
+
+bool     VmaUserRange(size_t addr, size_t length);
+uint64_t VmaPageFlags(int prot);
+Vma     *VmaFind(Task *task, size_t addr);
+size_t   VmaReserve(Task *task, size_t addr, size_t length, int prot, int flags,
+                    VMA_TYPE type);
+size_t   VmaReserveFile(Task *task, size_t addr, size_t length, int prot,
+                        int flags, OpenFile *file, size_t offset,
+                        PageCache *cache);
+void     VmaUnmap(Task *task, size_t addr, size_t length);
+size_t   VmaRemap(Task *task, size_t addr, size_t oldLength, size_t newLength,
+                  int flags, size_t newAddr);
+void     VmaDiscard(Task *task, size_t addr, size_t length);
+void     VmaSync(Task *task, size_t addr, size_t length);
+bool     VmaHandleFault(Task *task, size_t addr, uint64_t error);
+void     VmaDuplicate(Task *source, Task *target);
+void     VmaFreeAll(Task *task);
+
+#endif
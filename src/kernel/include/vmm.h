@@ -4,6 +4,10 @@
 #ifndef VMM_H
 #define VMM_H
 
+// Region for VmallocAllocate() (a whole PML4 entry, right past the kernel heap)
+#define KERNEL_VMALLOC_START 0xffffc08000000000
+#define KERNEL_VMALLOC_SIZE 0x8000000000
+
 DS_Bitmap virtual;
 
 void initiateVMM();
@@ -12,4 +16,7 @@ void *VirtualAllocate(int pages);
 void *VirtualAllocatePhysicallyContiguous(int pages);
 bool  VirtualFree(void *ptr, int pages);
 
+void *VmallocAllocate(size_t pages);
+void  VmallocFree(void *ptr, size_t pages);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,49 @@
+#include "spinlock.h"
+#include "system.h"
+#include "types.h"
+
+#ifndef WAIT_H
+#define WAIT_H
+
+// Hashed queues, for whatever can't fit one of its own (see waitHashed())
+#define WAIT_HASHED_BITS 6
+#define WAIT_HASHED (1 << WAIT_HASHED_BITS)
+
+typedef struct Task Task;
+
+// Tasks blocked until whatever they're after changes, linked through the tasks
+// themselves (a task waits on one queue at a time). Wakeups come from
+// interrupts as well, so the lock is only ever held with them disabled.
+typedef struct WaitQueue {
+  Spinlock LOCK;
+  Task    *head;
+  Task    *tail;
+} WaitQueue;
+
+#define WAIT_QUEUE_INIT {.LOCK = ATOMIC_FLAG_INIT, .head = 0, .tail = 0}
+
+// Blocks the running task until condition holds, it's checked again after
+// every wakeup. Whoever changes it has to wake the queue up afterwards. The
+// condition is evaluated with interrupts off, so it has to be a quick check.
+#define waitEvent(queue, condition)                                            \
+  do {                                                                         \
+    bool __waitInts = checkInterrupts();                                       \
+    while (true) {                                                             \
+      waitPrepare(queue);                                                      \
+      if (condition)                                                           \
+        break;                                                                 \
+      handControl();                                                           \
+    }                                                                          \
+    waitFinish(queue, __waitInts);                                             \
+  } while (0)
+
+void       waitQueueInit(WaitQueue *queue);
+void       waitPrepare(WaitQueue *queue);
+void       waitFinish(WaitQueue *queue, bool ints);
+void       waitWake(WaitQueue *queue);
+void       waitWakeAll(WaitQueue *queue);
+void       waitRemove(Task *task);
+void       waitUntil(uint64_t deadline);
+WaitQueue *waitHashed(void *addr);
+
+#endif
@@ -0,0 +1,60 @@
+#include "disk.h"
+#include "paging.h"
+#include "spinlock.h"
+#include "types.h"
+#include "vfs.h"
+
+#ifndef ZRAM_H
+#define ZRAM_H
+
+// Sectors getDiskBytes()/setDiskBytes() hand to the device instead of the
+// AHCI disk, so filesystems & swap work on top of it unmodified. Real disks
+// don't go past ZRAM_LBA_START (32-bit LBAs are ~2TiB as it is).
+#define ZRAM_LBA_START 0xF0000000
+#define ZRAM_MAX_SECTORS 0x0FFFFFFF
+
+// Device size, as a part of physical memory (only what's stored takes space)
+#define ZRAM_SIZE_DIVISOR 2
+
+#define ZRAM_PAGE_SECTORS (PAGE_SIZE / SECTOR_SIZE)
+// Pages that don't compress below this are kept as they are
+#define ZRAM_COMPRESS_LIMIT (PAGE_SIZE * 3 / 4)
+
+// ZramPage flags
+#define ZRAM_PAGE_ZERO (1 << 0) // all zeroes, nothing stored
+#define ZRAM_PAGE_RAW (1 << 1)  // wouldn't compress, stored as is
+
+typedef struct ZramPage {
+  uint8_t *data; // never written (or all zeroes) if null
+  uint16_t size;
+  uint16_t flags;
+  uint32_t generation; // bumped on every store, so racing writers can tell
+} ZramPage;
+
+typedef struct Zram {
+  size_t    pages;
+  ZramPage *table;
+  Spinlock  LOCK;
+  bool      claimed; // mounted or swapped on
+
+  size_t storedPages; // ones with data (compressed or not)
+  size_t zeroPages;
+  size_t rawPages;
+  size_t origBytes;  // what's stored, uncompressed
+  size_t comprBytes; // what's stored, compressed
+  size_t memUsed;    // what that takes off the heap (table excluded)
+  size_t memUsedMax;
+} Zram;
+
+Zram        zram;
+VfsHandlers zramHandlers;
+
+void   initiateZram();
+void   zramBytes(uint8_t *buff, size_t sector, size_t count, bool write);
+void   zramDiscard(size_t sector, size_t count);
+bool   zramPartition(mbr_partition *out);
+bool   zramClaim();
+void   zramUnclaim();
+size_t zramMmStat(char *out, size_t limit);
+
+#endif
@@ -5349,6 +5349,17 @@ int dlmalloc_trim(size_t pad) {
   return result;
 }
 
+/* cavOS: malloc_trim() for the reclaim thread, skipped if the heap is busy */
+int malloc_trim_try(size_t pad) {
+  int result = 0;
+  ensure_initialization();
+  if (spinlockTryAcquire(&gm->mutex)) {
+    result = sys_trim(gm, pad);
+    spinlockRelease(&gm->mutex);
+  }
+  return result;
+}
+
 size_t dlmalloc_footprint(void) {
   return gm->footprint;
 }
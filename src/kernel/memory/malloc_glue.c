@@ -1,31 +1,69 @@
+#include <bootloader.h>
 #include <malloc_glue.h>
+#include <paging.h>
+#include <shrinker.h>
 #include <system.h>
 #include <util.h>
 #include <vmm.h>
 
 #define DEBUG_DLMALLOC_GLUE 0
 
-void *last = 0;
+// The kernel heap is one virtually contiguous break on a region of its own.
+// Frames are only mapped in as it grows & handed back to the pmm whenever
+// dlmalloc trims it, so nothing here needs physically contiguous memory.
+size_t kernelHeapBreak = 0;
+size_t kernelHeapMapped = 0; // everything below this (page aligned) is backed
+
+void initiateKernelHeap() {
+  if (bootloader.hhdmOffset + bootloader.mmTotal > KERNEL_HEAP_START) {
+    debugf("[dlmalloc] HHDM{%lx} runs into the kernel heap region!\n",
+           bootloader.hhdmOffset);
+    panic();
+  }
+
+  // new pagedirs copy the kernel's top level entries (PageDirectoryAllocate()),
+  // so the region's has to exist before any of them does. The first page is
+  // never trimmed, which keeps it around for good.
+  VirtualPopulateRangeL(GetPageDirectory(), KERNEL_HEAP_START, 1, PF_RW);
+  kernelHeapBreak = KERNEL_HEAP_START;
+  kernelHeapMapped = KERNEL_HEAP_START + PAGE_SIZE;
+}
+
 void *sbrk(long increment) {
 #if DEBUG_DLMALLOC_GLUE
   debugf("[dlmalloc::sbrk] size{%lx}\n", increment);
 #endif
-  if (increment < 0)
-    return 0; // supposed to release, whatever.
-  if (!increment)
-    return last;
-  // return 0;
+  if (!kernelHeapBreak) {
+    debugf("[dlmalloc::sbrk] Kernel heap used before it was set up!\n");
+    panic();
+  }
+
+  size_t old = kernelHeapBreak;
+  size_t target = kernelHeapBreak + increment;
+  if (target < KERNEL_HEAP_START ||
+      target > KERNEL_HEAP_START + KERNEL_HEAP_SIZE)
+    return (void *)(-1);
 
-  uint64_t blocks = DivRoundUp(increment, BLOCK_SIZE);
-  void    *virt = VirtualAllocate(blocks);
-  memset(virt, 0, blocks * BLOCK_SIZE);
+  size_t targetMapped = DivRoundUp(target, PAGE_SIZE) * PAGE_SIZE;
+  if (targetMapped < KERNEL_HEAP_START + PAGE_SIZE)
+    targetMapped = KERNEL_HEAP_START + PAGE_SIZE;
+  if (targetMapped > kernelHeapMapped)
+    VirtualPopulateRangeL(GetPageDirectory(), kernelHeapMapped,
+                          (targetMapped - kernelHeapMapped) / PAGE_SIZE, PF_RW);
+  else if (targetMapped < kernelHeapMapped &&
+           !VirtualUnmapTryL(GetPageDirectory(), targetMapped,
+                             (kernelHeapMapped - targetMapped) / PAGE_SIZE,
+                             true))
+    targetMapped = kernelHeapMapped; // page tables are busy, maybe next time
 
-  last = (void *)((size_t)virt + increment);
+  kernelHeapBreak = target;
+  kernelHeapMapped = targetMapped;
 
 #if DEBUG_DLMALLOC_GLUE
-  debugf("[dlmalloc::sbrk] found{%lx}\n", virt);
+  debugf("[dlmalloc::sbrk] break{%lx} mapped{%lx}\n", kernelHeapBreak,
+         kernelHeapMapped);
 #endif
-  return virt;
+  return (void *)old;
 }
 
 int  __errnoF = 0;
@@ -40,17 +78,20 @@ void abort() {
 // spinlocks/mutexes/whatever people call them; I truly don't care!
 MLOCK_T malloc_global_mutex = ATOMIC_FLAG_INIT;
 
+// Growing the heap can't wait on reclaim, which needs the heap itself
 int ACQUIRE_LOCK(Spinlock *lock) {
   spinlockAcquire(lock);
+  ReclaimBlock();
   return 0;
 }
 
 int RELEASE_LOCK(Spinlock *lock) {
+  ReclaimUnblock();
   spinlockRelease(lock);
   return 0;
 }
 
 int INITIAL_LOCK(Spinlock *lock) {
-  RELEASE_LOCK(lock);
+  spinlockRelease(lock);
   return 0;
 }
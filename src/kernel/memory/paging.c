@@ -1,9 +1,13 @@
+#include <apic.h>
 #include <bitmap.h>
 #include <bootloader.h>
 #include <limine.h>
 #include <malloc.h>
 #include <paging.h>
 #include <pmm.h>
+#include <shrinker.h>
+#include <smp.h>
+#include <swap.h>
 #include <system.h>
 #include <task.h>
 #include <types.h>
@@ -23,7 +27,268 @@
 #define PAGING_DEBUG 0
 
 #define HHDMoffset (bootloader.hhdmOffset)
-uint64_t *globalPagedir = 0;
+#define globalPagedir (cpuPagedir()) // the one on this cpu's cr3
+uint64_t *pagingBootPagedir = 0; // limine's, also the kernel task's
+
+// Backs every demand-zero page that has only been read so far
+size_t pagingZeroPage = 0;
+
+// Address spaces are tagged with a PCID (when the cpu has them), so switching
+// between them doesn't throw the whole TLB away. Tags are derived from the
+// pagedir's address & every cpu's pcidOwners[] remembers who used each one
+// last over there. Anybody else loading it (or the owner, after changes it
+// couldn't invlpg) has to flush it first.
+bool pagingTlbTagging = true;
+
+static uint16_t PagingPcid(uint64_t *pagedir) {
+  return ((size_t)pagedir / PAGE_SIZE) % (PAGING_PCID_COUNT - 1) + 1;
+}
+
+// The pagedir changed while not loaded, so its tagged entries can't be trusted
+// on any cpu (skip takes care of its own TLB)
+static void PagingPcidStale(uint64_t *pagedir, Cpu *skip) {
+  uint16_t pcid = PagingPcid(pagedir);
+  for (uint32_t i = 0; i < smpCpus; i++) {
+    uint64_t *expected = pagedir;
+    if (cpus[i] != skip)
+      __atomic_compare_exchange_n(&cpus[i]->pcidOwners[pcid], &expected, 0,
+                                  false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+  }
+
+  // pairs with the one in PageDirectoryCr3(): whoever loads pagedir from here
+  // on flushes it, anybody that already did is seen by PagingShootdown()
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// The value to load on cr3 for switching to pagedir, which only flushes its
+// tag when there's anything stale on it. Called with interrupts off, after
+// pagedir was put on cpuSelf()->pagedir.
+uint64_t PageDirectoryCr3(uint64_t *pagedir) {
+  uint64_t phys = VirtualToPhysical((size_t)pagedir);
+  if (!pagingPcid)
+    return phys;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  uint16_t   pcid = PagingPcid(pagedir);
+  uint64_t **owner = &cpuSelf()->pcidOwners[pcid];
+  if (pagingTlbTagging && __atomic_load_n(owner, __ATOMIC_SEQ_CST) == pagedir)
+    return phys | pcid | CR3_NOFLUSH;
+
+  __atomic_store_n(owner, pagedir, __ATOMIC_SEQ_CST);
+  return phys | pcid;
+}
+
+static bool PagingKernelHalf(uint64_t virt_addr) {
+  return PML4E(AMD64_MM_STRIPSX(virt_addr)) >= 256;
+}
+
+// Drops a range (pages == 0 being everything) off this cpu's TLB, as far as
+// it might be caching it for pagedir. Past a few pages, dropping the whole
+// (PCID) tag via a cr3 reload beats a pile of invlpgs. That doesn't reach
+// global (kernel) entries, which need PGE toggled instead. Called with
+// interrupts off.
+static void PagingFlushLocal(uint64_t *pagedir, uint64_t virt_addr,
+                             size_t pages) {
+  bool kernel = PagingKernelHalf(virt_addr);
+  if (!kernel && pagedir != globalPagedir)
+    return;
+
+  if (pages && pages <= PAGING_FLUSH_THRESHOLD) {
+    for (size_t i = 0; i < pages; i++)
+      invalidate(virt_addr + i * PAGE_SIZE);
+    return;
+  }
+
+  if (kernel) {
+    // toggling PGE flushes everything, global entries & all PCIDs included
+    uint64_t cr4 = 0;
+    asm volatile("movq %%cr4, %0" : "=r"(cr4));
+    asm volatile("movq %0, %%cr4" ::"r"(cr4 ^ CR4_PGE) : "memory");
+    asm volatile("movq %0, %%cr4" ::"r"(cr4) : "memory");
+    return;
+  }
+
+  __atomic_store_n(&cpuSelf()->pcidOwners[PagingPcid(pagedir)], 0,
+                   __ATOMIC_SEQ_CST);
+  uint64_t cr3 = PageDirectoryCr3(pagedir);
+  asm volatile("movq %0, %%cr3" ::"r"(cr3) : "memory");
+}
+
+// Other cpus' TLBs are flushed by IPI (see APIC_VECTOR_SHOOTDOWN), one range at
+// a time: the initiator posts it & waits for every target to clear its bit
+Spinlock  LOCK_SHOOTDOWN = ATOMIC_FLAG_INIT;
+uint64_t *shootdownPagedir = 0;
+uint64_t  shootdownVirt = 0;
+size_t    shootdownPages = 0;
+uint64_t  shootdownPending = 0;
+
+// Serves the current shootdown, if it concerns us. Called with interrupts off,
+// by the IPI's handler & by anything that spins with them off (whoever waits on
+// us might be holding what we're spinning on).
+void PagingShootdownHandle() {
+  uint64_t online = __atomic_load_n(&smpOnline, __ATOMIC_RELAXED);
+  if (!(online & (online - 1)))
+    return;
+
+  uint64_t bit = 1ULL << cpuSelf()->id;
+  if (!(__atomic_load_n(&shootdownPending, __ATOMIC_ACQUIRE) & bit))
+    return;
+  PagingFlushLocal(shootdownPagedir, shootdownVirt, shootdownPages);
+  __atomic_and_fetch(&shootdownPending, ~bit, __ATOMIC_RELEASE);
+}
+
+// Only cpus that have pagedir loaded need to hear about it, apart from
+// changes to the kernel's half (which everybody shares)
+static void PagingShootdown(uint64_t *pagedir, uint64_t virt_addr,
+                            size_t pages) {
+  uint64_t online = __atomic_load_n(&smpOnline, __ATOMIC_SEQ_CST);
+  if (!(online & (online - 1)))
+    return;
+
+  bool     kernel = PagingKernelHalf(virt_addr);
+  Cpu     *self = cpuSelf();
+  uint64_t targets = 0;
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for (uint32_t i = 0; i < smpCpus; i++) {
+    if (cpus[i] == self || !(online & (1ULL << i)))
+      continue;
+    if (kernel || __atomic_load_n(&cpus[i]->pagedir, __ATOMIC_SEQ_CST) ==
+                      pagedir)
+      targets |= 1ULL << i;
+  }
+  if (!targets)
+    return;
+
+  while (!spinlockTryAcquire(&LOCK_SHOOTDOWN))
+    PagingShootdownHandle();
+  shootdownPagedir = pagedir;
+  shootdownVirt = virt_addr;
+  shootdownPages = pages;
+  __atomic_store_n(&shootdownPending, targets, __ATOMIC_SEQ_CST);
+
+  for (uint32_t i = 0; i < smpCpus; i++) {
+    if (targets & (1ULL << i))
+      apicIpi(cpus[i]->lapicId, APIC_VECTOR_SHOOTDOWN);
+  }
+  while (__atomic_load_n(&shootdownPending, __ATOMIC_ACQUIRE))
+    asm volatile("pause");
+  spinlockRelease(&LOCK_SHOOTDOWN);
+}
+
+// Flushes a range that had present entries replaced (pages == 0 being the
+// whole address space) off every TLB that might be caching it. Cpus that
+// don't have it loaded simply have its tag dropped.
+static void PagingFlushRange(uint64_t *pagedir, uint64_t virt_addr,
+                             size_t pages) {
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  if (!PagingKernelHalf(virt_addr))
+    PagingPcidStale(pagedir, pagedir == globalPagedir ? cpuSelf() : 0);
+  PagingFlushLocal(pagedir, virt_addr, pages);
+  PagingShootdown(pagedir, virt_addr, pages);
+  if (ints)
+    asm volatile("sti");
+}
+
+static void PagingInvalidate(uint64_t *pagedir, uint64_t virt_addr) {
+  PagingFlushRange(pagedir, virt_addr, 1);
+}
+
+// Lets benchmarks (see testing.c) compare against flushing on every switch
+void PagingTlbTagging(bool enabled) {
+  pagingTlbTagging = enabled;
+
+  uint64_t cr4 = 0;
+  asm volatile("movq %%cr4, %0" : "=r"(cr4));
+  if (enabled)
+    cr4 |= CR4_PGE;
+  else
+    cr4 &= ~CR4_PGE;
+  asm volatile("movq %0, %%cr4" ::"r"(cr4) : "memory");
+}
+
+// Kernel (upper half) mappings are shared by every address space, so they're
+// marked global & survive cr3 loads altogether
+static void PagingGlobalKernel() {
+  for (int pml4_index = 256; pml4_index < 512; pml4_index++) {
+    if (!(globalPagedir[pml4_index] & PF_PRESENT))
+      continue;
+    size_t *pdp =
+        (size_t *)(PTE_GET_ADDR(globalPagedir[pml4_index]) + HHDMoffset);
+
+    for (int pdp_index = 0; pdp_index < 512; pdp_index++) {
+      if (!(pdp[pdp_index] & PF_PRESENT))
+        continue;
+      if (pdp[pdp_index] & PF_PS) {
+        pdp[pdp_index] |= PF_GLOBAL;
+        continue;
+      }
+      size_t *pd = (size_t *)(PTE_GET_ADDR(pdp[pdp_index]) + HHDMoffset);
+
+      for (int pd_index = 0; pd_index < 512; pd_index++) {
+        if (!(pd[pd_index] & PF_PRESENT))
+          continue;
+        if (pd[pd_index] & PF_PS) {
+          pd[pd_index] |= PF_GLOBAL;
+          continue;
+        }
+        size_t *pt = (size_t *)(PTE_GET_ADDR(pd[pd_index]) + HHDMoffset);
+
+        for (int pt_index = 0; pt_index < 512; pt_index++) {
+          if (pt[pt_index] & PF_PRESENT)
+            pt[pt_index] |= PF_GLOBAL;
+        }
+      }
+    }
+  }
+}
+
+static bool PagingCheckPcid() {
+  uint32_t eax = 0x1, ebx = 0, ecx = 0, edx = 0;
+  cpuid(&eax, &ebx, &ecx, &edx);
+  return (ecx >> 17) & 1;
+}
+
+// Everything every cpu has to set up on its own: write protection, global
+// pages & PCIDs (going by what the BSP found)
+void PagingInitiateCpu() {
+  // make sure the kernel also respects read-only (copy-on-write) pages
+  asm volatile("movq %%cr0, %%rax;"
+               "orq $0x10000, %%rax;"
+               "movq %%rax, %%cr0;"
+               :
+               :
+               : "rax");
+
+  uint64_t cr4 = 0;
+  asm volatile("movq %%cr4, %0" : "=r"(cr4));
+
+  // toggling PGE flushes everything, global entries included
+  asm volatile("movq %0, %%cr4" ::"r"(cr4 & ~CR4_PGE) : "memory");
+  cr4 |= CR4_PGE;
+  asm volatile("movq %0, %%cr4" ::"r"(cr4) : "memory");
+
+  if (!pagingPcid)
+    return;
+
+  // PCIDE can only be set while cr3 is tagged with zero
+  uint64_t cr3 = 0;
+  asm volatile("movq %%cr3, %0" : "=r"(cr3));
+  asm volatile("movq %0, %%cr3" ::"r"(cr3 & ~0xFFF) : "memory");
+
+  cr4 |= CR4_PCIDE;
+  asm volatile("movq %0, %%cr4" ::"r"(cr4) : "memory");
+}
+
+static void PagingInitiateTlb() {
+  PagingGlobalKernel();
+
+  pagingPcid = PagingCheckPcid();
+  if (!pagingPcid)
+    debugf("[paging] No PCID support, every switch flushes the TLB\n");
+
+  PagingInitiateCpu();
+}
 
 void initiatePaging() {
   // debugf("phys{%lx} virt{%lx}\n", bootloader.kernelPhysBase,
@@ -88,7 +353,14 @@ void initiatePaging() {
   }
 
   uint64_t pdVirt = pdPhys + bootloader.hhdmOffset;
-  globalPagedir = (uint64_t *)pdVirt;
+  cpuSelf()->pagedir = (uint64_t *)pdVirt;
+  pagingBootPagedir = globalPagedir;
+
+  pagingZeroPage = PhysicalAllocate(1);
+  memset((void *)(pagingZeroPage + HHDMoffset), 0, PAGE_SIZE);
+  PhysicalPin(pagingZeroPage);
+
+  PagingInitiateTlb();
 
   // VirtualSeek(bootloader.hhdmOffset);
 }
@@ -99,24 +371,27 @@ void VirtualMapRegionByLength(uint64_t virt_addr, uint64_t phys_addr,
   debugf("[paging::map::region] virt{%lx} phys{%lx} len{%lx}\n", virt_addr,
          phys_addr, length);
 #endif
-  uint32_t pagesAmnt = DivRoundUp(length, PAGE_SIZE);
-  for (int i = 0; i < pagesAmnt; i++) {
-    uint64_t xvirt = virt_addr + i * PAGE_SIZE;
-    uint64_t xphys = phys_addr + i * PAGE_SIZE;
-    VirtualMap(xvirt, xphys, flags);
-  }
+  VirtualMapRangeL(globalPagedir, virt_addr, phys_addr,
+                   DivRoundUp(length, PAGE_SIZE), flags);
 }
 
 // Will NOT check for the current task and update it's pagedir (on the struct)!
+// Always flushes whatever the (local) TLB has for it
 void ChangePageDirectoryUnsafe(uint64_t *pd) {
-  uint64_t targ = VirtualToPhysical((size_t)pd);
-  if (!targ) {
+  if (!VirtualToPhysical((size_t)pd)) {
     debugf("[paging] Could not change to pd{%lx}!\n", pd);
     panic();
   }
-  asm volatile("movq %0, %%cr3" ::"r"(targ));
 
-  globalPagedir = pd;
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  Cpu *cpu = cpuSelf();
+  cpu->pagedir = pd;
+  __atomic_store_n(&cpu->pcidOwners[PagingPcid(pd)], 0, __ATOMIC_SEQ_CST);
+  uint64_t targ = PageDirectoryCr3(pd);
+  asm volatile("movq %0, %%cr3" ::"r"(targ));
+  if (ints)
+    asm volatile("sti");
 }
 
 // Used by the scheduler to avoid accessing globalPagedir directly
@@ -126,7 +401,7 @@ void ChangePageDirectoryFake(uint64_t *pd) {
     panic();
   }
 
-  globalPagedir = pd;
+  cpuSelf()->pagedir = pd;
 }
 
 void ChangePageDirectory(uint64_t *pd) {
@@ -137,38 +412,189 @@ void ChangePageDirectory(uint64_t *pd) {
 
 uint64_t *GetPageDirectory() { return (uint64_t *)globalPagedir; }
 
-void invalidate(uint64_t vaddr) { asm volatile("invlpg %0" ::"m"(vaddr)); }
+// Addresses around here are mostly stripped of their sign extension (see
+// AMD64_MM_STRIPSX()), which invlpg needs back
+void invalidate(uint64_t vaddr) {
+  uint64_t canonical = (uint64_t)((int64_t)(vaddr << 16) >> 16);
+  asm volatile("invlpg (%0)" ::"r"(canonical) : "memory");
+}
 
+// Every paging structure (past the boot ones) comes & goes through these, so
+// pagingTables stays accurate
 size_t PagingPhysAllocate() {
-  size_t phys = PhysicalAllocate(1);
+  __atomic_add_fetch(&pagingTables, 1, __ATOMIC_RELAXED);
+  return PhysicalAllocateFlags(1, PHYSICAL_ZERO);
+}
 
-  void *virt = (void *)(phys + HHDMoffset);
-  memset(virt, 0, PAGE_SIZE);
+static void PagingPhysFree(size_t *table) {
+  PhysicalFree((size_t)table - HHDMoffset, 1);
+  __atomic_sub_fetch(&pagingTables, 1, __ATOMIC_RELAXED);
+}
+
+// Frames (& tables) taken off an address space can only be handed back once no
+// TLB (or paging structure cache) out there still points to them. So they're
+// gathered up while the lock is held & released past a single flush of the
+// whole range that was touched. The kind is kept in an entry's low bits.
+#define PAGING_GATHER_MAX 64
+#define PAGING_GATHER_FRAME 0
+#define PAGING_GATHER_LARGE 1
+#define PAGING_GATHER_TABLE 2
+
+typedef struct PagingGather {
+  uint64_t *pagedir;
+  uint64_t  start;
+  uint64_t  end; // 0 while nothing was touched
+  bool      tables;
+  size_t    cnt;
+  size_t    entries[PAGING_GATHER_MAX];
+} PagingGather;
+
+static void PagingGatherFlush(PagingGather *gather) {
+  if (gather->end) {
+    // freed kernel tables might be cached under any PCID
+    size_t pages = (gather->end - gather->start) / PAGE_SIZE;
+    if (gather->tables && PagingKernelHalf(gather->start))
+      pages = 0;
+    PagingFlushRange(gather->pagedir, gather->start, pages);
+  }
+
+  for (size_t i = 0; i < gather->cnt; i++) {
+    size_t entry = gather->entries[i];
+    size_t phys = entry & ~(PAGE_SIZE - 1);
+    switch (entry & (PAGE_SIZE - 1)) {
+    case PAGING_GATHER_FRAME:
+      PhysicalRelease(phys);
+      break;
+    case PAGING_GATHER_LARGE:
+      PhysicalReleaseLarge(phys);
+      break;
+    case PAGING_GATHER_TABLE:
+      PagingPhysFree((size_t *)(phys + HHDMoffset));
+      break;
+    }
+  }
+
+  gather->start = 0;
+  gather->end = 0;
+  gather->tables = false;
+  gather->cnt = 0;
+}
+
+// Marks a range whose (present) entries were changed
+static void PagingGatherRange(PagingGather *gather, uint64_t virt_addr,
+                              size_t pages) {
+  uint64_t end = virt_addr + pages * PAGE_SIZE;
+  if (!gather->end) {
+    gather->start = virt_addr;
+    gather->end = end;
+    return;
+  }
+  gather->start = MIN(gather->start, virt_addr);
+  gather->end = MAX(gather->end, end);
+}
 
-  return phys;
+// Same, with something to release past the flush. The entry has to be gone
+// from the table already.
+static void PagingGatherAdd(PagingGather *gather, uint64_t virt_addr,
+                            size_t pages, size_t phys, int kind) {
+  if (gather->cnt == PAGING_GATHER_MAX)
+    PagingGatherFlush(gather);
+  PagingGatherRange(gather, virt_addr, pages);
+  gather->entries[gather->cnt++] = phys | kind;
+  if (kind == PAGING_GATHER_TABLE)
+    gather->tables = true;
 }
 
-SpinlockCnt WLOCK_PAGING = {0};
+// Every page directory we allocate is a pml4 followed by whatever is kept per
+// address space, so nothing has to be looked up on the way to it
+typedef struct PagingSpace {
+  uint64_t    pml4[512];
+  SpinlockCnt WLOCK; // userland half
+} PagingSpace;
+
+#define PAGING_SPACE_PAGES DivRoundUp(sizeof(PagingSpace), PAGE_SIZE)
+
+// The kernel's half is shared by every page directory (past the top level), so
+// it goes by a lock of its own. So does the boot page directory, which isn't a
+// PagingSpace to begin with.
+SpinlockCnt WLOCK_PAGING_KERNEL = {0};
+
+static SpinlockCnt *PagingLock(uint64_t *pagedir, uint64_t virt_addr) {
+  if (PML4E(AMD64_MM_STRIPSX(virt_addr)) >= 256 ||
+      pagedir == pagingBootPagedir)
+    return &WLOCK_PAGING_KERNEL;
+  return &((PagingSpace *)pagedir)->WLOCK;
+}
+
+// Write side of PagingLock(). The kernel's tables are needed to grow the heap,
+// so whoever holds them can't wait on reclaim (see ReclaimBlock()).
+static void PagingLockAcquire(SpinlockCnt *lock) {
+  spinlockCntWriteAcquire(lock);
+  if (lock == &WLOCK_PAGING_KERNEL)
+    ReclaimBlock();
+}
+
+static bool PagingLockTryAcquire(SpinlockCnt *lock) {
+  if (!spinlockCntWriteTryAcquire(lock))
+    return false;
+  if (lock == &WLOCK_PAGING_KERNEL)
+    ReclaimBlock();
+  return true;
+}
+
+static void PagingLockRelease(SpinlockCnt *lock) {
+  if (lock == &WLOCK_PAGING_KERNEL)
+    ReclaimUnblock();
+  spinlockCntWriteRelease(lock);
+}
+
+// Top level entries copied off the kernel's page directory (see
+// PageDirectoryAllocate()) point to tables every address space has in common
+static bool PagingSharedEntry(uint64_t *pagedir, uint32_t pml4_index) {
+  return pml4_index >= 256 || pagedir == pagingBootPagedir ||
+         pagedir[pml4_index] == pagingBootPagedir[pml4_index];
+}
 
 void VirtualMap(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
   VirtualMapL(globalPagedir, virt_addr, phys_addr, flags);
 }
 
-void VirtualMapL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
-                 uint64_t flags) {
-  if (virt_addr % PAGE_SIZE) {
-    debugf("[paging] Tried to map non-aligned address! virt{%lx} phys{%lx}\n",
-           virt_addr, phys_addr);
-    panic();
+#define PAGING_LARGE_PAGES (PAGE_SIZE_LARGE / PAGE_SIZE)
+
+// PF_PS entries carry the PAT bit on bit 12, since bit 7 is the size bit there
+static uint64_t PagingLargeFlags(uint64_t flags) {
+  if (flags & PF_PAT)
+    flags = (flags & ~PF_PAT) | PF_PAT_LARGE;
+  return flags | PF_PS;
+}
+
+static uint64_t PagingSmallFlags(uint64_t flags) {
+  flags &= ~PF_PS;
+  if (flags & PF_PAT_LARGE)
+    flags = (flags & ~PF_PAT_LARGE) | PF_PAT;
+  return flags;
+}
+
+// Whether a range starting at virt_addr fully covers a 2MiB page
+static bool PagingCoversLarge(uint64_t virt_addr, size_t pages) {
+  return !(virt_addr % PAGE_SIZE_LARGE) && pages >= PAGING_LARGE_PAGES;
+}
+
+static bool PagingTableEmpty(size_t *table) {
+  for (int i = 0; i < 512; i++) {
+    if (table[i])
+      return false;
   }
-  virt_addr = AMD64_MM_STRIPSX(virt_addr);
+  return true;
+}
 
+// Returns the page directory entry for virt_addr, allocating any missing
+// levels on the way there (needs PagingLock() held for writing)
+static size_t *PagingWalkCreateLarge(uint64_t *pagedir, uint64_t virt_addr) {
   uint32_t pml4_index = PML4E(virt_addr);
   uint32_t pdp_index = PDPTE(virt_addr);
   uint32_t pd_index = PDE(virt_addr);
-  uint32_t pt_index = PTE(virt_addr);
 
-  spinlockCntWriteAcquire(&WLOCK_PAGING);
   if (!(pagedir[pml4_index] & PF_PRESENT)) {
     size_t target = PagingPhysAllocate();
     pagedir[pml4_index] = target | PF_PRESENT | PF_RW | PF_USER;
@@ -181,34 +607,263 @@ void VirtualMapL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
   }
   size_t *pd = (size_t *)(PTE_GET_ADDR(pdp[pdp_index]) + HHDMoffset);
 
-  if (!(pd[pd_index] & PF_PRESENT)) {
+  return &pd[pd_index];
+}
+
+// Returns the page directory entry for virt_addr if it's a 2MiB one (present
+// or just reserved), 0 otherwise
+static size_t *PagingWalkLarge(uint64_t *pagedir, uint64_t virt_addr) {
+  virt_addr = AMD64_MM_STRIPSX(virt_addr);
+
+  if (!(pagedir[PML4E(virt_addr)] & PF_PRESENT) ||
+      pagedir[PML4E(virt_addr)] & PF_PS)
+    return 0;
+  size_t *pdp =
+      (size_t *)(PTE_GET_ADDR(pagedir[PML4E(virt_addr)]) + HHDMoffset);
+
+  if (!(pdp[PDPTE(virt_addr)] & PF_PRESENT) || pdp[PDPTE(virt_addr)] & PF_PS)
+    return 0;
+  size_t *pd = (size_t *)(PTE_GET_ADDR(pdp[PDPTE(virt_addr)]) + HHDMoffset);
+
+  return pd[PDE(virt_addr)] & PF_PS ? &pd[PDE(virt_addr)] : 0;
+}
+
+// Breaks a 2MiB entry (present or reserved) down to a table of 512 small ones,
+// for anything that only touches part of it. Frames are already refcounted
+// one by one (see PhysicalShareLarge()), so nothing changes on their side.
+// Returns false if no table could be allocated without waiting.
+static bool PagingSplitLarge(uint64_t *pagedir, size_t *pde,
+                             uint64_t virt_addr, bool wait) {
+  size_t table = wait ? PhysicalAllocate(1) : PhysicalAllocateTry(1);
+  if (!table)
+    return false;
+  __atomic_add_fetch(&pagingTables, 1, __ATOMIC_RELAXED);
+  size_t *pt = (size_t *)(table + HHDMoffset);
+
+  uint64_t flags = PagingSmallFlags(PTE_GET_FLAGS_LARGE(*pde));
+  if (*pde & PF_PRESENT) {
+    size_t phys = PTE_GET_ADDR_LARGE(*pde);
+    for (int i = 0; i < 512; i++)
+      pt[i] = (phys + i * PAGE_SIZE) | flags;
+    if (*pde & PF_USER)
+      pagingLargeMappings--;
+  } else {
+    for (int i = 0; i < 512; i++)
+      pt[i] = flags;
+  }
+
+  *pde = table | PF_PRESENT | PF_RW | PF_USER;
+  PagingInvalidate(pagedir, virt_addr & ~(PAGE_SIZE_LARGE - 1));
+  return true;
+}
+
+// Returns the page table entry for virt_addr, allocating any missing tables on
+// the way there & splitting 2MiB pages (needs PagingLock() held for writing)
+static size_t *PagingWalkCreate(uint64_t *pagedir, uint64_t virt_addr) {
+  size_t *pde = PagingWalkCreateLarge(pagedir, virt_addr);
+  if (*pde & PF_PS)
+    PagingSplitLarge(pagedir, pde, virt_addr, true);
+
+  if (!(*pde & PF_PRESENT)) {
     size_t target = PagingPhysAllocate();
-    pd[pd_index] = target | PF_PRESENT | PF_RW | PF_USER;
+    *pde = target | PF_PRESENT | PF_RW | PF_USER;
   }
-  size_t *pt = (size_t *)(PTE_GET_ADDR(pd[pd_index]) + HHDMoffset);
+  size_t *pt = (size_t *)(PTE_GET_ADDR(*pde) + HHDMoffset);
+
+  return &pt[PTE(virt_addr)];
+}
+
+// The kernel's half is the same everywhere, so it can outlive cr3 loads
+static uint64_t PagingLeafFlags(uint64_t virt_addr, uint64_t flags) {
+  if (!(flags & PF_USER) && PML4E(virt_addr) >= 256)
+    flags |= PF_GLOBAL;
+  return flags;
+}
+
+// Consecutive pages mostly share a page table, so range operations only walk
+// down from the root once per table (needs PagingLock() held for writing)
+typedef struct PagingCursor {
+  uint64_t *pagedir;
+  uint64_t  base;
+  size_t   *pt;
+} PagingCursor;
+
+static size_t *PagingCursorCreate(PagingCursor *cursor, uint64_t virt_addr) {
+  uint64_t base = virt_addr & ~(PAGE_SIZE_LARGE - 1);
+  if (!cursor->pt || cursor->base != base) {
+    cursor->pt = PagingWalkCreate(cursor->pagedir, base);
+    cursor->base = base;
+  }
+  return &cursor->pt[PTE(virt_addr)];
+}
 
-  if (pt[pt_index] & PF_PRESENT) {
-    PhysicalFree(PTE_GET_ADDR(pt[pt_index]), 1);
+static void PagingMapRange(uint64_t *pagedir, uint64_t virt_addr,
+                           uint64_t phys_addr, size_t pages, uint64_t flags,
+                           bool populate) {
+  if (virt_addr % PAGE_SIZE) {
+    debugf("[paging] Tried to map non-aligned range! virt{%lx} phys{%lx}\n",
+           virt_addr, phys_addr);
+    panic();
+  }
+  virt_addr = AMD64_MM_STRIPSX(virt_addr);
+
+  SpinlockCnt *lock = PagingLock(pagedir, virt_addr);
+  PagingLockAcquire(lock);
+  PagingCursor cursor = {.pagedir = pagedir};
+  PagingGather gather = {.pagedir = pagedir};
+  for (size_t i = 0; i < pages; i++) {
+    uint64_t virt = virt_addr + i * PAGE_SIZE;
+    size_t  *pte = PagingCursorCreate(&cursor, virt);
+    size_t   old = *pte;
+
+    uint64_t phys = phys_addr + i * PAGE_SIZE;
+    if (populate) {
+      if (old & PF_PRESENT)
+        continue;
+      phys = PhysicalAllocateFlags(1, PHYSICAL_ZERO);
+    }
+
+    *pte = P_PHYS_ADDR(phys) | PF_PRESENT | PagingLeafFlags(virt, flags);
+    if (old & PF_PRESENT)
+      PagingGatherAdd(&gather, virt, 1, PTE_GET_ADDR(old),
+                      PAGING_GATHER_FRAME);
+  }
+
+  PagingGatherFlush(&gather);
+  PagingLockRelease(lock);
+}
+
+// Maps a physically contiguous range in one go: the lock is taken once, tables
+// are walked once each & the TLB only gets flushed (once) if anything present
+// was replaced
+void VirtualMapRangeL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
+                      size_t pages, uint64_t flags) {
+  PagingMapRange(pagedir, virt_addr, phys_addr, pages, flags, false);
+}
+
+// Same, but backs every page that isn't present yet with a fresh (zeroed)
+// frame of its own
+void VirtualPopulateRangeL(uint64_t *pagedir, uint64_t virt_addr, size_t pages,
+                           uint64_t flags) {
+  PagingMapRange(pagedir, virt_addr, 0, pages, flags, true);
+}
+
+void VirtualMapL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
+                 uint64_t flags) {
+  if (virt_addr % PAGE_SIZE) {
+    debugf("[paging] Tried to map non-aligned address! virt{%lx} phys{%lx}\n",
+           virt_addr, phys_addr);
+    panic();
+  }
+  virt_addr = AMD64_MM_STRIPSX(virt_addr);
+
+  SpinlockCnt *lock = PagingLock(pagedir, virt_addr);
+  PagingLockAcquire(lock);
+  size_t *pte = PagingWalkCreate(pagedir, virt_addr);
+  size_t  old = *pte;
+
+  *pte = (P_PHYS_ADDR(phys_addr)) | PF_PRESENT |
+         PagingLeafFlags(virt_addr, flags); // | PF_RW
+
+  PagingInvalidate(pagedir, virt_addr);
+  if (old & PF_PRESENT) {
+    PhysicalRelease(PTE_GET_ADDR(old));
     // debugf("[paging] Overwrite (without unmapping) WARN! virt{%lx}
     // phys{%lx}\n",
     //        virt_addr, phys_addr);
   }
-  pt[pt_index] = (P_PHYS_ADDR(phys_addr)) | PF_PRESENT | flags; // | PF_RW
-
-  invalidate(virt_addr);
-  spinlockCntWriteRelease(&WLOCK_PAGING);
+  PagingLockRelease(lock);
 #if ELF_DEBUG
   debugf("[paging] Mapped virt{%lx} to phys{%lx}\n", virt_addr, phys_addr);
 #endif
 }
 
-size_t VirtualToPhysical(size_t virt_addr) {
-  if (!globalPagedir)
-    return 0;
+// Maps a whole 2MiB page through a single directory entry, both addresses have
+// to be aligned to that. Returns false if anything is already mapped in there.
+bool VirtualMapLargeL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
+                      uint64_t flags) {
+  if (virt_addr % PAGE_SIZE_LARGE || phys_addr % PAGE_SIZE_LARGE) {
+    debugf("[paging] Tried to map non-aligned large page! virt{%lx} "
+           "phys{%lx}\n",
+           virt_addr, phys_addr);
+    panic();
+  }
+  virt_addr = AMD64_MM_STRIPSX(virt_addr);
 
-  if (virt_addr >= HHDMoffset && virt_addr <= (HHDMoffset + bootloader.mmTotal))
-    return virt_addr - HHDMoffset;
+  SpinlockCnt *lock = PagingLock(pagedir, virt_addr);
+  PagingLockAcquire(lock);
+  size_t *pde = PagingWalkCreateLarge(pagedir, virt_addr);
+  size_t *empty = 0;
+  if (*pde & PF_PRESENT) {
+    size_t *pt = (size_t *)(PTE_GET_ADDR(*pde) + HHDMoffset);
+    if (*pde & PF_PS || !PagingTableEmpty(pt)) {
+      PagingLockRelease(lock);
+      return false;
+    }
+    empty = pt;
+  }
+
+  *pde = P_PHYS_ADDR(phys_addr) | PF_PRESENT | PagingLargeFlags(flags);
+  if (flags & PF_USER)
+    pagingLargeMappings++;
+
+  PagingInvalidate(pagedir, virt_addr);
+  if (empty)
+    PagingPhysFree(empty);
+  PagingLockRelease(lock);
+  return true;
+}
+
+bool VirtualMapLarge(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
+  return VirtualMapLargeL(globalPagedir, virt_addr, phys_addr, flags);
+}
+
+// Reserves a region without backing it by anything yet. The first access will
+// either map the zero page (reads) or a fresh frame (writes) through
+// PagingHandleFault(). Already present pages are left untouched. Anonymous
+// chunks covering a whole (aligned) 2MiB page are reserved as a huge one.
+void VirtualMapDemandL(uint64_t *pagedir, uint64_t virt_addr, size_t pages,
+                       uint64_t flags) {
+  if (virt_addr % PAGE_SIZE) {
+    debugf("[paging] Tried to reserve non-aligned address! virt{%lx}\n",
+           virt_addr);
+    panic();
+  }
+  virt_addr = AMD64_MM_STRIPSX(virt_addr);
+
+  SpinlockCnt *lock = PagingLock(pagedir, virt_addr);
+  PagingLockAcquire(lock);
+  PagingCursor cursor = {.pagedir = pagedir};
+  size_t       i = 0;
+  while (i < pages) {
+    uint64_t virt = virt_addr + i * PAGE_SIZE;
+    if (!(flags & PF_FILE) && PagingCoversLarge(virt, pages - i)) {
+      size_t *pde = PagingWalkCreateLarge(pagedir, virt);
+      if (!*pde)
+        *pde = PagingLargeFlags(flags & ~PF_PRESENT) | PF_DEMAND;
+      if (*pde & PF_PS) {
+        i += PAGING_LARGE_PAGES;
+        continue;
+      }
+    }
+
+    size_t *pte = PagingCursorCreate(&cursor, virt);
+    if (!(*pte & PF_PRESENT) && !(*pte & (PF_DEMAND | PF_SWAP)))
+      *pte = (flags & ~PF_PRESENT) | PF_DEMAND;
+    i++;
+  }
+  PagingLockRelease(lock);
+}
+
+void VirtualMapDemand(uint64_t virt_addr, size_t pages, uint64_t flags) {
+  VirtualMapDemandL(globalPagedir, virt_addr, pages, flags);
+}
+
+size_t VirtualToPhysical(size_t virt_addr) {
+  return VirtualToPhysicalL(globalPagedir, virt_addr);
+}
 
+static size_t PagingTranslate(uint64_t *pagedir, size_t virt_addr) {
   size_t virt_addr_init = virt_addr;
   virt_addr &= ~0xFFF;
 
@@ -219,39 +874,59 @@ size_t VirtualToPhysical(size_t virt_addr) {
   uint32_t pd_index = PDE(virt_addr);
   uint32_t pt_index = PTE(virt_addr);
 
-  spinlockCntReadAcquire(&WLOCK_PAGING);
-  if (!(globalPagedir[pml4_index] & PF_PRESENT))
-    goto error;
-  /*else if (globalPagedir[pml4_index] & PF_PRESENT &&
-           globalPagedir[pml4_index] & PF_PS)
-    return (void *)(PTE_GET_ADDR(globalPagedir[pml4_index] +
+  if (!(pagedir[pml4_index] & PF_PRESENT))
+    return 0;
+  /*else if (pagedir[pml4_index] & PF_PRESENT && pagedir[pml4_index] & PF_PS)
+    return (void *)(PTE_GET_ADDR(pagedir[pml4_index] +
                                  (virt_addr & PAGE_MASK(12 + 9 + 9 + 9))));*/
-  size_t *pdp =
-      (size_t *)(PTE_GET_ADDR(globalPagedir[pml4_index]) + HHDMoffset);
+  size_t *pdp = (size_t *)(PTE_GET_ADDR(pagedir[pml4_index]) + HHDMoffset);
 
   if (!(pdp[pdp_index] & PF_PRESENT))
-    goto error;
-  /*else if (pdp[pdp_index] & PF_PRESENT && pdp[pdp_index] & PF_PS)
-    return (void *)(PTE_GET_ADDR(pdp[pdp_index] +
-                                 (virt_addr & PAGE_MASK(12 + 9 + 9))));*/
+    return 0;
+  else if (pdp[pdp_index] & PF_PS)
+    return (size_t)((PTE_GET_ADDR(pdp[pdp_index]) & ~PAGE_MASK(12 + 9 + 9)) +
+                    (virt_addr_init & PAGE_MASK(12 + 9 + 9)));
   size_t *pd = (size_t *)(PTE_GET_ADDR(pdp[pdp_index]) + HHDMoffset);
 
   if (!(pd[pd_index] & PF_PRESENT))
-    goto error;
-  /*else if (pd[pd_index] & PF_PRESENT && pd[pd_index] & PF_PS)
-    return (
-        void *)(PTE_GET_ADDR(pd[pd_index] + (virt_addr & PAGE_MASK(12 + 9))));*/
+    return 0;
+  else if (pd[pd_index] & PF_PS)
+    return (size_t)(PTE_GET_ADDR_LARGE(pd[pd_index]) +
+                    (virt_addr_init & PAGE_MASK(12 + 9)));
   size_t *pt = (size_t *)(PTE_GET_ADDR(pd[pd_index]) + HHDMoffset);
 
-  if (pt[pt_index] & PF_PRESENT) {
-    spinlockCntReadRelease(&WLOCK_PAGING);
-    return (size_t)(PTE_GET_ADDR(pt[pt_index]) +
-                    ((size_t)virt_addr_init & 0xFFF));
+  if (!(pt[pt_index] & PF_PRESENT))
+    return 0;
+  return (size_t)(PTE_GET_ADDR(pt[pt_index]) +
+                  ((size_t)virt_addr_init & 0xFFF));
+}
+
+// Walks of the current page directory & of the kernel's half go without any
+// locks: tables are only ever freed past a flush (PagingGatherFlush()) that
+// every cpu with them loaded has to acknowledge, which can't happen while
+// we're halfway through with interrupts off. Anything else takes the address
+// space's lock, like before.
+size_t VirtualToPhysicalL(uint64_t *pagedir, size_t virt_addr) {
+  if (!pagedir)
+    return 0;
+
+  if (virt_addr >= HHDMoffset && virt_addr <= (HHDMoffset + bootloader.mmTotal))
+    return virt_addr - HHDMoffset;
+
+  if (pagedir != globalPagedir && PML4E(AMD64_MM_STRIPSX(virt_addr)) < 256) {
+    SpinlockCnt *lock = PagingLock(pagedir, virt_addr);
+    spinlockCntReadAcquire(lock);
+    size_t ret = PagingTranslate(pagedir, virt_addr);
+    spinlockCntReadRelease(lock);
+    return ret;
   }
 
-error:
-  spinlockCntReadRelease(&WLOCK_PAGING);
-  return 0;
+  bool interrupts = checkInterrupts();
+  asm volatile("cli");
+  size_t ret = PagingTranslate(pagedir, virt_addr);
+  if (interrupts)
+    asm volatile("sti");
+  return ret;
 }
 
 uint32_t VirtualUnmap(uint32_t virt_addr) {
@@ -264,24 +939,32 @@ uint64_t *PageDirectoryAllocate() {
     debugf("[paging] FATAL! Tried to allocate pd without tasks initiated!\n");
     panic();
   }
-  uint64_t *out = VirtualAllocate(1);
-
-  memset(out, 0, PAGE_SIZE);
+  PagingSpace *space = (PagingSpace *)VirtualAllocate(PAGING_SPACE_PAGES);
+  memset(space, 0, sizeof(PagingSpace));
+  uint64_t *out = space->pml4;
+  __atomic_add_fetch(&pagingTables, 1, __ATOMIC_RELAXED);
 
   uint64_t *model = taskGet(KERNEL_TASK_ID)->pagedir;
   for (int i = 0; i < 512; i++)
     out[i] = model[i];
 
+  // might be on the same address (& thus tag) as a previously freed one
+  PagingPcidStale(out, 0);
+
   return out;
 }
 
-// todo: clear orphans after a whole page level is emptied!
-// destroys any userland stuff on the page directory
+// Destroys any userland stuff on the page directory, the tables that held it
+// included. The pml4 itself might still be on cr3 (dying tasks free their own)
+// so it's left for PageDirectoryDestroy().
 void PageDirectoryFree(uint64_t *page_dir) {
-  spinlockCntWriteAcquire(&WLOCK_PAGING);
+  SpinlockCnt *lock = PagingLock(page_dir, 0);
+  PagingLockAcquire(lock);
 
-  for (int pml4_index = 0; pml4_index < 512; pml4_index++) {
-    if (!(page_dir[pml4_index] & PF_PRESENT) || page_dir[pml4_index] & PF_PS)
+  // the kernel's half is shared & holds nothing of userland's
+  for (int pml4_index = 0; pml4_index < 256; pml4_index++) {
+    if (!(page_dir[pml4_index] & PF_PRESENT) || page_dir[pml4_index] & PF_PS ||
+        PagingSharedEntry(page_dir, pml4_index))
       continue;
     size_t *pdp = (size_t *)(PTE_GET_ADDR(page_dir[pml4_index]) + HHDMoffset);
 
@@ -291,11 +974,23 @@ void PageDirectoryFree(uint64_t *page_dir) {
       size_t *pd = (size_t *)(PTE_GET_ADDR(pdp[pdp_index]) + HHDMoffset);
 
       for (int pd_index = 0; pd_index < 512; pd_index++) {
+        if (pd[pd_index] & PF_PRESENT && pd[pd_index] & PF_PS &&
+            pd[pd_index] & PF_USER) {
+          PhysicalReleaseLarge(PTE_GET_ADDR_LARGE(pd[pd_index]));
+          pagingLargeMappings--;
+          pd[pd_index] = 0;
+          continue;
+        }
         if (!(pd[pd_index] & PF_PRESENT) || pd[pd_index] & PF_PS)
           continue;
         size_t *pt = (size_t *)(PTE_GET_ADDR(pd[pd_index]) + HHDMoffset);
 
         for (int pt_index = 0; pt_index < 512; pt_index++) {
+          if (!(pt[pt_index] & PF_PRESENT) && pt[pt_index] & PF_SWAP) {
+            SwapSlotRelease(PTE_SWAP_SLOT(pt[pt_index]));
+            continue;
+          }
+
           if (!(pt[pt_index] & PF_PRESENT) || pt[pt_index] & PF_PS)
             continue;
 
@@ -303,19 +998,72 @@ void PageDirectoryFree(uint64_t *page_dir) {
           if (!(pt[pt_index] & PF_USER))
             continue;
 
-          uint64_t phys = PTE_GET_ADDR(pt[pt_index]);
-          PhysicalFree(phys, 1);
+          // copy-on-write frames might still be used by someone else
+          PhysicalRelease(PTE_GET_ADDR(pt[pt_index]));
         }
+
+        // the swapper might still come across the page directory
+        pd[pd_index] = 0;
+        PagingPhysFree(pt);
       }
+
+      pdp[pdp_index] = 0;
+      PagingPhysFree(pd);
     }
+
+    page_dir[pml4_index] = 0;
+    PagingPhysFree(pdp);
+  }
+
+  PagingLockRelease(lock);
+
+  // nothing stale may be walked through (or cached) past this point, by any cpu
+  PagingFlushRange(page_dir, 0, 0);
+}
+
+// Gives back the pml4 (& the rest of its PagingSpace) once PageDirectoryFree()
+// ran & nothing can be using it anymore
+void PageDirectoryDestroy(uint64_t *page_dir) {
+  VirtualFree(page_dir, PAGING_SPACE_PAGES);
+  __atomic_sub_fetch(&pagingTables, 1, __ATOMIC_RELAXED);
+}
+
+// PageDirectoryUserDuplicate() for 2MiB entries, called with the source's lock
+// held
+static void PagingDuplicateLarge(size_t *pde, size_t virt, uint64_t *target,
+                                 SpinlockCnt *lock) {
+  if (!(*pde & PF_PRESENT)) {
+    if (!(*pde & PF_DEMAND))
+      return;
+    uint64_t flags = PagingSmallFlags(PTE_GET_FLAGS_LARGE(*pde)) & ~PF_DEMAND;
+
+    PagingLockRelease(lock);
+    VirtualMapDemandL(target, virt, PAGING_LARGE_PAGES, flags);
+    PagingLockAcquire(lock);
+    return;
   }
 
-  spinlockCntWriteRelease(&WLOCK_PAGING);
+  if (!(*pde & PF_USER))
+    return;
+
+  size_t physSource = PTE_GET_ADDR_LARGE(*pde);
+  if (!(*pde & PF_SHARED) && *pde & PF_RW)
+    *pde = (*pde & ~PF_RW) | PF_COW;
+  PhysicalShareLarge(physSource);
+
+  uint64_t flags = PagingSmallFlags(PTE_GET_FLAGS_LARGE(*pde)) & ~PF_PRESENT;
+
+  PagingLockRelease(lock);
+  VirtualMapLargeL(target, virt, physSource, flags);
+  PagingLockAcquire(lock);
 }
 
+// Private pages are not copied, but shared read-only between the two page
+// directories until one of them writes (see PagingHandleFault())
 void PageDirectoryUserDuplicate(uint64_t *source, uint64_t *target) {
-  spinlockCntReadAcquire(&WLOCK_PAGING);
-  for (int pml4_index = 0; pml4_index < 512; pml4_index++) {
+  SpinlockCnt *lock = PagingLock(source, 0);
+  PagingLockAcquire(lock);
+  for (int pml4_index = 0; pml4_index < 256; pml4_index++) {
     if (!(source[pml4_index] & PF_PRESENT) || source[pml4_index] & PF_PS)
       continue;
     size_t *pdp = (size_t *)(PTE_GET_ADDR(source[pml4_index]) + HHDMoffset);
@@ -326,11 +1074,40 @@ void PageDirectoryUserDuplicate(uint64_t *source, uint64_t *target) {
       size_t *pd = (size_t *)(PTE_GET_ADDR(pdp[pdp_index]) + HHDMoffset);
 
       for (int pd_index = 0; pd_index < 512; pd_index++) {
-        if (!(pd[pd_index] & PF_PRESENT) || pd[pd_index] & PF_PS)
+        if (pd[pd_index] & PF_PS) {
+          PagingDuplicateLarge(&pd[pd_index],
+                               BITS_TO_VIRT_ADDR(pml4_index, pdp_index,
+                                                 pd_index, 0),
+                               target, lock);
+          continue;
+        }
+        if (!(pd[pd_index] & PF_PRESENT))
           continue;
         size_t *pt = (size_t *)(PTE_GET_ADDR(pd[pd_index]) + HHDMoffset);
 
         for (int pt_index = 0; pt_index < 512; pt_index++) {
+          // reserved but untouched regions have nothing to share yet
+          if (!(pt[pt_index] & PF_PRESENT) && pt[pt_index] & PF_DEMAND) {
+            size_t virt =
+                BITS_TO_VIRT_ADDR(pml4_index, pdp_index, pd_index, pt_index);
+            uint64_t flags = PTE_GET_FLAGS(pt[pt_index]) & ~PF_DEMAND;
+
+            PagingLockRelease(lock);
+            VirtualMapDemandL(target, virt, 1, flags);
+            PagingLockAcquire(lock);
+            continue;
+          }
+
+          // swapped out pages are read back privately by whoever touches
+          // them first, so both sides simply point to the same slot
+          if (!(pt[pt_index] & PF_PRESENT) && pt[pt_index] & PF_SWAP) {
+            size_t virt =
+                BITS_TO_VIRT_ADDR(pml4_index, pdp_index, pd_index, pt_index);
+            SwapSlotShare(PTE_SWAP_SLOT(pt[pt_index]));
+            *PagingWalkCreate(target, virt) = pt[pt_index];
+            continue;
+          }
+
           if (!(pt[pt_index] & PF_PRESENT) || pt[pt_index] & PF_PS)
             continue;
 
@@ -338,25 +1115,605 @@ void PageDirectoryUserDuplicate(uint64_t *source, uint64_t *target) {
           if (!(pt[pt_index] & PF_USER))
             continue;
 
+          // shared pages stay writable on both sides, yet they still need
+          // the extra reference (like everything else)
           size_t physSource = PTE_GET_ADDR(pt[pt_index]);
-          size_t physTarget =
-              (pt[pt_index] & PF_SHARED) ? physSource : PagingPhysAllocate();
+          if (!(pt[pt_index] & PF_SHARED) && pt[pt_index] & PF_RW)
+            pt[pt_index] = (pt[pt_index] & ~PF_RW) | PF_COW;
+          PhysicalShare(physSource);
 
           size_t virt =
               BITS_TO_VIRT_ADDR(pml4_index, pdp_index, pd_index, pt_index);
+          uint64_t flags = PTE_GET_FLAGS(pt[pt_index]) & ~PF_PRESENT;
+
+          PagingLockRelease(lock);
+          VirtualMapL(target, virt, physSource, flags);
+          PagingLockAcquire(lock);
+        }
+      }
+    }
+  }
 
-          void *ptrSource = (void *)(physSource + HHDMoffset);
-          void *ptrTarget = (void *)(physTarget + HHDMoffset);
+  PagingLockRelease(lock);
 
-          memcpy(ptrTarget, ptrSource, PAGE_SIZE);
+  // the source's writable entries just became read-only (threads of it might
+  // be running on other cpus too)
+  PagingFlushRange(source, 0, 0);
+}
 
-          spinlockCntReadRelease(&WLOCK_PAGING);
-          VirtualMapL(target, virt, physTarget, PF_RW | PF_USER);
-          spinlockCntReadAcquire(&WLOCK_PAGING);
-        }
+static size_t *PagingWalk(uint64_t *pagedir, uint64_t virt_addr) {
+  virt_addr = AMD64_MM_STRIPSX(virt_addr);
+
+  if (!(pagedir[PML4E(virt_addr)] & PF_PRESENT) ||
+      pagedir[PML4E(virt_addr)] & PF_PS)
+    return 0;
+  size_t *pdp =
+      (size_t *)(PTE_GET_ADDR(pagedir[PML4E(virt_addr)]) + HHDMoffset);
+
+  if (!(pdp[PDPTE(virt_addr)] & PF_PRESENT) || pdp[PDPTE(virt_addr)] & PF_PS)
+    return 0;
+  size_t *pd = (size_t *)(PTE_GET_ADDR(pdp[PDPTE(virt_addr)]) + HHDMoffset);
+
+  if (!(pd[PDE(virt_addr)] & PF_PRESENT) || pd[PDE(virt_addr)] & PF_PS)
+    return 0;
+  size_t *pt = (size_t *)(PTE_GET_ADDR(pd[PDE(virt_addr)]) + HHDMoffset);
+
+  return &pt[PTE(virt_addr)];
+}
+
+// Gives page tables, directories & PDPs that are left completely empty inside
+// a range back to the pmm (past the gather's flush). Shared PDPs (see
+// PagingSharedEntry()) are kept.
+static void PagingCollectTables(uint64_t *pagedir, uint64_t start,
+                                uint64_t end, PagingGather *gather) {
+  for (uint64_t curr = start & ~(PAGE_SIZE_LARGE - 1); curr < end;
+       curr += PAGE_SIZE_LARGE) {
+    if (!(pagedir[PML4E(curr)] & PF_PRESENT) || pagedir[PML4E(curr)] & PF_PS)
+      continue;
+    size_t *pdp = (size_t *)(PTE_GET_ADDR(pagedir[PML4E(curr)]) + HHDMoffset);
+
+    if (!(pdp[PDPTE(curr)] & PF_PRESENT) || pdp[PDPTE(curr)] & PF_PS)
+      continue;
+    size_t *pd = (size_t *)(PTE_GET_ADDR(pdp[PDPTE(curr)]) + HHDMoffset);
+
+    if (!(pd[PDE(curr)] & PF_PRESENT) || pd[PDE(curr)] & PF_PS)
+      continue;
+    size_t *pt = (size_t *)(PTE_GET_ADDR(pd[PDE(curr)]) + HHDMoffset);
+
+    if (!PagingTableEmpty(pt))
+      continue;
+    pd[PDE(curr)] = 0;
+    PagingGatherAdd(gather, curr, 1, (size_t)pt - HHDMoffset,
+                    PAGING_GATHER_TABLE);
+
+    if (!PagingTableEmpty(pd))
+      continue;
+    pdp[PDPTE(curr)] = 0;
+    PagingGatherAdd(gather, curr, 1, (size_t)pd - HHDMoffset,
+                    PAGING_GATHER_TABLE);
+
+    if (PagingSharedEntry(pagedir, PML4E(curr)) || !PagingTableEmpty(pdp))
+      continue;
+    pagedir[PML4E(curr)] = 0;
+    PagingGatherAdd(gather, curr, 1, (size_t)pdp - HHDMoffset,
+                    PAGING_GATHER_TABLE);
+  }
+}
+
+// Userland's half only ever holds userland's pages, anything else means an
+// unchecked (user supplied) range made it down here
+static void PagingUnmapCheck(uint64_t virt, size_t entry) {
+  if (virt >= USER_END || !(entry & PF_PRESENT) || entry & PF_USER)
+    return;
+  debugf("[paging] Unmapping a kernel page off userland's half: virt{%lx}\n",
+         virt);
+  panic();
+}
+
+// VirtualUnmapL() & VirtualUnmapTryL(), called with the lock held
+static void PagingUnmapRange(uint64_t *pagedir, uint64_t virt_addr,
+                             size_t pages, bool release) {
+  uint64_t end = virt_addr + pages * PAGE_SIZE;
+  if (virt_addr < USER_END && (end > USER_END || end < virt_addr)) {
+    debugf("[paging] Unmap crosses out of userland: virt{%lx} pages{%lx}\n",
+           virt_addr, pages);
+    panic();
+  }
+
+  PagingGather gather = {.pagedir = pagedir};
+  size_t       i = 0;
+  while (i < pages) {
+    uint64_t virt = virt_addr + i * PAGE_SIZE;
+    size_t  *pde = PagingWalkLarge(pagedir, virt);
+    if (pde && PagingCoversLarge(virt, pages - i)) {
+      size_t entry = *pde;
+      PagingUnmapCheck(virt, entry);
+      *pde = 0;
+      if (entry & PF_PRESENT && entry & PF_USER)
+        pagingLargeMappings--;
+      if (entry & PF_PRESENT && release)
+        PagingGatherAdd(&gather, virt, PAGING_LARGE_PAGES,
+                        PTE_GET_ADDR_LARGE(entry), PAGING_GATHER_LARGE);
+      else if (entry & PF_PRESENT)
+        PagingGatherRange(&gather, virt, PAGING_LARGE_PAGES);
+      i += PAGING_LARGE_PAGES;
+      continue;
+    } else if (pde)
+      PagingSplitLarge(pagedir, pde, virt, true);
+
+    size_t *pte = PagingWalk(pagedir, virt);
+    if (pte && *pte) {
+      size_t entry = *pte;
+      PagingUnmapCheck(virt, entry);
+      *pte = 0;
+      if (entry & PF_PRESENT && release)
+        PagingGatherAdd(&gather, virt, 1, PTE_GET_ADDR(entry),
+                        PAGING_GATHER_FRAME);
+      else if (entry & PF_PRESENT)
+        PagingGatherRange(&gather, virt, 1);
+      else if (entry & PF_SWAP)
+        SwapSlotRelease(PTE_SWAP_SLOT(entry));
+    }
+    i++;
+  }
+  PagingCollectTables(pagedir, virt_addr, virt_addr + pages * PAGE_SIZE,
+                      &gather);
+  PagingGatherFlush(&gather);
+}
+
+// Drops every mapping (and reservation) of the range. Frames are handed back
+// only when release is set, device memory (framebuffer) is never ours to free.
+void VirtualUnmapL(uint64_t *pagedir, uint64_t virt_addr, size_t pages,
+                   bool release) {
+  virt_addr = AMD64_MM_STRIPSX(virt_addr);
+
+  SpinlockCnt *lock = PagingLock(pagedir, virt_addr);
+  PagingLockAcquire(lock);
+  PagingUnmapRange(pagedir, virt_addr, pages, release);
+  PagingLockRelease(lock);
+}
+
+// Same, but gives up (returning false) instead of waiting on the lock. For the
+// kernel heap, which might be trimmed by the reclaim thread while someone who
+// holds the lock waits on it.
+bool VirtualUnmapTryL(uint64_t *pagedir, uint64_t virt_addr, size_t pages,
+                      bool release) {
+  virt_addr = AMD64_MM_STRIPSX(virt_addr);
+
+  SpinlockCnt *lock = PagingLock(pagedir, virt_addr);
+  if (!PagingLockTryAcquire(lock))
+    return false;
+  PagingUnmapRange(pagedir, virt_addr, pages, release);
+  PagingLockRelease(lock);
+  return true;
+}
+
+// Moves the entries themselves (not the data) to another range, which is
+// expected to be empty. Used by mremap().
+void VirtualMoveL(uint64_t *pagedir, uint64_t from, uint64_t to,
+                  size_t pages) {
+  from = AMD64_MM_STRIPSX(from);
+  to = AMD64_MM_STRIPSX(to);
+
+  SpinlockCnt *lock = PagingLock(pagedir, from);
+  PagingLockAcquire(lock);
+  for (size_t i = 0; i < pages; i++) {
+    // entries can only move one by one (the target isn't necessarily aligned)
+    size_t *pde = PagingWalkLarge(pagedir, from + i * PAGE_SIZE);
+    if (pde)
+      PagingSplitLarge(pagedir, pde, from + i * PAGE_SIZE, true);
+
+    size_t *source = PagingWalk(pagedir, from + i * PAGE_SIZE);
+    if (!source || !*source)
+      continue;
+
+    size_t *target = PagingWalkCreate(pagedir, to + i * PAGE_SIZE);
+    *target = *source;
+    *source = 0;
+    PagingInvalidate(pagedir, from + i * PAGE_SIZE);
+    PagingInvalidate(pagedir, to + i * PAGE_SIZE);
+  }
+
+  PagingGather gather = {.pagedir = pagedir};
+  PagingCollectTables(pagedir, from, from + pages * PAGE_SIZE, &gather);
+  PagingGatherFlush(&gather);
+  PagingLockRelease(lock);
+}
+
+// Throws away the contents of (private) pages, which return to being
+// demand-zero reservations. Used by madvise(MADV_DONTNEED).
+void VirtualDiscardL(uint64_t *pagedir, uint64_t virt_addr, size_t pages) {
+  virt_addr = AMD64_MM_STRIPSX(virt_addr);
+
+  SpinlockCnt *lock = PagingLock(pagedir, virt_addr);
+  PagingLockAcquire(lock);
+  PagingGather gather = {.pagedir = pagedir};
+  size_t       i = 0;
+  while (i < pages) {
+    uint64_t virt = virt_addr + i * PAGE_SIZE;
+    size_t  *pde = PagingWalkLarge(pagedir, virt);
+    if (pde && PagingCoversLarge(virt, pages - i)) {
+      if (*pde & PF_PRESENT && *pde & PF_USER) {
+        size_t   entry = *pde;
+        uint64_t flags = PTE_GET_FLAGS_LARGE(entry) &
+                         ~(PF_PRESENT | PF_ACCESS | PF_DIRTY);
+        if (flags & PF_COW)
+          flags = (flags & ~PF_COW) | PF_RW;
+
+        pagingLargeMappings--;
+        *pde = flags | PF_DEMAND;
+        PagingGatherAdd(&gather, virt, PAGING_LARGE_PAGES,
+                        PTE_GET_ADDR_LARGE(entry), PAGING_GATHER_LARGE);
       }
+      i += PAGING_LARGE_PAGES;
+      continue;
+    } else if (pde)
+      PagingSplitLarge(pagedir, pde, virt, true);
+
+    size_t *pte = PagingWalk(pagedir, virt);
+    bool    swapped = pte && !(*pte & PF_PRESENT) && *pte & PF_SWAP;
+    if (pte && ((*pte & PF_PRESENT && *pte & PF_USER) || swapped)) {
+      uint64_t flags = PTE_GET_FLAGS(*pte) &
+                       ~(PF_PRESENT | PF_ACCESS | PF_DIRTY | PF_SWAP);
+      if (flags & PF_COW)
+        flags = (flags & ~PF_COW) | PF_RW;
+
+      size_t entry = *pte;
+      *pte = flags | PF_DEMAND;
+      if (swapped)
+        SwapSlotRelease(PTE_SWAP_SLOT(entry));
+      else
+        PagingGatherAdd(&gather, virt, 1, PTE_GET_ADDR(entry),
+                        PAGING_GATHER_FRAME);
     }
+    i++;
   }
+  PagingGatherFlush(&gather);
+  PagingLockRelease(lock);
+}
+
+// Returns the frame behind a present page that has been written to since the
+// last call (or 0 otherwise), clearing its dirty bit. Used for writeback.
+size_t VirtualCleanL(uint64_t *pagedir, uint64_t virt_addr) {
+  size_t ret = 0;
+
+  SpinlockCnt *lock = PagingLock(pagedir, virt_addr);
+  PagingLockAcquire(lock);
+  size_t *pte = PagingWalk(pagedir, virt_addr);
+  if (pte && *pte & PF_PRESENT && *pte & PF_DIRTY) {
+    *pte &= ~PF_DIRTY;
+    PagingInvalidate(pagedir, virt_addr);
+    ret = PTE_GET_ADDR(*pte);
+  }
+  PagingLockRelease(lock);
+
+  return ret;
+}
+
+// Populates a (PF_FILE) reservation with a frame the page cache handed us.
+// Returns false if somebody else got to it first, or if it's gone altogether.
+bool VirtualFillL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
+                  uint64_t flags) {
+  bool ret = false;
+
+  SpinlockCnt *lock = PagingLock(pagedir, virt_addr);
+  PagingLockAcquire(lock);
+  size_t *pte = PagingWalk(pagedir, virt_addr);
+  if (pte && !(*pte & PF_PRESENT) && *pte & PF_DEMAND && *pte & PF_FILE) {
+    *pte = phys_addr | flags | PF_PRESENT;
+    PagingInvalidate(pagedir, virt_addr);
+    ret = true;
+  }
+  PagingLockRelease(lock);
+
+  return ret;
+}
+
+// Private, present userland pages that nobody else maps, the only kind that
+// can be swapped out
+static bool PagingSwappable(uint64_t entry) {
+  return entry & PF_PRESENT && entry & PF_USER && !(entry & PF_SHARED) &&
+         PhysicalPrivate(PTE_GET_ADDR(entry));
+}
+
+// One step of the swapper's clock: goes through (at most PAGING_SWAP_SCAN)
+// userland entries starting at *cursor, clearing accessed bits along the way,
+// until it finds a swappable page that wasn't touched since the last pass.
+// Its contents are copied to buff & the entry starts pointing to the slot.
+// Like Linux, the TLB isn't flushed for the accessed bits, a stale entry only
+// makes a page look colder than it actually is.
+PAGING_SWAP VirtualSwapOutL(uint64_t *pagedir, uint64_t *cursor, size_t slot,
+                            void *buff) {
+  // the swapper can't wait on whoever might be waiting for it
+  SpinlockCnt *lock = PagingLock(pagedir, 0);
+  if (!PagingLockTryAcquire(lock))
+    return PAGING_SWAP_BUSY;
+
+  PAGING_SWAP ret = PAGING_SWAP_NONE;
+  uint64_t    virt = *cursor;
+  for (size_t budget = PAGING_SWAP_SCAN; budget && virt < USER_STACK_BOTTOM;
+       budget--) {
+    if (!(pagedir[PML4E(virt)] & PF_PRESENT) ||
+        pagedir[PML4E(virt)] & PF_PS) {
+      virt = (virt | ((1ULL << PGSHIFT_PML4E) - 1)) + 1;
+      continue;
+    }
+    size_t *pdp = (size_t *)(PTE_GET_ADDR(pagedir[PML4E(virt)]) + HHDMoffset);
+
+    if (!(pdp[PDPTE(virt)] & PF_PRESENT) || pdp[PDPTE(virt)] & PF_PS) {
+      virt = (virt | ((1ULL << PGSHIFT_PDPTE) - 1)) + 1;
+      continue;
+    }
+    size_t *pd = (size_t *)(PTE_GET_ADDR(pdp[PDPTE(virt)]) + HHDMoffset);
+
+    // huge pages are left alone
+    if (!(pd[PDE(virt)] & PF_PRESENT) || pd[PDE(virt)] & PF_PS) {
+      virt = (virt | (PAGE_SIZE_LARGE - 1)) + 1;
+      continue;
+    }
+    size_t *pt = (size_t *)(PTE_GET_ADDR(pd[PDE(virt)]) + HHDMoffset);
+
+    size_t  *pte = &pt[PTE(virt)];
+    uint64_t page = virt;
+    virt += PAGE_SIZE;
+    if (!PagingSwappable(*pte))
+      continue;
+    if (*pte & PF_ACCESS) {
+      *pte &= ~PF_ACCESS;
+      continue;
+    }
+
+    // nobody may write to it anymore by the time it's copied out
+    uint64_t phys = PTE_GET_ADDR(*pte);
+    *pte = (slot << PGSHIFT_PTE) |
+           (PTE_GET_FLAGS(*pte) & ~(PF_PRESENT | PF_ACCESS | PF_DIRTY)) |
+           PF_SWAP;
+    PagingInvalidate(pagedir, page);
+    memcpy(buff, (void *)(phys + HHDMoffset), PAGE_SIZE);
+    PhysicalRelease(phys);
+
+    ret = PAGING_SWAP_EVICTED;
+    break;
+  }
+  *cursor = virt;
+
+  PagingLockRelease(lock);
+  return ret;
+}
+
+// The swap entry behind a page (or 0 if it's not swapped out)
+uint64_t VirtualSwappedL(uint64_t *pagedir, uint64_t virt_addr) {
+  uint64_t ret = 0;
+
+  SpinlockCnt *lock = PagingLock(pagedir, virt_addr);
+  spinlockCntReadAcquire(lock);
+  size_t *pte = PagingWalk(pagedir, virt_addr);
+  if (pte && !(*pte & PF_PRESENT) && *pte & PF_SWAP)
+    ret = *pte;
+  spinlockCntReadRelease(lock);
+
+  return ret;
+}
+
+// Brings a swapped out page back on phys_addr, as long as its entry didn't
+// change in the meantime. The caller still owns the slot's reference.
+bool VirtualSwapInL(uint64_t *pagedir, uint64_t virt_addr, uint64_t entry,
+                    uint64_t phys_addr) {
+  bool ret = false;
+
+  SpinlockCnt *lock = PagingLock(pagedir, virt_addr);
+  PagingLockAcquire(lock);
+  size_t *pte = PagingWalk(pagedir, virt_addr);
+  if (pte && *pte == entry) {
+    *pte = phys_addr | (PTE_GET_FLAGS(entry) & ~PF_SWAP) | PF_PRESENT;
+    PagingInvalidate(pagedir, virt_addr);
+    ret = true;
+  }
+  PagingLockRelease(lock);
+
+  return ret;
+}
+
+// Splits a copy-on-write page on the first write to it. Only moving to the new
+// frame has to reach other cpus, a stale read-only entry over there just takes
+// a (spurious) fault.
+static bool PagingHandleCow(size_t *pte, uint64_t virt_addr) {
+  size_t physOld = PTE_GET_ADDR(*pte);
+  size_t flags = (PTE_GET_FLAGS(*pte) & ~PF_COW) | PF_RW;
+
+  if (!PhysicalShared(physOld)) {
+    // everyone else let go already, it's all ours
+    *pte = physOld | flags;
+    invalidate(virt_addr);
+    return true;
+  }
+
+  // the pmm is busy, have the instruction fault again later
+  bool   zero = physOld == pagingZeroPage;
+  size_t physNew =
+      PhysicalAllocateFlags(1, PHYSICAL_TRY | (zero ? PHYSICAL_ZERO : 0));
+  if (!physNew)
+    return true;
+  if (!zero)
+    memcpy((void *)(physNew + HHDMoffset), (void *)(physOld + HHDMoffset),
+           PAGE_SIZE);
+  *pte = physNew | flags;
+  PagingInvalidate(globalPagedir, virt_addr);
+
+  PhysicalRelease(physOld);
+  return true;
+}
+
+// Populates a reserved (PF_DEMAND) page on its first touch
+static PAGING_FAULT PagingHandleDemand(size_t *pte, uint64_t virt_addr,
+                                       uint64_t error) {
+  size_t flags = PTE_GET_FLAGS(*pte) & ~PF_DEMAND;
+
+  // the page cache might have to hit the disk (see VmaHandleFault())
+  if (flags & PF_FILE)
+    return PAGING_FAULT_DEFER;
+  if (error & PF_ERR_USER && !(flags & PF_USER))
+    return PAGING_FAULT_FATAL; // PROT_NONE
+
+  if (!(error & PF_ERR_WRITE)) {
+    // nobody wrote anything yet, so it's all zeroes anyway
+    if (flags & PF_RW)
+      flags = (flags & ~PF_RW) | PF_COW;
+    *pte = pagingZeroPage | PF_PRESENT | flags;
+    return PAGING_FAULT_HANDLED;
+  }
+
+  if (!(flags & PF_RW))
+    return PAGING_FAULT_FATAL;
+
+  size_t phys = PhysicalAllocateFlags(1, PHYSICAL_TRY | PHYSICAL_ZERO);
+  if (!phys)
+    return PAGING_FAULT_HANDLED;
+  *pte = phys | PF_PRESENT | flags;
+  return PAGING_FAULT_HANDLED;
+}
+
+// Faults on 2MiB entries: writable reservations get a whole huge page on their
+// first touch (if the pmm can spare one right away), copy-on-write ones that
+// are still shared are split & only the touched page gets copied
+static PAGING_FAULT PagingHandleLarge(size_t *pde, uint64_t virt_addr,
+                                      uint64_t error) {
+  bool demand = !(*pde & PF_PRESENT) && *pde & PF_DEMAND;
+  bool cow = *pde & PF_PRESENT && *pde & PF_COW && error & PF_ERR_PRESENT &&
+             error & PF_ERR_WRITE;
+  if (!demand && !cow)
+    return PAGING_FAULT_FATAL;
+
+  if (demand && *pde & PF_RW) {
+    size_t phys = PhysicalAllocateLargeTry();
+    if (phys) {
+      memset((void *)(phys + HHDMoffset), 0, PAGE_SIZE_LARGE);
+      *pde = phys | PF_PRESENT | (PTE_GET_FLAGS_LARGE(*pde) & ~PF_DEMAND);
+      pagingLargeMappings++;
+      return PAGING_FAULT_HANDLED;
+    }
+  }
+
+  if (cow) {
+    size_t phys = PTE_GET_ADDR_LARGE(*pde);
+    bool   shared = false;
+    for (size_t i = 0; i < PAGING_LARGE_PAGES; i++) {
+      if (PhysicalShared(phys + i * PAGE_SIZE)) {
+        shared = true;
+        break;
+      }
+    }
+
+    // everyone else let go already, it's all ours
+    if (!shared) {
+      *pde = (*pde & ~PF_COW) | PF_RW;
+      invalidate(virt_addr);
+      return PAGING_FAULT_HANDLED;
+    }
+  }
+
+  // the pmm is busy, have the instruction fault again later
+  if (!PagingSplitLarge(globalPagedir, pde, virt_addr, false))
+    return PAGING_FAULT_HANDLED;
+
+  size_t *pte = PagingWalk(globalPagedir, virt_addr);
+  if (demand)
+    return PagingHandleDemand(pte, virt_addr, error);
+  return PagingHandleCow(pte, virt_addr) ? PAGING_FAULT_HANDLED
+                                         : PAGING_FAULT_FATAL;
+}
+
+// The PF_RW & PF_USER bits every level above the leaf entry (a 2MiB one if
+// large) agrees on, as the cpu only permits what all of them do
+static size_t PagingWalkUpper(uint64_t *pagedir, uint64_t virt_addr,
+                              bool large) {
+  virt_addr = AMD64_MM_STRIPSX(virt_addr);
+
+  size_t  upper = pagedir[PML4E(virt_addr)];
+  size_t *pdp = (size_t *)(PTE_GET_ADDR(upper) + HHDMoffset);
+  upper &= pdp[PDPTE(virt_addr)];
+  if (!large) {
+    size_t *pd = (size_t *)(PTE_GET_ADDR(pdp[PDPTE(virt_addr)]) + HHDMoffset);
+    upper &= pd[PDE(virt_addr)];
+  }
+  return upper & (PF_RW | PF_USER);
+}
+
+// Whether the walk already allows the access that faulted. Reserved bits or
+// fetches off present pages (SMEP) aren't something a stale TLB explains.
+static bool PagingPermits(size_t entry, size_t upper, uint64_t error) {
+  if (error & PF_ERR_RSVD ||
+      (error & PF_ERR_FETCH && error & PF_ERR_PRESENT))
+    return false;
+
+  entry &= upper | ~(PF_RW | PF_USER);
+  return entry & PF_PRESENT && (!(error & PF_ERR_WRITE) || entry & PF_RW) &&
+         (!(error & PF_ERR_USER) || entry & PF_USER);
+}
+
+// PagingHandleFault() past the lock
+static PAGING_FAULT PagingHandleFaultLocked(uint64_t page, uint64_t error) {
+  PAGING_FAULT ret = PAGING_FAULT_FATAL;
+  size_t      *pte = PagingWalkLarge(globalPagedir, page);
+  bool         large = !!pte;
+  if (!large)
+    pte = PagingWalk(globalPagedir, page);
+  if (!pte)
+    return ret;
+
+  size_t entry = *pte;
+  size_t upper = PagingWalkUpper(globalPagedir, page, large);
+  if (PagingPermits(entry, upper, error)) {
+    // another cpu got to it first, our TLB is just behind
+    invalidate(page);
+    ret = PAGING_FAULT_HANDLED;
+  } else if (large)
+    ret = PagingHandleLarge(pte, page, error);
+  else if (!(*pte & PF_PRESENT) && *pte & PF_DEMAND)
+    ret = PagingHandleDemand(pte, page, error);
+  else if (!(*pte & PF_PRESENT) && *pte & PF_SWAP)
+    ret = PAGING_FAULT_DEFER; // has to be read back (see SwapHandleFault())
+  else if (*pte & PF_PRESENT && *pte & PF_COW && error & PF_ERR_PRESENT &&
+           error & PF_ERR_WRITE)
+    ret = PagingHandleCow(pte, page) ? PAGING_FAULT_HANDLED
+                                     : PAGING_FAULT_FATAL;
+
+  if (ret == PAGING_FAULT_HANDLED && *pte != entry)
+    currentTask->minorFaults++;
+  return ret;
+}
+
+// Called by the #PF handler before giving up on the faulting task. We're inside
+// an interrupt and can't wait on the lock, whoever holds it might even be
+// preempted on this very cpu. Faults that came with interrupts on go through
+// PagingHandleFaultWait() outside of the isr instead (see isrDeferFault()),
+// ones without them can't be resumed at all.
+PAGING_FAULT PagingHandleFault(uint64_t virt_addr, uint64_t error, bool ints) {
+  if (!tasksInitiated)
+    return PAGING_FAULT_FATAL;
+
+  uint64_t     page = virt_addr & ~0xFFF;
+  SpinlockCnt *lock = PagingLock(globalPagedir, page);
+  if (!PagingLockTryAcquire(lock)) {
+    PagingShootdownHandle();
+    if (!ints)
+      debugf("[paging] Fault with interrupts off on a busy lock! "
+             "virt{%lx}\n",
+             virt_addr);
+    return ints ? PAGING_FAULT_DEFER : PAGING_FAULT_FATAL;
+  }
+
+  PAGING_FAULT ret = PagingHandleFaultLocked(page, error);
+  PagingLockRelease(lock);
+  return ret;
+}
 
-  spinlockCntReadRelease(&WLOCK_PAGING);
+// Same as PagingHandleFault(), for task context (interrupts on)
+PAGING_FAULT PagingHandleFaultWait(uint64_t virt_addr, uint64_t error) {
+  uint64_t     page = virt_addr & ~0xFFF;
+  SpinlockCnt *lock = PagingLock(globalPagedir, page);
+  PagingLockAcquire(lock);
+  PAGING_FAULT ret = PagingHandleFaultLocked(page, error);
+  PagingLockRelease(lock);
+  return ret;
 }
@@ -1,6 +1,8 @@
 #include <bootloader.h>
 #include <paging.h>
 #include <pmm.h>
+#include <shrinker.h>
+#include <swap.h>
 #include <system.h>
 #include <util.h>
 #include <vmm.h>
@@ -8,74 +10,333 @@
 // Physical memory space manager/allocator
 // Copyright (C) 2024 Panagiotis
 
+// Extra references (past the first one) of every frame, used by frames that
+// are mapped on multiple places at once (copy-on-write and the like)
+uint16_t *physicalRefs = 0;
+
+#define PHYSICAL_PINNED 0xffff
+
 void initiatePMM() {
-  DS_Bitmap *bitmap = &physical; // pointer to pmm bitmap (used later)
-  bitmap->ready = false;         // for bitmap dependency of vmm
+  DS_Buddy *buddy = &physical; // pointer to pmm buddy (used later)
+  buddy->ready = false;        // for buddy dependency of vmm
+
+  // we have to cover the highest usable address, holes included
+  size_t top = 0;
+  for (int i = 0; i < bootloader.mmEntryCnt; i++) {
+    struct limine_memmap_entry *entry = bootloader.mmEntries[i];
+    if (entry->type == LIMINE_MEMMAP_USABLE &&
+        (entry->base + entry->length) > top)
+      top = entry->base + entry->length;
+  }
 
-  physical.BitmapSizeInBlocks = DivRoundUp(bootloader.mmTotal, BLOCK_SIZE);
-  physical.BitmapSizeInBytes = DivRoundUp(physical.BitmapSizeInBlocks, 8);
+  size_t blocks = DivRoundUp(top, BLOCK_SIZE);
+  size_t ordersSize = DivRoundUp(blocks, BLOCK_SIZE) * BLOCK_SIZE;
+  size_t refsSize =
+      DivRoundUp(blocks * sizeof(uint16_t), BLOCK_SIZE) * BLOCK_SIZE;
+  size_t metadataSize = ordersSize + refsSize;
 
   struct limine_memmap_entry *mm = 0;
 
   for (int i = 0; i < bootloader.mmEntryCnt; i++) {
     struct limine_memmap_entry *entry = bootloader.mmEntries[i];
-    if (entry->type != LIMINE_MEMMAP_USABLE ||
-        entry->length < physical.BitmapSizeInBytes)
+    if (entry->type != LIMINE_MEMMAP_USABLE || entry->length < metadataSize)
       continue;
     mm = entry;
     break;
   }
 
   if (!mm) {
-    debugf("[pmm] Not enough memory: required{%lx}!\n",
-           physical.BitmapSizeInBytes);
+    debugf("[pmm] Not enough memory: required{%lx}!\n", metadataSize);
     panic();
     return;
   }
 
-  size_t bitmapStartPhys = mm->base;
-  physical.Bitmap = (uint8_t *)(bitmapStartPhys + bootloader.hhdmOffset);
+  size_t ordersStartPhys = mm->base;
+  buddy->mem_start = 0;
+  BuddyInit(buddy, (uint8_t *)(ordersStartPhys + bootloader.hhdmOffset),
+            blocks, bootloader.hhdmOffset);
 
-  memset(physical.Bitmap, 0xff, physical.BitmapSizeInBytes);
-  for (int i = 0; i < bootloader.mmEntryCnt; i++) {
-    struct limine_memmap_entry *entry = bootloader.mmEntries[i];
-    if (entry->type == LIMINE_MEMMAP_USABLE)
-      MarkRegion(bitmap, (void *)entry->base, entry->length, 0);
-  }
+  physicalRefs =
+      (uint16_t *)(ordersStartPhys + ordersSize + bootloader.hhdmOffset);
+  // anything we don't hand out (framebuffer, kernel, etc) might still end up
+  // mapped to userland, but must never be freed by dropping said mappings
+  memset(physicalRefs, 0xff, refsSize);
+
+  // seed the free lists off the usable memmap entries, minus our own metadata
   for (int i = 0; i < bootloader.mmEntryCnt; i++) {
     struct limine_memmap_entry *entry = bootloader.mmEntries[i];
     if (entry->type != LIMINE_MEMMAP_USABLE)
-      MarkRegion(bitmap, (void *)entry->base, entry->length, 1);
-  }
+      continue;
 
-  MarkRegion(bitmap, (void *)bitmapStartPhys, physical.BitmapSizeInBytes, 1);
+    size_t start = DivRoundUp(entry->base, BLOCK_SIZE);
+    size_t end = (entry->base + entry->length) / BLOCK_SIZE;
+    if (entry == mm)
+      start += metadataSize / BLOCK_SIZE;
+    if (!start) // 0 is our "out of memory" value
+      start++;
+    if (end <= start)
+      continue;
+    BuddyFree(buddy, start, end - start);
+    memset(&physicalRefs[start], 0, (end - start) * sizeof(uint16_t));
+  }
 
-  debugf("[pmm] Bitmap initiated: bitmapStartPhys{0x%lx} size{%lx}\n",
-         bitmapStartPhys, physical.BitmapSizeInBytes);
+  debugf("[pmm] Buddy initiated: ordersStartPhys{0x%lx} size{%lx} "
+         "free{%ld}\n",
+         ordersStartPhys, metadataSize, buddy->freeBlocks);
 
-  // BitmapDumpBlocks(bitmap);
-  bitmap->ready = true;
+  // BuddyDump(buddy);
+  buddy->ready = true;
 }
 
+// Every cpu (& the page fault handler) goes through the allocator, so its
+// locks are only ever held with interrupts off (see spinlockIrqAcquire())
 Spinlock LOCK_PMM = ATOMIC_FLAG_INIT;
 
+static size_t PhysicalAllocateBlock(int pages) {
+  bool   ints = spinlockIrqAcquire(&LOCK_PMM);
+  size_t block = BuddyAllocate(&physical, pages);
+  spinlockIrqRelease(&LOCK_PMM, ints);
+
+  if (physical.freeBlocks < PHYSICAL_FREE_LOW)
+    ReclaimWake();
+  return block;
+}
+
 size_t PhysicalAllocate(int pages) {
-  spinlockAcquire(&LOCK_PMM);
-  size_t phys = (size_t)BitmapAllocate(&physical, pages);
-  spinlockRelease(&LOCK_PMM);
+  size_t block = PhysicalAllocateBlock(pages);
+
+  // pre-zeroed frames are still free memory
+  if (block == INVALID_BLOCK && PhysicalZeroPoolDrain())
+    block = PhysicalAllocateBlock(pages);
+
+  // sit through a few reclaim rounds (when we're allowed to) before giving up
+  for (int i = 0;
+       block == INVALID_BLOCK && i < RECLAIM_WAIT_ROUNDS && ReclaimWait(); i++)
+    block = PhysicalAllocateBlock(pages);
 
-  if (!phys) {
+  if (block == INVALID_BLOCK) {
     debugf("[vmm::alloc] Physical kernel memory ran out!\n");
     panic();
   }
 
-  return phys;
+  return physical.mem_start + block * BLOCK_SIZE;
+}
+
+// Same as PhysicalAllocate(), but returns 0 instead of waiting on the lock (or
+// the swapper, if there's any)
+size_t PhysicalAllocateTry(int pages) {
+  bool ints = false;
+  if (!spinlockIrqTryAcquire(&LOCK_PMM, &ints))
+    return 0;
+  size_t block = BuddyAllocate(&physical, pages);
+  spinlockIrqRelease(&LOCK_PMM, ints);
+
+  if (block == INVALID_BLOCK && PhysicalZeroPoolDrain() &&
+      spinlockIrqTryAcquire(&LOCK_PMM, &ints)) {
+    block = BuddyAllocate(&physical, pages);
+    spinlockIrqRelease(&LOCK_PMM, ints);
+  }
+
+  if (physical.freeBlocks < PHYSICAL_FREE_LOW)
+    ReclaimWake();
+
+  // faults simply retry once the swapper has made some room
+  if (block == INVALID_BLOCK && swapActive)
+    return 0;
+
+  if (block == INVALID_BLOCK) {
+    debugf("[vmm::alloc] Physical kernel memory ran out!\n");
+    panic();
+  }
+
+  return physical.mem_start + block * BLOCK_SIZE;
+}
+
+// A naturally aligned PAGE_SIZE_LARGE block for huge pages, which can always
+// fall back to small ones. Returns 0 if the pmm is busy or too fragmented.
+size_t PhysicalAllocateLargeTry() {
+  bool ints = false;
+  if (!spinlockIrqTryAcquire(&LOCK_PMM, &ints))
+    return 0;
+  size_t block = BuddyAllocate(&physical, PAGE_SIZE_LARGE / BLOCK_SIZE);
+  spinlockIrqRelease(&LOCK_PMM, ints);
+
+  if (block == INVALID_BLOCK)
+    return 0;
+  return physical.mem_start + block * BLOCK_SIZE;
 }
 
 void PhysicalFree(size_t ptr, int pages) {
-  // maybe verify no double-frees are occuring..
+  bool ints = spinlockIrqAcquire(&LOCK_PMM);
+  BuddyFree(&physical, (ptr - physical.mem_start) / BLOCK_SIZE, pages);
+  spinlockIrqRelease(&LOCK_PMM, ints);
+}
+
+static uint16_t *PhysicalRef(size_t ptr) {
+  size_t block = (ptr - physical.mem_start) / BLOCK_SIZE;
+  if (block >= physical.blocks)
+    return 0;
+  return &physicalRefs[block];
+}
+
+// Another mapping now points to this frame as well
+void PhysicalShare(size_t ptr) {
+  uint16_t *ref = PhysicalRef(ptr);
+  if (ref && __atomic_load_n(ref, __ATOMIC_SEQ_CST) != PHYSICAL_PINNED)
+    __atomic_fetch_add(ref, 1, __ATOMIC_SEQ_CST);
+}
+
+bool PhysicalShared(size_t ptr) {
+  uint16_t *ref = PhysicalRef(ptr);
+  return ref && __atomic_load_n(ref, __ATOMIC_SEQ_CST) > 0;
+}
+
+// Ours to hand out & mapped exactly once (swappable, if it's userland)
+bool PhysicalPrivate(size_t ptr) {
+  uint16_t *ref = PhysicalRef(ptr);
+  return ref && __atomic_load_n(ref, __ATOMIC_SEQ_CST) == 0;
+}
+
+// Drops a reference, actually freeing the frame when we were the last one
+bool PhysicalRelease(size_t ptr) {
+  uint16_t *ref = PhysicalRef(ptr);
+  if (!ref || __atomic_load_n(ref, __ATOMIC_SEQ_CST) == PHYSICAL_PINNED)
+    return false;
+
+  if (__atomic_fetch_sub(ref, 1, __ATOMIC_SEQ_CST) != 0)
+    return false;
+
+  __atomic_store_n(ref, 0, __ATOMIC_SEQ_CST);
+  PhysicalFree(ptr, 1);
+  return true;
+}
+
+// Huge pages keep every one of their frames refcounted, so that they can be
+// split back to small ones at any point (even while shared)
+void PhysicalShareLarge(size_t ptr) {
+  for (size_t i = 0; i < (PAGE_SIZE_LARGE / BLOCK_SIZE); i++)
+    PhysicalShare(ptr + i * BLOCK_SIZE);
+}
+
+bool PhysicalReleaseLarge(size_t ptr) {
+  bool shared = false;
+  for (size_t i = 0; i < (PAGE_SIZE_LARGE / BLOCK_SIZE); i++) {
+    if (PhysicalShared(ptr + i * BLOCK_SIZE)) {
+      shared = true;
+      break;
+    }
+  }
+
+  // nobody else is left to share it with, give it back in one go
+  if (!shared) {
+    PhysicalFree(ptr, PAGE_SIZE_LARGE / BLOCK_SIZE);
+    return true;
+  }
+
+  for (size_t i = 0; i < (PAGE_SIZE_LARGE / BLOCK_SIZE); i++)
+    PhysicalRelease(ptr + i * BLOCK_SIZE);
+  return false;
+}
+
+// Frames that are never to be freed (like the zero page), no matter how many
+// mappings point to them
+void PhysicalPin(size_t ptr) {
+  uint16_t *ref = PhysicalRef(ptr);
+  if (ref)
+    __atomic_store_n(ref, PHYSICAL_PINNED, __ATOMIC_SEQ_CST);
+}
+
+// Frames zeroed ahead of time by the zeroing thread (see kernel_helper.c),
+// whenever there's nothing better to do, so page faults & friends don't have
+// to clear them on their own latency path
+size_t   physicalZeroPool[PHYSICAL_ZERO_POOL] = {0};
+size_t   physicalZeroPoolCnt = 0;
+Spinlock LOCK_PMM_ZERO = ATOMIC_FLAG_INIT;
+
+size_t physicalZeroHits = 0;
+size_t physicalZeroMisses = 0;
+
+static size_t PhysicalZeroPoolTake(bool try) {
+  bool ints = false;
+  if (try) {
+    if (!spinlockIrqTryAcquire(&LOCK_PMM_ZERO, &ints))
+      return 0;
+  } else
+    ints = spinlockIrqAcquire(&LOCK_PMM_ZERO);
+
+  size_t phys = 0;
+  if (physicalZeroPoolCnt)
+    phys = physicalZeroPool[--physicalZeroPoolCnt];
+  spinlockIrqRelease(&LOCK_PMM_ZERO, ints);
+
+  return phys;
+}
+
+// PhysicalAllocate() with PHYSICAL_* flags. Zeroed single frames come off the
+// pool when possible. With PHYSICAL_TRY it returns 0 instead of waiting.
+size_t PhysicalAllocateFlags(int pages, uint32_t flags) {
+  bool try = flags & PHYSICAL_TRY;
+  if (flags & PHYSICAL_ZERO && pages == 1) {
+    size_t phys = PhysicalZeroPoolTake(try);
+    if (phys) {
+      __atomic_add_fetch(&physicalZeroHits, 1, __ATOMIC_RELAXED);
+      return phys;
+    }
+  }
+
+  size_t phys = try ? PhysicalAllocateTry(pages) : PhysicalAllocate(pages);
+  if (!phys)
+    return 0;
+
+  if (flags & PHYSICAL_ZERO) {
+    __atomic_add_fetch(&physicalZeroMisses, 1, __ATOMIC_RELAXED);
+    memset((void *)(phys + bootloader.hhdmOffset), 0, pages * BLOCK_SIZE);
+  }
+  return phys;
+}
+
+// Hands the whole pool back, for allocations that came up empty. Returns how
+// many frames that was.
+size_t PhysicalZeroPoolDrain() {
+  size_t drained = 0;
+  while (true) {
+    size_t phys = PhysicalZeroPoolTake(false);
+    if (!phys)
+      break;
+    PhysicalFree(phys, 1);
+    drained++;
+  }
+  return drained;
+}
+
+// No point in hoarding zeroed frames while memory is being reclaimed
+bool PhysicalZeroPoolWanted() {
+  return physicalZeroPoolCnt < PHYSICAL_ZERO_POOL &&
+         physical.freeBlocks > PHYSICAL_FREE_HIGH;
+}
+
+// Tops the pool up by (at most) batch frames, which get zeroed outside of any
+// locks. Returns whether the pool is full.
+bool PhysicalZeroPoolFill(size_t batch) {
+  for (size_t i = 0; i < batch; i++) {
+    if (physicalZeroPoolCnt >= PHYSICAL_ZERO_POOL)
+      return true;
+    if (physical.freeBlocks <= PHYSICAL_FREE_HIGH)
+      return false;
+
+    size_t phys = PhysicalAllocate(1);
+    memset((void *)(phys + bootloader.hhdmOffset), 0, PAGE_SIZE);
+
+    bool ints = spinlockIrqAcquire(&LOCK_PMM_ZERO);
+    if (physicalZeroPoolCnt < PHYSICAL_ZERO_POOL) {
+      physicalZeroPool[physicalZeroPoolCnt++] = phys;
+      phys = 0;
+    }
+    spinlockIrqRelease(&LOCK_PMM_ZERO, ints);
+
+    if (phys)
+      PhysicalFree(phys, 1);
+  }
 
-  spinlockAcquire(&LOCK_PMM);
-  MarkRegion(&physical, (void *)ptr, pages * BLOCK_SIZE, 0);
-  spinlockRelease(&LOCK_PMM);
+  return physicalZeroPoolCnt >= PHYSICAL_ZERO_POOL;
 }
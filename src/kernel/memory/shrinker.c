@@ -0,0 +1,156 @@
+#include <kernel_helper.h>
+#include <malloc.h>
+#include <malloc_glue.h>
+#include <pmm.h>
+#include <schedule.h>
+#include <shrinker.h>
+#include <swap.h>
+#include <system.h>
+#include <task.h>
+#include <timer.h>
+#include <util.h>
+
+// Memory reclaim: subsystems register shrinkers for whatever they could let go
+// of, which the reclaim thread goes through (by priority) whenever free memory
+// runs low, before resorting to swap.
+// Copyright (C) 2024 Panagiotis
+
+#define RECLAIM_DEBUG 0
+
+Shrinker *firstShrinker = 0;
+Spinlock  LOCK_SHRINKERS = {0};
+
+// Finished reclaim rounds (& whether the latest one got anywhere), for
+// ReclaimWait()
+size_t reclaimRounds = 0;
+size_t reclaimRoundFreed = 0;
+
+// Kept sorted by priority, equal ones in the order they came in
+Shrinker *ShrinkerRegister(char *name, int priority, ShrinkerCount count,
+                           ShrinkerScan scan, void *ctx) {
+  Shrinker *shrinker = (Shrinker *)malloc(sizeof(Shrinker));
+  memset(shrinker, 0, sizeof(Shrinker));
+  shrinker->name = name;
+  shrinker->priority = priority;
+  shrinker->count = count;
+  shrinker->scan = scan;
+  shrinker->ctx = ctx;
+
+  spinlockAcquire(&LOCK_SHRINKERS);
+  Shrinker **link = &firstShrinker;
+  while (*link && (*link)->priority <= priority)
+    link = &(*link)->next;
+  shrinker->next = *link;
+  *link = shrinker;
+  spinlockRelease(&LOCK_SHRINKERS);
+
+  return shrinker;
+}
+
+// Runs every shrinker in turn until we're past the high watermark. The heap
+// only hands frames back to the pmm when trimmed, hence the malloc_trim()s.
+// Returns the amount of objects freed.
+static size_t ShrinkerReclaim() {
+  size_t freed = 0;
+  spinlockAcquire(&LOCK_SHRINKERS);
+  for (Shrinker *browse = firstShrinker;
+       browse && physical.freeBlocks < PHYSICAL_FREE_HIGH;
+       browse = browse->next) {
+    while (physical.freeBlocks < PHYSICAL_FREE_HIGH) {
+      size_t target = MIN(browse->count(browse->ctx), SHRINKER_BATCH);
+      size_t done = target ? browse->scan(browse->ctx, target) : 0;
+      if (!done)
+        break;
+
+      browse->reclaimed += done;
+      freed += done;
+      malloc_trim_try(0);
+    }
+  }
+  spinlockRelease(&LOCK_SHRINKERS);
+
+  return freed;
+}
+
+// One round of the reclaim thread (see kernel_helper.c): shrinkers first, then
+// swap if that wasn't enough. Returns how much got freed (shrunk objects &
+// evicted pages alike).
+size_t ReclaimRound() {
+  size_t freed = ShrinkerReclaim();
+  if (physical.freeBlocks < PHYSICAL_FREE_HIGH)
+    freed += SwapReclaim();
+
+#if RECLAIM_DEBUG
+  debugf("[reclaim] Round done: freed{%ld} free{%ld}\n", freed,
+         physical.freeBlocks);
+#endif
+
+  __atomic_store_n(&reclaimRoundFreed, freed, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&reclaimRounds, 1, __ATOMIC_SEQ_CST);
+  return freed;
+}
+
+// Safe from anywhere (interrupts included), called by the pmm
+void ReclaimWake() {
+  if (reclaimHelperTask && reclaimHelperTask->state == TASK_STATE_IDLE)
+    scheduleWake(reclaimHelperTask);
+}
+
+// The heap's & the kernel page tables' locks are needed by reclaim itself
+// (shrinkers free() stuff, zram malloc()s, the heap gets trimmed), so whoever
+// holds either can't wait on it. Allocations under them fail right away.
+void ReclaimBlock() {
+  if (tasksInitiated)
+    currentTask->reclaimBlocked++;
+}
+
+void ReclaimUnblock() {
+  if (tasksInitiated && currentTask->reclaimBlocked)
+    currentTask->reclaimBlocked--;
+}
+
+// Sits through a whole reclaim round, for allocations that came up empty.
+// Returns false when that's not possible (interrupts, the reclaim thread
+// itself, locks it needs being held), when the round couldn't free anything
+// or when it took too long.
+bool ReclaimWait() {
+  if (!tasksInitiated || !checkInterrupts() ||
+      currentTask == reclaimHelperTask || currentTask->reclaimBlocked)
+    return false;
+
+  size_t   round = __atomic_load_n(&reclaimRounds, __ATOMIC_SEQ_CST);
+  uint64_t deadline = timerTicks + RECLAIM_WAIT_MS;
+  while (__atomic_load_n(&reclaimRounds, __ATOMIC_SEQ_CST) == round) {
+    if (timerTicks > deadline)
+      return false;
+    // a wakeup right before it went idle would've been lost
+    ReclaimWake();
+    handControl();
+  }
+
+  return __atomic_load_n(&reclaimRoundFreed, __ATOMIC_SEQ_CST) > 0;
+}
+
+// Text summary (for /sys/kernel/shrinkers), returns the amount of characters
+// written
+size_t ShrinkerInfo(char *out, size_t limit) {
+  size_t len = snprintf(out, limit, "%-20s %8s %8s %9s\n", "name", "priority",
+                        "objects", "reclaimed");
+
+  spinlockAcquire(&LOCK_SHRINKERS);
+  for (Shrinker *browse = firstShrinker; browse && len < limit;
+       browse = browse->next)
+    len += snprintf(&out[len], limit - len, "%-20s %8d %8ld %9ld\n",
+                    browse->name, browse->priority, browse->count(browse->ctx),
+                    browse->reclaimed);
+  spinlockRelease(&LOCK_SHRINKERS);
+
+  return len < limit ? len : limit - 1;
+}
+
+void ShrinkerDump() {
+  char *buff = (char *)malloc(PAGE_SIZE);
+  ShrinkerInfo(buff, PAGE_SIZE);
+  debugf("%s", buff);
+  free(buff);
+}
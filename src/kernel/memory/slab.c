@@ -0,0 +1,205 @@
+#include <malloc.h>
+#include <paging.h>
+#include <slab.h>
+#include <system.h>
+#include <util.h>
+#include <vmm.h>
+
+// Object caches for the small, hot & fixed-size kernel structures, so they
+// don't have to go through dlmalloc every single time
+// Copyright (C) 2024 Panagiotis
+
+#define SLAB_DEBUG 0
+
+// VirtualAllocate() hands out buddy blocks through the HHDM, which are
+// naturally aligned, so the header is always found by masking the address
+#define SLAB_HEADER (DivRoundUp(sizeof(Slab), SLAB_ALIGN) * SLAB_ALIGN)
+#define SLAB_BYTES(cache) ((size_t)(cache)->slabPages * PAGE_SIZE)
+#define SLAB_LINK(cache, obj) (*(void **)((size_t)(obj) + (cache)->linkOffset))
+
+Spinlock   LOCK_SLAB_CACHES = ATOMIC_FLAG_INIT;
+SlabCache *firstSlabCache = 0;
+
+static void SlabListPush(Slab **list, Slab *slab) {
+  slab->prev = 0;
+  slab->next = *list;
+  if (*list)
+    (*list)->prev = slab;
+  *list = slab;
+}
+
+static void SlabListRemove(Slab **list, Slab *slab) {
+  if (slab->prev)
+    slab->prev->next = slab->next;
+  else
+    *list = slab->next;
+  if (slab->next)
+    slab->next->prev = slab->prev;
+  slab->next = 0;
+  slab->prev = 0;
+}
+
+// Works out the geometry of the cache & makes it visible to SlabInfo()
+static void SlabSetup(SlabCache *cache) {
+  size_t slot = DivRoundUp(cache->objSize, sizeof(void *)) * sizeof(void *);
+
+  // constructed state has to survive being on the free list, so the link goes
+  // past the object itself
+  cache->linkOffset = 0;
+  if (cache->ctor) {
+    cache->linkOffset = slot;
+    slot += sizeof(void *);
+  }
+  cache->slotSize = DivRoundUp(slot, SLAB_ALIGN) * SLAB_ALIGN;
+
+  uint32_t pages = 1;
+  while (pages < SLAB_MAX_PAGES &&
+         (pages * PAGE_SIZE - SLAB_HEADER) / cache->slotSize < SLAB_MIN_OBJECTS)
+    pages *= 2;
+  cache->slabPages = pages;
+  cache->perSlab = (SLAB_BYTES(cache) - SLAB_HEADER) / cache->slotSize;
+  if (!cache->perSlab) {
+    debugf("[slab] Object too large for cache{%s} size{%lx}\n", cache->name,
+           cache->objSize);
+    panic();
+  }
+
+  spinlockAcquire(&LOCK_SLAB_CACHES);
+  cache->next = firstSlabCache;
+  firstSlabCache = cache;
+  spinlockRelease(&LOCK_SLAB_CACHES);
+
+#if SLAB_DEBUG
+  debugf("[slab] New cache{%s} slot{%lx} perSlab{%d} pages{%d}\n", cache->name,
+         cache->slotSize, cache->perSlab, cache->slabPages);
+#endif
+}
+
+static Slab *SlabGrow(SlabCache *cache) {
+  Slab *slab = (Slab *)VirtualAllocate(cache->slabPages);
+  slab->next = 0;
+  slab->prev = 0;
+  slab->cache = cache;
+  slab->freeList = 0;
+  slab->inUse = 0;
+
+  size_t start = (size_t)slab + SLAB_HEADER;
+  for (int i = cache->perSlab - 1; i >= 0; i--) {
+    void *obj = (void *)(start + i * cache->slotSize);
+    if (cache->ctor)
+      cache->ctor(obj);
+    SLAB_LINK(cache, obj) = slab->freeList;
+    slab->freeList = obj;
+  }
+
+  cache->slabs++;
+  return slab;
+}
+
+void *SlabAllocate(SlabCache *cache) {
+  spinlockAcquire(&cache->LOCK);
+  if (!cache->slabPages)
+    SlabSetup(cache);
+
+  Slab *slab = cache->partial;
+  if (!slab) {
+    slab = cache->empty;
+    if (slab)
+      SlabListRemove(&cache->empty, slab);
+    else
+      slab = SlabGrow(cache);
+    SlabListPush(&cache->partial, slab);
+  }
+
+  void *obj = slab->freeList;
+  slab->freeList = SLAB_LINK(cache, obj);
+  slab->inUse++;
+  if (slab->inUse == cache->perSlab) {
+    SlabListRemove(&cache->partial, slab);
+    SlabListPush(&cache->full, slab);
+  }
+
+  cache->active++;
+  cache->allocations++;
+  spinlockRelease(&cache->LOCK);
+
+  return obj;
+}
+
+// For caches without a constructor, where callers want a clean object anyway
+void *SlabAllocateZero(SlabCache *cache) {
+  void *obj = SlabAllocate(cache);
+  memset(obj, 0, cache->objSize);
+  return obj;
+}
+
+void SlabFree(SlabCache *cache, void *obj) {
+  if (!obj)
+    return;
+
+  Slab *slab = (Slab *)((size_t)obj & ~(SLAB_BYTES(cache) - 1));
+  if (slab->cache != cache) {
+    debugf("[slab] Object{%lx} doesn't belong to cache{%s}!\n", obj,
+           cache->name);
+    panic();
+  }
+
+  spinlockAcquire(&cache->LOCK);
+  if (slab->inUse == cache->perSlab)
+    SlabListRemove(&cache->full, slab);
+  else
+    SlabListRemove(&cache->partial, slab);
+
+  SLAB_LINK(cache, obj) = slab->freeList;
+  slab->freeList = obj;
+  slab->inUse--;
+  cache->active--;
+
+  if (slab->inUse) {
+    SlabListPush(&cache->partial, slab);
+    spinlockRelease(&cache->LOCK);
+    return;
+  }
+
+  // keep one empty slab around so we don't bounce on the pmm
+  if (!cache->empty) {
+    SlabListPush(&cache->empty, slab);
+    spinlockRelease(&cache->LOCK);
+    return;
+  }
+
+  cache->slabs--;
+  spinlockRelease(&cache->LOCK);
+  VirtualFree(slab, cache->slabPages);
+}
+
+// Text table of every cache (for /sys/kernel/slabinfo & the shell), returns
+// the amount of characters written. Counters are read without the cache locks,
+// so they're only a snapshot.
+size_t SlabInfo(char *out, size_t limit) {
+  size_t len = snprintf(out, limit, "%-16s %8s %8s %8s %8s %6s %8s %5s\n",
+                        "name", "active", "total", "objsize", "perslab",
+                        "pages", "slabs", "util");
+
+  spinlockAcquire(&LOCK_SLAB_CACHES);
+  SlabCache *browse = firstSlabCache;
+  while (browse && len < limit) {
+    size_t total = browse->slabs * browse->perSlab;
+    size_t util = total ? browse->active * 100 / total : 0;
+    len += snprintf(&out[len], limit - len,
+                    "%-16s %8ld %8ld %8ld %8d %6d %8ld %4ld%%\n", browse->name,
+                    browse->active, total, browse->objSize, browse->perSlab,
+                    browse->slabPages, browse->slabs, util);
+    browse = browse->next;
+  }
+  spinlockRelease(&LOCK_SLAB_CACHES);
+
+  return len < limit ? len : limit - 1;
+}
+
+void SlabDump() {
+  char *buff = (char *)malloc(PAGE_SIZE);
+  SlabInfo(buff, PAGE_SIZE);
+  debugf("%s", buff);
+  free(buff);
+}
@@ -0,0 +1,341 @@
+#include <bootloader.h>
+#include <linux.h>
+#include <malloc.h>
+#include <paging.h>
+#include <pmm.h>
+#include <swap.h>
+#include <system.h>
+#include <task.h>
+#include <util.h>
+#include <vmm.h>
+
+// Swapping anonymous pages out to a dedicated partition or a swap file, under
+// memory pressure. Victims are picked by a clock over the tasks' page tables,
+// going by the accessed bits, & are read back from the page fault handler.
+// Copyright (C) 2024 Panagiotis
+
+#define SWAP_DEBUG 0
+
+#define HHDMoffset (bootloader.hhdmOffset)
+
+bool   swapActive = false;
+size_t swapSlots = 0;
+size_t swapUsed = 0;
+size_t swapIns = 0;
+size_t swapOuts = 0;
+
+// Every slot's first sector (0 if it's unusable) & how many entries point to
+// it, with unusable ones pinned
+size_t    swapSlotsTotal = 0;
+uint32_t *swapSlotLba = 0;
+uint16_t *swapRefs = 0;
+size_t    swapSlotHint = 1;
+
+// Slots freed since the last discard sweep (see SwapDiscardStale())
+size_t swapStale = 0;
+
+// The clock hand: a task & how far into its address space we are
+uint32_t swapHandId = 0;
+uint64_t swapHandVirt = USER_STACK_BOTTOM;
+
+// Pages are copied out while holding the page tables' lock, then written out
+// from here. Faults on the slot that's being written wait for it to finish.
+uint8_t *swapBounce = 0;
+size_t   swapWriteback = 0;
+
+static void SwapIo(size_t slot, void *buff, bool write) {
+  if (write)
+    setDiskBytes(buff, swapSlotLba[slot], SWAP_SLOT_SECTORS);
+  else
+    getDiskBytes(buff, swapSlotLba[slot], SWAP_SLOT_SECTORS);
+}
+
+static void SwapAreaAllocate(size_t total) {
+  swapSlotsTotal = total;
+  swapSlotLba = (uint32_t *)VmallocAllocate(
+      DivRoundUp(total * sizeof(uint32_t), PAGE_SIZE));
+  swapRefs = (uint16_t *)VmallocAllocate(
+      DivRoundUp(total * sizeof(uint16_t), PAGE_SIZE));
+}
+
+static void SwapAreaFree() {
+  VmallocFree(swapSlotLba,
+              DivRoundUp(swapSlotsTotal * sizeof(uint32_t), PAGE_SIZE));
+  VmallocFree(swapRefs,
+              DivRoundUp(swapSlotsTotal * sizeof(uint16_t), PAGE_SIZE));
+  swapSlotsTotal = 0;
+  swapSlotLba = 0;
+  swapRefs = 0;
+}
+
+// Pins every slot without a sector (the header one included) & goes live
+static bool SwapAreaEnable() {
+  size_t usable = 0;
+  swapSlotLba[0] = 0;
+  for (size_t i = 0; i < swapSlotsTotal; i++) {
+    swapRefs[i] = swapSlotLba[i] ? 0 : SWAP_PINNED;
+    if (swapSlotLba[i])
+      usable++;
+  }
+  if (!usable)
+    return false;
+
+  if (!swapBounce)
+    swapBounce = (uint8_t *)VirtualAllocate(1);
+  swapSlots = usable;
+  __atomic_store_n(&swapActive, true, __ATOMIC_SEQ_CST);
+
+  debugf("[swap] Activated: slots{%ld} usable{%ld}\n", swapSlotsTotal,
+         swapSlots);
+  return true;
+}
+
+bool SwapActivatePartition(mbr_partition *mbr) {
+  if (swapActive)
+    return false;
+
+  size_t total = mbr->sector_count / SWAP_SLOT_SECTORS;
+  if (total < 2)
+    return false;
+
+  SwapAreaAllocate(total);
+  for (size_t i = 1; i < total; i++)
+    swapSlotLba[i] = mbr->lba_first_sector + i * SWAP_SLOT_SECTORS;
+
+  if (!SwapAreaEnable()) {
+    SwapAreaFree();
+    return false;
+  }
+  return true;
+}
+
+// Swap files are accessed straight on the disk, so the filesystem has to tell
+// us where everything is (bmap). Pages split up on the disk (or sparse ones)
+// are simply left unused. The file is held onto for good.
+int SwapActivateFile(OpenFile *file) {
+  if (swapActive)
+    return -EBUSY;
+  if (!file->handlers->bmap || !file->handlers->getFilesize)
+    return -EINVAL;
+
+  size_t total = file->handlers->getFilesize(file) / PAGE_SIZE;
+  if (total < 2)
+    return -EINVAL;
+
+  SwapAreaAllocate(total);
+  for (size_t i = 1; i < total; i++) {
+    size_t lba = file->handlers->bmap(file, i * PAGE_SIZE);
+    for (size_t j = 1; lba && j < SWAP_SLOT_SECTORS; j++) {
+      if (file->handlers->bmap(file, i * PAGE_SIZE + j * SECTOR_SIZE) !=
+          lba + j)
+        lba = 0;
+    }
+    // getDiskBytes() only goes as far as 32-bit LBAs
+    swapSlotLba[i] = (lba + SWAP_SLOT_SECTORS) >> 32 ? 0 : lba;
+  }
+
+  if (!SwapAreaEnable()) {
+    SwapAreaFree();
+    return -EINVAL;
+  }
+  return 0;
+}
+
+// Picks up the first swap partition of the boot disk, if there's any
+void initiateSwap() {
+  for (int i = 0; i < 4; i++) {
+    mbr_partition mbr = {0};
+    if (!openDisk(0, i, &mbr))
+      return;
+    if (mbr.type == MBR_TYPE_SWAP && SwapActivatePartition(&mbr))
+      return;
+  }
+}
+
+/* Slots */
+
+static size_t SwapSlotAllocate() {
+  for (size_t i = 0; i < swapSlotsTotal; i++) {
+    size_t   slot = (swapSlotHint + i) % swapSlotsTotal;
+    uint16_t expected = 0;
+    if (!__atomic_compare_exchange_n(&swapRefs[slot], &expected, 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+      continue;
+
+    swapSlotHint = slot + 1;
+    __atomic_add_fetch(&swapUsed, 1, __ATOMIC_RELAXED);
+    return slot;
+  }
+
+  return 0;
+}
+
+// Another (fork()ed) entry now points to the slot as well
+void SwapSlotShare(size_t slot) {
+  __atomic_add_fetch(&swapRefs[slot], 1, __ATOMIC_SEQ_CST);
+}
+
+void SwapSlotRelease(size_t slot) {
+  if (__atomic_sub_fetch(&swapRefs[slot], 1, __ATOMIC_SEQ_CST) == 0) {
+    __atomic_sub_fetch(&swapUsed, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&swapStale, 1, __ATOMIC_RELAXED);
+  }
+}
+
+// Lets the disk drop what free slots held (which frees up actual memory on
+// zram). Slots are released with the page tables locked, so this is left to
+// the swapper instead. Slots are pinned while at it, so they can't be handed
+// out & written to in the meantime.
+static void SwapDiscardStale() {
+  if (!__atomic_exchange_n(&swapStale, 0, __ATOMIC_SEQ_CST))
+    return;
+
+  for (size_t slot = 1; slot < swapSlotsTotal; slot++) {
+    uint16_t expected = 0;
+    if (!__atomic_compare_exchange_n(&swapRefs[slot], &expected, SWAP_PINNED,
+                                     false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+      continue;
+    discardDiskBytes(swapSlotLba[slot], SWAP_SLOT_SECTORS);
+    __atomic_store_n(&swapRefs[slot], 0, __ATOMIC_SEQ_CST);
+  }
+}
+
+/* Swapping out */
+
+static bool SwapTaskEligible(Task *task) {
+  return !task->kernel_task && task->pagedir &&
+         task->state != TASK_STATE_DEAD && task->state != TASK_STATE_CREATED;
+}
+
+// The task the hand is on, or the next one (by id) once it has gone through
+// all of its address space. Wrapping around counts as a lap. Called with
+// TASK_LL_MODIFY held.
+static Task *SwapHandTask(size_t *laps) {
+  Task *next = 0;
+  Task *first = 0;
+  for (Task *browse = firstTask; browse; browse = browse->next) {
+    if (!SwapTaskEligible(browse))
+      continue;
+    if (browse->id == swapHandId && swapHandVirt < USER_STACK_BOTTOM)
+      return browse;
+    if (browse->id > swapHandId && (!next || browse->id < next->id))
+      next = browse;
+    if (!first || browse->id < first->id)
+      first = browse;
+  }
+
+  if (!next) {
+    next = first;
+    (*laps)++;
+  }
+  if (next) {
+    swapHandId = next->id;
+    swapHandVirt = 0;
+  }
+  return next;
+}
+
+// Moves a single page out to a fresh slot. The first lap over everything might
+// only clear accessed bits, so we give up after the second one.
+static bool SwapOutOne() {
+  size_t slot = SwapSlotAllocate();
+  if (!slot)
+    return false;
+
+  // published before any entry can point at the slot, faults on it have to
+  // wait until it's actually been written
+  __atomic_store_n(&swapWriteback, slot, __ATOMIC_SEQ_CST);
+
+  size_t laps = 0;
+  size_t busy = 0;
+  while (laps < 2 && busy < SWAP_BUSY_RETRIES) {
+    PAGING_SWAP res = PAGING_SWAP_BUSY;
+    if (spinlockCntReadTryAcquire(&TASK_LL_MODIFY)) {
+      Task *task = SwapHandTask(&laps);
+      res = task ? VirtualSwapOutL(task->pagedir, &swapHandVirt, slot,
+                                   swapBounce)
+                 : PAGING_SWAP_NONE;
+      spinlockCntReadRelease(&TASK_LL_MODIFY);
+    }
+
+    if (res == PAGING_SWAP_BUSY) {
+      busy++;
+      handControl();
+      continue;
+    }
+    if (res != PAGING_SWAP_EVICTED)
+      continue;
+
+    SwapIo(slot, swapBounce, true);
+    __atomic_store_n(&swapWriteback, 0, __ATOMIC_SEQ_CST);
+
+    __atomic_add_fetch(&swapOuts, 1, __ATOMIC_RELAXED);
+    return true;
+  }
+
+  __atomic_store_n(&swapWriteback, 0, __ATOMIC_SEQ_CST);
+  SwapSlotRelease(slot);
+  return false;
+}
+
+// Swap's part of a reclaim round (see ReclaimRound()), evicting pages until
+// we're past the high watermark. Returns the amount of frames it freed.
+size_t SwapReclaim() {
+  if (swapActive)
+    SwapDiscardStale();
+
+  size_t freed = 0;
+  while (swapActive && physical.freeBlocks < PHYSICAL_FREE_HIGH &&
+         SwapOutOne())
+    freed++;
+
+#if SWAP_DEBUG
+  debugf("[swap] Round done: freed{%ld} free{%ld} used{%ld}\n", freed,
+         physical.freeBlocks, swapUsed);
+#endif
+
+  return freed;
+}
+
+/* Swapping in */
+
+// Called for deferred faults (see isrDeferredFault()), returns false if the
+// page wasn't swapped out to begin with. Protection is left to the fault that
+// follows, if the access wasn't allowed after all.
+bool SwapHandleFault(Task *task, size_t addr, uint64_t error) {
+  if (!swapActive)
+    return false;
+
+  uint64_t page = addr & ~(PAGE_SIZE - 1);
+  uint64_t entry = VirtualSwappedL(task->pagedir, page);
+  if (!entry)
+    return false;
+
+  size_t slot = PTE_SWAP_SLOT(entry);
+  while (__atomic_load_n(&swapWriteback, __ATOMIC_SEQ_CST) == slot)
+    handControl();
+
+  size_t phys = PhysicalAllocate(1);
+  SwapIo(slot, (void *)(phys + HHDMoffset), false);
+
+  // somebody else got to it first, the instruction can go through either way
+  if (!VirtualSwapInL(task->pagedir, page, entry, phys)) {
+    PhysicalFree(phys, 1);
+    return true;
+  }
+  SwapSlotRelease(slot);
+
+  task->majorFaults++;
+  __atomic_add_fetch(&swapIns, 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+// Text summary (for /sys/kernel/swapinfo), returns the amount of characters
+// written
+size_t SwapInfo(char *out, size_t limit) {
+  size_t len = snprintf(out, limit,
+                        "active %d\nslots %ld\nused %ld\nswapins %ld\n"
+                        "swapouts %ld\n",
+                        swapActive, swapSlots, swapUsed, swapIns, swapOuts);
+  return len < limit ? len : limit - 1;
+}
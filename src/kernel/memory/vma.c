@@ -0,0 +1,421 @@
+#include <linux.h>
+#include <malloc.h>
+#include <page_cache.h>
+#include <paging.h>
+#include <pmm.h>
+#include <system.h>
+#include <task.h>
+#include <util.h>
+#include <vma.h>
+
+// Per-task virtual memory areas (everything mmap() hands out), kept on an AVL
+// tree keyed by their start address
+// Copyright (C) 2024 Panagiotis
+
+#define VMA_DEBUG 0
+
+/* Tree helpers (need WLOCK_VMAS) */
+
+static Vma *VmaFirstOverlap(Task *task, size_t start, size_t end) {
+  Vma *vma = (Vma *)AvlFloor(&task->vmas, start);
+  if (vma && vma->end > start)
+    return vma;
+
+  vma = (Vma *)AvlCeiling(&task->vmas, start);
+  if (vma && vma->start < end)
+    return vma;
+
+  return 0;
+}
+
+static bool VmaRangeFree(Task *task, size_t start, size_t end) {
+  return end > start && !VmaFirstOverlap(task, start, end);
+}
+
+// Inserts a copy of the model covering [start, end), with a handle of its own
+// to the file (if there is one)
+static Vma *VmaInsertUnsafe(Task *task, Vma *model, size_t start, size_t end) {
+  Vma *vma = (Vma *)malloc(sizeof(Vma));
+  memcpy(vma, model, sizeof(Vma));
+  memset(&vma->node, 0, sizeof(AvlNode));
+  vma->start = start;
+  vma->end = end;
+  vma->flags &= ~MAP_FIXED;
+  if (vma->file) {
+    vma->file = fsUserDuplicateNodeUnsafe(model->file);
+    vma->offset = model->offset + (start - model->start);
+  }
+
+  vma->node.key = start;
+  AvlInsert(&task->vmas, &vma->node);
+  return vma;
+}
+
+static void VmaFreeUnsafe(Task *task, Vma *vma) {
+  AvlRemove(&task->vmas, &vma->node);
+  if (vma->file)
+    fsCloseOrphan(vma->file);
+  free(vma);
+}
+
+// Start addresses are the keys, so moving one means re-inserting the node
+static void VmaRekeyUnsafe(Task *task, Vma *vma, size_t start) {
+  AvlRemove(&task->vmas, &vma->node);
+  vma->offset += start - vma->start;
+  vma->start = start;
+  vma->node.key = start;
+  AvlInsert(&task->vmas, &vma->node);
+}
+
+// Big enough areas that might end up on 2MiB pages (see VirtualMapDemandL())
+// get a start that lets them do so
+static size_t VmaAlignment(size_t length, VMA_TYPE type) {
+  if (type != VMA_FILE && length >= PAGE_SIZE_LARGE)
+    return PAGE_SIZE_LARGE;
+  return PAGE_SIZE;
+}
+
+// First fit, starting from the hint (if it's any good) or VMA_SEARCH_START
+static size_t VmaFindHoleUnsafe(Task *task, size_t hint, size_t length,
+                                size_t align) {
+  if (hint && !(hint % PAGE_SIZE) && hint >= VMA_SEARCH_START &&
+      (hint + length) <= VMA_SEARCH_END &&
+      VmaRangeFree(task, hint, hint + length))
+    return hint;
+
+  size_t candidate = DivRoundUp(VMA_SEARCH_START, align) * align;
+  Vma   *vma = VmaFirstOverlap(task, candidate, candidate + length);
+  while (vma && vma->start < (candidate + length)) {
+    candidate = DivRoundUp(MAX(candidate, vma->end), align) * align;
+    vma = (Vma *)AvlNext(&task->vmas, &vma->node);
+  }
+
+  if ((candidate + length) > VMA_SEARCH_END)
+    return 0;
+  return candidate;
+}
+
+// Pushes dirty MAP_SHARED file pages of the range back to their file
+static void VmaSyncUnsafe(Task *task, Vma *vma, size_t start, size_t end) {
+  if (vma->type != VMA_FILE || !(vma->flags & MAP_SHARED) ||
+      !(vma->prot & PROT_WRITE) || !vma->cache->mnt)
+    return;
+
+  for (size_t page = MAX(vma->start, start); page < MIN(vma->end, end);
+       page += PAGE_SIZE) {
+    if (!VirtualCleanL(task->pagedir, page))
+      continue;
+    PageCacheWriteback(vma->cache, vma->file,
+                       (vma->offset + page - vma->start) / PAGE_SIZE);
+  }
+}
+
+static void VmaUnmapUnsafe(Task *task, size_t start, size_t end) {
+  Vma *vma = VmaFirstOverlap(task, start, end);
+  while (vma && vma->start < end) {
+    Vma *next = (Vma *)AvlNext(&task->vmas, &vma->node);
+    VmaSyncUnsafe(task, vma, start, end);
+
+    // device memory only has to disappear from the page tables
+    if (vma->type == VMA_DEVICE) {
+      size_t from = MAX(vma->start, start);
+      size_t to = MIN(vma->end, end);
+      VirtualUnmapL(task->pagedir, from, (to - from) / PAGE_SIZE, false);
+    }
+
+    if (vma->start >= start && vma->end <= end) {
+      // swallowed whole
+      VmaFreeUnsafe(task, vma);
+    } else if (vma->start < start && vma->end > end) {
+      // punching a hole in the middle
+      VmaInsertUnsafe(task, vma, end, vma->end);
+      vma->end = start;
+    } else if (vma->start < start)
+      vma->end = start;
+    else
+      VmaRekeyUnsafe(task, vma, end);
+
+    vma = next;
+  }
+
+  VirtualUnmapL(task->pagedir, start, (end - start) / PAGE_SIZE, true);
+}
+
+static size_t VmaReserveModel(Task *task, size_t addr, size_t length,
+                              Vma *model) {
+  if (model->flags & MAP_FIXED &&
+      (addr % PAGE_SIZE || !VmaUserRange(addr, length)))
+    return 0;
+  length = DivRoundUp(length, PAGE_SIZE) * PAGE_SIZE;
+
+  spinlockCntWriteAcquire(&task->WLOCK_VMAS);
+  size_t start = 0;
+  if (model->flags & MAP_FIXED) {
+    start = addr;
+    VmaUnmapUnsafe(task, start, start + length);
+  } else
+    start = VmaFindHoleUnsafe(task, addr, length,
+                              VmaAlignment(length, model->type));
+
+  if (start) {
+    model->start = start;
+    VmaInsertUnsafe(task, model, start, start + length);
+  }
+  spinlockCntWriteRelease(&task->WLOCK_VMAS);
+
+#if VMA_DEBUG
+  debugf("[vma] Reserved: id{%d} start{%lx} length{%lx} type{%d}\n", task->id,
+         start, length, model->type);
+#endif
+  return start;
+}
+
+/* Public interface */
+
+// Whether [addr, addr + length) is non-empty, doesn't wrap around & stays
+// below USER_END. Anything a task passes in has to be, before it may reach the
+// page tables.
+bool VmaUserRange(size_t addr, size_t length) {
+  return length && addr < USER_END && length <= USER_END - addr;
+}
+
+// Page table flags for anonymous memory of an area. PROT_NONE leaves out
+// PF_USER, so userland touching it never gets past PagingHandleFault().
+uint64_t VmaPageFlags(int prot) {
+  if (!(prot & (PROT_READ | PROT_WRITE | PROT_EXEC)))
+    return 0;
+  return PF_USER | (prot & PROT_WRITE ? PF_RW : 0);
+}
+
+Vma *VmaFind(Task *task, size_t addr) {
+  spinlockCntReadAcquire(&task->WLOCK_VMAS);
+  Vma *vma = (Vma *)AvlFloor(&task->vmas, addr);
+  if (vma && vma->end <= addr)
+    vma = 0;
+  spinlockCntReadRelease(&task->WLOCK_VMAS);
+  return vma;
+}
+
+// Claims a (page aligned) range of the address space & returns its start, or 0
+// if there isn't any room left. MAP_FIXED replaces whatever was there before.
+// Populating the page tables is left to the caller.
+size_t VmaReserve(Task *task, size_t addr, size_t length, int prot, int flags,
+                  VMA_TYPE type) {
+  Vma model = {.prot = prot, .flags = flags, .type = type};
+  return VmaReserveModel(task, addr, length, &model);
+}
+
+// File mappings additionally take over the (already duplicated) file handle
+size_t VmaReserveFile(Task *task, size_t addr, size_t length, int prot,
+                      int flags, OpenFile *file, size_t offset,
+                      PageCache *cache) {
+  Vma model = {.prot = prot,
+               .flags = flags,
+               .type = VMA_FILE,
+               .file = file,
+               .offset = offset,
+               .cache = cache};
+  size_t ret = VmaReserveModel(task, addr, length, &model);
+
+  // every area got its own copy of the handle by now
+  if (ret)
+    fsCloseOrphan(file);
+  return ret;
+}
+
+// Frees up frames & page tables alongside the areas themselves
+void VmaUnmap(Task *task, size_t addr, size_t length) {
+  if (!VmaUserRange(addr, length))
+    return;
+  length = DivRoundUp(length, PAGE_SIZE) * PAGE_SIZE;
+
+  spinlockCntWriteAcquire(&task->WLOCK_VMAS);
+  VmaUnmapUnsafe(task, addr, addr + length);
+  spinlockCntWriteRelease(&task->WLOCK_VMAS);
+}
+
+// Resizes and/or moves an area by only ever touching the page tables, the data
+// itself is never copied. Returns the new address or a negative errno.
+size_t VmaRemap(Task *task, size_t addr, size_t oldLength, size_t newLength,
+                int flags, size_t newAddr) {
+  if (flags & MREMAP_FIXED && !(flags & MREMAP_MAYMOVE))
+    return -EINVAL;
+  if (addr >= USER_END || oldLength > USER_END - addr || newLength > USER_END ||
+      (flags & MREMAP_FIXED && !VmaUserRange(newAddr, newLength)))
+    return -EINVAL;
+
+  oldLength = DivRoundUp(oldLength, PAGE_SIZE) * PAGE_SIZE;
+  newLength = DivRoundUp(newLength, PAGE_SIZE) * PAGE_SIZE;
+
+  size_t ret = -EFAULT;
+  spinlockCntWriteAcquire(&task->WLOCK_VMAS);
+
+  Vma *vma = (Vma *)AvlFloor(&task->vmas, addr);
+  if (!vma || vma->end < (addr + oldLength))
+    goto cleanup;
+
+  // only anonymous memory can grow (the rest would need to be populated)
+  if (newLength > oldLength && vma->type != VMA_ANONYMOUS) {
+    ret = -EINVAL;
+    goto cleanup;
+  }
+
+  // shrinking (in place)
+  if (!(flags & MREMAP_FIXED) && newLength <= oldLength) {
+    if (newLength < oldLength)
+      VmaUnmapUnsafe(task, addr + newLength, addr + oldLength);
+    ret = addr;
+    goto cleanup;
+  }
+
+  // growing in place, when there's enough room right after us
+  if (!(flags & MREMAP_FIXED) && vma->end == (addr + oldLength) &&
+      (addr + newLength) <= VMA_SEARCH_END &&
+      VmaRangeFree(task, vma->end, addr + newLength)) {
+    VirtualMapDemandL(task->pagedir, vma->end,
+                      (addr + newLength - vma->end) / PAGE_SIZE,
+                      VmaPageFlags(vma->prot));
+    vma->end = addr + newLength;
+    ret = addr;
+    goto cleanup;
+  }
+
+  if (!(flags & MREMAP_MAYMOVE)) {
+    ret = -ENOMEM;
+    goto cleanup;
+  }
+
+  size_t target = 0;
+  if (flags & MREMAP_FIXED) {
+    if (newAddr % PAGE_SIZE || (newAddr < (addr + oldLength) &&
+                                (newAddr + newLength) > addr)) {
+      ret = -EINVAL;
+      goto cleanup;
+    }
+    target = newAddr;
+    VmaUnmapUnsafe(task, target, target + newLength);
+  } else
+    target = VmaFindHoleUnsafe(task, 0, newLength,
+                               VmaAlignment(newLength, vma->type));
+
+  if (!target) {
+    ret = -ENOMEM;
+    goto cleanup;
+  }
+
+  // the new area goes in first, while the old one's file handle is still up
+  Vma model = *vma;
+  model.start = target;
+  model.offset = vma->offset + (addr - vma->start);
+  VmaInsertUnsafe(task, &model, target, target + newLength);
+
+  // the page table entries themselves travel over
+  size_t moved = MIN(oldLength, newLength);
+  VirtualMoveL(task->pagedir, addr, target, moved / PAGE_SIZE);
+  if (newLength > moved)
+    VirtualMapDemandL(task->pagedir, target + moved,
+                      (newLength - moved) / PAGE_SIZE,
+                      VmaPageFlags(vma->prot));
+
+  VmaUnmapUnsafe(task, addr, addr + oldLength);
+  ret = target;
+
+cleanup:
+  spinlockCntWriteRelease(&task->WLOCK_VMAS);
+  return ret;
+}
+
+// Anonymous memory in the range goes back to being demand-zero, handing its
+// frames back
+void VmaDiscard(Task *task, size_t addr, size_t length) {
+  size_t end = addr + DivRoundUp(length, PAGE_SIZE) * PAGE_SIZE;
+
+  spinlockCntReadAcquire(&task->WLOCK_VMAS);
+  Vma *vma = VmaFirstOverlap(task, addr, end);
+  while (vma && vma->start < end) {
+    if (vma->type == VMA_ANONYMOUS) {
+      size_t from = MAX(vma->start, addr);
+      size_t to = MIN(vma->end, end);
+      VirtualDiscardL(task->pagedir, from, (to - from) / PAGE_SIZE);
+    }
+    vma = (Vma *)AvlNext(&task->vmas, &vma->node);
+  }
+  spinlockCntReadRelease(&task->WLOCK_VMAS);
+}
+
+// fork(): the page tables themselves are handled by PageDirectoryUserDuplicate
+void VmaDuplicate(Task *source, Task *target) {
+  spinlockCntReadAcquire(&source->WLOCK_VMAS);
+  Vma *vma = (Vma *)AvlFirst(&source->vmas);
+  while (vma) {
+    VmaInsertUnsafe(target, vma, vma->start, vma->end);
+    vma = (Vma *)AvlNext(&source->vmas, &vma->node);
+  }
+  spinlockCntReadRelease(&source->WLOCK_VMAS);
+}
+
+// Writes back MAP_SHARED file pages of the range (msync())
+void VmaSync(Task *task, size_t addr, size_t length) {
+  size_t end = addr + DivRoundUp(length, PAGE_SIZE) * PAGE_SIZE;
+
+  spinlockCntReadAcquire(&task->WLOCK_VMAS);
+  Vma *vma = VmaFirstOverlap(task, addr, end);
+  while (vma && vma->start < end) {
+    VmaSyncUnsafe(task, vma, addr, end);
+    vma = (Vma *)AvlNext(&task->vmas, &vma->node);
+  }
+  spinlockCntReadRelease(&task->WLOCK_VMAS);
+}
+
+// Populates a file page on its first touch, through the page cache. Unlike
+// the rest of the page fault handling this might need to hit the disk, so it
+// runs in the task's (kernel) context instead of the isr (see isr.c).
+bool VmaHandleFault(Task *task, size_t addr, uint64_t error) {
+  size_t page = addr & ~(PAGE_SIZE - 1);
+  bool   ret = false;
+
+  spinlockCntReadAcquire(&task->WLOCK_VMAS);
+  Vma *vma = (Vma *)AvlFloor(&task->vmas, page);
+  if (!vma || vma->end <= page || vma->type != VMA_FILE || !vma->cache)
+    goto cleanup;
+  if (error & PF_ERR_WRITE && !(vma->prot & PROT_WRITE))
+    goto cleanup;
+
+  // read-only private pages (program text, see elf.c) keep running off the
+  // frame they got, even if the file's written to afterwards
+  bool   text = !(vma->flags & MAP_SHARED) && !(vma->prot & PROT_WRITE);
+  size_t index = (vma->offset + page - vma->start) / PAGE_SIZE;
+  size_t phys = PageCacheFetchShare(vma->cache, vma->file, index, text);
+
+  // shared mappings write straight into the cache, private ones get their
+  // own copy on the first write
+  uint64_t flags = PF_USER;
+  if (vma->flags & MAP_SHARED) {
+    flags |= PF_SHARED;
+    if (vma->prot & PROT_WRITE)
+      flags |= PF_RW;
+  } else if (vma->prot & PROT_WRITE)
+    flags |= PF_COW;
+
+  if (!VirtualFillL(task->pagedir, page, phys, flags))
+    PhysicalRelease(phys); // another thread beat us to it
+  else
+    task->majorFaults++;
+  ret = true;
+
+cleanup:
+  spinlockCntReadRelease(&task->WLOCK_VMAS);
+  return ret;
+}
+
+// Gets rid of the bookkeeping (writing back shared file pages first), has to
+// run before PageDirectoryFree() which does the rest
+void VmaFreeAll(Task *task) {
+  spinlockCntWriteAcquire(&task->WLOCK_VMAS);
+  while (task->vmas.root) {
+    Vma *vma = (Vma *)task->vmas.root;
+    VmaSyncUnsafe(task, vma, vma->start, vma->end);
+    VmaFreeUnsafe(task, vma);
+  }
+  spinlockCntWriteRelease(&task->WLOCK_VMAS);
+}
@@ -11,17 +11,15 @@
 
 #define VMM_DEBUG 0
 
-// HHDM might be mapped as a full-GB entry, so we have to be careful!
-#define VMM_POS_ENSURE 0x40000000
+// Large kernel buffers that have no reason to be physically contiguous are
+// built out of scattered frames, mapped one after the other on a region of
+// their own (right past the kernel heap's). Every range is followed by an
+// unmapped guard page, so overruns fault instead of corrupting the next one.
+Spinlock LOCK_VMALLOC = ATOMIC_FLAG_INIT;
 
 void initiateVMM() {
-  size_t targetPosition =
-      DivRoundUp(bootloader.hhdmOffset - bootloader.mmTotal - VMM_POS_ENSURE,
-                 PAGE_SIZE) *
-      PAGE_SIZE;
-
   virtual.ready = false;
-  virtual.mem_start = targetPosition;
+  virtual.mem_start = KERNEL_VMALLOC_START;
   virtual.BitmapSizeInBlocks = DivRoundUp(bootloader.mmTotal, BLOCK_SIZE);
   virtual.BitmapSizeInBytes = DivRoundUp(virtual.BitmapSizeInBlocks, 8);
 
@@ -29,8 +27,11 @@ void initiateVMM() {
   virtual.Bitmap = (uint8_t *)VirtualAllocate(pagesRequired);
   memset(virtual.Bitmap, 0, virtual.BitmapSizeInBytes);
 
-  // should NEVER get put inside (since it's on the HHDM region)
-  // MarkRegion(&virtual, virtual.Bitmap, virtual.BitmapSizeInBytes, 1);
+  // new pagedirs copy the kernel's top level entries (PageDirectoryAllocate()),
+  // so the region's has to exist before any of them does. The first page is
+  // never handed out, which keeps it around for good.
+  MarkBlocks(&virtual, 0, 1, 1);
+  VirtualPopulateRangeL(GetPageDirectory(), KERNEL_VMALLOC_START, 1, PF_RW);
 
   virtual.ready = true;
 }
@@ -60,3 +61,30 @@ bool VirtualFree(void *ptr, int pages) {
   PhysicalFree(phys, pages);
   return true;
 }
+
+// Always comes zeroed, like anything else VirtualPopulateRangeL() maps
+void *VmallocAllocate(size_t pages) {
+  spinlockAcquire(&LOCK_VMALLOC);
+  void *virt = BitmapAllocate(&virtual, pages + 1);
+  spinlockRelease(&LOCK_VMALLOC);
+  if (!virt) {
+    debugf("[vmm::vmalloc] Ran out of virtual space! pages{%lx}\n", pages);
+    panic();
+  }
+
+  VirtualPopulateRangeL(GetPageDirectory(), (size_t)virt, pages, PF_RW);
+#if VMM_DEBUG
+  debugf("[vmm::vmalloc] Mapped region: out{%lx} pages{%lx}\n", virt, pages);
+#endif
+  return virt;
+}
+
+void VmallocFree(void *ptr, size_t pages) {
+  if (!ptr)
+    return;
+
+  VirtualUnmapL(GetPageDirectory(), (size_t)ptr, pages, true);
+  spinlockAcquire(&LOCK_VMALLOC);
+  BitmapFree(&virtual, ptr, pages + 1);
+  spinlockRelease(&LOCK_VMALLOC);
+}
@@ -1,50 +1,299 @@
+#include <apic.h>
 #include <bootloader.h>
 #include <gdt.h>
 #include <isr.h>
+#include <kernel_helper.h>
 #include <malloc.h>
 #include <paging.h>
+#include <pmm.h>
 #include <schedule.h>
+#include <smp.h>
 #include <system.h>
 #include <task.h>
+#include <timer.h>
 #include <util.h>
 #include <vmm.h>
 
-// Clock-tick triggered scheduler
+// Clock-tick triggered, round robin scheduler over per-cpu queues of ready
+// tasks. Cpus that run out of work steal some off the busiest one.
 // Copyright (C) 2024 Panagiotis
 
 #define SCHEDULE_DEBUG 0
 
-extern TSSPtr *tssPtr;
-extern void    asm_finalize_sched(uint64_t rsp, uint64_t cr3, Task *old);
+extern void asm_finalize_sched(uint64_t rsp, uint64_t cr3, Task *old);
+
+// Every cpu has a queue of tasks that are ready to run, in the order they get
+// it. Blocking doesn't take a task off right away, whatever isn't ready anymore
+// by the time it comes up is simply dropped. Running tasks are only queued back
+// up once they're switched away from (see scheduleFinish()).
+// Wakeups come from interrupts as well, so the lock (one for all queues) is
+// only ever held with them disabled.
+Spinlock LOCK_SCHEDULE = ATOMIC_FLAG_INIT;
+
+static void scheduleEnqueue(Cpu *cpu, Task *task) {
+  if (task->runQueued)
+    return;
+
+  task->runQueued = true;
+  task->cpu = cpu->id;
+  task->runNext = 0;
+  task->runPrev = cpu->runTail;
+  if (cpu->runTail)
+    cpu->runTail->runNext = task;
+  else
+    cpu->runHead = task;
+  cpu->runTail = task;
+  cpu->runCnt++;
+}
+
+static void scheduleUnlink(Task *task) {
+  if (!task->runQueued)
+    return;
+
+  Cpu *cpu = cpus[task->cpu];
+  if (task->runPrev)
+    task->runPrev->runNext = task->runNext;
+  else
+    cpu->runHead = task->runNext;
+  if (task->runNext)
+    task->runNext->runPrev = task->runPrev;
+  else
+    cpu->runTail = task->runPrev;
+  cpu->runCnt--;
+
+  task->runQueued = false;
+  task->runNext = 0;
+  task->runPrev = 0;
+}
+
+static bool scheduleAllowed(Task *task, Cpu *cpu) {
+  return task->affinity & (1ULL << cpu->id);
+}
+
+// First task on from's queue that target may run
+static Task *scheduleTake(Cpu *from, Cpu *target) {
+  Task *task = from->runHead;
+  while (task) {
+    Task *next = task->runNext;
+    if (task->state != TASK_STATE_READY)
+      scheduleUnlink(task);
+    else if (scheduleAllowed(task, target)) {
+      scheduleUnlink(task);
+      return task;
+    }
+    task = next;
+  }
+  return 0;
+}
+
+static Task *schedulePick(Cpu *self) {
+  Task *task = scheduleTake(self, self);
+  if (task)
+    return task;
+
+  // nothing of our own, help out whoever's the busiest
+  Cpu *busiest = 0;
+  for (uint32_t i = 0; i < smpCpus; i++) {
+    Cpu *cpu = cpus[i];
+    if (cpu != self && cpu->online && cpu->runCnt &&
+        (!busiest || cpu->runCnt > busiest->runCnt))
+      busiest = cpu;
+  }
+  if (!busiest)
+    return 0;
+  task = scheduleTake(busiest, self);
+  if (task)
+    return task;
+
+  // (its tasks might not be allowed to run here)
+  for (uint32_t i = 0; i < smpCpus && !task; i++) {
+    Cpu *cpu = cpus[i];
+    if (cpu != self && cpu != busiest && cpu->online && cpu->runCnt)
+      task = scheduleTake(cpu, self);
+  }
+  return task;
+}
+
+// Least loaded cpu the task may run on. Ties go to the later ones, the BSP
+// takes device interrupts on top.
+static Cpu *schedulePlace(Task *task) {
+  uint64_t online = __atomic_load_n(&smpOnline, __ATOMIC_RELAXED);
+  uint64_t allowed = task->affinity & online;
+  if (!allowed)
+    allowed = online;
+
+  Cpu     *best = 0;
+  uint32_t bestLoad = 0;
+  for (uint32_t i = 0; i < smpCpus; i++) {
+    if (!(allowed & (1ULL << i)))
+      continue;
+    Cpu     *cpu = cpus[i];
+    uint32_t load = cpu->runCnt + (cpu->current != cpu->idle);
+    if (!best || load <= bestLoad) {
+      best = cpu;
+      bestLoad = load;
+    }
+  }
+  return best;
+}
+
+// Idle cpus get interrupted for new work, instead of finding it on their next
+// tick
+static void scheduleKick(Cpu *cpu) {
+  if (cpu != cpuSelf() &&
+      __atomic_load_n(&cpu->current, __ATOMIC_RELAXED) == cpu->idle)
+    apicIpi(cpu->lapicId, APIC_VECTOR_RESCHEDULE);
+}
+
+// Makes a task runnable (from anywhere, interrupts included). Dead (or
+// stopped) ones stay that way.
+void scheduleWake(Task *task) {
+  Cpu *target = 0;
+  bool ints = spinlockIrqAcquire(&LOCK_SCHEDULE);
+  if (task->state != TASK_STATE_DEAD && task->state != TASK_STATE_DUMMY &&
+      !task->runStopped) {
+    task->state = TASK_STATE_READY;
+    if (!task->onCpu && !task->runQueued) {
+      target = schedulePlace(task);
+      scheduleEnqueue(target, task);
+    }
+  }
+  spinlockIrqRelease(&LOCK_SCHEDULE, ints);
+
+  if (target)
+    scheduleKick(target);
+}
+
+// Takes a task (other than the running one) off the cpus for good, for when
+// it's going away. Returns once whichever cpu was running it switched away.
+void scheduleStop(Task *task) {
+  Cpu *running = 0;
+  bool ints = spinlockIrqAcquire(&LOCK_SCHEDULE);
+  task->runStopped = true;
+  scheduleUnlink(task);
+  if (task->onCpu)
+    running = cpus[task->cpu];
+  spinlockIrqRelease(&LOCK_SCHEDULE, ints);
+
+  if (!running)
+    return;
+  apicIpi(running->lapicId, APIC_VECTOR_RESCHEDULE);
+  while (__atomic_load_n(&task->onCpu, __ATOMIC_ACQUIRE))
+    handControl();
+}
+
+// Called on the new task's stack right after a switch (see asm_finalize_sched)
+// with the old one, which only now may be picked up by other cpus again. Ones
+// that killed themselves are left for the reaper, the rest were stopped by
+// whoever killed them (see scheduleStop()).
+void scheduleFinish(Task *old) {
+  if (old == currentTask)
+    return;
+
+  Cpu *target = 0;
+  bool ints = spinlockIrqAcquire(&LOCK_SCHEDULE);
+  bool dead = old->state == TASK_STATE_DEAD && !old->runStopped;
+  if (old->state == TASK_STATE_READY && !old->runStopped) {
+    target = schedulePlace(old);
+    scheduleEnqueue(target, old);
+  }
+  __atomic_store_n(&old->onCpu, false, __ATOMIC_RELEASE);
+  spinlockIrqRelease(&LOCK_SCHEDULE, ints);
+
+  if (target)
+    scheduleKick(target);
+  if (dead)
+    taskKillCleanup(old);
+}
+
+// Whether the running task has to make way right away: it's blocked (or gone),
+// it's been stopped or it's merely the idle one
+bool scheduleWanted() {
+  if (!tasksInitiated)
+    return false;
+
+  Cpu  *self = cpuSelf();
+  Task *task = self->current;
+  return task == self->idle || task->state != TASK_STATE_READY ||
+         task->runStopped;
+}
+
+// Called whenever the cpu's timer fires, returns whether it's time to switch:
+// the running task is only preempted once it's used up its slice
+bool scheduleTick() {
+  if (!tasksInitiated)
+    return false;
+  if (scheduleWanted())
+    return true;
+
+  return timerTicks >= currentTask->sliceEnd;
+}
+
+// When the cpu's timer has to fire next (for the scheduler's sake), 0 being
+// never: the idle task is left alone until something wakes up
+uint64_t scheduleDeadline() {
+  if (!tasksInitiated)
+    return timerTicks + 1;
+
+  Cpu *self = cpuSelf();
+  if (self->current == self->idle)
+    return 0;
+  return self->current->sliceEnd;
+}
 
 void schedule(uint64_t rsp) {
   if (!tasksInitiated)
     return;
 
-  // try to find a next task
+  // whoever's waiting on us got here with interrupts off as well
+  PagingShootdownHandle();
+
   AsmPassedInterrupt *cpu = (AsmPassedInterrupt *)rsp;
-  Task               *next = currentTask->next;
-  if (!next)
-    next = firstTask;
-
-  int fullRun = 0;
-  while (next->state != TASK_STATE_READY) {
-    next = next->next;
-    if (!next) {
-      fullRun++;
-      if (fullRun > 2)
-        break;
-      next = firstTask;
-    }
+  Cpu                *self = cpuSelf();
+  Task               *old = self->current;
+
+  bool  ints = spinlockIrqAcquire(&LOCK_SCHEDULE);
+  Task *next = schedulePick(self);
+
+  // the running task goes to the back of the line, unless there's nobody else
+  if (!next && old != self->idle && old->state == TASK_STATE_READY &&
+      !old->runStopped && scheduleAllowed(old, self))
+    next = old;
+
+  // found no task, so it's a good time to zero some frames ahead
+  if (!next && zeroHelperTask && zeroHelperTask->state == TASK_STATE_IDLE &&
+      !zeroHelperTask->onCpu && PhysicalZeroPoolWanted()) {
+    zeroHelperTask->state = TASK_STATE_READY;
+    next = zeroHelperTask;
   }
 
   // found no task
   if (!next)
-    next = dummyTask;
+    next = self->idle;
+
+  next->onCpu = true;
+  next->cpu = self->id;
+  spinlockIrqRelease(&LOCK_SCHEDULE, ints);
+
+  // the timer (& other interrupts) preempt, exceptions only ever switch away
+  // through handControl()
+  if (next != old && old != self->idle) {
+    if (cpu->interrupt < 32 || old->state != TASK_STATE_READY)
+      old->switchesVoluntary++;
+    else
+      old->switchesInvoluntary++;
+  }
 
-  Task *old = currentTask;
+  // idle time is kept on the TSC, there are no ticks to count it in
+  uint64_t now = rdtsc();
+  if (old == self->idle && next != self->idle)
+    self->idleTsc += now - self->idleSince;
+  else if (old != self->idle && next == self->idle)
+    self->idleSince = now;
 
-  currentTask = next;
+  self->current = next;
+  next->sliceEnd = timerTicks + SCHEDULE_SLICE;
+  timerProgram(scheduleDeadline());
 
 #if SCHEDULE_DEBUG
   // if (old->id != 0 || next->id != 0)
@@ -56,15 +305,16 @@ void schedule(uint64_t rsp) {
 #endif
 
   // Change TSS rsp0 (software multitasking)
-  tssPtr->rsp0 = next->whileTssRsp;
+  self->tss.rsp0 = next->whileTssRsp;
+  self->syscallStack = next->whileSyscallRsp;
 
   // Save MSRIDs (HIGHLY unsure)
   // old->fsbase = rdmsr(MSRID_FSBASE);
   // old->gsbase = rdmsr(MSRID_GSBASE);
 
-  // Apply new MSRIDs
+  // Apply new MSRIDs (userland's gs base is swapped in on the way out)
   wrmsr(MSRID_FSBASE, next->fsbase);
-  wrmsr(MSRID_GSBASE, next->gsbase);
+  wrmsr(MSRID_KERNEL_GSBASE, next->gsbase);
 
   // Save generic (and non) registers
   memcpy(&old->registers, cpu, sizeof(AsmPassedInterrupt));
@@ -97,10 +347,9 @@ void schedule(uint64_t rsp) {
 
   // Pass off control to our assembly finalization code that:
   //   - uses the tssRsp to iretq (give control back)
-  //   - applies the new pagetable
-  //   - cleanups old killed task (if necessary)
+  //   - applies the new pagetable (without a TLB flush if it's PCID-tagged)
+  //   - queues the old task back up or cleans it up (see scheduleFinish())
   // .. basically replaces all (not needed!) stuff
   ChangePageDirectoryFake(next->pagedir); // just for globalPagedir to update
-  asm_finalize_sched((size_t)iretqRsp, VirtualToPhysical((size_t)next->pagedir),
-                     old);
+  asm_finalize_sched((size_t)iretqRsp, PageDirectoryCr3(next->pagedir), old);
 }
@@ -16,13 +16,20 @@ void stackGenerateMutual(Task *task) {
   //   panic();
   // }
 
-  // Map the user stack (for variables & such)
-  for (int i = 0; i < USER_STACK_PAGES; i++) {
-    size_t virt_addr =
-        USER_STACK_BOTTOM - USER_STACK_PAGES * 0x1000 + i * 0x1000;
-    VirtualMap(virt_addr, PhysicalAllocate(1), PF_USER | PF_RW);
-    memset((void *)virt_addr, 0, PAGE_SIZE);
+  size_t stackTop = USER_STACK_BOTTOM - USER_STACK_PAGES * 0x1000;
+
+  // Reserve the user stack (for variables & such), pages are only backed once
+  // they're actually used
+  if (!task->kernel_task) {
+    VirtualMapDemandL(task->pagedir, stackTop, USER_STACK_PAGES,
+                      PF_USER | PF_RW);
+    return;
   }
+
+  // Kernel tasks fault in ring 0 on this very stack, where the cpu would have
+  // nowhere to push the exception frame... So map (& zero) it right away
+  VirtualPopulateRangeL(task->pagedir, stackTop, USER_STACK_PAGES,
+                        PF_USER | PF_RW);
 }
 
 typedef struct StackStorePtrStyle {
@@ -48,8 +55,7 @@ StackStorePtrStyle stackStorePtrStyle(Task *target, int ptrc, char **ptrv) {
 }
 
 void stackGenerateUser(Task *target, uint32_t argc, char **argv, uint32_t envc,
-                       char **envv, uint8_t *out, size_t filesize,
-                       void *elf_ehdr_ptr) {
+                       char **envv, uint8_t *phdrs, void *elf_ehdr_ptr) {
   Elf64_Ehdr *elf_ehdr = (Elf64_Ehdr *)(elf_ehdr_ptr);
 
   // yeah, we will need to construct a stackframe...
@@ -74,8 +80,7 @@ void stackGenerateUser(Task *target, uint32_t argc, char **argv, uint32_t envc,
 
   size_t lowestThing = 0;
   for (int i = 0; i < elf_ehdr->e_phnum; i++) {
-    Elf64_Phdr *elf_phdr = (Elf64_Phdr *)((size_t)out + elf_ehdr->e_phoff +
-                                          i * elf_ehdr->e_phentsize);
+    Elf64_Phdr *elf_phdr = (Elf64_Phdr *)(phdrs + i * elf_ehdr->e_phentsize);
     if (elf_phdr->p_type != PT_LOAD)
       continue;
     if (!lowestThing || lowestThing > elf_phdr->p_vaddr)
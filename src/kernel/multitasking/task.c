@@ -1,16 +1,19 @@
 #include <gdt.h>
 #include <isr.h>
+#include <kernel_helper.h>
 #include <linked_list.h>
 #include <linux.h>
 #include <malloc.h>
 #include <paging.h>
 #include <pmm.h>
 #include <schedule.h>
+#include <slab.h>
 #include <stack.h>
 #include <string.h>
 #include <syscalls.h>
 #include <task.h>
 #include <util.h>
+#include <vma.h>
 #include <vmm.h>
 
 // Task manager allowing for task management
@@ -18,6 +21,45 @@
 
 SpinlockCnt TASK_LL_MODIFY = {0};
 
+SlabCache slabTask = SLAB_CACHE_INIT("task", Task, 0);
+SlabCache slabKilledInfo = SLAB_CACHE_INIT("killed_info", KilledInfo, 0);
+
+Task *firstDeadTask = 0;
+
+// Kernel stacks are only ever touched by the kernel itself, so neither fresh
+// nor recycled ones need zeroing. Returns the top (they grow downwards).
+Spinlock LOCK_TASK_STACKS = ATOMIC_FLAG_INIT;
+void    *taskStackPool[TASK_STACK_POOL] = {0};
+int      taskStackPoolCnt = 0;
+
+static uint64_t taskStackAllocate() {
+  void *stack = 0;
+  spinlockAcquire(&LOCK_TASK_STACKS);
+  if (taskStackPoolCnt)
+    stack = taskStackPool[--taskStackPoolCnt];
+  spinlockRelease(&LOCK_TASK_STACKS);
+
+  if (!stack)
+    stack = VirtualAllocate(USER_STACK_PAGES);
+  return (uint64_t)stack + USER_STACK_PAGES * BLOCK_SIZE;
+}
+
+static void taskStackFree(uint64_t top) {
+  if (!top)
+    return;
+
+  void *stack = (void *)(top - USER_STACK_PAGES * BLOCK_SIZE);
+  spinlockAcquire(&LOCK_TASK_STACKS);
+  if (taskStackPoolCnt < TASK_STACK_POOL) {
+    taskStackPool[taskStackPoolCnt++] = stack;
+    stack = 0;
+  }
+  spinlockRelease(&LOCK_TASK_STACKS);
+
+  if (stack)
+    VirtualFree(stack, USER_STACK_PAGES);
+}
+
 void taskAttachDefTermios(Task *task) {
   memset(&task->term, 0, sizeof(termios));
   task->term.c_iflag = BRKINT | ICRNL | INPCK | ISTRIP | IXON;
@@ -57,8 +99,7 @@ Task *taskCreate(uint32_t id, uint64_t rip, bool kernel_task, uint64_t *pagedir,
     debugf("[scheduler] Something went wrong with init!\n");
     panic();
   }
-  Task *target = (Task *)malloc(sizeof(Task));
-  memset(target, 0, sizeof(Task));
+  Task *target = (Task *)SlabAllocateZero(&slabTask);
   browse->next = target;
   spinlockCntWriteRelease(&TASK_LL_MODIFY);
 
@@ -79,23 +120,14 @@ Task *taskCreate(uint32_t id, uint64_t rip, bool kernel_task, uint64_t *pagedir,
   target->kernel_task = kernel_task;
   target->state = TASK_STATE_CREATED; // TASK_STATE_READY
   target->pagedir = pagedir;
+  target->affinity = SMP_AFFINITY_ALL;
 
-  void  *tssRsp = VirtualAllocate(USER_STACK_PAGES);
-  size_t tssRspSize = USER_STACK_PAGES * BLOCK_SIZE;
-  memset(tssRsp, 0, tssRspSize);
-  target->whileTssRsp = (uint64_t)tssRsp + tssRspSize;
-
-  void  *syscalltssRsp = VirtualAllocate(USER_STACK_PAGES);
-  size_t syscalltssRspSize = USER_STACK_PAGES * BLOCK_SIZE;
-  memset(syscalltssRsp, 0, syscalltssRspSize);
-  target->whileSyscallRsp = (uint64_t)syscalltssRsp + syscalltssRspSize;
+  target->whileTssRsp = taskStackAllocate();
+  target->whileSyscallRsp = taskStackAllocate();
 
   target->heap_start = USER_HEAP_START;
   target->heap_end = USER_HEAP_START;
 
-  target->mmap_start = USER_MMAP_START;
-  target->mmap_end = USER_MMAP_START;
-
   target->umask = S_IWGRP | S_IWOTH;
 
   memset(target->fpuenv, 0, 512);
@@ -115,7 +147,7 @@ Task *taskCreateKernel(uint64_t rip, uint64_t rdi) {
   return target;
 }
 
-void taskCreateFinish(Task *task) { task->state = TASK_STATE_READY; }
+void taskCreateFinish(Task *task) { scheduleWake(task); }
 
 void taskAdjustHeap(Task *task, size_t new_heap_end, size_t *start,
                     size_t *end) {
@@ -130,19 +162,10 @@ void taskAdjustHeap(Task *task, size_t new_heap_end, size_t *start,
   size_t new_page_top = DivRoundUp(new_heap_end, PAGE_SIZE);
 
   if (new_page_top > old_page_top) {
+    // only reserved, pages get zero-filled when first touched
     size_t num = new_page_top - old_page_top;
-
-    for (size_t i = 0; i < num; i++) {
-      size_t virt = old_page_top * PAGE_SIZE + i * PAGE_SIZE;
-      if (VirtualToPhysical(virt))
-        continue;
-
-      size_t phys = PhysicalAllocate(1);
-
-      VirtualMap(virt, phys, PF_RW | PF_USER);
-
-      memset((void *)virt, 0, PAGE_SIZE);
-    }
+    VirtualMapDemandL(task->pagedir, old_page_top * PAGE_SIZE, num,
+                      PF_RW | PF_USER);
   } else if (new_page_top < old_page_top) {
     debugf("[task] New page is lower than old page: id{%d}\n", task->id);
     taskKill(task->id, 139);
@@ -157,6 +180,13 @@ void taskKill(uint32_t id, uint16_t ret) {
   if (!task)
     return;
 
+  // has to be off every other cpu before anything goes away under it, we'll
+  // switch away ourselves at the very end
+  if (task != currentTask) {
+    scheduleStop(task);
+    waitRemove(task);
+  }
+
   // We'll need this later
   bool parentVfork = task->parent->state == TASK_STATE_WAITING_VFORK;
 
@@ -164,21 +194,21 @@ void taskKill(uint32_t id, uint16_t ret) {
   // place!
   if (task->parent && !task->noInformParent) {
     spinlockAcquire(&task->parent->LOCK_CHILD_TERM);
-    KilledInfo *info = (KilledInfo *)LinkedListAllocate(
-        (void **)(&task->parent->firstChildTerminated), sizeof(KilledInfo));
+    KilledInfo *info = (KilledInfo *)SlabAllocateZero(&slabKilledInfo);
+    LinkedListAppend((void **)(&task->parent->firstChildTerminated), info);
     info->pid = task->id;
     info->ret = ret;
     task->parent->childrenTerminatedAmnt++;
     if (task->parent->state == TASK_STATE_WAITING_CHILD ||
         (task->parent->state == TASK_STATE_WAITING_CHILD_SPECIFIC &&
          task->parent->waitingForPid == task->id))
-      task->parent->state = TASK_STATE_READY;
+      scheduleWake(task->parent);
     spinlockRelease(&task->parent->LOCK_CHILD_TERM);
   }
 
   // vfork() children need to notify parents no matter what
   if (task->parent->state == TASK_STATE_WAITING_VFORK)
-    task->parent->state = TASK_STATE_READY;
+    scheduleWake(task->parent);
 
   // close any left open files
   OpenFile *file = task->firstFile;
@@ -195,15 +225,20 @@ void taskKill(uint32_t id, uint16_t ret) {
       break;
     browse = browse->next;
   }
+  if (browse)
+    browse->next = task->next;
   spinlockCntWriteRelease(&TASK_LL_MODIFY);
 
+  // shared file mappings get written back, so the pagedir has to be around
+  VmaFreeAll(task);
   if (!parentVfork)
     PageDirectoryFree(task->pagedir);
+  task->reapPagedir = !parentVfork;
 
-  // tssRsp, syscalltssRsp left
-
-  browse->next = task->next;
+  // children can't be left pointing at us once the reaper gets to us
+  taskFreeChildren(task);
 
+  // stacks & the struct itself are left for the reaper (taskKillCleanup())
   task->state = TASK_STATE_DEAD;
 
   if (currentTask == task) {
@@ -219,25 +254,66 @@ void taskKill(uint32_t id, uint16_t ret) {
   taskKillCleanup(task);
 }
 
+// Called for the task we just switched away from (see asm_finalize_sched) or
+// by taskKill() for ones that weren't running. A dead task can't free the stack
+// it's still on, so it's queued up for the reaper thread instead. Runs with
+// interrupts off, hence the lockless push.
 void taskKillCleanup(Task *task) {
   if (task->state != TASK_STATE_DEAD)
     return;
 
-  return;
-  VirtualFree((void *)task->whileTssRsp, USER_STACK_PAGES);
-  VirtualFree((void *)task->whileSyscallRsp, USER_STACK_PAGES);
-  free(task);
+  Task *head = __atomic_load_n(&firstDeadTask, __ATOMIC_RELAXED);
+  do {
+    task->nextDead = head;
+  } while (!__atomic_compare_exchange_n(&firstDeadTask, &head, task, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 
-  // taskKillChildren(task); // wait()
-  taskFreeChildren(task);
+  if (reaperHelperTask && reaperHelperTask->state == TASK_STATE_IDLE)
+    scheduleWake(reaperHelperTask);
+}
+
+// Frees everything taskKill() left behind, for tasks that are guaranteed to be
+// off the CPU by now (only ever called from the reaper thread)
+void taskReap() {
+  Task *task = __atomic_exchange_n(&firstDeadTask, 0, __ATOMIC_ACQUIRE);
+  if (!task)
+    return;
+
+  // the swapper might still be walking a page directory it found on the list
+  spinlockCntWriteAcquire(&TASK_LL_MODIFY);
+  spinlockCntWriteRelease(&TASK_LL_MODIFY);
+
+  while (task) {
+    Task *next = task->nextDead;
+
+    taskStackFree(task->whileTssRsp);
+    taskStackFree(task->whileSyscallRsp);
+    free(task->cwd);
+    if (task->reapPagedir)
+      PageDirectoryDestroy(task->pagedir);
+
+    // whatever wait4() never got to
+    KilledInfo *info = task->firstChildTerminated;
+    while (info) {
+      KilledInfo *nextInfo = info->next;
+      SlabFree(&slabKilledInfo, info);
+      info = nextInfo;
+    }
+
+    SlabFree(&slabTask, task);
+    task = next;
+  }
 }
 
 void taskFreeChildren(Task *task) {
   Task *child = firstTask;
   while (child) {
     Task *next = child->next;
-    if (child->parent == task && child->state != TASK_STATE_DEAD)
+    if (child->parent == task && child->state != TASK_STATE_DEAD) {
+      // the kernel task never wait4()s, so nothing's to be left for it
+      child->noInformParent = true;
       child->parent = firstTask; // ykyk
+    }
     child = next;
   }
 }
@@ -270,7 +346,7 @@ Task *taskGet(uint32_t id) {
 int taskIdCurr = 1;
 
 int16_t taskGenerateId() {
-  return taskIdCurr++;
+  return __atomic_fetch_add(&taskIdCurr, 1, __ATOMIC_RELAXED);
   // spinlockCntReadAcquire(&TASK_LL_MODIFY);
   // Task    *browse = firstTask;
   // uint16_t max = 0;
@@ -340,8 +416,7 @@ Task *taskFork(AsmPassedInterrupt *cpu, uint64_t rsp, bool copyPages,
     debugf("[scheduler] Something went wrong with init!\n");
     panic();
   }
-  Task *target = (Task *)malloc(sizeof(Task));
-  memset(target, 0, sizeof(Task));
+  Task *target = (Task *)SlabAllocateZero(&slabTask);
   browse->next = target;
   spinlockCntWriteRelease(&TASK_LL_MODIFY);
 
@@ -359,24 +434,17 @@ Task *taskFork(AsmPassedInterrupt *cpu, uint64_t rsp, bool copyPages,
 
   // target->registers = currentTask->registers;
   memcpy(&target->registers, cpu, sizeof(AsmPassedInterrupt));
-  void  *tssRsp = VirtualAllocate(USER_STACK_PAGES);
-  size_t tssRspSize = USER_STACK_PAGES * BLOCK_SIZE;
-  memset(tssRsp, 0, tssRspSize);
-  target->whileTssRsp = (uint64_t)tssRsp + tssRspSize;
-
-  void  *syscalltssRsp = VirtualAllocate(USER_STACK_PAGES);
-  size_t syscalltssRspSize = USER_STACK_PAGES * BLOCK_SIZE;
-  memset(syscalltssRsp, 0, syscalltssRspSize);
-  target->whileSyscallRsp = (uint64_t)syscalltssRsp + syscalltssRspSize;
+  target->whileTssRsp = taskStackAllocate();
+  target->whileSyscallRsp = taskStackAllocate();
 
   target->fsbase = currentTask->fsbase;
   target->gsbase = currentTask->gsbase;
+  target->affinity = currentTask->affinity;
 
   target->heap_start = currentTask->heap_start;
   target->heap_end = currentTask->heap_end;
 
-  target->mmap_start = currentTask->mmap_start;
-  target->mmap_end = currentTask->mmap_end;
+  VmaDuplicate(currentTask, target);
 
   target->term = currentTask->term;
 
@@ -414,28 +482,40 @@ Task *taskFork(AsmPassedInterrupt *cpu, uint64_t rsp, bool copyPages,
   return target;
 }
 
+// Halts until the next interrupt, an idle cpu's timer is left stopped (see
+// scheduleDeadline()) so that's only ever for something to do
 void kernelDummyEntry() {
   while (true)
-    dummyTask->state = TASK_STATE_DUMMY;
+    asm volatile("hlt");
+}
+
+// Runs whenever a cpu has nothing else to do, it's never woken up (or queued)
+// like the rest and may never leave its cpu
+Task *taskCreateIdle(Cpu *cpu) {
+  Task *target = taskCreate(taskGenerateId(), (uint64_t)kernelDummyEntry, true,
+                            PageDirectoryAllocate(), 0, 0);
+  stackGenerateKernel(target, 0);
+  target->state = TASK_STATE_DUMMY;
+  target->affinity = 1ULL << cpu->id;
+  target->cpu = cpu->id;
+  return target;
 }
 
 void initiateTasks() {
-  firstTask = (Task *)malloc(sizeof(Task));
-  memset(firstTask, 0, sizeof(Task));
+  firstTask = (Task *)SlabAllocateZero(&slabTask);
 
-  currentTask = firstTask;
+  cpuBsp.current = firstTask;
   currentTask->id = KERNEL_TASK_ID;
   currentTask->state = TASK_STATE_READY;
+  currentTask->affinity = SMP_AFFINITY_ALL;
+  currentTask->onCpu = true;
   currentTask->pagedir = GetPageDirectory();
   currentTask->kernel_task = true;
   currentTask->cwd = malloc(2);
   currentTask->cwd[0] = '/';
   currentTask->cwd[1] = '\0';
 
-  void  *tssRsp = VirtualAllocate(USER_STACK_PAGES);
-  size_t tssRspSize = USER_STACK_PAGES * BLOCK_SIZE;
-  memset(tssRsp, 0, tssRspSize);
-  currentTask->whileTssRsp = (uint64_t)tssRsp + tssRspSize;
+  currentTask->whileTssRsp = taskStackAllocate();
   taskAttachDefTermios(currentTask);
 
   debugf("[tasks] Current execution ready for multitasking\n");
@@ -444,6 +524,5 @@ void initiateTasks() {
   // task 0 represents the execution we're in right now
 
   // create a dummy task in case the scheduler has nothing to do
-  dummyTask = taskCreateKernel((uint64_t)kernelDummyEntry, 0);
-  dummyTask->state = TASK_STATE_DUMMY;
+  cpuBsp.idle = taskCreateIdle(&cpuBsp);
 }
\ No newline at end of file
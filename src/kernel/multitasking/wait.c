@@ -0,0 +1,134 @@
+#include <schedule.h>
+#include <system.h>
+#include <task.h>
+#include <timer.h>
+#include <util.h>
+#include <wait.h>
+
+// Wait queues: tasks sleep on one until somebody wakes them up, instead of
+// spinning (or handing control over) until whatever they're after changes
+// Copyright (C) 2024 Panagiotis
+
+WaitQueue waitHashedQueues[WAIT_HASHED];
+
+void waitQueueInit(WaitQueue *queue) { memset(queue, 0, sizeof(WaitQueue)); }
+
+// Shared by anything (spinlocks for one) that can't fit a queue of its own,
+// so wakeups on these have to go to everybody
+WaitQueue *waitHashed(void *addr) {
+  uint64_t hash = ((size_t)addr >> 3) * 0x9E3779B97F4A7C15ULL;
+  return &waitHashedQueues[hash >> (64 - WAIT_HASHED_BITS)];
+}
+
+static void waitUnlink(WaitQueue *queue, Task *task) {
+  if (task->waitQueue != queue)
+    return;
+
+  if (task->waitPrev)
+    task->waitPrev->waitNext = task->waitNext;
+  else
+    queue->head = task->waitNext;
+  if (task->waitNext)
+    task->waitNext->waitPrev = task->waitPrev;
+  else
+    queue->tail = task->waitPrev;
+
+  task->waitQueue = 0;
+  task->waitNext = 0;
+  task->waitPrev = 0;
+}
+
+// Queues the running task up & marks it as blocked. Interrupts are left off
+// until waitFinish(), so it can't get preempted (& forgotten about) before it
+// has checked what it's waiting for and handed control over.
+void waitPrepare(WaitQueue *queue) {
+  asm volatile("cli");
+  Task *task = currentTask;
+  spinlockIrqAcquire(&queue->LOCK);
+  if (task->waitQueue != queue) {
+    task->waitQueue = queue;
+    task->waitNext = 0;
+    task->waitPrev = queue->tail;
+    if (queue->tail)
+      queue->tail->waitNext = task;
+    else
+      queue->head = task;
+    queue->tail = task;
+  }
+  task->state = TASK_STATE_BLOCKED;
+  spinlockIrqRelease(&queue->LOCK, false);
+}
+
+// Takes the running task back off the queue (if nobody woke it up already)
+void waitFinish(WaitQueue *queue, bool ints) {
+  Task *task = currentTask;
+  spinlockIrqAcquire(&queue->LOCK);
+  waitUnlink(queue, task);
+  if (task->state == TASK_STATE_BLOCKED)
+    task->state = TASK_STATE_READY;
+  spinlockIrqRelease(&queue->LOCK, ints);
+}
+
+// Tasks are woken up with the queue's lock held, so they can't go away (see
+// waitRemove()) in the meantime
+void waitWake(WaitQueue *queue) {
+  bool  ints = spinlockIrqAcquire(&queue->LOCK);
+  Task *task = queue->head;
+  if (task) {
+    waitUnlink(queue, task);
+    scheduleWake(task);
+  }
+  spinlockIrqRelease(&queue->LOCK, ints);
+}
+
+void waitWakeAll(WaitQueue *queue) {
+  bool ints = spinlockIrqAcquire(&queue->LOCK);
+  while (queue->head) {
+    Task *task = queue->head;
+    waitUnlink(queue, task);
+    scheduleWake(task);
+  }
+  spinlockIrqRelease(&queue->LOCK, ints);
+}
+
+// Takes a task (that's off the cpus) off whatever it's waiting on, for when
+// it's going away
+void waitRemove(Task *task) {
+  timerEventCancel(&task->waitTimer);
+
+  while (true) {
+    WaitQueue *queue = __atomic_load_n(&task->waitQueue, __ATOMIC_ACQUIRE);
+    if (!queue)
+      return;
+
+    bool ints = spinlockIrqAcquire(&queue->LOCK);
+    bool found = task->waitQueue == queue;
+    waitUnlink(queue, task);
+    spinlockIrqRelease(&queue->LOCK, ints);
+    if (found)
+      return;
+  }
+}
+
+static void waitTimerFire(void *arg) { scheduleWake((Task *)arg); }
+
+// Blocks the running task until deadline (in timerTicks) has passed
+void waitUntil(uint64_t deadline) {
+  Task *task = currentTask;
+  bool  ints = checkInterrupts();
+  asm volatile("cli");
+
+  task->waitTimer.callback = waitTimerFire;
+  task->waitTimer.arg = task;
+  while (timerTicks < deadline) {
+    task->state = TASK_STATE_BLOCKED;
+    timerEventArm(&task->waitTimer, deadline);
+    handControl();
+  }
+  timerEventCancel(&task->waitTimer);
+  if (task->state == TASK_STATE_BLOCKED)
+    task->state = TASK_STATE_READY;
+
+  if (ints)
+    asm volatile("sti");
+}
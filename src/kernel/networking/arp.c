@@ -15,6 +15,25 @@ uint8_t broadcastMAC[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
 
 /* Arp tables (send help) */
 void registerArpTableEntry(NIC *nic, uint8_t *ip, uint8_t *mac) {
+  // allocated outside of the lock, the shrinker needs it
+  arpTableEntry *fresh = 0;
+  if (!nic->arpTable) {
+    fresh = (arpTableEntry *)malloc(ARP_TABLE_LEN * sizeof(arpTableEntry));
+    memset(fresh, 0, ARP_TABLE_LEN * sizeof(arpTableEntry));
+  }
+
+  spinlockAcquire(&nic->LOCK_ARP);
+  if (!nic->arpTable) {
+    nic->arpTable = fresh;
+    nic->arpTableCurr = 0;
+    fresh = 0;
+  }
+  if (!nic->arpTable) {
+    // dropped right after we checked, it's only a cache anyway
+    spinlockRelease(&nic->LOCK_ARP);
+    return;
+  }
+
   arpTableEntry *entry = &nic->arpTable[nic->arpTableCurr++];
 
   memcpy(entry->ip, ip, ARP_PROTOCOL_SIZE);
@@ -23,20 +42,33 @@ void registerArpTableEntry(NIC *nic, uint8_t *ip, uint8_t *mac) {
   // Overwrite table from the start
   if (nic->arpTableCurr >= ARP_TABLE_LEN)
     nic->arpTableCurr = 0;
+  spinlockRelease(&nic->LOCK_ARP);
+
+  free(fresh);
 }
 
-arpTableEntry *lookupArpTable(NIC *nic, const uint8_t *ip) {
-  for (int i = 0; i < ARP_TABLE_LEN; i++) {
-    if (*(uint32_t *)(&nic->arpTable[i].ip[0]) == *(uint32_t *)(ip))
-      return &nic->arpTable[i];
+// Copies the MAC address out (if mac isn't null), since the table can go away
+// at any point
+bool lookupArpTable(NIC *nic, const uint8_t *ip, uint8_t *mac) {
+  bool found = false;
+  spinlockAcquire(&nic->LOCK_ARP);
+  for (int i = 0; nic->arpTable && i < ARP_TABLE_LEN; i++) {
+    if (*(uint32_t *)(&nic->arpTable[i].ip[0]) == *(uint32_t *)(ip)) {
+      if (mac)
+        memcpy(mac, nic->arpTable[i].mac, ARP_HARDWARE_SIZE);
+      found = true;
+      break;
+    }
   }
+  spinlockRelease(&nic->LOCK_ARP);
 
-  return 0; // null ptr
+  return found;
 }
 
 void debugArpTable(NIC *nic) {
   printf("\n");
-  for (int i = 0; i < ARP_TABLE_LEN; i++) {
+  spinlockAcquire(&nic->LOCK_ARP);
+  for (int i = 0; nic->arpTable && i < ARP_TABLE_LEN; i++) {
     if (!(*(uint32_t *)(&nic->arpTable[i].ip[0])))
       continue;
 
@@ -47,9 +79,41 @@ void debugArpTable(NIC *nic) {
            nic->arpTable[i].mac[2], nic->arpTable[i].mac[3],
            nic->arpTable[i].mac[4], nic->arpTable[i].mac[5]);
   }
+  spinlockRelease(&nic->LOCK_ARP);
   printf("\n");
 }
 
+/* Shrinker (see shrinker.c) */
+
+size_t netArpTableCount(void *ctx) {
+  NIC   *nic = (NIC *)ctx;
+  size_t cnt = 0;
+  spinlockAcquire(&nic->LOCK_ARP);
+  for (int i = 0; nic->arpTable && i < ARP_TABLE_LEN; i++) {
+    if (*(uint32_t *)(&nic->arpTable[i].ip[0]))
+      cnt++;
+  }
+  spinlockRelease(&nic->LOCK_ARP);
+
+  return cnt;
+}
+
+// Entries can't go away on their own, so the whole table is dropped (they're
+// simply resolved again as needed)
+size_t netArpTableShrink(void *ctx, size_t target) {
+  NIC   *nic = (NIC *)ctx;
+  size_t freed = netArpTableCount(ctx);
+
+  spinlockAcquire(&nic->LOCK_ARP);
+  arpTableEntry *table = nic->arpTable;
+  nic->arpTable = 0;
+  nic->arpTableCurr = 0;
+  spinlockRelease(&nic->LOCK_ARP);
+
+  free(table);
+  return freed;
+}
+
 /* The send/respond functions don't manipualte the arp table at all, that's the
  * job of the handle function, called by the generic NIC interface controller*/
 
@@ -113,7 +177,8 @@ void netArpHandle(NIC *nic, arpPacket *packet) {
          packet->sender_mac[2], packet->sender_mac[3], packet->sender_mac[4],
          packet->sender_mac[5]);*/
 
-  if (!lookupArpTable(nic, packet->sender_ip)) { // unless already stored
+  // unless already stored
+  if (!lookupArpTable(nic, packet->sender_ip, 0)) {
     // store the ip & mac regardless of request
     registerArpTableEntry(nic, packet->sender_ip, packet->sender_mac);
   }
@@ -129,26 +194,18 @@ bool netArpGetIPv4(NIC *nic, const uint8_t *ipInput, uint8_t *mac) {
 
   const uint8_t *ip = isLocalIPv4(ipInput) ? ipInput : nic->serverIp;
 
-  arpTableEntry *tableEntry = lookupArpTable(nic, ip);
-  if (tableEntry) {
-    memcpy(mac, tableEntry->mac, 6);
+  if (lookupArpTable(nic, ip, mac))
     return true;
-  }
 
   netArpSend(nic, ip);
 
-  uint64_t       caputre = timerTicks;
-  arpTableEntry *tableEntryRetry = lookupArpTable(nic, ip);
+  uint64_t caputre = timerTicks;
+  bool     found = lookupArpTable(nic, ip, mac);
 
   // retry until either half a second passes or we get a reply
-  while (!tableEntryRetry && timerTicks < (caputre + ARP_TIMEOUT)) {
-    tableEntryRetry = lookupArpTable(nic, ip);
-  }
-
-  if (tableEntryRetry) {
-    memcpy(mac, tableEntryRetry->mac, 6);
-    return true;
+  while (!found && timerTicks < (caputre + ARP_TIMEOUT)) {
+    found = lookupArpTable(nic, ip, mac);
   }
 
-  return false;
+  return found;
 }
@@ -271,7 +271,7 @@ void netIPv4SendInternal(NIC *nic, uint8_t *destination_mac,
   if (!finalSize)
     return;
 
-  uint8_t    *final = malloc(finalSize);
+  uint8_t    *final = netPacketAllocate(finalSize);
   IPv4header *header = (IPv4header *) final;
 
   memset(header, 0, sizeof(IPv4header));
@@ -295,7 +295,7 @@ void netIPv4SendInternal(NIC *nic, uint8_t *destination_mac,
 
   sendPacket(nic, destination_mac, final, finalSize, 0x0800);
 
-  free(final);
+  netPacketFree(final, finalSize);
 }
 
 #define MAX_FREEID_CYCLES 1000
@@ -2,6 +2,7 @@
 #include <ipv4.h>
 #include <linked_list.h>
 #include <malloc.h>
+#include <slab.h>
 #include <socket.h>
 #include <system.h>
 #include <tcp.h>
@@ -10,13 +11,15 @@
 // Something like Linux sockets...
 // Copyright (C) 2024 Panagiotis
 
+SlabCache slabSocket = SLAB_CACHE_INIT("socket", Socket, 0);
+
 Socket *netSocketConnect(NIC *nic, SOCKET_PROT protocol,
                          uint8_t *destination_ip, uint16_t source_port,
                          uint16_t destination_port) {
   if (!nic)
     return 0;
-  Socket *target =
-      LinkedListAllocate((void **)&nic->firstSocket, sizeof(Socket));
+  Socket *target = (Socket *)SlabAllocateZero(&slabSocket);
+  LinkedListAppend((void **)&nic->firstSocket, target);
 
   target->client_port = source_port;
   target->server_port = destination_port;
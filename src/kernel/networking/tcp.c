@@ -2,6 +2,7 @@
 #include <checksum.h>
 #include <ipv4.h>
 #include <malloc.h>
+#include <slab.h>
 #include <socket.h>
 #include <system.h>
 #include <tcp.h>
@@ -11,6 +12,9 @@
 // Tried to keep the code as simple as I could, good for educational purposes
 // Copyright (C) 2024 Panagiotis
 
+SlabCache slabTcpConnection =
+    SLAB_CACHE_INIT("tcp_connection", tcpConnection, 0);
+
 void netTcpReceive(NIC *nic, void *body, uint32_t size) {
   tcpHeader  *header = (tcpHeader *)((size_t)body + sizeof(netPacketHeader) +
                                     sizeof(IPv4header));
@@ -67,7 +71,7 @@ void netTcpSendGeneric(NIC *nic, uint8_t *destination_ip,
                        uint32_t destination_port, uint32_t sequence_number,
                        uint32_t acknowledgement_number, uint8_t flags,
                        void *payload, uint32_t size) {
-  uint8_t   *body = (uint8_t *)malloc(sizeof(tcpHeader) + size);
+  uint8_t   *body = (uint8_t *)netPacketAllocate(sizeof(tcpHeader) + size);
   tcpHeader *header = (tcpHeader *)body;
 
   header->source_port = switch_endian_16(source_port);
@@ -91,7 +95,7 @@ void netTcpSendGeneric(NIC *nic, uint8_t *destination_ip,
 
   netIPv4Send(nic, destination_mac, destination_ip, body,
               sizeof(tcpHeader) + size, TCP_PROTOCOL);
-  free(body);
+  netPacketFree(body, sizeof(tcpHeader) + size);
 }
 
 /* More caring, still not secure!
@@ -126,13 +130,15 @@ void netTcpFinishHandshake(NIC *nic, Socket *socket, void *request,
                     ++connection->client_ack_number, ACK_FLAG, 0, 0);
 
   connection->open = true; // hell yea
+  waitWakeAll(&connection->opened);
 }
 
 /* Most below functions are usual and user-usable half-securely (lol) */
 
 tcpConnection *netTcpConnect(NIC *nic, Socket *socket) {
   // Start the threeway (handshake... IT'S A HANDSHAKE!)
-  tcpConnection *connection = (tcpConnection *)malloc(sizeof(tcpConnection));
+  tcpConnection *connection =
+      (tcpConnection *)SlabAllocateZero(&slabTcpConnection);
 
   connection->open = false;
   connection->closing = false;
@@ -160,8 +166,7 @@ void netTcpAwaitOpen(Socket *socket) {
   tcpConnection *connection = (tcpConnection *)socket->protocolSpecific;
   if (connection->closing)
     return;
-  while (!connection->open)
-    ;
+  waitEvent(&connection->opened, connection->open);
 }
 
 bool netTcpClose(NIC *nic, Socket *socket) {
@@ -179,6 +184,6 @@ bool netTcpCleanup(NIC *nic, Socket *socket) {
   if (connection->open)
     return false;
 
-  free(connection);
+  SlabFree(&slabTcpConnection, connection);
   return true;
 }
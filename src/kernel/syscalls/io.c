@@ -19,11 +19,9 @@ int readHandler(OpenFile *fd, uint8_t *in, size_t limit) {
   uint8_t *kernelBuff = malloc(limit);
 
   // start reading
-  kbTaskRead(currentTask->id, (char *)kernelBuff, limit, true);
+  kbTaskRead(currentTask->id, (char *)kernelBuff, limit);
   asm volatile("sti"); // leave this task/execution (awaiting return)
-  while (currentTask->state == TASK_STATE_WAITING_INPUT) {
-    handControl();
-  }
+  waitEvent(&kbWaiters, !kbIsReading(currentTask->id));
   if (currentTask->term.c_lflag & ICANON)
     printf("\n"); // you technically pressed enter, didn't you?
 
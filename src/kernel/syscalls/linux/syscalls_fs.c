@@ -2,9 +2,11 @@
 #include <linked_list.h>
 #include <linux.h>
 #include <malloc.h>
+#include <string.h>
 #include <syscalls.h>
 #include <task.h>
 #include <util.h>
+#include <zram.h>
 
 #define SYSCALL_READ 0
 static int syscallRead(int fd, char *str, uint32_t count) {
@@ -282,6 +284,23 @@ static int syscallFcntl(int fd, int cmd, uint64_t arg) {
   }
 }
 
+#define SYSCALL_FTRUNCATE 77
+static int syscallFtruncate(int fd, size_t length) {
+  OpenFile *file = fsUserGetNode(currentTask, fd);
+  if (!file)
+    return -EBADF;
+  if (!(file->flags & O_RDWR) && !(file->flags & O_WRONLY))
+    return -EINVAL;
+  if (!file->handlers->truncate) {
+#if DEBUG_SYSCALLS_STUB
+    debugf("[syscalls::ftruncate] Unsupported file! fd{%d}\n", fd);
+#endif
+    return -EINVAL;
+  }
+
+  return file->handlers->truncate(file, length);
+}
+
 #define SYSCALL_MKDIR 83
 static int syscallMkdir(char *path, uint32_t mode) {
   mode &= ~(currentTask->umask);
@@ -529,6 +548,44 @@ static int syscallStatx(int dirfd, char *pathname, int flags, uint32_t mask,
   return 0;
 }
 
+#define SYSCALL_MEMFD_CREATE 319
+static int syscallMemfdCreate(char *name, unsigned int flags) {
+  return shmemMemfdCreate(name, flags);
+}
+
+// Only the compressed ram disk can be mounted for now (whatever's on it is
+// picked up on its own, so fstype, flags & data are ignored)
+#define SYSCALL_MOUNT 165
+static int syscallMount(char *source, char *target, char *fstype,
+                        unsigned long flags, void *data) {
+  if (!source || !target)
+    return -EFAULT;
+  if (strlength(source) != 10 || memcmp(source, "/dev/zram0", 10) != 0)
+    return -ENODEV;
+
+  if (!zramClaim())
+    return -EBUSY;
+
+  // mount points need their trailing '/'
+  char  *safeTarget = fsSanitize(currentTask->cwd, target);
+  size_t len = strlength(safeTarget);
+  char  *prefix = (char *)malloc(len + 2);
+  memcpy(prefix, safeTarget, len);
+  if (prefix[len - 1] != '/')
+    prefix[len++] = '/';
+  prefix[len] = '\0';
+  free(safeTarget);
+
+  // nothing (mountable) on it, which fsMount() finds out on its own
+  MountPoint *mnt = fsMount(prefix, CONNECTOR_ZRAM, 0, 0);
+  free(prefix);
+  if (!mnt) {
+    zramUnclaim();
+    return -EINVAL;
+  }
+  return 0;
+}
+
 // #define SYSCALL_FACCESSAT2 439
 // static int syscallFaccessat2(int dirfd, char *pathname, int mode, int flags)
 // {
@@ -563,5 +620,8 @@ void syscallRegFs() {
   registerSyscall(SYSCALL_FCNTL, syscallFcntl);
   registerSyscall(SYSCALL_STATX, syscallStatx);
   registerSyscall(SYSCALL_READLINK, syscallReadlink);
+  registerSyscall(SYSCALL_FTRUNCATE, syscallFtruncate);
+  registerSyscall(SYSCALL_MEMFD_CREATE, syscallMemfdCreate);
+  registerSyscall(SYSCALL_MOUNT, syscallMount);
   // registerSyscall(SYSCALL_FACCESSAT2, syscallFaccessat2);
 }
\ No newline at end of file
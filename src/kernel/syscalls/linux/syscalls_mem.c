@@ -1,8 +1,12 @@
 #include <linux.h>
+#include <malloc.h>
 #include <paging.h>
+#include <swap.h>
 #include <syscalls.h>
 #include <task.h>
 #include <util.h>
+#include <vma.h>
+#include <zram.h>
 
 #define SYSCALL_MMAP 9
 static uint64_t syscallMmap(size_t addr, size_t length, int prot, int flags,
@@ -10,52 +14,38 @@ static uint64_t syscallMmap(size_t addr, size_t length, int prot, int flags,
   if (length == 0)
     return -EINVAL;
 
-  length = DivRoundUp(length, 0x1000) * 0x1000;
   /* No point in DEBUG_SYSCALLS_ARGS'ing here */
   if (!addr)
     flags &= ~MAP_FIXED;
+  // replacing whatever is there, so it better be ours
+  if (flags & MAP_FIXED && (addr % PAGE_SIZE || !VmaUserRange(addr, length)))
+    return -EINVAL;
+  if (length > USER_END)
+    return -ENOMEM;
+  length = DivRoundUp(length, 0x1000) * 0x1000;
 
-  if (flags & MAP_FIXED && flags & MAP_ANONYMOUS) {
-    size_t pages = DivRoundUp(length, PAGE_SIZE);
-
-    for (int i = 0; i < pages; i++)
-      VirtualMap(addr + i * PAGE_SIZE, PhysicalAllocate(1), PF_RW | PF_USER);
-
-    memset((void *)addr, 0, pages * PAGE_SIZE);
-    return addr;
-  }
+  if (flags & MAP_ANONYMOUS && !(flags & MAP_SHARED)) {
+#if DEBUG_SYSCALLS_EXTRA
+    debugf("[syscalls::mmap] No file descriptor: addr{%lx} length{%lx}\n",
+           addr, length);
+#endif
+    size_t base = VmaReserve(currentTask, addr, length, prot, flags,
+                             VMA_ANONYMOUS);
+    if (!base)
+      return -ENOMEM;
 
-  if (!addr && fd == -1 &&
-      (flags & ~MAP_FIXED & ~MAP_PRIVATE) ==
-          MAP_ANONYMOUS) { // before: !addr &&
-    size_t curr = currentTask->mmap_end;
+    // zero-filled lazily, see PagingHandleFault()
+    VirtualMapDemand(base, length / PAGE_SIZE, VmaPageFlags(prot));
 #if DEBUG_SYSCALLS_EXTRA
-    debugf("[syscalls::mmap] No placement preference, no file descriptor: "
-           "addr{%lx} length{%lx}\n",
-           curr, length);
+    debugf("[syscalls::mmap] Found addr{%lx}\n", base);
 #endif
-    taskAdjustHeap(currentTask, currentTask->mmap_end + length,
-                   &currentTask->mmap_start, &currentTask->mmap_end);
-    memset((void *)curr, 0, length);
+    return base;
+  } else if (flags & MAP_ANONYMOUS) {
+    // shared with fork()ed children, through a shared memory object
+    size_t base = shmemMmapAnonymous(addr, length, prot, flags);
 #if DEBUG_SYSCALLS_EXTRA
-    debugf("[syscalls::mmap] Found addr{%lx}\n", curr);
+    debugf("[syscalls::mmap] Found shared addr{%lx}\n", base);
 #endif
-    return curr;
-  } else if (!addr && fd == -1 &&
-             (flags & ~MAP_FIXED & ~MAP_PRIVATE & ~MAP_SHARED) ==
-                 MAP_ANONYMOUS &&
-             (flags & ~MAP_FIXED & ~MAP_PRIVATE & ~MAP_ANONYMOUS) ==
-                 MAP_SHARED) {
-    debugf("[syscalls::mmap] FATAL! Shared memory is unstable asf!\n");
-    panic();
-    size_t base = currentTask->mmap_end;
-    size_t pages = DivRoundUp(length, PAGE_SIZE);
-    currentTask->mmap_end += pages * PAGE_SIZE;
-
-    for (int i = 0; i < pages; i++)
-      VirtualMap(base + i * PAGE_SIZE, PhysicalAllocate(1),
-                 PF_RW | PF_USER | PF_SHARED);
-
     return base;
   } else if (fd != -1) {
     OpenFile *file = fsUserGetNode(currentTask, fd);
@@ -80,7 +70,10 @@ static uint64_t syscallMmap(size_t addr, size_t length, int prot, int flags,
 
 #define SYSCALL_MUNMAP 11
 static int syscallMunmap(uint64_t addr, size_t len) {
-  // todo
+  if (addr % PAGE_SIZE || !VmaUserRange(addr, len))
+    return -EINVAL;
+
+  VmaUnmap(currentTask, addr, len);
   return 0;
 }
 
@@ -104,8 +97,71 @@ static uint64_t syscallBrk(uint64_t brk) {
   return currentTask->heap_end;
 }
 
+#define SYSCALL_MREMAP 25
+static uint64_t syscallMremap(uint64_t oldAddr, size_t oldLen, size_t newLen,
+                              int flags, uint64_t newAddr) {
+  if (oldAddr % PAGE_SIZE || !newLen ||
+      flags & ~(MREMAP_MAYMOVE | MREMAP_FIXED))
+    return -EINVAL;
+  if (oldAddr >= USER_END || oldLen > USER_END - oldAddr || newLen > USER_END ||
+      (flags & MREMAP_FIXED && !VmaUserRange(newAddr, newLen)))
+    return -EINVAL;
+
+  return VmaRemap(currentTask, oldAddr, oldLen, newLen, flags, newAddr);
+}
+
+#define SYSCALL_MSYNC 26
+static int syscallMsync(uint64_t addr, size_t len, int flags) {
+  if (addr % PAGE_SIZE || flags & ~(MS_ASYNC | MS_INVALIDATE | MS_SYNC))
+    return -EINVAL;
+
+  // the cache is the only copy around, so there's nothing to invalidate
+  VmaSync(currentTask, addr, len);
+  return 0;
+}
+
+#define SYSCALL_MADVISE 28
+static int syscallMadvise(uint64_t addr, size_t len, int advice) {
+  if (addr % PAGE_SIZE)
+    return -EINVAL;
+
+  // the rest are mere hints, which we can safely ignore
+  if (advice == MADV_DONTNEED)
+    VmaDiscard(currentTask, addr, len);
+
+  return 0;
+}
+
+#define SYSCALL_SWAPON 167
+static int syscallSwapon(char *path, int swapflags) {
+  char     *safePath = fsSanitize(currentTask->cwd, path);
+  OpenFile *file = fsKernelOpen(safePath, O_RDWR, 0);
+  free(safePath);
+  if (!file)
+    return -ENOENT;
+
+  // the compressed ram disk can't hold a filesystem at the same time
+  if (file->handlers == &zramHandlers && !zramClaim()) {
+    fsKernelClose(file);
+    return -EBUSY;
+  }
+
+  // priorities & discards make no sense with a single swap area
+  int ret = SwapActivateFile(file);
+  if (ret < 0) {
+    if (file->handlers == &zramHandlers)
+      zramUnclaim();
+    fsKernelClose(file);
+  }
+  return ret;
+}
+
 void syscallRegMem() {
   registerSyscall(SYSCALL_MMAP, syscallMmap);
   registerSyscall(SYSCALL_MUNMAP, syscallMunmap);
   registerSyscall(SYSCALL_BRK, syscallBrk);
+  registerSyscall(SYSCALL_MREMAP, syscallMremap);
+  registerSyscall(SYSCALL_MSYNC, syscallMsync);
+  registerSyscall(SYSCALL_MADVISE, syscallMadvise);
+  registerSyscall(SYSCALL_SWAPON, syscallSwapon);
 }
\ No newline at end of file
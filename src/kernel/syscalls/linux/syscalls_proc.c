@@ -218,7 +218,8 @@ static int syscallWait4(int pid, int *wstatus, int options, struct rusage *ru) {
   int ret = target->ret;
 
   // cleanup
-  LinkedListRemove((void **)(&currentTask->firstChildTerminated), target);
+  LinkedListUnregister((void **)(&currentTask->firstChildTerminated), target);
+  SlabFree(&slabKilledInfo, target);
   currentTask->childrenTerminatedAmnt--;
   spinlockRelease(&currentTask->LOCK_CHILD_TERM);
 
@@ -231,6 +232,51 @@ static int syscallWait4(int pid, int *wstatus, int options, struct rusage *ru) {
   return output;
 }
 
+#define SYSCALL_GETRUSAGE 98
+static int syscallGetrusage(int who, struct rusage *usage) {
+  if (who != RUSAGE_SELF) {
+#if DEBUG_SYSCALLS_STUB
+    debugf("[syscall::getrusage] UNIMPLEMENTED who{%d}!\n", who);
+#endif
+    return -EINVAL;
+  }
+
+  memset(usage, 0, sizeof(struct rusage));
+  usage->ru_minflt = currentTask->minorFaults;
+  usage->ru_majflt = currentTask->majorFaults;
+  usage->ru_nvcsw = currentTask->switchesVoluntary;
+  usage->ru_nivcsw = currentTask->switchesInvoluntary;
+  return 0;
+}
+
+#define SYSCALL_SCHED_SETAFFINITY 203
+static int syscallSchedSetaffinity(int pid, size_t len, uint64_t *mask) {
+  Task *task = pid ? taskGet(pid) : currentTask;
+  if (!task)
+    return -ESRCH;
+  if (len < sizeof(uint64_t) || !(*mask & smpOnline))
+    return -EINVAL;
+
+  task->affinity = *mask;
+
+  // takes effect on its next switch, which is right now for us
+  if (task == currentTask && !(task->affinity & (1ULL << cpuSelf()->id)))
+    handControl();
+  return 0;
+}
+
+#define SYSCALL_SCHED_GETAFFINITY 204
+static int syscallSchedGetaffinity(int pid, size_t len, uint64_t *mask) {
+  Task *task = pid ? taskGet(pid) : currentTask;
+  if (!task)
+    return -ESRCH;
+  if (len < sizeof(uint64_t))
+    return -EINVAL;
+
+  *mask = task->affinity & smpOnline;
+  return sizeof(uint64_t);
+}
+
 #define SYSCALL_EXIT_GROUP 231
 static void syscallExitGroup(int return_code) { syscallExitTask(return_code); }
 
@@ -242,5 +288,8 @@ void syscallsRegProc() {
   registerSyscall(SYSCALL_VFORK, syscallVfork);
   registerSyscall(SYSCALL_WAIT4, syscallWait4);
   registerSyscall(SYSCALL_EXECVE, syscallExecve);
+  registerSyscall(SYSCALL_GETRUSAGE, syscallGetrusage);
+  registerSyscall(SYSCALL_SCHED_SETAFFINITY, syscallSchedSetaffinity);
+  registerSyscall(SYSCALL_SCHED_GETAFFINITY, syscallSchedGetaffinity);
   registerSyscall(SYSCALL_EXIT_GROUP, syscallExitGroup);
 }
@@ -3,8 +3,12 @@
 #include <kb.h>
 #include <linux.h>
 #include <malloc.h>
+#include <paging.h>
+#include <slab.h>
 #include <syscalls.h>
 #include <task.h>
+#include <vmm.h>
+#include <wait.h>
 
 // Industrial two-way solid steel pipe()
 // Copyright (C) 2024 Panagiotis
@@ -17,14 +21,22 @@ typedef struct PipeInfo {
   int readFds;
 
   Spinlock LOCK;
+
+  WaitQueue readers; // waiting for data (or the last write end to go)
+  WaitQueue writers; // waiting for room
 } PipeInfo;
 
+#define PIPE_INFO_PAGES DivRoundUp(sizeof(PipeInfo), PAGE_SIZE)
+
 typedef struct PipeSpecific PipeSpecific;
 struct PipeSpecific {
   bool      write;
   PipeInfo *info;
 };
 
+SlabCache slabPipeSpecific =
+    SLAB_CACHE_INIT("pipe_specific", PipeSpecific, 0);
+
 int pipeOpen(int *fds) {
   int readFd = fsUserOpen(currentTask, "/dev/stdout", O_RDONLY, 0);
   int writeFd = fsUserOpen(currentTask, "/dev/stdout", O_WRONLY, 0);
@@ -41,16 +53,18 @@ int pipeOpen(int *fds) {
   read->handlers = &pipeReadEnd;
   write->handlers = &pipeWriteEnd;
 
-  PipeInfo *info = (PipeInfo *)malloc(sizeof(PipeInfo));
-  memset(info, 0, sizeof(PipeInfo));
+  // the buffer alone is 16 pages, no reason to have the pmm find them in a row
+  PipeInfo *info = (PipeInfo *)VmallocAllocate(PIPE_INFO_PAGES);
   info->readFds = 1;
   info->writeFds = 1;
+  waitQueueInit(&info->readers);
+  waitQueueInit(&info->writers);
 
-  PipeSpecific *readSpec = (PipeSpecific *)malloc(sizeof(PipeSpecific));
+  PipeSpecific *readSpec = (PipeSpecific *)SlabAllocate(&slabPipeSpecific);
   readSpec->write = false;
   readSpec->info = info;
 
-  PipeSpecific *writeSpec = (PipeSpecific *)malloc(sizeof(PipeSpecific));
+  PipeSpecific *writeSpec = (PipeSpecific *)SlabAllocate(&slabPipeSpecific);
   writeSpec->write = true;
   writeSpec->info = info;
 
@@ -68,7 +82,7 @@ bad_error:
 }
 
 bool pipeDuplicate(OpenFile *original, OpenFile *orphan) {
-  orphan->dir = malloc(sizeof(PipeSpecific));
+  orphan->dir = SlabAllocate(&slabPipeSpecific);
   memcpy(orphan->dir, original->dir, sizeof(PipeSpecific));
 
   PipeSpecific *spec = (PipeSpecific *)original->dir;
@@ -103,18 +117,23 @@ int pipeRead(OpenFile *fd, uint8_t *out, size_t limit) {
   //   browse = browse->next;
   // }
 
-  // if there are no more write items, don't hang
-  while (pipe->writeFds != 0 && !pipe->assigned) {
-    if (fd->flags & O_NONBLOCK)
+  // every reader gets woken up, so whatever the wait saw might've been taken
+  // by another one before we got the lock
+  while (true) {
+    // if there are no more write items, don't hang
+    if (pipe->writeFds != 0 && !pipe->assigned && fd->flags & O_NONBLOCK)
       return -EWOULDBLOCK;
-    // debugf("write{%d} curr{%d}\n", pipe->writeFds, currentTask->id);
-    asm volatile("pause");
-  }
+    waitEvent(&pipe->readers, pipe->writeFds == 0 || pipe->assigned);
 
-  if (!pipe->assigned)
-    return 0;
+    spinlockAcquire(&pipe->LOCK);
+    if (pipe->assigned)
+      break;
+    bool eof = pipe->writeFds == 0;
+    spinlockRelease(&pipe->LOCK);
+    if (eof)
+      return 0;
+  }
 
-  spinlockAcquire(&pipe->LOCK);
   int toCopy = pipe->assigned;
   if (toCopy > limit)
     toCopy = limit;
@@ -123,6 +142,7 @@ int pipeRead(OpenFile *fd, uint8_t *out, size_t limit) {
   pipe->assigned -= toCopy;
   memmove(pipe->buf, &pipe->buf[toCopy], 65536 - toCopy);
   spinlockRelease(&pipe->LOCK);
+  waitWakeAll(&pipe->writers);
 
   return toCopy;
 }
@@ -130,16 +150,22 @@ int pipeRead(OpenFile *fd, uint8_t *out, size_t limit) {
 int pipeWriteInner(OpenFile *fd, uint8_t *in, size_t limit) {
   PipeSpecific *spec = (PipeSpecific *)fd->dir;
   PipeInfo     *pipe = spec->info;
-  while ((pipe->assigned + limit) > 65536) {
-    if (fd->flags & O_NONBLOCK)
+  // same as pipeRead(), the room has to still be there once we've got the lock
+  while (true) {
+    if ((pipe->assigned + limit) > 65536 && fd->flags & O_NONBLOCK)
       return -EWOULDBLOCK;
-    asm volatile("pause");
+    waitEvent(&pipe->writers, (pipe->assigned + limit) <= 65536);
+
+    spinlockAcquire(&pipe->LOCK);
+    if ((pipe->assigned + limit) <= 65536)
+      break;
+    spinlockRelease(&pipe->LOCK);
   }
 
-  spinlockAcquire(&pipe->LOCK);
   memcpy(&pipe->buf[pipe->assigned], in, limit);
   pipe->assigned += limit;
   spinlockRelease(&pipe->LOCK);
+  waitWakeAll(&pipe->readers);
 
   return limit;
 }
@@ -176,12 +202,16 @@ bool pipeCloseEnd(OpenFile *readFd) {
   else
     pipe->readFds--;
 
+  // readers don't wait on the last write end that's gone
+  if (spec->write && !pipe->writeFds)
+    waitWakeAll(&pipe->readers);
+
   if (!pipe->readFds && !pipe->writeFds) {
     spinlockAcquire(&pipe->LOCK);
-    free(pipe);
+    VmallocFree(pipe, PIPE_INFO_PAGES);
   }
 
-  free(spec);
+  SlabFree(&slabPipeSpecific, spec);
 
   return true;
 }
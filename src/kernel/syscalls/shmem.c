@@ -0,0 +1,268 @@
+#include <bootloader.h>
+#include <linked_list.h>
+#include <linux.h>
+#include <malloc.h>
+#include <page_cache.h>
+#include <paging.h>
+#include <slab.h>
+#include <string.h>
+#include <syscalls.h>
+#include <task.h>
+#include <util.h>
+
+// Shared memory objects: memfd_create(), /dev/shm & MAP_SHARED|MAP_ANONYMOUS
+// All of them are just an unbacked page cache, shared by every handle & mapping
+// Copyright (C) 2024 Panagiotis
+
+#define SHMEM_DEBUG 0
+
+#define HHDMoffset (bootloader.hhdmOffset)
+
+typedef struct ShmemObject ShmemObject;
+struct ShmemObject {
+  ShmemObject *next; // only named (/dev/shm) ones are on the list
+
+  char  *name;
+  size_t size;
+
+  // open handles (mappings keep one of their own) & the name itself, which
+  // stays around until the very end since there's no unlink() yet
+  int refs;
+
+  PageCache *cache;
+  Spinlock   LOCK;
+};
+
+Spinlock     LOCK_SHMEM_NAMED;
+ShmemObject *firstShmemNamed = 0;
+
+static ShmemObject *shmemObjectAllocate() {
+  ShmemObject *object = (ShmemObject *)malloc(sizeof(ShmemObject));
+  memset(object, 0, sizeof(ShmemObject));
+  object->cache = PageCacheAllocate();
+  return object;
+}
+
+// Hands out a file descriptor (or an orphan when task is null) for the object
+static OpenFile *shmemAttach(Task *task, ShmemObject *object, int flags) {
+  spinlockAcquire(&object->LOCK);
+  object->refs++;
+  spinlockRelease(&object->LOCK);
+
+  return fsUserOpenSpecial(task, &shmemHandlers, object,
+                           O_RDWR | (flags & O_CLOEXEC));
+}
+
+int shmemMemfdCreate(char *name, unsigned int flags) {
+  if (flags & ~(MFD_CLOEXEC | MFD_ALLOW_SEALING))
+    return -EINVAL;
+
+  ShmemObject *object = shmemObjectAllocate();
+  OpenFile    *fd =
+      shmemAttach(currentTask, object, (flags & MFD_CLOEXEC) ? O_CLOEXEC : 0);
+
+#if SHMEM_DEBUG
+  debugf("[shmem] memfd: name{%s} fd{%d}\n", name, fd->id);
+#endif
+  return fd->id;
+}
+
+// MAP_SHARED|MAP_ANONYMOUS: an object nobody can reach besides the mapping
+// itself (& its fork()ed copies)
+size_t shmemMmapAnonymous(size_t addr, size_t length, int prot, int flags) {
+  ShmemObject *object = shmemObjectAllocate();
+  object->size = length;
+
+  OpenFile *orphan = shmemAttach(0, object, 0);
+  size_t    ret =
+      PageCacheMmap(addr, length, prot, flags, orphan, 0, object->cache);
+  fsCloseOrphan(orphan);
+
+  return ret;
+}
+
+/* /dev/shm (the fakefs "*" entry under it, see dev_controller.c) */
+
+int shmemOpen(char *filename, int flags, int mode, OpenFile *fd,
+              char **symlinkResolve) {
+  char *name = filename;
+  for (char *browse = filename; *browse; browse++) {
+    if (*browse == '/')
+      name = browse + 1;
+  }
+  if (!name[0])
+    return -EINVAL;
+
+  spinlockAcquire(&LOCK_SHMEM_NAMED);
+  ShmemObject *object = firstShmemNamed;
+  while (object) {
+    if (strlength(object->name) == strlength(name) &&
+        memcmp(object->name, name, strlength(name)) == 0)
+      break;
+    object = object->next;
+  }
+
+  if (object && flags & O_CREAT && flags & O_EXCL) {
+    spinlockRelease(&LOCK_SHMEM_NAMED);
+    return -EEXIST;
+  }
+
+  if (!object) {
+    if (!(flags & O_CREAT)) {
+      spinlockRelease(&LOCK_SHMEM_NAMED);
+      return -ENOENT;
+    }
+
+    object = shmemObjectAllocate();
+    size_t len = strlength(name) + 1;
+    object->name = (char *)malloc(len);
+    memcpy(object->name, name, len);
+    object->refs = 1; // the name
+    LinkedListPushFrontUnsafe((void **)&firstShmemNamed, object);
+  }
+  spinlockRelease(&LOCK_SHMEM_NAMED);
+
+  spinlockAcquire(&object->LOCK);
+  if (flags & O_TRUNC && (flags & O_ACCMODE) != O_RDONLY) {
+    object->size = 0;
+    PageCacheTruncate(object->cache, 0);
+  }
+  object->refs++;
+  spinlockRelease(&object->LOCK);
+
+  fd->dir = object;
+  fd->pointer = 0;
+  return 0;
+}
+
+/* Handlers */
+
+static int shmemRead(OpenFile *fd, uint8_t *out, size_t limit) {
+  ShmemObject *object = (ShmemObject *)fd->dir;
+
+  spinlockAcquire(&object->LOCK);
+  size_t done = 0;
+  limit = fd->pointer < object->size ? MIN(limit, object->size - fd->pointer)
+                                     : 0;
+  while (done < limit) {
+    size_t inner = fd->pointer % PAGE_SIZE;
+    size_t chunk = MIN(PAGE_SIZE - inner, limit - done);
+    size_t phys = PageCacheFetch(object->cache, 0, fd->pointer / PAGE_SIZE);
+    memcpy(&out[done], (void *)(phys + HHDMoffset + inner), chunk);
+
+    fd->pointer += chunk;
+    done += chunk;
+  }
+  spinlockRelease(&object->LOCK);
+
+  return done;
+}
+
+static int shmemWrite(OpenFile *fd, uint8_t *in, size_t limit) {
+  ShmemObject *object = (ShmemObject *)fd->dir;
+
+  spinlockAcquire(&object->LOCK);
+  if (fd->flags & O_APPEND)
+    fd->pointer = object->size;
+
+  size_t done = 0;
+  while (done < limit) {
+    size_t inner = fd->pointer % PAGE_SIZE;
+    size_t chunk = MIN(PAGE_SIZE - inner, limit - done);
+    size_t phys = PageCacheFetch(object->cache, 0, fd->pointer / PAGE_SIZE);
+    memcpy((void *)(phys + HHDMoffset + inner), &in[done], chunk);
+
+    fd->pointer += chunk;
+    done += chunk;
+  }
+  object->size = MAX(object->size, fd->pointer);
+  spinlockRelease(&object->LOCK);
+
+  return done;
+}
+
+static size_t shmemSeek(OpenFile *fd, size_t target, long int offset,
+                        int whence) {
+  // fsUserSeek() already did the math for us
+  fd->pointer = target;
+  return fd->pointer;
+}
+
+static int shmemStat(OpenFile *fd, stat *target) {
+  ShmemObject *object = (ShmemObject *)fd->dir;
+
+  memset(target, 0, sizeof(stat));
+  target->st_dev = 70;
+  target->st_ino = (size_t)object;
+  target->st_mode = S_IFREG | S_IRUSR | S_IWUSR;
+  target->st_nlink = 1;
+  target->st_blksize = PAGE_SIZE;
+  target->st_size = object->size;
+  target->st_blocks = DivRoundUp(object->size, PAGE_SIZE) * PAGE_SIZE / 512;
+
+  return 0;
+}
+
+static size_t shmemGetFilesize(OpenFile *fd) {
+  ShmemObject *object = (ShmemObject *)fd->dir;
+  return object->size;
+}
+
+static int shmemTruncate(OpenFile *fd, size_t length) {
+  ShmemObject *object = (ShmemObject *)fd->dir;
+
+  spinlockAcquire(&object->LOCK);
+  if (length < object->size)
+    PageCacheTruncate(object->cache, length);
+  object->size = length;
+  spinlockRelease(&object->LOCK);
+
+  return 0;
+}
+
+static size_t shmemMmap(size_t addr, size_t length, int prot, int flags,
+                        OpenFile *fd, size_t pgoffset) {
+  ShmemObject *object = (ShmemObject *)fd->dir;
+  return PageCacheMmap(addr, length, prot, flags, fd, pgoffset, object->cache);
+}
+
+static bool shmemDuplicate(OpenFile *original, OpenFile *orphan) {
+  ShmemObject *object = (ShmemObject *)original->dir;
+
+  spinlockAcquire(&object->LOCK);
+  object->refs++;
+  spinlockRelease(&object->LOCK);
+
+  return true;
+}
+
+static bool shmemClose(OpenFile *fd) {
+  ShmemObject *object = (ShmemObject *)fd->dir;
+
+  spinlockAcquire(&object->LOCK);
+  bool last = --object->refs == 0;
+  spinlockRelease(&object->LOCK);
+
+  if (last) {
+#if SHMEM_DEBUG
+    debugf("[shmem] Freeing object{%lx} size{%lx}\n", object, object->size);
+#endif
+    PageCacheFree(object->cache);
+    free(object);
+  }
+
+  return true;
+}
+
+VfsHandlers shmemHandlers = {.open = shmemOpen,
+                             .close = shmemClose,
+                             .duplicate = shmemDuplicate,
+                             .ioctl = 0,
+                             .mmap = shmemMmap,
+                             .stat = shmemStat,
+                             .read = shmemRead,
+                             .write = shmemWrite,
+                             .seek = shmemSeek,
+                             .truncate = shmemTruncate,
+                             .getFilesize = shmemGetFilesize,
+                             .getdents64 = 0};
@@ -0,0 +1,172 @@
+#include <avl_tree.h>
+#include <util.h>
+
+// AVL (self-balancing binary search) trees, keyed by a plain integer. Nodes
+// are intrusive, so no allocations whatsoever happen in here.
+// Copyright (C) 2024 Panagiotis
+
+/* Balancing */
+
+static int AvlHeight(AvlNode *node) { return node ? node->height : 0; }
+
+static void AvlUpdate(AvlNode *node) {
+  node->height = 1 + MAX(AvlHeight(node->left), AvlHeight(node->right));
+}
+
+static AvlNode *AvlRotateRight(AvlNode *node) {
+  AvlNode *left = node->left;
+  node->left = left->right;
+  left->right = node;
+  AvlUpdate(node);
+  AvlUpdate(left);
+  return left;
+}
+
+static AvlNode *AvlRotateLeft(AvlNode *node) {
+  AvlNode *right = node->right;
+  node->right = right->left;
+  right->left = node;
+  AvlUpdate(node);
+  AvlUpdate(right);
+  return right;
+}
+
+static AvlNode *AvlBalance(AvlNode *node) {
+  AvlUpdate(node);
+  int balance = AvlHeight(node->left) - AvlHeight(node->right);
+
+  if (balance > 1) {
+    if (AvlHeight(node->left->left) < AvlHeight(node->left->right))
+      node->left = AvlRotateLeft(node->left);
+    return AvlRotateRight(node);
+  }
+
+  if (balance < -1) {
+    if (AvlHeight(node->right->right) < AvlHeight(node->right->left))
+      node->right = AvlRotateRight(node->right);
+    return AvlRotateLeft(node);
+  }
+
+  return node;
+}
+
+/* Insertion & removal */
+
+static AvlNode *AvlInsertAt(AvlNode *root, AvlNode *node) {
+  if (!root)
+    return node;
+
+  if (node->key < root->key)
+    root->left = AvlInsertAt(root->left, node);
+  else
+    root->right = AvlInsertAt(root->right, node);
+
+  return AvlBalance(root);
+}
+
+void AvlInsert(DS_AvlTree *tree, AvlNode *node) {
+  node->left = 0;
+  node->right = 0;
+  node->height = 1;
+
+  tree->root = AvlInsertAt(tree->root, node);
+  tree->count++;
+}
+
+static AvlNode *AvlRemoveMin(AvlNode *root, AvlNode **min) {
+  if (!root->left) {
+    *min = root;
+    return root->right;
+  }
+
+  root->left = AvlRemoveMin(root->left, min);
+  return AvlBalance(root);
+}
+
+static AvlNode *AvlRemoveAt(AvlNode *root, AvlNode *node, bool *found) {
+  if (!root)
+    return 0;
+
+  if (node->key < root->key)
+    root->left = AvlRemoveAt(root->left, node, found);
+  else if (node->key > root->key)
+    root->right = AvlRemoveAt(root->right, node, found);
+  else {
+    *found = true;
+    AvlNode *left = root->left;
+    AvlNode *right = root->right;
+    if (!right)
+      return left;
+
+    // the in-order successor takes our place
+    AvlNode *min = 0;
+    right = AvlRemoveMin(right, &min);
+    min->left = left;
+    min->right = right;
+    return AvlBalance(min);
+  }
+
+  return AvlBalance(root);
+}
+
+bool AvlRemove(DS_AvlTree *tree, AvlNode *node) {
+  bool found = false;
+  tree->root = AvlRemoveAt(tree->root, node, &found);
+  if (found)
+    tree->count--;
+  return found;
+}
+
+/* Lookups */
+
+AvlNode *AvlFind(DS_AvlTree *tree, size_t key) {
+  AvlNode *browse = tree->root;
+  while (browse) {
+    if (key == browse->key)
+      return browse;
+    browse = key < browse->key ? browse->left : browse->right;
+  }
+  return 0;
+}
+
+// Greatest key that is <= the one provided
+AvlNode *AvlFloor(DS_AvlTree *tree, size_t key) {
+  AvlNode *browse = tree->root;
+  AvlNode *ret = 0;
+  while (browse) {
+    if (browse->key <= key) {
+      ret = browse;
+      browse = browse->right;
+    } else
+      browse = browse->left;
+  }
+  return ret;
+}
+
+// Smallest key that is >= the one provided
+AvlNode *AvlCeiling(DS_AvlTree *tree, size_t key) {
+  AvlNode *browse = tree->root;
+  AvlNode *ret = 0;
+  while (browse) {
+    if (browse->key >= key) {
+      ret = browse;
+      browse = browse->left;
+    } else
+      browse = browse->right;
+  }
+  return ret;
+}
+
+AvlNode *AvlFirst(DS_AvlTree *tree) {
+  AvlNode *browse = tree->root;
+  while (browse && browse->left)
+    browse = browse->left;
+  return browse;
+}
+
+// In-order successor (no parent pointers, so we just search for it)
+AvlNode *AvlNext(DS_AvlTree *tree, AvlNode *node) {
+  if (node->key == (size_t)-1)
+    return 0;
+  return AvlCeiling(tree, node->key + 1);
+}
@@ -0,0 +1,153 @@
+#include <bitmap.h>
+#include <buddy.h>
+#include <util.h>
+
+// Buddy-based memory region manager
+// Blocks of 2^order are kept on per-order free lists and get merged back with
+// their "buddy" (block ^ 2^order) whenever both halves end up free.
+// Copyright (C) 2024 Panagiotis
+
+/* Free list management */
+
+static BuddyFreeBlock *BuddyNode(DS_Buddy *buddy, size_t block) {
+  return (BuddyFreeBlock *)(buddy->mem_start + buddy->virt_offset +
+                            block * BLOCK_SIZE);
+}
+
+static size_t BuddyBlock(DS_Buddy *buddy, BuddyFreeBlock *node) {
+  return ((size_t)node - buddy->virt_offset - buddy->mem_start) / BLOCK_SIZE;
+}
+
+static void BuddyListPush(DS_Buddy *buddy, size_t block, int order) {
+  BuddyFreeBlock *node = BuddyNode(buddy, block);
+  node->prev = 0;
+  node->next = buddy->freeLists[order];
+  if (node->next)
+    node->next->prev = node;
+  buddy->freeLists[order] = node;
+
+  buddy->orders[block] = order;
+  buddy->freeCount[order]++;
+  buddy->freeBlocks += 1UL << order;
+}
+
+static void BuddyListRemove(DS_Buddy *buddy, size_t block, int order) {
+  BuddyFreeBlock *node = BuddyNode(buddy, block);
+  if (node->prev)
+    node->prev->next = node->next;
+  else
+    buddy->freeLists[order] = node->next;
+  if (node->next)
+    node->next->prev = node->prev;
+
+  buddy->orders[block] = BUDDY_ORDER_NONE;
+  buddy->freeCount[order]--;
+  buddy->freeBlocks -= 1UL << order;
+}
+
+/* Buddy data structure essentials */
+
+void BuddyInit(DS_Buddy *buddy, uint8_t *orders, size_t blocks,
+               size_t virtOffset) {
+  buddy->orders = orders;
+  buddy->blocks = blocks;
+  buddy->virt_offset = virtOffset;
+  buddy->freeBlocks = 0;
+
+  memset(buddy->orders, BUDDY_ORDER_NONE, blocks);
+  for (int i = 0; i < BUDDY_MAX_ORDER; i++) {
+    buddy->freeLists[i] = 0;
+    buddy->freeCount[i] = 0;
+  }
+}
+
+int BuddyOrderFor(size_t blocks) {
+  int order = 0;
+  while ((1UL << order) < blocks)
+    order++;
+  return order;
+}
+
+// Gives back a single 2^order block, merging it with its buddy for as long as
+// the buddy is also entirely free
+static void BuddyFreeOrder(DS_Buddy *buddy, size_t block, int order) {
+  while (order < (BUDDY_MAX_ORDER - 1)) {
+    size_t sibling = block ^ (1UL << order);
+    if ((sibling + (1UL << order)) > buddy->blocks ||
+        buddy->orders[sibling] != order)
+      break;
+
+    BuddyListRemove(buddy, sibling, order);
+    block = MIN(block, sibling);
+    order++;
+  }
+
+  BuddyListPush(buddy, block, order);
+}
+
+// Arbitrary (non power of two) ranges get split into the biggest naturally
+// aligned blocks that fit
+void BuddyFree(DS_Buddy *buddy, size_t block, size_t blocks) {
+  if ((block + blocks) > buddy->blocks) {
+    debugf("[buddy] Tried to free untracked memory! block{%lx} blocks{%lx}\n",
+           block, blocks);
+    return;
+  }
+
+  while (blocks) {
+    int order = 0;
+    while ((order + 1) < BUDDY_MAX_ORDER && !(block & (1UL << order)) &&
+           (1UL << (order + 1)) <= blocks)
+      order++;
+
+    if (buddy->orders[block] != BUDDY_ORDER_NONE) {
+      debugf("[buddy] Double free detected! block{%lx}\n", block);
+      return;
+    }
+
+    BuddyFreeOrder(buddy, block, order);
+    block += 1UL << order;
+    blocks -= 1UL << order;
+  }
+}
+
+size_t BuddyAllocate(DS_Buddy *buddy, size_t blocks) {
+  if (blocks == 0)
+    return INVALID_BLOCK;
+
+  int order = BuddyOrderFor(blocks);
+  if (order >= BUDDY_MAX_ORDER)
+    return INVALID_BLOCK;
+
+  int curr = order;
+  while (curr < BUDDY_MAX_ORDER && !buddy->freeLists[curr])
+    curr++;
+  if (curr >= BUDDY_MAX_ORDER)
+    return INVALID_BLOCK;
+
+  size_t block = BuddyBlock(buddy, buddy->freeLists[curr]);
+  BuddyListRemove(buddy, block, curr);
+
+  // split it down, handing the upper halves back
+  while (curr > order) {
+    curr--;
+    BuddyListPush(buddy, block + (1UL << curr), curr);
+  }
+
+  // non power of two requests return their unused tail immediately
+  size_t tail = (1UL << order) - blocks;
+  if (tail)
+    BuddyFree(buddy, block + blocks, tail);
+
+  return block;
+}
+
+/* Debugging functions */
+
+#define BUDDY_DEBUG_F debugf
+void BuddyDump(DS_Buddy *buddy) {
+  BUDDY_DEBUG_F("=== BUDDY DUMPING %ld BLOCKS (%ld FREE) ===\n", buddy->blocks,
+                buddy->freeBlocks);
+  for (int i = 0; i < BUDDY_MAX_ORDER; i++)
+    BUDDY_DEBUG_F("order{%d} free{%ld}\n", i, buddy->freeCount[i]);
+}
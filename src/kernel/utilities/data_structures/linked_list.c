@@ -21,6 +21,15 @@ void *LinkedListAllocate(void **LLfirstPtr, uint32_t structSize) {
   LLheader *target = (LLheader *)malloc(structSize);
   memset(target, 0, structSize);
 
+  LinkedListAppend(LLfirstPtr, target);
+  return target;
+}
+
+// Same as LinkedListAllocate(), for items that come from somewhere else (like
+// a slab cache)
+void LinkedListAppend(void **LLfirstPtr, void *LLtarget) {
+  LLheader *target = (LLheader *)LLtarget;
+
   LLheader *curr = (LLheader *)(*LLfirstPtr);
   while (1) {
     if (curr == 0) {
@@ -37,7 +46,6 @@ void *LinkedListAllocate(void **LLfirstPtr, uint32_t structSize) {
   }
 
   target->next = 0; // null ptr
-  return target;
 }
 
 bool LinkedListUnregister(void **LLfirstPtr, const void *LLtarget) {
@@ -1,8 +1,10 @@
 #include <bitmap.h>
+#include <bootloader.h>
 #include <console.h>
 #include <elf.h>
 #include <fb.h>
 #include <malloc.h>
+#include <page_cache.h>
 #include <paging.h>
 #include <pmm.h>
 #include <stack.h>
@@ -12,6 +14,8 @@
 #include <timer.h>
 #include <util.h>
 #include <vfs.h>
+#include <vma.h>
+#include <vmm.h>
 
 // ELF (for now only 64) parser
 // Copyright (C) 2024 Panagiotis
@@ -45,57 +49,193 @@ bool elf_check_file(Elf64_Ehdr *hdr) {
   return true;
 }
 
-void elfProcessLoad(Elf64_Phdr *elf_phdr, uint8_t *out, size_t base) {
+// Reads len bytes of the file at offset, false if it's cut short
+static bool elfReadAt(OpenFile *file, size_t offset, void *out, size_t len) {
+  if (!file->handlers->seek)
+    return false;
+  file->handlers->seek(file, offset, offset, SEEK_SET);
+  return fsRead(file, (uint8_t *)out, len) == len;
+}
+
+// Only the ELF header & the program headers are needed up front, the segments
+// themselves are read straight into place (see elfProcessLoad()). Returns the
+// program headers (to be free()d), or 0 if the file's no good.
+static uint8_t *elfReadHeaders(OpenFile *file, Elf64_Ehdr *ehdr) {
+  if (!elfReadAt(file, 0, ehdr, sizeof(Elf64_Ehdr)) || !elf_check_file(ehdr))
+    return 0;
+  if (ehdr->e_phentsize < sizeof(Elf64_Phdr))
+    return 0;
+
+  size_t   len = ehdr->e_phnum * ehdr->e_phentsize;
+  uint8_t *phdrs = (uint8_t *)malloc(len);
+  if (!elfReadAt(file, ehdr->e_phoff, phdrs, len)) {
+    free(phdrs);
+    return 0;
+  }
+  return phdrs;
+}
+
+// Reads (or zeroes, without a file) into another address space through the
+// HHDM, so that it doesn't have to be switched to. Frames that happen to be
+// physically contiguous (2MiB pages, mostly) go in a single read.
+static void elfCopyOut(uint64_t *pagedir, size_t virt, OpenFile *file,
+                       size_t offset, size_t length) {
+  if (file && file->handlers->seek)
+    file->handlers->seek(file, offset, offset, SEEK_SET);
+
+  size_t done = 0;
+  while (done < length) {
+    size_t phys = VirtualToPhysicalL(pagedir, virt + done);
+    if (!phys) {
+      debugf("[elf] Segment isn't mapped! virt{%lx}\n", virt + done);
+      panic();
+    }
+
+    size_t chunk = MIN(PAGE_SIZE - (virt + done) % PAGE_SIZE, length - done);
+    while (done + chunk < length &&
+           VirtualToPhysicalL(pagedir, virt + done + chunk) == phys + chunk)
+      chunk += MIN(PAGE_SIZE, length - done - chunk);
+
+    void *target = (void *)(phys + bootloader.hhdmOffset);
+    if (!file)
+      memset(target, 0, chunk);
+    else if (fsRead(file, target, chunk) != chunk) {
+      // truncated file, what's missing reads as zeroes
+      memset(target, 0, chunk);
+      file = 0;
+    }
+    done += chunk;
+  }
+}
+
+void elfProcessLoad(uint64_t *pagedir, Elf64_Phdr *elf_phdr, OpenFile *file,
+                    size_t base) {
   // Map the (current) program page
   size_t   startRounded = (elf_phdr->p_vaddr & ~0xFFF);
   uint64_t pagesRequired = DivRoundUp(
       (elf_phdr->p_vaddr - startRounded) + elf_phdr->p_memsz, 0x1000);
-  for (int j = 0; j < pagesRequired; j++) {
-    size_t vaddr = (elf_phdr->p_vaddr & ~0xFFF) + j * 0x1000;
-    if (VirtualToPhysical(base + vaddr))
-      continue;
-    size_t paddr = PhysicalAllocate(1);
-    VirtualMap(base + vaddr, paddr, PF_USER | PF_RW);
+
+  size_t virt = base + startRounded;
+  size_t end = virt + pagesRequired * PAGE_SIZE;
+  while (virt < end) {
+    // big segments go on whole 2MiB pages wherever they're aligned to them
+    if (!(virt % PAGE_SIZE_LARGE) && (end - virt) >= PAGE_SIZE_LARGE) {
+      size_t paddr = PhysicalAllocateLargeTry();
+      if (paddr) {
+        memset((void *)(paddr + bootloader.hhdmOffset), 0, PAGE_SIZE_LARGE);
+        if (VirtualMapLargeL(pagedir, virt, paddr, PF_USER | PF_RW)) {
+          virt += PAGE_SIZE_LARGE;
+          continue;
+        }
+        PhysicalFree(paddr, PAGE_SIZE_LARGE / PAGE_SIZE);
+      }
+    }
+
+    // everything up to the next chance of a 2MiB page goes in one batch
+    size_t next = DivRoundUp(virt + 1, PAGE_SIZE_LARGE) * PAGE_SIZE_LARGE;
+    if ((next + PAGE_SIZE_LARGE) > end)
+      next = end;
+    VirtualPopulateRangeL(pagedir, virt, (next - virt) / PAGE_SIZE,
+                          PF_USER | PF_RW);
+    virt = next;
   }
 
-  // Copy the required info
-  memcpy((void *)(base + elf_phdr->p_vaddr), out + elf_phdr->p_offset,
-         elf_phdr->p_filesz);
+  // Read the required info
+  elfCopyOut(pagedir, base + elf_phdr->p_vaddr, file, elf_phdr->p_offset,
+             elf_phdr->p_filesz);
 
   // wtf is this? (needed)
   if (elf_phdr->p_memsz > elf_phdr->p_filesz)
-    memset((void *)(base + elf_phdr->p_vaddr + elf_phdr->p_filesz), 0,
-           elf_phdr->p_memsz - elf_phdr->p_filesz);
+    elfCopyOut(pagedir, base + elf_phdr->p_vaddr + elf_phdr->p_filesz, 0, 0,
+               elf_phdr->p_memsz - elf_phdr->p_filesz);
+}
+
+// Read-only segments are mapped straight off the file's page cache, so every
+// process running the same binary (or interpreter) ends up on the same frames.
+// Pages another segment touches as well (or bss, which needs zeroing) would
+// have to be private, so those segments are loaded like writable ones.
+static bool elfShareable(OpenFile *file, Elf64_Ehdr *ehdr, uint8_t *phdrs,
+                         Elf64_Phdr *target) {
+  if (target->p_flags & ELF_PF_W || !file->handlers->pageCache ||
+      !target->p_memsz || target->p_memsz != target->p_filesz ||
+      target->p_vaddr % PAGE_SIZE != target->p_offset % PAGE_SIZE)
+    return false;
+
+  size_t start = target->p_vaddr & ~(PAGE_SIZE - 1);
+  size_t end = target->p_vaddr + target->p_memsz;
+  for (int i = 0; i < ehdr->e_phnum; i++) {
+    Elf64_Phdr *phdr = (Elf64_Phdr *)(phdrs + i * ehdr->e_phentsize);
+    if (phdr == target || phdr->p_type != PT_LOAD)
+      continue;
+    size_t from = phdr->p_vaddr & ~(PAGE_SIZE - 1);
+    if (from < DivRoundUp(end, PAGE_SIZE) * PAGE_SIZE &&
+        DivRoundUp(phdr->p_vaddr + phdr->p_memsz, PAGE_SIZE) * PAGE_SIZE >
+            start)
+      return false;
+  }
+  return true;
+}
+
+// The segment becomes a private file area, its pages fault in off the cache
+// on their first touch (see VmaHandleFault())
+static void elfShareLoad(Task *target, Elf64_Phdr *elf_phdr, OpenFile *file,
+                         size_t base) {
+  PageCache *cache = file->handlers->pageCache(file);
+
+  size_t virt = base + (elf_phdr->p_vaddr & ~(PAGE_SIZE - 1));
+  size_t length = base + elf_phdr->p_vaddr + elf_phdr->p_memsz - virt;
+  size_t offset = elf_phdr->p_offset & ~(PAGE_SIZE - 1);
+  int    prot = PROT_READ;
+  if (elf_phdr->p_flags & ELF_PF_X)
+    prot |= PROT_EXEC;
+
+  // the area keeps a handle of its own, ours is closed once we're done
+  OpenFile *orphan = fsUserDuplicateNodeUnsafe(file);
+  int       flags = MAP_PRIVATE | MAP_FIXED;
+  if (orphan && VmaReserveFile(target, virt, length, prot, flags, orphan,
+                               offset, cache)) {
+    VirtualMapDemandL(target->pagedir, virt, DivRoundUp(length, PAGE_SIZE),
+                      PF_USER | PF_FILE);
+    return;
+  }
+
+  if (orphan)
+    fsCloseOrphan(orphan);
+  elfProcessLoad(target->pagedir, elf_phdr, file, base);
+}
+
+static void elfLoadSegment(Task *target, OpenFile *file, Elf64_Ehdr *ehdr,
+                           uint8_t *phdrs, Elf64_Phdr *elf_phdr, size_t base) {
+  if (elfShareable(file, ehdr, phdrs, elf_phdr))
+    elfShareLoad(target, elf_phdr, file, base);
+  else
+    elfProcessLoad(target->pagedir, elf_phdr, file, base);
 }
 
 Task *elfExecute(char *filepath, uint32_t argc, char **argv, uint32_t envc,
                  char **envv, bool startup) {
-  // Open & read executable file
+  // Open executable file, only its headers are read for now
   OpenFile *dir = fsKernelOpen(filepath, O_RDONLY, 0);
   if (!dir) {
     debugf("[elf] Could not open %s\n", filepath);
     return 0;
   }
-  size_t filesize = fsGetFilesize(dir);
 #if ELF_DEBUG
-  debugf("[elf] Executing %s: filesize{%d}\n", filepath, filesize);
+  debugf("[elf] Executing %s: filesize{%d}\n", filepath, fsGetFilesize(dir));
 #endif
-  uint8_t *out = (uint8_t *)malloc(filesize);
-  fsReadFullFile(dir, out);
-  fsKernelClose(dir);
 
-  // Cast ELF32 header
-  Elf64_Ehdr *elf_ehdr = (Elf64_Ehdr *)(out);
-
-  if (!elf_check_file(elf_ehdr)) {
+  Elf64_Ehdr  ehdr = {0};
+  Elf64_Ehdr *elf_ehdr = &ehdr;
+  uint8_t    *phdrs = elfReadHeaders(dir, elf_ehdr);
+  if (!phdrs) {
     debugf("[elf] File %s is not a valid cavOS ELF32 executable!\n", filepath);
+    fsKernelClose(dir);
     return 0;
   }
 
-  // Create a new page directory which is later used by the process
-  uint64_t *oldpagedir = GetPageDirectory();
+  // Create a new page directory which is later used by the process (it's
+  // populated from here, without switching to it)
   uint64_t *pagedir = PageDirectoryAllocate();
-  ChangePageDirectory(pagedir);
 
 #if ELF_DEBUG
   debugf("\n[elf_ehdr] entry=%x type=%d arch=%d\n", elf_ehdr->e_entry,
@@ -114,50 +254,56 @@ Task *elfExecute(char *filepath, uint32_t argc, char **argv, uint32_t envc,
     panic();
   }
 
+  // Segments might end up as file areas, which need the task to hang off of
+  // (its entry point is only known once they're all loaded)
+  Task *target = taskCreate(id, 0, false, pagedir, argc, argv);
+
   size_t interpreterEntry = 0;
   size_t interpreterBase = 0x100000000000; // todo: not hardcode
   // Loop through the multiple ELF32 program header tables
   for (int i = 0; i < elf_ehdr->e_phnum; i++) {
-    Elf64_Phdr *elf_phdr = (Elf64_Phdr *)((size_t)out + elf_ehdr->e_phoff +
-                                          i * elf_ehdr->e_phentsize);
+    Elf64_Phdr *elf_phdr = (Elf64_Phdr *)(phdrs + i * elf_ehdr->e_phentsize);
     if (elf_phdr->p_type == 3) {
-      char     *interpreterFilename = (char *)(out + elf_phdr->p_offset);
-      OpenFile *interpreter = fsKernelOpen(interpreterFilename, O_RDONLY, 0);
+      char *interpreterFilename = (char *)malloc(elf_phdr->p_filesz + 1);
+      interpreterFilename[elf_phdr->p_filesz] = '\0';
+      OpenFile *interpreter =
+          elfReadAt(dir, elf_phdr->p_offset, interpreterFilename,
+                    elf_phdr->p_filesz)
+              ? fsKernelOpen(interpreterFilename, O_RDONLY, 0)
+              : 0;
       if (!interpreter) {
         debugf("[elf] Interpreter path{%s} could not be found!\n",
                interpreterFilename);
         panic();
       }
-      size_t size = fsGetFilesize(interpreter);
 
-      uint8_t *interpreterContents = (uint8_t *)malloc(size);
-      fsReadFullFile(interpreter, interpreterContents);
-      fsKernelClose(interpreter);
-
-      Elf64_Ehdr *interpreterEhdr = (Elf64_Ehdr *)(interpreterContents);
-      if (interpreterEhdr->e_type != 3) { // ET_DYN
+      Elf64_Ehdr interpreterEhdr = {0};
+      uint8_t   *interpreterPhdrs =
+          elfReadHeaders(interpreter, &interpreterEhdr);
+      if (!interpreterPhdrs || interpreterEhdr.e_type != 3) { // ET_DYN
         debugf("[elf::dyn] Interpreter{%s} isn't really of type ET_DYN!\n",
                interpreterFilename);
         panic();
       }
-      interpreterEntry = interpreterEhdr->e_entry;
-      for (int i = 0; i < interpreterEhdr->e_phnum; i++) {
+      interpreterEntry = interpreterEhdr.e_entry;
+      for (int i = 0; i < interpreterEhdr.e_phnum; i++) {
         Elf64_Phdr *interpreterPhdr =
-            (Elf64_Phdr *)((size_t)interpreterContents +
-                           interpreterEhdr->e_phoff +
-                           i * interpreterEhdr->e_phentsize);
+            (Elf64_Phdr *)(interpreterPhdrs + i * interpreterEhdr.e_phentsize);
         if (interpreterPhdr->p_type != PT_LOAD)
           continue;
-        elfProcessLoad(interpreterPhdr, interpreterContents, interpreterBase);
+        elfLoadSegment(target, interpreter, &interpreterEhdr,
+                       interpreterPhdrs, interpreterPhdr, interpreterBase);
       }
-      free(interpreterContents);
+      free(interpreterPhdrs);
+      fsKernelClose(interpreter);
+      free(interpreterFilename);
 
       continue;
     }
     if (elf_phdr->p_type != PT_LOAD)
       continue;
 
-    elfProcessLoad(elf_phdr, out, 0);
+    elfLoadSegment(target, dir, elf_ehdr, phdrs, elf_phdr, 0);
 
 #if ELF_DEBUG
     debugf("[elf] Program header: type{%d} offset{%x} vaddr{%x} size{%x} "
@@ -181,14 +327,9 @@ Task *elfExecute(char *filepath, uint32_t argc, char **argv, uint32_t envc,
   debugf("[elf] New pagedir: offset{%x}\n", pagedir);
 #endif
 
-  // Done loading into the pagedir
-  ChangePageDirectory(oldpagedir);
-
-  Task *target =
-      taskCreate(id,
-                 interpreterEntry ? (interpreterBase + interpreterEntry)
-                                  : elf_ehdr->e_entry,
-                 false, pagedir, argc, argv);
+  target->registers.rip = interpreterEntry
+                              ? (interpreterBase + interpreterEntry)
+                              : elf_ehdr->e_entry;
 
   // libc takes care of tls lmao
   /*if (tls) {
@@ -219,8 +360,9 @@ Task *elfExecute(char *filepath, uint32_t argc, char **argv, uint32_t envc,
   target->cwd[1] = '\0';
 
   // User stack generation: the stack itself, AUXs, etc...
-  stackGenerateUser(target, argc, argv, envc, envv, out, filesize, elf_ehdr);
-  free(out);
+  stackGenerateUser(target, argc, argv, envc, envv, phdrs, elf_ehdr);
+  free(phdrs);
+  fsKernelClose(dir);
 
   // void **a = (void **)(&target->firstSpecialFile);
   // fsUserOpenSpecial(a, "/dev/stdin", target, 0, &stdio);
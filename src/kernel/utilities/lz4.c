@@ -0,0 +1,149 @@
+#include <lz4.h>
+#include <util.h>
+
+// LZ4 block format (de)compression: fast & greedy, with a single hash table of
+// recent positions & no frame format on top
+// Copyright (C) 2024 Panagiotis
+
+static uint32_t LZ4Read32(const uint8_t *ptr) {
+  uint32_t ret;
+  memcpy(&ret, ptr, sizeof(uint32_t));
+  return ret;
+}
+
+static uint32_t LZ4Hash(uint32_t sequence) {
+  return (sequence * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+// Lengths past 15 continue on extra bytes, 255 meaning "keep going"
+static uint8_t *LZ4WriteLength(uint8_t *op, size_t length) {
+  if (length < 15)
+    return op;
+  length -= 15;
+  while (length >= 255) {
+    *op++ = 255;
+    length -= 255;
+  }
+  *op++ = length;
+  return op;
+}
+
+static bool LZ4ReadLength(const uint8_t **ip, const uint8_t *iend,
+                          size_t *length) {
+  if (*length != 15)
+    return true;
+
+  uint8_t extra;
+  do {
+    if (*ip >= iend)
+      return false;
+    extra = *(*ip)++;
+    *length += extra;
+  } while (extra == 255);
+  return true;
+}
+
+// Returns the compressed size, or 0 if it wouldn't fit in limit. The table has
+// to hold LZ4_HASH_SIZE entries.
+size_t LZ4Compress(const uint8_t *in, size_t len, uint8_t *out, size_t limit,
+                   uint16_t *table) {
+  const uint8_t *ip = in;
+  const uint8_t *anchor = in;
+  const uint8_t *end = in + len;
+  uint8_t       *op = out;
+  uint8_t       *oend = out + limit;
+
+  memset(table, 0, LZ4_HASH_SIZE * sizeof(uint16_t));
+  while (len > LZ4_MF_LIMIT && ip < end - LZ4_MF_LIMIT) {
+    uint32_t       sequence = LZ4Read32(ip);
+    uint32_t       hash = LZ4Hash(sequence);
+    const uint8_t *ref = in + table[hash];
+    table[hash] = ip - in;
+    if (ref >= ip || LZ4Read32(ref) != sequence) {
+      ip++;
+      continue;
+    }
+
+    const uint8_t *matchEnd = ip + LZ4_MIN_MATCH;
+    const uint8_t *refEnd = ref + LZ4_MIN_MATCH;
+    while (matchEnd < end - LZ4_LAST_LITERALS && *matchEnd == *refEnd) {
+      matchEnd++;
+      refEnd++;
+    }
+
+    size_t literals = ip - anchor;
+    size_t match = matchEnd - ip - LZ4_MIN_MATCH;
+    if ((size_t)(oend - op) < literals + literals / 255 + match / 255 + 5)
+      return 0;
+
+    uint8_t *token = op++;
+    *token = (MIN(literals, 15) << 4) | MIN(match, 15);
+    op = LZ4WriteLength(op, literals);
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    uint16_t offset = ip - ref;
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    op = LZ4WriteLength(op, match);
+
+    ip = matchEnd;
+    anchor = ip;
+  }
+
+  size_t literals = end - anchor;
+  if ((size_t)(oend - op) < literals + literals / 255 + 2)
+    return 0;
+  *op++ = MIN(literals, 15) << 4;
+  op = LZ4WriteLength(op, literals);
+  memcpy(op, anchor, literals);
+  op += literals;
+
+  return op - out;
+}
+
+// Fills exactly outLen bytes, returns false on malformed (or short) input
+bool LZ4Decompress(const uint8_t *in, size_t len, uint8_t *out,
+                   size_t outLen) {
+  const uint8_t *ip = in;
+  const uint8_t *iend = in + len;
+  uint8_t       *op = out;
+  uint8_t       *oend = out + outLen;
+
+  while (ip < iend) {
+    uint8_t token = *ip++;
+
+    size_t literals = token >> 4;
+    if (!LZ4ReadLength(&ip, iend, &literals) ||
+        literals > (size_t)(iend - ip) || literals > (size_t)(oend - op))
+      return false;
+    memcpy(op, ip, literals);
+    op += literals;
+    ip += literals;
+
+    // the last sequence is nothing but literals
+    if (ip >= iend)
+      break;
+
+    if (iend - ip < 2)
+      return false;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (!offset || offset > (size_t)(op - out))
+      return false;
+
+    size_t match = token & 15;
+    if (!LZ4ReadLength(&ip, iend, &match))
+      return false;
+    match += LZ4_MIN_MATCH;
+    if (match > (size_t)(oend - op))
+      return false;
+
+    // byte by byte, since matches may overlap with what they produce
+    const uint8_t *ref = op - offset;
+    while (match--)
+      *op++ = *ref++;
+  }
+
+  return op == oend;
+}
@@ -11,12 +11,17 @@
 #include <pci.h>
 #include <pmm.h>
 #include <rtc.h>
+#include <schedule.h>
 #include <shell.h>
+#include <shrinker.h>
+#include <slab.h>
 #include <string.h>
+#include <swap.h>
 #include <system.h>
 #include <task.h>
 #include <timer.h>
 #include <util.h>
+#include <zram.h>
 
 // Temporary kernelspace shell
 // Copyright (C) 2024 Panagiotis
@@ -64,7 +69,7 @@ void help() {
   printf("\n= fetch          : Brings you some system information       =");
   printf("\n= time           : Tells you the time and date from BIOS    =");
   printf("\n= lspci          : Lists PCI device info                    =");
-  printf("\n= dump           : Dumps some of the bitmap allocator       =");
+  printf("\n= dump           : Dumps the physical buddy allocator       =");
   printf("\n= draw           : Tests framebuffer by drawing a rectangle =");
   printf("\n= proctest       : Tests multitasking support               =");
   printf("\n= exec           : Runs a cavOS binary of your choice       =");
@@ -158,7 +163,21 @@ void launch_shell(int n) {
       echo(ch);
     } else if (strEql(ch, "dump")) {
       printf("\n");
-      BitmapDumpBlocks(&physical);
+      BuddyDump(&physical);
+      debugf("large (2MiB) mappings{%ld} page tables{%ld}\n",
+             pagingLargeMappings, pagingTables);
+      debugf("zeroed frame pool{%ld} hits{%ld} misses{%ld}\n",
+             physicalZeroPoolCnt, physicalZeroHits, physicalZeroMisses);
+      SlabDump();
+      ShrinkerDump();
+      debugf("swap slots{%ld} used{%ld} swapins{%ld} swapouts{%ld}\n",
+             swapSlots, swapUsed, swapIns, swapOuts);
+      // ratio in hundredths, no floats in here
+      debugf("zram orig{%ld} compr{%ld} ratio{%ld.%02ld} used{%ld}\n",
+             zram.origBytes, zram.comprBytes,
+             zram.origBytes / MAX(zram.comprBytes, 1),
+             zram.origBytes * 100 / MAX(zram.comprBytes, 1) % 100,
+             zram.memUsed);
     } else if (strEql(ch, "help")) {
       help();
     } else if (strEql(ch, "readdisk")) {
@@ -232,7 +251,7 @@ void launch_shell(int n) {
       printf("\n");
     } else if (strEql(ch, "crack")) {
       Task *fr = firstTask->next;
-      fr->state = TASK_STATE_READY;
+      scheduleWake(fr);
       printf("\n");
     } else if (strEql(ch, "arptable")) {
       debugArpTable(selectedNIC);
@@ -337,9 +356,11 @@ void launch_shell(int n) {
       printf("\n");
       Task *browse = firstTask;
       while (browse) {
-        printf("%ld: [%c] heap{0x%016lx-0x%016lX}\n", browse->id,
-               browse->kernel_task ? '-' : 'u', browse->heap_start,
-               browse->heap_end);
+        printf("%ld: [%c] heap{0x%016lx-0x%016lX} minflt{%ld} nvcsw{%ld} "
+               "nivcsw{%ld}\n",
+               browse->id, browse->kernel_task ? '-' : 'u', browse->heap_start,
+               browse->heap_end, browse->minorFaults,
+               browse->switchesVoluntary, browse->switchesInvoluntary);
 
         browse = browse->next;
       }
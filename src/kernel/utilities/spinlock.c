@@ -1,13 +1,74 @@
+#include <paging.h>
+#include <smp.h>
 #include <spinlock.h>
 #include <system.h>
+#include <task.h>
+#include <wait.h>
 
 void spinlockAcquire(Spinlock *lock) {
-  while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire))
-    handControl();
+  size_t spins = 0;
+  while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire)) {
+    // another cpu's holder is probably about to let go
+    if (smpOnline & (smpOnline - 1) && ++spins < SPINLOCK_SPINS) {
+      asm volatile("pause");
+      continue;
+    }
+
+    // otherwise sleep until it does (see spinlockRelease()), interrupt
+    // handlers on top of the idle task can't
+    spins = 0;
+    if (currentTask == cpuSelf()->idle) {
+      handControl();
+      continue;
+    }
+    waitEvent(waitHashed(lock), spinlockTryAcquire(lock));
+    return;
+  }
+}
+
+// For contexts that can't hand control over (interrupt handlers)
+bool spinlockTryAcquire(Spinlock *lock) {
+  return !atomic_flag_test_and_set_explicit(lock, memory_order_acquire);
 }
 
+// The clear has to be seen before checking for sleepers, that (in turn) queue
+// up before trying the lock one last time
 void spinlockRelease(Spinlock *lock) {
+  atomic_flag_clear_explicit(lock, memory_order_seq_cst);
+  WaitQueue *queue = waitHashed(lock);
+  if (__atomic_load_n(&queue->head, __ATOMIC_RELAXED))
+    waitWakeAll(queue);
+}
+
+// Irq spinlocks are held with interrupts off, so whoever holds one is never
+// preempted & the rest can simply spin (on any cpu, interrupt handlers
+// included). Nothing that might sleep (or fault) goes inside of them. Returns
+// whether interrupts were enabled, for spinlockIrqRelease().
+bool spinlockIrqAcquire(Spinlock *lock) {
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire)) {
+    // the holder might be waiting on our TLB (see PagingShootdown())
+    PagingShootdownHandle();
+    asm volatile("pause");
+  }
+  return ints;
+}
+
+bool spinlockIrqTryAcquire(Spinlock *lock, bool *ints) {
+  *ints = checkInterrupts();
+  asm volatile("cli");
+  if (!atomic_flag_test_and_set_explicit(lock, memory_order_acquire))
+    return true;
+  if (*ints)
+    asm volatile("sti");
+  return false;
+}
+
+void spinlockIrqRelease(Spinlock *lock, bool ints) {
   atomic_flag_clear_explicit(lock, memory_order_release);
+  if (ints)
+    asm volatile("sti");
 }
 
 // Cnt spinlock is basically just a counter that increases for every read
@@ -15,30 +76,46 @@ void spinlockRelease(Spinlock *lock) {
 // makes it -1, not permitting any reads. Useful for linked lists..
 
 void spinlockCntReadAcquire(SpinlockCnt *lock) {
-  while (lock->cnt < 0)
+  while (!spinlockCntReadTryAcquire(lock))
     handControl();
-  lock->cnt++;
+}
+
+// For contexts that can't hand control over (or wait on the writer)
+bool spinlockCntReadTryAcquire(SpinlockCnt *lock) {
+  int64_t cnt = __atomic_load_n(&lock->cnt, __ATOMIC_RELAXED);
+  while (cnt >= 0) {
+    // cnt gets refreshed on failure, so other readers just mean another go
+    if (__atomic_compare_exchange_n(&lock->cnt, &cnt, cnt + 1, true,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      return true;
+  }
+  return false;
 }
 
 void spinlockCntReadRelease(SpinlockCnt *lock) {
-  if (lock->cnt < 0) {
+  if (__atomic_fetch_sub(&lock->cnt, 1, __ATOMIC_RELEASE) <= 0) {
     debugf("[spinlock] Something very bad is going on...\n");
     panic();
   }
-
-  lock->cnt--;
 }
 
 void spinlockCntWriteAcquire(SpinlockCnt *lock) {
-  while (lock->cnt != 0)
+  while (!spinlockCntWriteTryAcquire(lock))
     handControl();
-  lock->cnt = -1;
+}
+
+// For contexts that can't hand control over (interrupt handlers)
+bool spinlockCntWriteTryAcquire(SpinlockCnt *lock) {
+  int64_t expected = 0;
+  return __atomic_compare_exchange_n(&lock->cnt, &expected, -1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
 }
 
 void spinlockCntWriteRelease(SpinlockCnt *lock) {
-  if (lock->cnt != -1) {
+  int64_t expected = -1;
+  if (!__atomic_compare_exchange_n(&lock->cnt, &expected, 0, false,
+                                   __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
     debugf("[spinlock] Something very bad is going on...\n");
     panic();
   }
-  lock->cnt = 0;
 }